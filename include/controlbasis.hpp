@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <vector>
+#include <algorithm>
 #include <cassert>
 #include "util.hpp"
 #pragma once
@@ -133,6 +134,22 @@ class ControlBasis {
          */
         virtual void evaluate(const double t, const std::vector<double>& coeff, int carrier_freq_id, double* Blt1, double*Blt2) = 0;
 
+        /**
+         * @brief Evaluates the control basis at a sorted array of time points.
+         *
+         * Default implementation calls @ref evaluate for each time point.
+         *
+         * @param[in] ntimes Number of time points.
+         * @param[in] t Array of time points, sorted ascending.
+         * @param[in] coeff Vector of parameters (coefficients of the basis parameterization).
+         * @param[in] carrier_freq_id ID of the carrier frequency, provided by the oscillator.
+         * @param[out] Blt1 Array to store the real part of the control parameterization at each time point.
+         * @param[out] Blt2 Array to store the imaginary part of the control parameterization at each time point.
+         */
+        virtual void evaluateBatch(const int ntimes, const double* t, const std::vector<double>& coeff, int carrier_freq_id, double* Blt1, double* Blt2) {
+            for (int i=0; i<ntimes; i++) evaluate(t[i], coeff, carrier_freq_id, &Blt1[i], &Blt2[i]);
+        };
+
         /**
          * @brief Evaluates the derivative of the control basis at a given time.
          *
@@ -168,6 +185,19 @@ class BSpline2nd : public ControlBasis {
          */
         double basisfunction(int id, double t);
 
+        /**
+         * @brief Computes the range of basis functions that are non-zero at time t.
+         *
+         * Basis function l has support [tstart + (l-2)*dtknot, tstart + (l+1)*dtknot), hence 
+         * at most three consecutive basis functions are active at any time. The range excludes 
+         * the first and last two splines if zero boundary conditions are enforced.
+         *
+         * @param[in] t Time point.
+         * @param[out] lmin First active basis function.
+         * @param[out] lmax Last active basis function (inclusive).
+         */
+        void activeSplines(const double t, int* lmin, int* lmax);
+
     public:
         /**
          * @brief Constructor for quadratic Bsplines.
@@ -194,6 +224,8 @@ class BSpline2nd : public ControlBasis {
 
         void evaluate(const double t, const std::vector<double>& coeff, int carrier_freq_id, double* Blt1_ptr, double* Blt2_ptr);
 
+        void evaluateBatch(const int ntimes, const double* t, const std::vector<double>& coeff, int carrier_freq_id, double* Blt1, double* Blt2);
+
         void derivative(const double t, const std::vector<double>& coeff, double* coeff_diff, const double valbar1, const double valbar2, int carrier_freq_id);
 };
 
@@ -222,6 +254,19 @@ class BSpline2ndAmplitude : public ControlBasis {
          */
         double basisfunction(int id, double t);
 
+        /**
+         * @brief Computes the range of basis functions that are non-zero at time t.
+         *
+         * Basis function l has support [tstart + (l-2)*dtknot, tstart + (l+1)*dtknot), hence 
+         * at most three consecutive basis functions are active at any time. The range excludes 
+         * the first and last two splines if zero boundary conditions are enforced.
+         *
+         * @param[in] t Time point.
+         * @param[out] lmin First active basis function.
+         * @param[out] lmax Last active basis function (inclusive).
+         */
+        void activeSplines(const double t, int* lmin, int* lmax);
+
     public:
         /**
          * @brief Constructor for quadratic Bsplines for amplitude parameterization.
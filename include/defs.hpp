@@ -78,7 +78,19 @@ enum class ObjectiveType {
  */
 enum class LinearSolverType{
   GMRES,   ///< Uses Petsc's GMRES solver (default)
-  NEUMANN  ///< Uses Neuman power iterations
+  NEUMANN, ///< Uses Neuman power iterations
+  DENSELU  ///< Uses a dense LU factorization (selected automatically for the dense small-system path)
+};
+
+/**
+ * @brief Storage layouts of the real-valued state vector x.
+ *
+ * Each processor owns a contiguous chunk of localsize_u complex elements of the state.
+ * The layout defines how their real and imaginary parts are ordered in the local array.
+ */
+enum class StateLayout {
+  BLOCKED,    ///< Real parts followed by imaginary parts: [u_local, v_local] (default)
+  INTERLEAVED ///< Real and imaginary part of each element next to each other: [u_0, v_0, u_1, v_1, ...]
 };
 
 /**
@@ -91,6 +103,7 @@ enum class RunType {
   GRADIENT,     ///< Runs a simulation followed by the adjoint for gradient computation (forward & backward)
   OPTIMIZATION, ///< Runs optimization iterations
   EVALCONTROLS, ///< Only evaluates the current control pulses (no simulation)
+  HESSIAN,      ///< Computes one Hessian-vector product and compares it to finite differences of the gradient
   NONE          ///< Don't run anything
 };
 
@@ -106,3 +119,16 @@ enum class ControlType {
   STEP,       ///< Control parameter is the width of a step function for a given amplitude
   BSPLINE0    ///< Control pulses are parameterized with Zeroth order Bspline (piece-wise constant)
 };
+
+/**
+ * @brief Final status of one optimization run in multi-start mode.
+ *
+ * Each optim processor group runs an independent optimization from its own starting point. 
+ * The status is reported per group in the merged multi-start output file.
+ */
+enum class MultistartStatus {
+  RUNNING,   ///< Optimization has not reached any of the stopping criteria
+  CONVERGED, ///< Optimization converged (infidelity, final-time cost, or gradient norm tolerance)
+  MAXITER,   ///< Optimization stopped at the maximum number of iterations
+  DROPPED    ///< Optimization was stopped early because it fell behind the best group
+};
@@ -37,9 +37,13 @@ class Gate {
 
 
   private:
-    Mat VxV_re, VxV_im;     ///< Real and imaginary parts of vectorized gate \f$\bar V \kron V\f$.
-    Vec x;                  ///< Auxiliary state vector for computations.
-    IS isu, isv;            ///< Vector strides for accessing real and imaginary parts of the state.
+    std::vector<double> Ve_re, Ve_im; ///< Rotated gate V (essential levels, row-major), real and imaginary parts.
+    std::vector<PetscInt> ess2full;   ///< Full-dimension index of each essential index.
+    std::vector<PetscInt> full2ess;   ///< Essential index of each full-dimension index, -1 for non-essential levels.
+    VecScatter scat;                  ///< Scatter context for gathering the full state onto the first processor, and back.
+    Vec xall;                         ///< Sequential copy of the full state on the first processor (empty on all others).
+    std::vector<double> rho_re, rho_im; ///< Full state on the first processor (Lindblad: column-major density matrix), real and imaginary parts.
+    std::vector<double> W_re, W_im;   ///< Intermediate product \f$V\rho\f$ (Lindblad only), column-major.
 
   public:
     Gate();
@@ -66,18 +70,21 @@ class Gate {
     PetscInt getDimRho() { return dim_rho; };
 
     /**
-     * @brief Assembles the vectorized gate matrix.
+     * @brief Rotates the gate to the rotating frame and prepares its application.
      *
-     * Computes VxV_re = \f$\text{Re}(\bar{V} \otimes V)\f$ and VxV_im = \f$\text{Im}(\bar{V} \otimes V)\f$
-     * where V is the gate matrix.
+     * Stores the rotated gate V (essential levels only) and the maps between essential and full indices. 
+     * The vectorized gate \f$\bar{V} \otimes V\f$ is never formed.
      */
     void assembleGate();
 
     /**
      * @brief Applies the gate transformation to a quantum state.
      *
-     * Computes \f$V\rho V^\dagger\f$ where \f$V\f$ is the gate matrix and \f$\rho\f$ is the input state.
-     * The output vector VrhoV must be pre-allocated.
+     * Computes \f$V\rho V^\dagger\f$ (Lindblad) or \f$V\psi\f$ (Schroedinger), where \f$V\f$ is the gate lifted 
+     * to the full dimension by acting as the identity on non-essential levels. The state is gathered 
+     * onto the first PETSc processor, which applies the gate (for Lindblad from the left and right, 
+     * \f$O(N^2)\f$ memory and \f$O(N^2 N_e)\f$ work) and scatters the result back. The other processors 
+     * hold no copy of the full state. Must be called collectively. The output vector VrhoV must be pre-allocated.
      *
      * @param state Input quantum state vector.
      * @param VrhoV Output vector storing the transformed state.
@@ -6,6 +6,8 @@
 #include <iostream> 
 #include <fstream>
 #include <controlbasis.hpp>
+#include "util.hpp"
+#include "kronoperator.hpp"
 
 #pragma once
 
@@ -15,12 +17,31 @@
  * This class provides functionality to read system and control Hamiltonians
  * from files generated by the Python interface. It supports both Lindblad and
  * Schroedinger solver and handles matrix data communication.
+ *
+ * Two file formats are supported. The text format lists one nonzero per line, as
+ * "row col real imag" (system Hamiltonian) or "oscillator row col real imag" (control
+ * Hamiltonians). The binary format is detected by its leading magic "QUANDHAM" and stores
+ * all operators in CSR format, with native-endian 64-bit integers and doubles:
+ *   - header: magic (8 bytes), version (=1), dimension N, number of operators, total number of nonzeros nnz, reserved
+ *   - row pointers: (N+1) per operator, as offsets into the entry arrays
+ *   - column indices (nnz), real parts (nnz), imaginary parts (nnz)
+ *
+ * Each processor only reads and expands the rows it needs. Use quandary.py's
+ * convert_hamiltonian_to_binary to convert text files.
+ *
+ * The factored (Kronecker) format starts with the line "# kronecker" and lists each Hamiltonian
+ * as a sum of Kronecker products of small per-oscillator matrices. A line "term cre cim" (system
+ * Hamiltonian) or "term oscillator re|im cre cim" (control Hamiltonians, multiplied by p(t) or i*q(t))
+ * starts a new product with coefficient cre + i*cim. It is followed by the nonzeros of its factors,
+ * one per line as "oscillator row col real imag". Oscillators without entries carry the identity.
+ * Factored files can be applied matrix-free by a @ref KronOperator, or expanded into sparse matrices.
  */
 class HamiltonianFileReader{
   protected:
 
     LindbladType lindbladtype; ///< Type of solver (Lindblad vs Schroedinger)
     PetscInt dim_rho; ///< Dimension of the Hilbert space (N)
+    std::vector<int> nlevels; ///< Number of levels per oscillator
     std::string hamiltonian_file_Hsys; ///< Filename for system Hamiltonian data ('none' if not used)
     std::string hamiltonian_file_Hc; ///< Filename for control Hamiltonian data ('none' if not used)
     int mpirank_world; ///< Rank of global MPI communicator
@@ -35,30 +56,107 @@ class HamiltonianFileReader{
      *
      * @param hamiltonian_file_Hsys Path to file containing system Hamiltonian data
      * @param hamiltonian_file_Hc Path to file containing control Hamiltonian data
+     * @param nlevels_ Number of levels per oscillator
      * @param lindbladtype_ Type of solver (Lindblad or Schroedinger)
      * @param dim_rho_ Dimension of the Hilbert space
      * @param quietmode_ Flag for quiet operation
      */
-    HamiltonianFileReader(std::string hamiltonian_file_Hsys, std::string hamiltonian_file_Hc, LindbladType lindbladtype_, PetscInt dim_rho_, bool quietmode_);
+    HamiltonianFileReader(std::string hamiltonian_file_Hsys, std::string hamiltonian_file_Hc, const std::vector<int>& nlevels_, LindbladType lindbladtype_, PetscInt dim_rho_, bool quietmode_);
 
     ~HamiltonianFileReader();
 
+  /**
+   * @brief Adds one Hamiltonian entry to the real and imaginary parts of the system matrix for (-i*H).
+   *
+   * For the Lindblad solver, the entry is vectorized. Only entries in locally owned rows are added.
+   *
+   * @param[out] A Entries of the real part of (-i*H)
+   * @param[out] B Entries of the imaginary part of (-i*H)
+   * @param row Row index of the entry in H
+   * @param col Column index of the entry in H
+   * @param real Real part of the entry
+   * @param imag Imaginary part of the entry
+   */
+  void addEntry(SparseEntries& A, SparseEntries& B, PetscInt row, PetscInt col, double real, double imag);
+
+  /**
+   * @brief Checks if a file is in the binary Hamiltonian format.
+   *
+   * @param filename Name of the file
+   * @return true if the file starts with the binary magic
+   */
+  bool isBinary(const std::string& filename);
+
+  /**
+   * @brief Reads Hamiltonian operators from a binary file.
+   *
+   * Reads the row pointers of the needed rows and then one contiguous range of entries
+   * per operator (Schroedinger: only the locally owned rows; Lindblad: the full Hamiltonian,
+   * of which only the locally owned superoperator rows are expanded).
+   *
+   * @param filename Name of the binary file
+   * @param[out] A Entries of the real parts of (-i*H), one per operator
+   * @param[out] B Entries of the imaginary parts of (-i*H), one per operator
+   * @param noperators Maximum number of operators
+   */
+  void readBinary(const std::string& filename, SparseEntries* A, SparseEntries* B, size_t noperators);
+
+  /**
+   * @brief Checks if a file is in the factored (Kronecker) format.
+   *
+   * @param filename Name of the file
+   * @return true if the first line of the file is "# kronecker"
+   */
+  static bool isKronecker(const std::string& filename);
+
+  /**
+   * @brief Reads the Kronecker product terms from a factored file.
+   *
+   * @param filename Name of the factored file
+   * @param control Flag: file holds control Hamiltonians ("term oscillator re|im cre cim")
+   * @param[out] prods Product terms. The factor i of "im" control terms is included in their coefficient.
+   * @param[out] groups Coefficient group of each term: 0 constant, 1+2k for p_k(t), 2+2k for q_k(t)
+   */
+  void readKronecker(const std::string& filename, bool control, std::vector<KronProduct>& prods, std::vector<int>& groups);
+
+  /**
+   * @brief Expands a Kronecker product term into the sparse entries of (-i*H).
+   *
+   * The sparse control matrices are multiplied by p(t) (imaginary part) and q(t) (real part)
+   * only, so "re" control terms must be real and "im" control terms must be imaginary.
+   *
+   * @param prod Product term
+   * @param group Coefficient group of the term
+   * @param[out] A Entries of the real part of (-i*H)
+   * @param[out] B Entries of the imaginary part of (-i*H)
+   */
+  void expandKronecker(const KronProduct& prod, int group, SparseEntries& A, SparseEntries& B);
+
+  /**
+   * @brief Reads the factored system and control Hamiltonians into a matrix-free Kronecker operator.
+   *
+   * @param[out] kronop Operator that receives all Hamiltonian terms
+   */
+  void receiveKronecker(KronOperator& kronop);
+
   /**
    * @brief Reads the constant system Hamiltonian from file.
    *
-   * @param[out] Ad Reference to matrix that stores the real part of the system matrix for (-i*Hsys). Must be allocated. 
-   * @param[out] Bd Reference to matrix that stores the imaginary part of the system matrix for (-i*Hsys). Must be allocated. 
+   * Each processor reads the file (text, binary or factored) and collects the entries of its locally owned rows.
+   *
+   * @param[out] Ad Entries of the real part of the system matrix for (-i*Hsys)
+   * @param[out] Bd Entries of the imaginary part of the system matrix for (-i*Hsys)
    */
-  void receiveHsys(Mat& Ad, Mat& Bd);
+  void receiveHsys(SparseEntries& Ad, SparseEntries& Bd);
 
   /**
    * @brief Receives real and imaginary control operators from file.
    *
    * Reads control Hamiltonian matrices for each oscillator from the
-   * Hamiltonian file and stores them in the provided matrix vectors.
+   * Hamiltonian file. Each processor collects the entries of its locally owned rows.
    *
-   * @param Ac_vec Reference to vector of matrices storing real parts of control system matrices. One per oscillator.
-   * @param Bc_vec Reference to vector of matrices storing imaginary parts of control matrices. One per oscillator.
+   * @param Ac_vec Entries of the real parts of control system matrices. One per oscillator.
+   * @param Bc_vec Entries of the imaginary parts of control system matrices. One per oscillator.
    */
-  void receiveHc(std::vector<Mat>& Ac_vec, std::vector<Mat>& Bc_vec);
+  void receiveHc(std::vector<SparseEntries>& Ac_vec, std::vector<SparseEntries>& Bc_vec);
 };
@@ -0,0 +1,144 @@
+#include "defs.hpp"
+#include <petscmat.h>
+#include <vector>
+
+#pragma once
+
+/**
+ * @brief One product term \f$c (F_{k_1} \otimes F_{k_2} \otimes \dots)\f$ of a Hamiltonian on the composite system.
+ *
+ * Only the oscillators with a non-identity factor are listed, all others carry the identity.
+ * Factors are dense, stored row-major with real and imaginary parts separately.
+ */
+typedef struct {
+  double coeff_re = 1.0; ///< Real part of the scalar coefficient
+  double coeff_im = 0.0; ///< Imaginary part of the scalar coefficient
+  std::vector<int> osc; ///< Oscillators that carry a non-identity factor
+  std::vector<std::vector<double>> F_re; ///< Real parts of the factors (n_k x n_k, row-major), one per listed oscillator
+  std::vector<std::vector<double>> F_im; ///< Imaginary parts of the factors (n_k x n_k, row-major), one per listed oscillator
+} KronProduct;
+
+/**
+ * @brief Matrix-free RHS operator for Hamiltonians given as sums of Kronecker products.
+ *
+ * The state is treated as a tensor with one mode per oscillator (Schroedinger), or with one
+ * column mode and one row mode per oscillator (Lindblad, vectorized column-major density matrix
+ * \f$x_{r + cN} = \rho_{rc}\f$). The RHS is stored as a sum of superoperator terms, each of which is
+ * a complex coefficient times small dense factors acting on single modes:
+ *   - Hamiltonian term \f$cF\f$: \f$-icF\f$ on the row modes, and \f$+icF^T\f$ on the column modes (Lindblad)
+ *   - T1 decay: \f$\gamma_1 (a \rho a^\dagger - \frac 12 \{a^\dagger a, \rho\})\f$, T2 dephasing likewise with \f$L = a^\dagger a\f$
+ *
+ * Each term is applied by contracting its factors with the state one mode at a time, so that
+ * the global matrix is never formed. Memory scales with the size of the local factors. Terms are
+ * grouped by their time-dependent coefficient: the constant group 0, and the groups of \f$p_k(t)\f$
+ * and \f$q_k(t)\f$ for each oscillator k. Serial only, as the other matrix-free kernels.
+ */
+class KronOperator {
+  protected:
+    /**
+     * @brief Superoperator term: coefficient times factors on single modes of the state tensor.
+     */
+    typedef struct {
+      int group; ///< Coefficient group: 0 constant, 1+2k for p_k(t), 2+2k for q_k(t)
+      double coeff_re; ///< Real part of the coefficient
+      double coeff_im; ///< Imaginary part of the coefficient
+      std::vector<int> modes; ///< Modes of the state tensor with a non-identity factor
+      std::vector<std::vector<double>> F_re, F_im; ///< Factors (n x n, row-major), one per mode
+      std::vector<std::vector<double>> FH_re, FH_im; ///< Conjugate transposes of the factors, for the adjoint
+    } SuperTerm;
+
+    std::vector<int> nlevels; ///< Number of levels per oscillator
+    int noscillators; ///< Number of oscillators
+    LindbladType lindbladtype; ///< Type of Lindblad operators, or NONE for Schroedinger solver
+    PetscInt dim_rho; ///< Dimension of the Hilbert space N
+    PetscInt dim; ///< Dimension of the vectorized system: N^2 (Lindblad) or N (Schroedinger)
+    std::vector<PetscInt> modesize; ///< Size of each mode of the state tensor
+    std::vector<PetscInt> modestride; ///< Stride of each mode of the state tensor
+
+    std::vector<SuperTerm> terms; ///< All superoperator terms
+    std::vector<double> group_coeff; ///< Current coefficient of each group (1.0 for the constant group)
+    std::vector<double> buf[2]; ///< Work buffers for the mode-by-mode contraction (size 2*dim each)
+    std::vector<double> acc; ///< Accumulator for the gradient (size 2*dim)
+
+    /**
+     * @brief Applies a dense factor along one mode: y = F x, contracting the mode index.
+     */
+    void applyFactor(int mode, const std::vector<double>& F_re, const std::vector<double>& F_im, const double* x, double* y) const;
+
+    /**
+     * @brief Adds y += (c_re + i c_im) * term(x), or its adjoint.
+     */
+    void addTerm(const SuperTerm& term, double c_re, double c_im, bool adjoint, const double* x, double* y);
+
+    /**
+     * @brief Adds a superoperator term, precomputes the conjugate transposes of its factors.
+     */
+    void pushTerm(int group, double c_re, double c_im, const std::vector<int>& modes, const std::vector<std::vector<double>>& F_re, const std::vector<std::vector<double>>& F_im);
+
+  public:
+    KronOperator();
+
+    /**
+     * @brief Constructor.
+     *
+     * @param nlevels Number of levels per oscillator
+     * @param lindbladtype Type of Lindblad operators, or NONE for Schroedinger solver
+     */
+    KronOperator(const std::vector<int>& nlevels, LindbladType lindbladtype);
+
+    ~KronOperator();
+
+    /**
+     * @brief Adds a Hamiltonian product term as \f$-i[cF, \rho]\f$ (Lindblad) or \f$-icF\psi\f$ (Schroedinger).
+     *
+     * @param group Coefficient group: 0 constant, 1+2k for p_k(t), 2+2k for q_k(t)
+     * @param prod Kronecker product term of the Hamiltonian
+     */
+    void addHamiltonian(int group, const KronProduct& prod);
+
+    /**
+     * @brief Adds T1 decay and T2 dephasing of one oscillator (Lindblad only).
+     *
+     * @param iosc Oscillator index
+     * @param gammaT1 Decay rate 1/T1 (0 if none)
+     * @param gammaT2 Dephasing rate 1/T2 (0 if none)
+     */
+    void addDissipation(int iosc, double gammaT1, double gammaT2);
+
+    /**
+     * @brief Sets the current time-dependent coefficients of the control groups.
+     *
+     * @param p Real parts of the controls, one per oscillator
+     * @param q Imaginary parts of the controls, one per oscillator
+     */
+    void setControls(const std::vector<double>& p, const std::vector<double>& q);
+
+    /**
+     * @brief Applies the RHS (or its transpose) to a state x=[u,v].
+     *
+     * @param x Input state array of size 2*dim
+     * @param y Output state array of size 2*dim
+     * @param adjoint Flag to apply the transpose of the real-valued RHS (conjugate transpose of the complex operator)
+     */
+    void apply(const double* x, double* y, bool adjoint);
+
+    /**
+     * @brief Computes \f$\bar x^T G x\f$ for the operator G of one coefficient group with unit coefficient.
+     *
+     * @param group Coefficient group
+     * @param x State array of size 2*dim
+     * @param xbar Adjoint state array of size 2*dim
+     * @return double Inner product
+     */
+    double groupInnerProduct(int group, const double* x, const double* xbar);
+
+    /**
+     * @brief Returns the number of superoperator terms.
+     */
+    size_t getNTerms() const { return terms.size(); }
+
+    /**
+     * @brief Returns the memory of the stored factors in bytes.
+     */
+    size_t getFactorMemory() const;
+};
@@ -0,0 +1,127 @@
+#include "defs.hpp"
+#include "util.hpp"
+#include <petscmat.h>
+#include <vector>
+
+#pragma once
+
+/**
+ * @brief Complex sparse N x N matrix in CSR format, real and imaginary parts stored separately.
+ */
+typedef struct {
+  std::vector<PetscInt> rowptr; ///< Row pointers
+  std::vector<PetscInt> cols; ///< Column indices, sorted within each row
+  std::vector<double> re; ///< Real parts of the values
+  std::vector<double> im; ///< Imaginary parts of the values
+} SmallCSR;
+
+/**
+ * @brief Matrix-form application of the Lindblad RHS to the density matrix.
+ *
+ * Instead of the vectorized superoperator \f$I_N \otimes M - M^T \otimes I_N\f$ (N^2 x N^2), this class
+ * stores all operators at size N x N and treats the state as the N x N density matrix
+ * \f$\rho_{rc} = x_{r + cN}\f$ (column-major, real and imaginary part stored separately). The RHS is
+ * \f[ \dot \rho = M\rho + \rho M^\dagger + \sum_j \gamma_j L_j \rho L_j^\dagger,
+ *     \quad M(t) = -iH(t) - \frac 12 \sum_j \gamma_j L_j^\dagger L_j \f]
+ * where M(t) is merged into one sparse matrix with a fixed pattern, whose values are rewritten
+ * whenever the coefficients change. Each product is a sparse N x N matrix times the dense N x N
+ * state: left products run one column of \f$\rho\f$ at a time, right products are axpys on whole
+ * columns, so that the small operator stays in cache while streaming the state.
+ *
+ * Terms are grouped by their time-dependent coefficient. Group 0 is constant, all other groups
+ * are set with @ref setCoefficients. Serial only.
+ */
+class LindbladMatrixForm {
+  protected:
+    PetscInt N; ///< Dimension of the Hilbert space
+    std::vector<SmallCSR> terms; ///< Terms of M, each with unit coefficient
+    std::vector<int> term_group; ///< Coefficient group of each term
+    std::vector<std::vector<PetscInt>> term_slots; ///< Position of each entry of each term in the pattern of M
+    std::vector<double> group_coeff; ///< Current coefficient of each group (1.0 for the constant group)
+
+    SmallCSR M; ///< Current merged operator M(t)
+    std::vector<SmallCSR> jumps; ///< Collapse operators L_j
+    std::vector<double> jump_gamma; ///< Rates gamma_j of the collapse operators
+    std::vector<double> work; ///< Work array for the collapse terms (size 2N^2)
+    std::vector<double> acc; ///< Accumulator for the gradient (size 2N^2)
+
+    /**
+     * @brief Adds y += T x, or y += T^dagger x, for a dense N x N matrix x.
+     */
+    void leftMult(const SmallCSR& T, bool conjtranspose, const double* x, double* y) const;
+
+    /**
+     * @brief Adds y += x T, or y += x T^dagger, for a dense N x N matrix x.
+     */
+    void rightMult(const SmallCSR& T, bool conjtranspose, const double* x, double* y) const;
+
+  public:
+    LindbladMatrixForm();
+
+    /**
+     * @brief Constructor.
+     *
+     * @param N Dimension of the Hilbert space
+     * @param ngroups Number of coefficient groups, including the constant group 0
+     */
+    LindbladMatrixForm(PetscInt N, int ngroups);
+
+    ~LindbladMatrixForm();
+
+    /**
+     * @brief Adds a term to M. Call @ref finalize after all terms have been added.
+     *
+     * @param group Coefficient group
+     * @param imag Flag: the values are the imaginary part of the term (otherwise the real part)
+     * @param csr_i Row pointers
+     * @param csr_j Column indices, sorted within each row
+     * @param csr_v Values
+     */
+    void addTerm(int group, bool imag, const std::vector<PetscInt>& csr_i, const std::vector<PetscInt>& csr_j, const std::vector<double>& csr_v);
+
+    /**
+     * @brief Adds a real collapse operator L with rate gamma, including its part \f$-\frac \gamma 2 L^TL\f$ of M.
+     *
+     * @param gamma Rate
+     * @param csr_i Row pointers of L
+     * @param csr_j Column indices of L, sorted within each row
+     * @param csr_v Values of L
+     */
+    void addJump(double gamma, const std::vector<PetscInt>& csr_i, const std::vector<PetscInt>& csr_j, const std::vector<double>& csr_v);
+
+    /**
+     * @brief Builds the merged pattern of M and the positions of all terms in it.
+     */
+    void finalize();
+
+    /**
+     * @brief Sets the coefficients of the time-dependent groups and rewrites the values of M.
+     *
+     * @param coeffs Coefficients of the groups 1, 2, ...
+     */
+    void setCoefficients(const std::vector<double>& coeffs);
+
+    /**
+     * @brief Applies the RHS (or its transpose) to a state x=[u,v].
+     *
+     * @param x Input state array of size 2N^2
+     * @param y Output state array of size 2N^2
+     * @param adjoint Flag to apply the transpose of the real-valued RHS
+     */
+    void apply(const double* x, double* y, bool adjoint);
+
+    /**
+     * @brief Computes \f$\bar x^T G x\f$ with \f$G\rho = T\rho + \rho T^\dagger\f$ for the sum T of the terms of one group.
+     *
+     * @param group Coefficient group
+     * @param x State array of size 2N^2
+     * @param xbar Adjoint state array of size 2N^2
+     * @return double Inner product
+     */
+    double groupInnerProduct(int group, const double* x, const double* xbar);
+
+    /**
+     * @brief Returns the number of nonzeros of the merged operator M.
+     */
+    size_t getNNZ() const { return M.cols.size(); }
+};
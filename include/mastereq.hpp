@@ -5,12 +5,33 @@
 #include <vector>
 #include <assert.h>
 #include <iostream> 
+#include <type_traits>
 #include "gate.hpp"
 #include "hamiltonianfilereader.hpp"
+#include "observables.hpp"
+#include "lindbladmatrixform.hpp"
 
 #pragma once
 
 
+/**
+ * @brief Real-valued system matrix that merges all sparse terms, with precomputed value positions.
+ *
+ * Holds the local rows of [[A, -B], [B, A]] (or of its transpose) in CSR format. The nonzero
+ * pattern is fixed at setup. Updating the time-dependent coefficients only rewrites the values.
+ * For the interleaved state layout, the rows and columns follow the interleaved ordering and the
+ * matrix is stored in BAIJ format with 2x2 blocks, one per complex matrix element.
+ */
+typedef struct {
+  Mat A = NULL; ///< Assembled matrix (size 2dim x 2dim)
+  std::vector<PetscInt> rowptr; ///< CSR row pointers of the local rows
+  std::vector<PetscInt> cols; ///< Global column indices of the local rows
+  std::vector<double> constvals; ///< Values of the time-independent terms
+  std::vector<double> vals; ///< Current values
+  std::vector<std::vector<PetscInt>> slots; ///< Positions in vals of each time-dependent term
+  std::vector<std::vector<double>> termvals; ///< Signed values of each time-dependent term at its positions
+} MergedSparseMat;
+
 /**
  * @brief Matrix shell context containing data needed for applying the right-hand-side (RHS) system matrix to a vector.
  *
@@ -21,6 +42,13 @@ typedef struct {
   PetscInt dim; ///< Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
   std::vector<int> nlevels; ///< Number of levels per oscillator
   IS *isu, *isv; ///< Vector strides for accessing real and imaginary parts
+  PetscInt stride_x; ///< Distance between consecutive elements in the local state array: 1 if blocked, 2 if interleaved
+  PetscInt offset_im; ///< Offset of the imaginary part of an element from its real part: localsize_u if blocked, 1 if interleaved
+  int rowtiledepth; ///< Matrix-free Lindblad kernels: number of leading row indices fixed per tile (0: no row blocking)
+  int coltiledepth; ///< Matrix-free Lindblad kernels: number of leading column indices fixed per tile (0: no column blocking)
+  int nrowtiles; ///< Matrix-free Lindblad kernels: number of row blocks
+  int ntiles; ///< Matrix-free Lindblad kernels: number of tiles (row blocks x column blocks)
+  bool hermitianpacked; ///< Matrix-free Lindblad kernels: x and y are Hermitian-packed states, see @ref HermitianPackedReader
   Oscillator** oscil_vec; ///< Array of pointers to the oscillators
   std::vector<double> crosskerr; ///< Cross-Kerr coupling coefficients
   std::vector<double> Jkl; ///< Dipole-dipole coupling strength
@@ -38,9 +66,30 @@ typedef struct {
   std::vector<double> Bd_coeffs;  //< Time-dependent coefficients for dipole-dipole coupling matrices: cos(eta_k*t)
   std::vector<double> Ad_coeffs;  //< Time-dependent coefficients for dipole-dipole coupling matrices: sin(eta_k*t)
   Vec *aux; ///< Auxiliary vector for computations
+  Mat *RHSmerged; ///< Merged real-valued sparse system matrix (size 2dim x 2dim), if used
+  Mat *RHSmerged_T; ///< Stored transpose of the merged system matrix, or NULL
+  Mat *Ad_T, *Bd_T; ///< Stored transposes of Ad and Bd, or NULL
+  std::vector<Mat> Ac_vec_T; ///< Stored transposes of the control matrices Ac (empty if not stored)
+  std::vector<Mat> Bc_vec_T; ///< Stored transposes of the control matrices Bc (empty if not stored)
+  std::vector<Mat> Ad_vec_T; ///< Stored transposes of the coupling matrices Ad_kl (empty if not stored)
+  std::vector<Mat> Bd_vec_T; ///< Stored transposes of the coupling matrices Bd_kl (empty if not stored)
+  KronOperator* kronop; ///< Kronecker operator for factored Hamiltonian files, or NULL
+  LindbladMatrixForm* matrixform; ///< N x N operators of the matrix-form Lindblad solver, or NULL
+  Mat *RHSdense; ///< Dense system matrix of the small-system path, or NULL
   double time; ///< Current time
 } MatShellCtx;
 
+/**
+ * @brief Matrix shell context for applying the RHS to a Hermitian-packed state, see @ref packHermitianState.
+ *
+ * The packed RHS is P A U, with A the RHS on the full vectorized state, U the unpacking and P the packing.
+ */
+typedef struct {
+  Mat *RHS; ///< MatShell of the RHS on the full vectorized state
+  Vec *xfull; ///< Work vector for the unpacked input state
+  Vec *yfull; ///< Work vector for the full output state
+} PackedShellCtx;
+
 
 /**
  * @brief Matrix-vector products to apply the RHS system matrix to a state vector.
@@ -62,6 +111,16 @@ int applyRHS_matfree_5Osc(Mat RHS, Vec x, Vec y); ///< Matrix-free MatMult for 5
 int applyRHS_matfree_transpose_5Osc(Mat RHS, Vec x, Vec y); ///< Transpose matrix-free MatMult for 5 oscillators
 int applyRHS_sparsemat(Mat RHS, Vec x, Vec y); ///< Sparse matrix MatMult
 int applyRHS_sparsemat_transpose(Mat RHS, Vec x, Vec y); ///< Transpose sparse matrix MatMult
+int applyRHS_sparsemat_merged(Mat RHS, Vec x, Vec y); ///< Merged sparse matrix MatMult
+int applyRHS_sparsemat_merged_transpose(Mat RHS, Vec x, Vec y); ///< Transpose merged sparse matrix MatMult
+int applyRHS_kron(Mat RHS, Vec x, Vec y); ///< Kronecker operator MatMult
+int applyRHS_kron_transpose(Mat RHS, Vec x, Vec y); ///< Transpose Kronecker operator MatMult
+int applyRHS_matrixform(Mat RHS, Vec x, Vec y); ///< Matrix-form Lindblad MatMult
+int applyRHS_matrixform_transpose(Mat RHS, Vec x, Vec y); ///< Transpose matrix-form Lindblad MatMult
+int applyRHS_hermitianpacked(Mat RHS, Vec x, Vec y); ///< MatMult on a Hermitian-packed state
+int applyRHS_dense(Mat RHS, Vec x, Vec y); ///< Dense system matrix MatMult
+int applyRHS_dense_transpose(Mat RHS, Vec x, Vec y); ///< Transpose dense system matrix MatMult
+int applyRHS_hermitianpacked_transpose(Mat RHS, Vec x, Vec y); ///< Transpose MatMult on a Hermitian-packed state
 
 
 /**
@@ -97,8 +156,11 @@ class MasterEq{
     int noscillators; ///< Number of oscillators in the system
     Oscillator** oscil_vec; ///< Array of pointers to oscillator objects
 
-    Mat RHS; ///< MatShell for real-valued, vectorized system matrix (size 2N^2 x 2N^2)
+    Mat RHS; ///< MatShell for real-valued, vectorized system matrix (size 2N^2 x 2N^2, or N^2 x N^2 if packedkernels)
     MatShellCtx RHSctx; ///< Context containing data for applying the RHS to a state
+    Mat RHS_packed; ///< MatShell unpacking a Hermitian-packed state around RHS (size N^2 x N^2), if used. NULL if the matrix-free kernels apply RHS to the packed state directly.
+    PackedShellCtx packedctx; ///< Context for applying the RHS to a Hermitian-packed state
+    Vec packed_xfull, packed_yfull; ///< Full-size work vectors for the Hermitian-packed RHS, if RHS_packed is used
 
     std::vector<Mat> Ac_vec;  // Vector of constant mats for time-varying control term (real). One for each oscillators. 
     std::vector<Mat> Bc_vec;  // Vector of constant mats for time-varying control term (imag). One for each oscillators. 
@@ -106,6 +168,28 @@ class MasterEq{
     std::vector<Mat> Ad_vec;  // Vector of constant mats for Dipole-Dipole coupling term in drift Hamiltonian (real)
     std::vector<Mat> Bd_vec;  // Vector of constant mats for Dipole-Dipole coupling term in drift Hamiltonian (imag)
 
+    MergedSparseMat merged; ///< Merged real-valued system matrix [[A, -B], [B, A]] holding all sparse terms
+    MergedSparseMat merged_T; ///< Stored transpose of the merged system matrix
+    std::vector<int> merged_coupling; ///< Index kl of the coupling coefficient for each allocated coupling matrix
+
+    Mat Ad_T, Bd_T; ///< Stored transposes of Ad and Bd
+    std::vector<Mat> Ac_vec_T; ///< Stored transposes of the control matrices Ac
+    std::vector<Mat> Bc_vec_T; ///< Stored transposes of the control matrices Bc
+    std::vector<Mat> Ad_vec_T; ///< Stored transposes of the coupling matrices Ad_kl
+    std::vector<Mat> Bd_vec_T; ///< Stored transposes of the coupling matrices Bd_kl
+
+    KronOperator* kronop; ///< Matrix-free operator for factored Hamiltonian files, or NULL
+
+    LindbladMatrixForm* matrixform; ///< N x N operators for the matrix-form Lindblad solver, or NULL
+    std::vector<int> matrixform_coupling; ///< Index kl of the coupling coefficient for each coupling term of the matrix form
+
+    Mat RHSdense; ///< Dense real-valued system matrix at the current time (size 2dim x 2dim), for small systems
+    Mat dense_const; ///< Dense time-independent part of the system matrix
+    std::vector<Mat> dense_terms; ///< Dense time-dependent terms, ordered as (Ac, Bc) per oscillator, then (Ad_kl, Bd_kl) per coupling
+    Vec dense_aux; ///< Auxiliary vector of size 2dim for the dense gradient
+    std::vector<double> dense_coeffs; ///< Coefficients of the time-dependent terms currently summed into RHSdense
+    Vec dir_aux; ///< Auxiliary state vector for applying the control derivative of the RHS, allocated on first use
+
     std::vector<double> crosskerr; ///< Cross-Kerr coefficients (rad/time) \f$\xi_{kl}\f$ for ZZ-coupling \f$a_k^\dagger a_k a_l^\dagger a_l\f$
     std::vector<double> Jkl; ///< Dipole-dipole coupling coefficients (rad/time), multiplies \f$a_k^\dagger a_l + a_k a_l^\dagger\f$
     std::vector<double> eta; ///< Frequency differences in rotating frame (rad/time) for dipole-dipole coupling
@@ -120,6 +204,7 @@ class MasterEq{
 
     IS isu, isv; ///< Vector strides for accessing real and imaginary parts u=Re(x), v=Im(x)
     Vec aux; ///< Auxiliary vector for computations
+    Observables* observables; ///< Engine for evaluating diagonal observables (energies, populations, leakage)
     bool quietmode; ///< Flag for quiet mode operation
     std::string hamiltonian_file_Hsys; ///< Filename if a custom system Hamiltonian is read from file ('none' if standard Hamiltonian is used)
     std::string hamiltonian_file_Hc; ///< Filename if a custom control Hamiltonians are read from file ('none' if standard Hamiltonian is used)
@@ -128,6 +213,12 @@ class MasterEq{
     std::vector<int> nlevels; ///< Number of levels per oscillator
     std::vector<int> nessential; ///< Number of essential levels per oscillator
     bool usematfree; ///< Flag for using matrix-free solver
+    bool usemergedsparse; ///< Flag for applying all sparse terms as one merged sparse matrix
+    bool usesparsetranspose; ///< Flag for storing transposed sparse matrices for the adjoint
+    bool usematrixform; ///< Flag for applying the Lindblad RHS in matrix form with N x N operators
+    bool hermitianpacked; ///< Flag for evolving the Hermitian-packed upper triangle of the density matrix (size N^2 instead of 2N^2)
+    bool packedkernels; ///< Flag for applying the matrix-free kernels to the Hermitian-packed state directly, without unpacking
+    bool usedense; ///< Flag for applying the RHS as one dense matrix (small systems, serial only)
     LindbladType lindbladtype; ///< Type of Lindblad operators to include (NONE means Schroedinger equation)
 
   public:
@@ -144,11 +235,17 @@ class MasterEq{
      * @param eta_ Frequency differences for rotating frame
      * @param lindbladtype_ Type of Lindblad operators to include
      * @param usematfree_ Flag to use matrix-free solver
+     * @param usemergedsparse_ Flag to merge all sparse terms into one matrix (sparse-matrix solver only)
+     * @param usesparsetranspose_ Flag to store transposed sparse matrices for the adjoint (sparse-matrix solver only)
+     * @param usematrixform_ Flag to apply the Lindblad RHS in matrix form with N x N operators (sparse-matrix solver, Lindblad only)
+     * @param matfree_tilesize_ Maximum number of rows and of columns of the density matrix per tile in the matrix-free Lindblad kernels (0: no tiling)
+     * @param hermitianpacked_ Flag to apply the RHS to the Hermitian-packed density matrix (Lindblad only, serial only)
+     * @param dense_maxdim_ Largest size 2*dim of the real-valued system for which the RHS is stored as a dense matrix (0: never)
      * @param hamiltonian_file_Hsys Filename for system Hamiltonian data
      * @param hamiltonian_file_Hc Filename for control Hamiltonian data
      * @param quietmode Flag for quiet operation (default: false)
      */
-    MasterEq(const std::vector<int>& nlevels, const std::vector<int>& nessential, Oscillator** oscil_vec_, const std::vector<double>& crosskerr_, const std::vector<double>& Jkl_, const std::vector<double>& eta_, LindbladType lindbladtype_, bool usematfree_, const std::string& hamiltonian_file_Hsys, const std::string& hamiltonian_file_Hc, bool quietmode=false);
+    MasterEq(const std::vector<int>& nlevels, const std::vector<int>& nessential, Oscillator** oscil_vec_, const std::vector<double>& crosskerr_, const std::vector<double>& Jkl_, const std::vector<double>& eta_, LindbladType lindbladtype_, bool usematfree_, bool usemergedsparse_, bool usesparsetranspose_, bool usematrixform_, int matfree_tilesize_, bool hermitianpacked_, int dense_maxdim_, const std::string& hamiltonian_file_Hsys, const std::string& hamiltonian_file_Hc, bool quietmode=false);
 
     ~MasterEq();
 
@@ -165,6 +262,94 @@ class MasterEq{
      */
     void initSparseMatSolver();
 
+    /**
+     * @brief Collects the entries of all Hamiltonian terms of the locally owned rows.
+     *
+     * Reads the Hamiltonian files, if given, or sets up the standard Hamiltonian model. The rows are
+     * given by the row range of the entries.
+     *
+     * @param type Lindblad type for vectorizing the terms, or NONE for N x N terms
+     * @param[out] Ad_entries Real part of the constant system matrix
+     * @param[out] Bd_entries Imaginary part of the constant system matrix
+     * @param[out] Ac_entries Real parts of the control matrices, one per oscillator
+     * @param[out] Bc_entries Imaginary parts of the control matrices, one per oscillator
+     * @param[out] Adkl_entries Real parts of the coupling matrices, one per nonzero Jkl
+     * @param[out] Bdkl_entries Imaginary parts of the coupling matrices, one per nonzero Jkl
+     */
+    void collectHamiltonianEntries(LindbladType type, SparseEntries& Ad_entries, SparseEntries& Bd_entries, std::vector<SparseEntries>& Ac_entries, std::vector<SparseEntries>& Bc_entries, std::vector<SparseEntries>& Adkl_entries, std::vector<SparseEntries>& Bdkl_entries);
+
+    /**
+     * @brief Initializes the N x N operators of the matrix-form Lindblad solver.
+     */
+    void initMatrixForm();
+
+    /**
+     * @brief Initializes the matrix-free Kronecker operator from factored Hamiltonian files.
+     *
+     * Adds the system and control Hamiltonian terms from file, and the T1 decay and T2
+     * dephasing terms of each oscillator (Lindblad solver).
+     */
+    void initKronOperator();
+
+    /**
+     * @brief Builds a merged sparse system matrix from the individual sparse terms.
+     *
+     * The nonzero pattern is the union of all terms. The position of each entry of each
+     * time-dependent term is stored, so that @ref updateMergedSparseMat only rewrites values.
+     *
+     * @param M Merged matrix to build
+     * @param Ad_ Real part of the constant system matrix
+     * @param Bd_ Imaginary part of the constant system matrix
+     * @param Ac_ Real parts of the control matrices
+     * @param Bc_ Imaginary parts of the control matrices
+     * @param Adkl_ Real parts of the coupling matrices
+     * @param Bdkl_ Imaginary parts of the coupling matrices
+     * @param transpose Flag: terms are transposed, build the transpose of the system matrix
+     */
+    void initMergedSparseMat(MergedSparseMat& M, Mat Ad_, Mat Bd_, const std::vector<Mat>& Ac_, const std::vector<Mat>& Bc_, const std::vector<Mat>& Adkl_, const std::vector<Mat>& Bdkl_, bool transpose);
+
+    /**
+     * @brief Rewrites the values of a merged sparse system matrix for the current controls and coupling coefficients.
+     *
+     * @param M Merged matrix to update
+     */
+    void updateMergedSparseMat(MergedSparseMat& M);
+
+    /**
+     * @brief Returns the current coefficient of a time-dependent term of the merged system matrix.
+     *
+     * @param iterm Index of the term: (Ac, Bc) per oscillator, then (Ad_kl, Bd_kl) per coupling
+     * @return double Control q (Ac) or p (Bc), or sin(eta*t) (Ad_kl) or cos(eta*t) (Bd_kl)
+     */
+    double getMergedTermCoeff(size_t iterm);
+
+    /**
+     * @brief Builds the dense constant and time-dependent parts of the system matrix from the merged sparse matrix.
+     *
+     * The merged sparse matrix is released afterwards. Serial only.
+     */
+    void initDenseMat();
+
+    /**
+     * @brief Rewrites the dense system matrix for the current controls and coupling coefficients.
+     */
+    void updateDenseMat();
+
+    /**
+     * @brief Passes the controls and coupling coefficients stored in RHSctx to the operators that hold their own copies.
+     */
+    void updateRHSCoefficients();
+
+    /**
+     * @brief Prints the number of nonzeros and memory of the sparse operators, including stored transposes.
+     */
+    void reportSparseMemory();
+
+    /**
+     * @brief Destroys the stored transposes of the individual sparse terms.
+     */
+    void destroyTransposedTerms();
+
     /**
      * @brief Retrieves the i-th oscillator.
      *
@@ -201,6 +386,13 @@ class MasterEq{
      */
     PetscInt getDimRho(){ return dim_rho; }
 
+    /**
+     * @brief Retrieves the engine for evaluating diagonal observables of the state.
+     *
+     * @return Observables* Pointer to the observables engine
+     */
+    Observables* getObservables(){ return observables; }
+
     /**
      * @brief Assembles the real-valued system matrix (RHS) at time t.
      *
@@ -215,15 +407,34 @@ class MasterEq{
     /**
      * @brief Retrieves the right-hand-side system matrix.
      *
+     * If the Hermitian-packed state is used, this is the RHS acting on the packed state.
+     *
      * @return Mat PETSc matrix shell object representing the RHS.
      */
     Mat getRHS();
 
+    /**
+     * @brief Returns the size of the state vector evolved by the time-stepper.
+     *
+     * @return PetscInt N^2 for the Hermitian-packed state, 2*dim otherwise.
+     */
+    PetscInt getStateSize(){ return hermitianpacked ? dim : 2*dim; }
+
+    /**
+     * @brief Returns the coefficients of the time-dependent terms currently summed into the dense system matrix.
+     *
+     * The dense matrix only depends on these coefficients, so equal coefficients mean an equal matrix.
+     *
+     * @return const std::vector<double>& Coefficients, ordered as the dense terms. Empty if the dense path is not used.
+     */
+    const std::vector<double>& getDenseCoeffs() const { return dense_coeffs; }
+
     /**
      * @brief Computes gradient of RHS with respect to control parameters.
      *
      * Updates grad += alpha * x^T * (d RHS / d params)^T * x_bar. Supports both 
      * the sparse-matrix and the matrix-free version of the RHS. 
+     * If the Hermitian-packed state is used, x and x_bar are packed.
      *
      * @param t Current time
      * @param x State vector
@@ -233,6 +444,28 @@ class MasterEq{
      */
     void compute_dRHS_dParams(const double t,const Vec x,const Vec x_bar, const double alpha, Vec grad);
 
+    /**
+     * @brief Passes a direction in the space of control parameters to each oscillator, for Hessian-vector products.
+     *
+     * @param v Direction, same layout as the global design vector
+     */
+    void setControlDirection(const Vec v);
+
+    /**
+     * @brief Applies the derivative of the RHS along the control direction set by @ref setControlDirection.
+     *
+     * Computes y = (d RHS / d params * v) x, or its transpose. The RHS is affine in the controls, hence 
+     * this is the RHS evaluated with the directional derivatives of the controls, minus the RHS with zero controls.
+     * The RHS is re-assembled at time t afterwards, it must not be scaled or shifted when calling this. 
+     * If the Hermitian-packed state is used, x and y are packed.
+     *
+     * @param t Current time
+     * @param x State vector
+     * @param y Vector to store the result
+     * @param transpose Flag to apply the transpose
+     */
+    void applyControlDerivative(const double t, const Vec x, Vec y, bool transpose);
+
     /**
      * @brief Pass control parameters from global design vector to each oscillator.
      *
@@ -240,6 +473,13 @@ class MasterEq{
      */
     void setControlAmplitudes(const Vec x);
 
+    /**
+     * @brief Passes the time points at which the controls are tabulated to each oscillator.
+     *
+     * @param times Sorted vector of time points, see @ref Oscillator::setControlTimes
+     */
+    void setControlTimes(const std::vector<double>& times);
+
     /**
      * @brief Computes expected energy of the full composite system.
      *
@@ -284,6 +524,56 @@ class MasterEq{
  */
 void compute_dRHS_dParams_sparsemat(const double t,const Vec x,const Vec x_bar, const double alpha, Vec grad, std::vector<int>& nlevels, IS isu, IS isv, std::vector<Mat>& Ac_vec, std::vector<Mat>& Bc_vec, Vec aux, Oscillator** oscil_vec);
 
+/**
+ * @brief: Matrix-form Lindblad version to compute gradient of RHS with respect to parameters
+ *
+ * Updates grad += alpha * x^T * (d RHS / d params)^T * x_bar with the N x N control terms.
+ *
+ * @param[in] t Current time
+ * @param[in] x State vector
+ * @param[in] x_bar Adjoint state vector
+ * @param[in] alpha Scaling factor
+ * @param[out] grad Gradient vector to update
+ * @param[in] matrixform Matrix-form operators holding the control terms
+ * @param[in] noscillators Number of oscillators
+ * @param[in] oscil_vec Vector of quantum oscilators
+ */
+void compute_dRHS_dParams_matrixform(const double t, const Vec x, const Vec x_bar, const double alpha, Vec grad, LindbladMatrixForm* matrixform, int noscillators, Oscillator** oscil_vec);
+
+/**
+ * @brief: Dense small-system version to compute gradient of RHS with respect to parameters
+ *
+ * Updates grad += alpha * x^T * (d RHS / d params)^T * x_bar with the dense control terms.
+ *
+ * @param[in] t Current time
+ * @param[in] x State vector
+ * @param[in] x_bar Adjoint state vector
+ * @param[in] alpha Scaling factor
+ * @param[out] grad Gradient vector to update
+ * @param[in] dense_terms Dense time-dependent terms, starting with (Ac, Bc) per oscillator
+ * @param[in] aux Auxiliary vector of size 2dim
+ * @param[in] noscillators Number of oscillators
+ * @param[in] oscil_vec Vector of quantum oscilators
+ */
+void compute_dRHS_dParams_dense(const double t, const Vec x, const Vec x_bar, const double alpha, Vec grad, std::vector<Mat>& dense_terms, Vec aux, int noscillators, Oscillator** oscil_vec);
+
+/**
+ * @brief: Kronecker operator version to compute gradient of RHS with respect to parameters
+ *
+ * Updates grad += alpha * x^T * (d RHS / d params)^T * x_bar, applying the control terms
+ * of each oscillator with unit coefficient.
+ *
+ * @param[in] t Current time
+ * @param[in] x State vector
+ * @param[in] x_bar Adjoint state vector
+ * @param[in] alpha Scaling factor
+ * @param[out] grad Gradient vector to update
+ * @param[in] kronop Kronecker operator holding the control terms
+ * @param[in] noscillators Number of oscillators
+ * @param[in] oscil_vec Vector of quantum oscilators
+ */
+void compute_dRHS_dParams_kron(const double t, const Vec x, const Vec x_bar, const double alpha, Vec grad, KronOperator* kronop, int noscillators, Oscillator** oscil_vec);
+
 /**
  * @brief: Matrix free version to compute gradient of RHS with respect to parameters 
  *
@@ -299,13 +589,51 @@ void compute_dRHS_dParams_sparsemat(const double t,const Vec x,const Vec x_bar,
  * @param[in] nlevels Number of energy levels per subsystem
  * @param[in] lindbladtype Type of Lindblad decoherence operators, or NONE
  * @param[in] oscil_vec Vector of quantum oscillators 
+ * @param[in] hermitianpacked Flag: x and x_bar are Hermitian-packed states (size dim)
  */
-void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x,const Vec x_bar, const double alpha, Vec grad, std::vector<int>& nlevels, LindbladType lindbladtype, Oscillator** oscil_vec);
+void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x,const Vec x_bar, const double alpha, Vec grad, std::vector<int>& nlevels, LindbladType lindbladtype, Oscillator** oscil_vec, bool hermitianpacked = false);
 
 
 
 // Inline functions for the Matrix-free RHS application
 
+/**
+ * @brief Inline for Matrix-free RHS to get the index ranges of one row block or column block of the density matrix.
+ *
+ * A block fixes the first tiledepth indices i_0, ..., i_{tiledepth-1} (numbered in row-major order by
+ * the block number) and runs over all remaining indices, so it is a contiguous range of rows (ket indices i_k)
+ * or columns (bra indices i_k'). The kernels sweep one tile, i.e. one row block times one column block, at a
+ * time, with the row blocks of one column block visited in turn. The neighbors at i_k +/- 1 and i_k' +/- 1 of the
+ * trailing indices then lie within the tile, and those of the fixed leading ket indices in the tiles of the same
+ * column block that were just visited.
+ *
+ * @param block Block number, 0 <= block < n_0 * ... * n_{tiledepth-1}
+ * @param tiledepth Number of fixed leading indices (0: one block holds all rows or columns)
+ * @param noscillators Number of oscillators
+ * @param nlevels Number of levels per oscillator
+ * @param lo First index per oscillator (output)
+ * @param hi Last index (+1) per oscillator (output)
+ * @return int First row or column of the block
+ */
+inline int matfreeTileBounds(const int block, const int tiledepth, const int noscillators, const int* nlevels, int* lo, int* hi){
+  int start = 0;
+  int postdim = 1;
+  int rem = block;
+  for (int k = noscillators-1; k >= 0; k--) {
+    if (k < tiledepth) {
+      lo[k] = rem % nlevels[k];
+      hi[k] = lo[k] + 1;
+      rem /= nlevels[k];
+    } else {
+      lo[k] = 0;
+      hi[k] = nlevels[k];
+    }
+    start += lo[k] * postdim;
+    postdim *= nlevels[k];
+  }
+  return start;
+};
+
 /**
  * @brief Inline for Matrix-free RHS to Compute detuning for 1 oscillator.
  *
@@ -531,26 +859,108 @@ inline int TensorGetIndex(const int nlevels0, const int nlevels1, const int nlev
 }
 
 
+/**
+ * @brief Read access to a Hermitian-packed density matrix through the positions of the full vectorized state.
+ *
+ * The matrix-free kernels index x as the full state in blocked layout: position row + N*col holds the real part,
+ * N^2 further the imaginary part. Passing this reader instead of the state array applies them to the packed state
+ * (see @ref getPackedIndexReal) directly: entries below the diagonal are read as complex conjugates of the stored
+ * upper triangle. For the transpose kernels, the real part of a diagonal entry is read twice: U^T A^T P^T x is the
+ * upper triangle of A^T applied to the Hermitian matrix expanded from x, with the diagonal real part doubled on
+ * input and halved on output (see @ref matfreeStore).
+ *
+ * @tparam transposed Flag for the transpose kernels
+ * @tparam NC Dimension N of the density matrix, if known at compile time (0: use the runtime value)
+ */
+template <bool transposed, int NC = 0>
+struct HermitianPackedReader {
+  const double* xp; ///< Packed state data (size N^2)
+  int N;            ///< Dimension of the density matrix
+
+  HermitianPackedReader(const double* xp_, const int N_ = NC) : xp(xp_), N(N_) {}
+
+  /** @brief Dimension of the density matrix */
+  int size() const { return NC > 0 ? NC : N; }
+
+  /** @brief Value at position idx of the full vectorized state */
+  double operator[](const int idx) const {
+    const int n = size();
+    const bool imag = idx >= n*n;
+    const int k = imag ? idx - n*n : idx;
+    const int col = k / n;
+    const int row = k - col*n;
+    if (!imag) {
+      double re = row <= col ? xp[col*col + row] : xp[row*row + col];
+      return (transposed && row == col) ? 2.0*re : re;
+    }
+    if (row < col) return  xp[col*col + col + 1 + row];
+    if (row > col) return -xp[row*row + row + 1 + col];
+    return 0.0;
+  }
+};
+
+/**
+ * @brief Inline for Matrix-free RHS to store one output element of the full state.
+ *
+ * @param xptr State vector data (unused)
+ * @param yptr Output vector data
+ * @param it Position of the real part of the output element
+ * @param offset_im Offset of the imaginary part of an element (dim if blocked, 1 if interleaved)
+ * @param yre Real part of the output element
+ * @param yim Imaginary part of the output element
+ */
+inline void matfreeStore(const double* /*xptr*/, double* yptr, const int it, const PetscInt offset_im, const double yre, const double yim){
+  yptr[it] = yre;
+  yptr[it + offset_im] = yim;
+}
+
+/**
+ * @brief Inline for Matrix-free RHS to store one output element (row <= col) of the Hermitian-packed state.
+ *
+ * The imaginary part of a diagonal element is not stored. The transpose kernels halve the real part of a
+ * diagonal element, see @ref HermitianPackedReader.
+ *
+ * @param xptr Reader of the packed input state
+ * @param yptr Packed output vector data
+ * @param it Position row + N*col of the output element in the full state
+ * @param offset_im Offset of the imaginary part in the full state (unused)
+ * @param yre Real part of the output element
+ * @param yim Imaginary part of the output element
+ */
+template <bool transposed, int NC>
+inline void matfreeStore(const HermitianPackedReader<transposed, NC>& xptr, double* yptr, const int it, const PetscInt /*offset_im*/, const double yre, const double yim){
+  const int n = xptr.size();
+  const int col = it / n;
+  const int row = it - col*n;
+  if (row == col) {
+    yptr[col*col + col] = transposed ? 0.5*yre : yre;
+    return;
+  }
+  yptr[col*col + row] = yre;
+  yptr[col*col + col + 1 + row] = yim;
+}
+
 /**
  * @brief Inline for Matrix-free RHS for gradient updates.
  *
  * Computes coefficients for gradient computation with respect to control parameters.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param n Number of levels for current oscillator
  * @param np Number of levels for conjugate oscillator
  * @param i Current occupation number
  * @param ip Conjugate occupation number
- * @param stridei Stride for current oscillator
- * @param strideip Stride for conjugate oscillator
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for current oscillator
+ * @param strideip Stride in x for conjugate oscillator
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param res_p_re Pointer to store real part of p result
  * @param res_p_im Pointer to store imaginary part of p result
  * @param res_q_re Pointer to store real part of q result
  * @param res_q_im Pointer to store imaginary part of q result
  */
-inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, const int np, const int i, const int ip, const int stridei, const int strideip, const double* xptr, double* res_p_re, double* res_p_im, double* res_q_re, double* res_q_im) {
+template <typename XPtr>
+inline void dRHSdp_getcoeffs(const PetscInt offset_im, const int it, const int n, const int np, const int i, const int ip, const int stridei, const int strideip, const XPtr& xptr, double* res_p_re, double* res_p_im, double* res_q_re, double* res_q_im) {
 
   *res_p_re = 0.0;
   *res_p_im = 0.0;
@@ -561,7 +971,7 @@ inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, cons
   if (i < n-1) {
     int itx = it + stridei;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(i + 1);
     *res_p_re +=   sq * xim;
     *res_p_im += - sq * xre;
@@ -572,7 +982,7 @@ inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, cons
   if (ip < np-1) {
     int itx = it + strideip;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(ip + 1);
     *res_p_re += - sq * xim;
     *res_p_im += + sq * xre;
@@ -583,7 +993,7 @@ inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, cons
   if (i > 0) {
     int itx = it - stridei;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(i);
     *res_p_re += + sq * xim;
     *res_p_im += - sq * xre;
@@ -594,7 +1004,7 @@ inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, cons
   if (ip > 0) {
     int itx = it - strideip;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(ip);
     *res_p_re += - sq * xim;
     *res_p_im += + sq * xre;
@@ -608,8 +1018,8 @@ inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, cons
  *
  * Implements J_kl coupling terms in the rotating frame between oscillator i and j.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param ni Number of levels for oscillator i
  * @param nj Number of levels for oscillator j
  * @param nip Number of levels for oscillator i (conjugate)
@@ -618,24 +1028,25 @@ inline void dRHSdp_getcoeffs(const PetscInt dim, const int it, const int n, cons
  * @param ip Occupation number for oscillator i (conjugate)
  * @param j Occupation number for oscillator j
  * @param jp Occupation number for oscillator j (conjugate)
- * @param stridei Stride for oscillator i
- * @param strideip Stride for oscillator i (conjugate)
- * @param stridej Stride for oscillator j
- * @param stridejp Stride for oscillator j (conjugate)
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for oscillator i
+ * @param strideip Stride in x for oscillator i (conjugate)
+ * @param stridej Stride in x for oscillator j
+ * @param stridejp Stride in x for oscillator j (conjugate)
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param Jij Coupling coefficient
  * @param cosij Cosine of frequency difference
  * @param sinij Sine of frequency difference
  * @param yre Pointer to store real part of result
  * @param yim Pointer to store imaginary part of result
  */
-inline void Jkl_coupling(const PetscInt dim, const int it, const int ni, const int nj, const int nip, const int njp, const int i, const int ip, const int j, const int jp, const int stridei, const int strideip, const int stridej, const int stridejp, const double* xptr, const double Jij, const double cosij, const double sinij, double* yre, double* yim) {
+template <typename XPtr>
+inline void Jkl_coupling(const PetscInt offset_im, const int it, const int ni, const int nj, const int nip, const int njp, const int i, const int ip, const int j, const int jp, const int stridei, const int strideip, const int stridej, const int stridejp, const XPtr& xptr, const double Jij, const double cosij, const double sinij, double* yre, double* yim) {
   if (fabs(Jij)>1e-10) {
     //  1) J_kl (-icos + sin) * ρ_{E−k+l i, i′}
     if (i > 0 && j < nj-1) {
       int itx = it - stridei + stridej;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(i * (j + 1));
       // sin u + cos v + i ( -cos u + sin v)
       *yre += Jij * sq * (   cosij * xim + sinij * xre);
@@ -645,7 +1056,7 @@ inline void Jkl_coupling(const PetscInt dim, const int it, const int ni, const i
     if (i < ni-1 && j > 0) {
       int itx = it + stridei - stridej;  // E+k-l i, i'
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(j * (i + 1)); // sqrt( il*(ik+1))
       // -sin u + cos v + i (-cos u - sin v)
       *yre += Jij * sq * (   cosij * xim - sinij * xre);
@@ -655,7 +1066,7 @@ inline void Jkl_coupling(const PetscInt dim, const int it, const int ni, const i
     if (ip > 0 && jp < njp-1) {
       int itx = it - strideip + stridejp;  // i, E-k+l i'
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(ip * (jp + 1)); // sqrt( ik'*(il'+1))
       //  sin u - cos v + i ( cos u + sin v)
       *yre += Jij * sq * ( - cosij * xim + sinij * xre);
@@ -665,7 +1076,7 @@ inline void Jkl_coupling(const PetscInt dim, const int it, const int ni, const i
     if (ip < nip-1 && jp > 0) {
       int itx = it + strideip - stridejp;  // i, E+k-l i'
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(jp * (ip + 1)); // sqrt( il'*(ik'+1))
       // - sin u - cos v + i ( cos u - sin v)
       *yre += Jij * sq * ( - cosij * xim - sinij * xre);
@@ -677,8 +1088,8 @@ inline void Jkl_coupling(const PetscInt dim, const int it, const int ni, const i
 /**
  * @brief Transpose of dipole-dipole coupling for adjoint computations.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param ni Number of levels for oscillator i
  * @param nj Number of levels for oscillator j
  * @param nip Number of levels for oscillator i (conjugate)
@@ -687,24 +1098,25 @@ inline void Jkl_coupling(const PetscInt dim, const int it, const int ni, const i
  * @param ip Occupation number for oscillator i (conjugate)
  * @param j Occupation number for oscillator j
  * @param jp Occupation number for oscillator j (conjugate)
- * @param stridei Stride for oscillator i
- * @param strideip Stride for oscillator i (conjugate)
- * @param stridej Stride for oscillator j
- * @param stridejp Stride for oscillator j (conjugate)
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for oscillator i
+ * @param strideip Stride in x for oscillator i (conjugate)
+ * @param stridej Stride in x for oscillator j
+ * @param stridejp Stride in x for oscillator j (conjugate)
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param Jij Coupling coefficient
  * @param cosij Cosine of frequency difference
  * @param sinij Sine of frequency difference
  * @param yre Pointer to store real part of result
  * @param yim Pointer to store imaginary part of result
  */
-inline void Jkl_coupling_T(const PetscInt dim, const int it, const int ni, const int nj, const int nip, const int njp, const int i, const int ip, const int j, const int jp, const int stridei, const int strideip, const int stridej, const int stridejp, const double* xptr, const double Jij, const double cosij, const double sinij, double* yre, double* yim) {
+template <typename XPtr>
+inline void Jkl_coupling_T(const PetscInt offset_im, const int it, const int ni, const int nj, const int nip, const int njp, const int i, const int ip, const int j, const int jp, const int stridei, const int strideip, const int stridej, const int stridejp, const XPtr& xptr, const double Jij, const double cosij, const double sinij, double* yre, double* yim) {
   if (fabs(Jij)>1e-10) {
     //  1) [...] * \bar y_{E+k-l i, i′}
     if (i < ni-1 && j > 0) {
       int itx = it + stridei - stridej;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(j * (i + 1));
       *yre += Jij * sq * ( - cosij * xim + sinij * xre);
       *yim += Jij * sq * ( + cosij * xre + sinij * xim);
@@ -713,7 +1125,7 @@ inline void Jkl_coupling_T(const PetscInt dim, const int it, const int ni, const
     if (i > 0 && j < nj-1) {
       int itx = it - stridei + stridej;  // E-k+l i, i'
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(i * (j + 1)); // sqrt( ik*(il+1))
       *yre += Jij * sq * ( - cosij * xim - sinij * xre);
       *yim += Jij * sq * ( + cosij * xre - sinij * xim);
@@ -722,7 +1134,7 @@ inline void Jkl_coupling_T(const PetscInt dim, const int it, const int ni, const
     if (ip < nip-1 && jp > 0) {
       int itx = it + strideip - stridejp;  // i, E+k-l i'
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(jp * (ip + 1)); // sqrt( il'*(ik'+1))
       *yre += Jij * sq * (   cosij * xim + sinij * xre);
       *yim += Jij * sq * ( - cosij * xre + sinij * xim);
@@ -731,7 +1143,7 @@ inline void Jkl_coupling_T(const PetscInt dim, const int it, const int ni, const
     if (ip > 0 && jp < njp-1) {
       int itx = it - strideip + stridejp;  // i, E-k+l i'
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(ip * (jp + 1)); // sqrt( ik'*(il'+1))
       *yre += Jij * sq * (   cosij * xim - sinij * xre);
       *yim += Jij * sq * ( - cosij * xre - sinij * xim);
@@ -743,25 +1155,26 @@ inline void Jkl_coupling_T(const PetscInt dim, const int it, const int ni, const
 /**
  * @brief Matrix-free solver inline for off-diagonal L1 decay term.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param n Number of levels
  * @param i Occupation number (bra)
  * @param ip Occupation number (ket)
- * @param stridei Stride for bra index
- * @param strideip Stride for ket index
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for bra index
+ * @param strideip Stride in x for ket index
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param decayi Decay rate
  * @param yre Pointer to store real part of result
  * @param yim Pointer to store imaginary part of result
  */
-inline void L1decay(const PetscInt dim, const int it, const int n, const int i, const int ip, const int stridei, const int strideip, const double* xptr, const double decayi, double* yre, double* yim){
+template <typename XPtr>
+inline void L1decay(const PetscInt offset_im, const int it, const int n, const int i, const int ip, const int stridei, const int strideip, const XPtr& xptr, const double decayi, double* yre, double* yim){
   if  (fabs(decayi) > 1e-12) {
     if (i < n-1 && ip < n-1) {
       double l1off = decayi * sqrt((i+1)*(ip+1));
       int itx = it + stridei + strideip;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       *yre += l1off * xre;
       *yim += l1off * xim;
     }
@@ -772,24 +1185,25 @@ inline void L1decay(const PetscInt dim, const int it, const int n, const int i,
 /**
  * @brief Matrix-free inline Transpose of off-diagonal L1 decay for adjoint computations.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param i Occupation number (bra)
  * @param ip Occupation number (ket)
- * @param stridei Stride for bra index
- * @param strideip Stride for ket index
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for bra index
+ * @param strideip Stride in x for ket index
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param decayi Decay rate
  * @param yre Pointer to store real part of result
  * @param yim Pointer to store imaginary part of result
  */
-inline void L1decay_T(const PetscInt dim, const int it, const int i, const int ip, const int stridei, const int strideip, const double* xptr, const double decayi, double* yre, double* yim){
+template <typename XPtr>
+inline void L1decay_T(const PetscInt offset_im, const int it, const int i, const int ip, const int stridei, const int strideip, const XPtr& xptr, const double decayi, double* yre, double* yim){
   if (fabs(decayi) > 1e-12) {
       if (i > 0 && ip > 0) {
         double l1off = decayi * sqrt(i*ip);
         int itx = it - stridei - strideip;
         double xre = xptr[itx];
-        double xim = xptr[itx+dim];
+        double xim = xptr[itx+offset_im];
         *yre += l1off * xre;
         *yim += l1off * xim;
       }
@@ -801,26 +1215,27 @@ inline void L1decay_T(const PetscInt dim, const int it, const int i, const int i
  *
  * Applies control Hamiltonian terms (ladder operators) to the state.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param n Number of levels
  * @param i Occupation number (bra)
  * @param np Number of levels (conjugate)
  * @param ip Occupation number (ket)
- * @param stridei Stride for bra index
- * @param strideip Stride for ket index
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for bra index
+ * @param strideip Stride in x for ket index
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param pt Real part of control amplitude
  * @param qt Imaginary part of control amplitude
  * @param yre Pointer to store real part of result
  * @param yim Pointer to store imaginary part of result
  */
-inline void control(const PetscInt dim, const int it, const int n, const int i, const int np, const int ip, const int stridei, const int strideip, const double* xptr, const double pt, const double qt, double* yre, double* yim){
+template <typename XPtr>
+inline void control(const PetscInt offset_im, const int it, const int n, const int i, const int np, const int ip, const int stridei, const int strideip, const XPtr& xptr, const double pt, const double qt, double* yre, double* yim){
   /* \rho(ik+1..,ik'..) term */
   if (i < n-1) {
       int itx = it + stridei;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(i + 1);
       *yre += sq * (   pt * xim + qt * xre);
       *yim += sq * ( - pt * xre + qt * xim);
@@ -829,7 +1244,7 @@ inline void control(const PetscInt dim, const int it, const int n, const int i,
     if (ip < np-1) {
       int itx = it + strideip;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(ip + 1);
       *yre += sq * ( -pt * xim + qt * xre);
       *yim += sq * (  pt * xre + qt * xim);
@@ -838,7 +1253,7 @@ inline void control(const PetscInt dim, const int it, const int n, const int i,
     if (i > 0) {
       int itx = it - stridei;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(i);
       *yre += sq * (  pt * xim - qt * xre);
       *yim += sq * (- pt * xre - qt * xim);
@@ -847,7 +1262,7 @@ inline void control(const PetscInt dim, const int it, const int n, const int i,
     if (ip > 0) {
       int itx = it - strideip;
       double xre = xptr[itx];
-      double xim = xptr[itx+dim];
+      double xim = xptr[itx+offset_im];
       double sq = sqrt(ip);
       *yre += sq * (- pt * xim - qt * xre);
       *yim += sq * (  pt * xre - qt * xim);
@@ -858,26 +1273,27 @@ inline void control(const PetscInt dim, const int it, const int n, const int i,
 /**
  * @brief Matrix-free Transpose of control terms for adjoint computations.
  *
- * @param dim Dimension of full vectorized system: N^2 if Lindblad, N if Schroedinger
- * @param it Current tensor index
+ * @param offset_im Offset of the imaginary part of an element in x (dim if blocked, 1 if interleaved)
+ * @param it Position of the real part of the current element in x
  * @param n Number of levels
  * @param i Occupation number (bra)
  * @param np Number of levels (conjugate)
  * @param ip Occupation number (ket)
- * @param stridei Stride for bra index
- * @param strideip Stride for ket index
- * @param xptr Pointer to state vector data
+ * @param stridei Stride in x for bra index
+ * @param strideip Stride in x for ket index
+ * @param xptr State vector data, or a @ref HermitianPackedReader
  * @param pt Real part of control amplitude
  * @param qt Imaginary part of control amplitude
  * @param yre Pointer to store real part of result
  * @param yim Pointer to store imaginary part of result
  */
-inline void control_T(const PetscInt dim, const int it, const int n, const int i, const int np, const int ip, const int stridei, const int strideip, const double* xptr, const double pt, const double qt, double* yre, double* yim){
+template <typename XPtr>
+inline void control_T(const PetscInt offset_im, const int it, const int n, const int i, const int np, const int ip, const int stridei, const int strideip, const XPtr& xptr, const double pt, const double qt, double* yre, double* yim){
   /* \rho(ik+1..,ik'..) term */
   if (i > 0) {
     int itx = it - stridei;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(i);
     *yre += sq * ( - pt * xim + qt * xre);
     *yim += sq * (   pt * xre + qt * xim);
@@ -886,7 +1302,7 @@ inline void control_T(const PetscInt dim, const int it, const int n, const int i
   if (ip > 0) {
     int itx = it - strideip;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(ip);
     *yre += sq * (  pt * xim + qt * xre);
     *yim += sq * ( -pt * xre + qt * xim);
@@ -895,7 +1311,7 @@ inline void control_T(const PetscInt dim, const int it, const int n, const int i
   if (i < n-1) {
     int itx = it + stridei;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(i+1);
     *yre += sq * (- pt * xim - qt * xre);
     *yim += sq * (  pt * xre - qt * xim);
@@ -904,7 +1320,7 @@ inline void control_T(const PetscInt dim, const int it, const int n, const int i
   if (ip < np-1) {
     int itx = it + strideip;
     double xre = xptr[itx];
-    double xim = xptr[itx+dim];
+    double xim = xptr[itx+offset_im];
     double sq = sqrt(ip+1);
     *yre += sq * (+ pt * xim - qt * xre);
     *yim += sq * (- pt * xre - qt * xim);
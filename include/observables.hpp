@@ -0,0 +1,123 @@
+#include "defs.hpp"
+#include "util.hpp"
+#include <petscvec.h>
+#include <vector>
+#include <math.h>
+
+#pragma once
+
+/**
+ * @brief Bulk evaluation of diagonal observables of the quantum state.
+ *
+ * Expected energy levels, level populations, guard-level leakage and the pure-state
+ * measure all only depend on the diagonal of the density matrix (Lindblad), or on
+ * \f$|\psi_i|^2\f$ (Schroedinger). This class precomputes, for the part of the diagonal that
+ * is owned by this processor, the local storage positions and the energy level of each
+ * oscillator. Each call to @ref compute then streams the local diagonal once,
+ * accumulates all requested quantities, and sums them up over all PETSc processors in
+ * one single packed reduction. On one PETSc processor, the quantities are accumulated
+ * into the results directly, without a reduction.
+ */
+class Observables {
+  protected:
+    std::vector<int> nlevels; ///< Number of levels per oscillator
+    LindbladType lindbladtype; ///< Type of Lindblad operators, or NONE for Schroedinger solver
+    PetscInt dim_rho; ///< Dimension of Hilbert space = N
+    PetscInt localsize_u; ///< Size of local sub vector u or v in state x=[u,v]
+    PetscInt stride_x; ///< Distance between consecutive elements in the local state array (see @ref getStateStrides)
+    PetscInt offset_im; ///< Offset of the imaginary part of an element in the local state array
+
+    std::vector<PetscInt> diag_global; ///< Row index i of each locally owned diagonal element
+    std::vector<PetscInt> diag_local; ///< Local index of each locally owned diagonal element among the elements of this processor
+    std::vector<int> diag_levels; ///< Energy level of each oscillator for each locally owned diagonal element (noscillators per element)
+    std::vector<char> diag_guard; ///< Flag for each locally owned diagonal element: is a guard level
+    std::vector<PetscInt> guard_local; ///< Local positions of all guard-level diagonal elements
+    std::vector<size_t> pop_offset; ///< Offset of the population of each oscillator in the result buffer
+    size_t nscalar; ///< Size of the result buffer without the composite populations
+    bool serial; ///< Flag: one PETSc processor owns the whole state, no reduction needed
+
+    std::vector<double> mybuf; ///< Local contributions, packed for the reduction
+    std::vector<double> result; ///< Packed results after the reduction
+
+  public:
+    /**
+     * @brief Quantities that can be requested from @ref compute, combine with bitwise or.
+     */
+    enum Quantity {
+      ENERGY = 1,             ///< Expected energy level of the full composite system
+      ENERGY_OSC = 2,         ///< Expected energy level of each oscillator
+      POPULATION = 4,         ///< Populations of the full composite system
+      POPULATION_OSC = 8,     ///< Populations of the energy levels of each oscillator
+      LEAKAGE = 16,           ///< Occupation of the guard levels
+      MEASURE = 32            ///< Pure-state measure \f$\sum_i |i-m| \rho_{ii}\f$
+    };
+
+    Observables();
+
+    /**
+     * @brief Constructor, precomputes the index maps for the local part of the diagonal.
+     *
+     * @param nlevels Number of levels per oscillator
+     * @param nessential Number of essential levels per oscillator
+     * @param lindbladtype Type of Lindblad operators, or NONE for Schroedinger solver
+     * @param ilow First index of the local sub vector u,v
+     * @param iupp Last index (+1) of the local sub vector u,v
+     */
+    Observables(const std::vector<int>& nlevels, const std::vector<int>& nessential, LindbladType lindbladtype, PetscInt ilow, PetscInt iupp);
+
+    ~Observables();
+
+    /**
+     * @brief Evaluates the requested quantities for a state.
+     *
+     * Streams the local diagonal once and performs one reduction over all PETSc processors (none if serial).
+     * Must be called collectively. Results are available through the getters below.
+     *
+     * @param x State vector x=[u,v]
+     * @param quantities Requested quantities, bitwise or of @ref Quantity
+     * @param measure_state Integer m for the pure-state measure (only used for MEASURE)
+     */
+    void compute(const Vec x, int quantities, PetscInt measure_state = 0);
+
+    /**
+     * @brief Returns the expected energy level of the full composite system.
+     */
+    double getEnergy() const { return result[0]; }
+
+    /**
+     * @brief Returns the expected energy level of one oscillator.
+     *
+     * @param iosc Oscillator index
+     */
+    double getEnergy(size_t iosc) const { return result[3 + iosc]; }
+
+    /**
+     * @brief Returns the guard-level occupation.
+     */
+    double getLeakage() const { return result[1]; }
+
+    /**
+     * @brief Returns the pure-state measure.
+     */
+    double getMeasure() const { return result[2]; }
+
+    /**
+     * @brief Returns the populations of the energy levels of one oscillator.
+     *
+     * @param iosc Oscillator index
+     * @param pop Output vector, resized to the number of levels of this oscillator
+     */
+    void getPopulation(size_t iosc, std::vector<double>& pop) const;
+
+    /**
+     * @brief Returns the populations of the full composite system.
+     *
+     * @param pop Output vector, resized to N
+     */
+    void getPopulation(std::vector<double>& pop) const;
+
+    /**
+     * @brief Returns the local positions of the guard-level diagonal elements in the u-part of x.
+     */
+    const std::vector<PetscInt>& getGuardLocal() const { return guard_local; }
+};
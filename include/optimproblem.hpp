@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include "optimtarget.hpp"
+#include <random>
 #pragma once
 
 /* if Petsc version < 3.17: Change interface for Tao Optimizer */
@@ -15,6 +16,7 @@
 #define TaoSetObjectiveAndGradient(tao, NULL, TaoEvalObjectiveAndGradient,this) TaoSetObjectiveAndGradientRoutine(tao, TaoEvalObjectiveAndGradient,this)
 #define TaoSetSolution(tao, xinit) TaoSetInitialVector(tao, xinit)
 #define TaoGetSolution(tao, params) TaoGetSolutionVector(tao, params) 
+#define TaoSetHessian TaoSetHessianRoutine
 #endif
 /* if Petsc version < 3.21: Change interface for Tao Monitor */
 #if PETSC_VERSION_MAJOR<4 && PETSC_VERSION_MINOR<21
@@ -51,12 +53,15 @@ class OptimProblem {
   int ninit_local; ///< Local number of initial conditions on this processor
   Vec rho_t0; ///< Storage for initial condition of the ODE
   Vec rho_t0_bar; ///< Storage for adjoint initial condition of the adjoint ODE (aka the terminal condition)
+  Vec rho_t0_bar_dot; ///< Storage for the terminal condition of the second-order adjoint ODE
   std::vector<Vec> store_finalstates; ///< Storage for final states for each initial condition
+  std::vector<Vec> store_finaltangents; ///< Storage for final tangent states for each initial condition (Schroedinger only, Hessian-vector products)
 
   OptimTarget* optim_target; ///< Pointer to the optimization target (gate or state)
 
   MPI_Comm comm_init; ///< MPI communicator for initial condition parallelization
-  MPI_Comm comm_optim; ///< MPI communicator for optimization parallelization, currently not used (size 1)
+  MPI_Comm comm_optim; ///< MPI communicator for optimization parallelization, connects the multi-start groups
+  MPI_Comm comm_group; ///< MPI communicator for all processors within this multi-start group
   int mpirank_optim, mpisize_optim; ///< MPI rank and size for optimization communicator
   int mpirank_petsc, mpisize_petsc; ///< MPI rank and size for spatial parallelization (PETSc)
   int mpirank_world, mpisize_world; ///< MPI rank and size for global communicator
@@ -65,6 +70,8 @@ class OptimProblem {
   bool quietmode; ///< Flag for quiet mode operation
 
   std::vector<double> obj_weights; ///< Weights for averaging objective over initial conditions
+  std::vector<double> obj_weights_full; ///< Weights for averaging the objective over the full set of initial conditions
+  std::vector<double> fid_weights; ///< Weights for averaging the fidelity over initial conditions (1/ninit, unless mini-batch)
   int ndesign; ///< Number of global design (optimization) parameters
   double objective; ///< Current objective function value (sum over final-time cost, regularization terms and penalty terms)
   double obj_cost; ///< Final-time measure J(T) in objective
@@ -89,9 +96,57 @@ class OptimProblem {
   int maxiter; ///< Stopping criterion based on maximum number of iterations
   Tao tao; ///< PETSc's TAO optimization solver
   std::vector<double> initguess_fromfile; ///< Initial guess read from file
-  double* mygrad; ///< Auxiliary gradient storage
+  double* mygrad; ///< Send buffers for the non-blocking gradient reduction (two slots of size ndesign)
+  double* mygrad_sum; ///< Receive buffers for the non-blocking gradient reduction (two slots of size ndesign)
+  MPI_Request grad_request[2]; ///< Pending gradient reductions over initial condition processors, one per buffer slot
+  int grad_slot; ///< Buffer slot used by the next gradient reduction
+
+  std::mt19937 rand_engine; ///< Random number generator engine, used for perturbing multi-start initial guesses
+  double multistart_perturb; ///< Amplitude of the random perturbation of the initial guess for multi-start groups other than the first one
+  double multistart_droptol; ///< Stop a multi-start group if its objective exceeds droptol times the best objective over all groups
+  int multistart_warmup; ///< Number of iterations before a multi-start group may be stopped
+  MultistartStatus multistart_status; ///< Final status of the optimization run in this multi-start group
+  MPI_Win multistart_win; ///< One-sided MPI window for sharing the best objective value across multi-start groups
+  double* multistart_best; ///< Window memory holding the best objective value (used on rank 0 of comm_optim)
+
+  int minibatch_size; ///< Number of initial conditions sampled per mini-batch epoch (0: mini-batch mode disabled)
+  int minibatch_epoch; ///< Number of optimization iterations per mini-batch epoch
+  double minibatch_switchtol; ///< Switch to the full set of initial conditions once the full infidelity is below this tolerance
+  bool minibatch_active; ///< Flag: Objective and gradient are currently evaluated on a sampled subset of initial conditions
+  std::mt19937 minibatch_engine; ///< Random number generator for sampling the initial conditions on this processor
+  int iter_offset; ///< Number of optimization iterations performed in previous mini-batch epochs or multilevel levels
+
+  int multilevel_nlevels; ///< Number of time grids for multilevel optimization (1: optimize on the fine grid only)
+  double multilevel_tol; ///< Infidelity tolerance for stopping on a coarse time grid
+  int multilevel_maxiter; ///< Maximum number of optimization iterations on each coarse time grid
+  bool multilevel_coarse; ///< Flag: Currently optimizing on a coarse time grid
     
   Vec xtmp; ///< Temporary vector storage
+
+  std::string solver_str; ///< Type of the optimization solver (BQNLS, BNLS or BNTR)
+  Mat Hess; ///< Matrix-free Hessian operator (MatShell), only used by the Newton-type solvers
+  Vec xhess; ///< Design vector at which the Hessian is applied
+
+  /**
+   * @brief Adds the gradient contribution of one initial condition.
+   *
+   * If the initial conditions are distributed, the contribution is copied into a free
+   * buffer slot and summed over the initial condition processors with a non-blocking
+   * reduction, so that communication overlaps with the next adjoint solve. All initial
+   * condition processors must call this the same number of times per gradient evaluation.
+   *
+   * @param redgrad Reduced gradient of this initial condition, or NULL to contribute zero
+   * @param G Gradient vector to update
+   */
+  void addGradientContribution(Vec redgrad, Vec G);
+
+  /**
+   * @brief Waits for a pending gradient reduction and adds its result to the gradient.
+   *
+   * @param slot Buffer slot to complete
+   * @param G Gradient vector to update
+   */
+  void completeGradientReduction(int slot, Vec G);
   
   public: 
     Output* output; ///< Pointer to output handler
@@ -109,9 +164,10 @@ class OptimProblem {
    * @param comm_optim MPI communicator for optimization parallelization
    * @param ninit_ Number of initial conditions
    * @param output_ Pointer to output handler
+   * @param rand_engine_ Random number generator engine
    * @param quietmode Flag for quiet operation (default: false)
    */
-  OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm comm_init_, MPI_Comm comm_optim, int ninit_, Output* output_, bool quietmode=false);
+  OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm comm_init_, MPI_Comm comm_optim, int ninit_, Output* output_, std::mt19937 rand_engine_, bool quietmode=false);
 
   ~OptimProblem();
 
@@ -213,6 +269,87 @@ class OptimProblem {
    */
   int getMaxIter()     { return maxiter; };
 
+  /**
+   * @brief Checks whether multiple optimizations are run in parallel (multi-start).
+   *
+   * @return bool True if there is more than one optim processor group
+   */
+  bool isMultistart()  { return mpisize_optim > 1; };
+
+  /**
+   * @brief Retrieves the relative tolerance for stopping a multi-start group early.
+   *
+   * @return double Drop tolerance relative to the best objective over all groups
+   */
+  double getMultistartDropTol() { return multistart_droptol; };
+
+  /**
+   * @brief Retrieves the number of iterations before a multi-start group may be stopped early.
+   *
+   * @return int Number of warmup iterations
+   */
+  int getMultistartWarmup() { return multistart_warmup; };
+
+  /**
+   * @brief Sets the final status of this multi-start group.
+   *
+   * @param status Status of the optimization run
+   */
+  void setMultistartStatus(MultistartStatus status) { multistart_status = status; };
+
+  /**
+   * @brief Shares the current objective value with all multi-start groups.
+   *
+   * Uses one-sided communication, so that groups progressing at different speeds 
+   * never wait for each other. The result is broadcasted within this group.
+   *
+   * @param f Current objective function value of this group
+   * @return double Best objective function value reported by any group so far
+   */
+  double updateMultistartBest(double f);
+
+  /**
+   * @brief Checks whether the objective is currently evaluated on a mini-batch of initial conditions.
+   *
+   * @return bool True if a sampled subset of initial conditions is used
+   */
+  bool isMinibatchActive() { return minibatch_active; };
+
+  /**
+   * @brief Retrieves the number of optimization iterations performed in previous mini-batch epochs.
+   *
+   * @return int Iteration offset
+   */
+  int getIterOffset() { return iter_offset; };
+
+  /**
+   * @brief Checks if the optimizer currently runs on a coarse time grid of the multilevel optimization.
+   *
+   * @return bool True if on a coarse time grid
+   */
+  bool isCoarseLevel() { return multilevel_coarse; };
+
+  /**
+   * @brief Retrieves the infidelity tolerance for the coarse time grids.
+   *
+   * @return double Coarse-level infidelity tolerance
+   */
+  double getMultilevelTol() { return multilevel_tol; };
+
+  /**
+   * @brief Samples a new mini-batch of initial conditions.
+   *
+   * Each processor draws its share of the batch from its local initial conditions with 
+   * probabilities proportional to the objective weights, and rescales the objective and 
+   * fidelity weights such that the sampled terms are unbiased estimates of the full ones.
+   */
+  void sampleMinibatch();
+
+  /**
+   * @brief Restores the weights of the full set of initial conditions.
+   */
+  void useFullBatch();
+
   /**
    * @brief Evaluates the objective function F(x).
    * 
@@ -232,9 +369,45 @@ class OptimProblem {
    */
   void evalGradF(const Vec x, Vec G);
 
+  /**
+   * @brief Sets the design vector at which the Hessian is applied.
+   *
+   * @param x Design (optimization) vector
+   */
+  void setHessianPoint(const Vec x);
+
+  /**
+   * @brief Applies the Hessian of the objective function to a vector.
+   *
+   * The product is computed exactly (up to solver tolerances) at the point set by setHessianPoint():
+   * For each initial condition, a tangent-linear forward sweep propagates the state derivative along 
+   * the direction v, and a second-order adjoint sweep backwards in time accumulates Hv, including 
+   * the second derivatives of the final-time objective, the penalty terms and the control-dependent 
+   * system matrix. Each product hence costs about two forward and two backward solves. 
+   * Requires controls that are linear in the parameters and an implicit midpoint time-stepper.
+   *
+   * @param v Direction vector
+   * @param Hv Vector to store the Hessian-vector product
+   */
+  void evalHessVec(const Vec v, Vec Hv);
+
+  /**
+   * @brief Checks that the current setup supports Hessian-vector products and allocates their storage.
+   *
+   * Exits with an error for nonlinear control parameterizations or a nonzero dpdm penalty.
+   */
+  void checkHessianSupport();
+
   /**
    * @brief Runs the optimization solver.
    *
+   * If multilevel optimization is enabled, the optimizer first runs on coarser time grids 
+   * (ntime halved per level) until a loose infidelity tolerance is reached, each level 
+   * warm-starting the next finer one.
+   * If mini-batch mode is enabled, the optimizer then runs epochs on random subsets 
+   * of the initial conditions, checking the full objective in between, before 
+   * finishing on the full set.
+   *
    * @param xinit Initial guess for design variables
    */
   void solve(Vec xinit);
@@ -254,6 +427,15 @@ class OptimProblem {
    * @param opt Pointer to vector to store the optimal solution
    */
   void getSolution(Vec* opt);
+
+  /**
+   * @brief Finalizes a multi-start optimization.
+   *
+   * Determines the group with the smallest objective, distributes its solution to all groups, 
+   * writes the merged multi-start summary, and writes controls and trajectory data of the best solution.
+   * This method is called collectively by all processors after TaoSolve() has finished.
+   */
+  void finalizeMultistart();
 };
 
 /**
@@ -301,3 +483,27 @@ PetscErrorCode TaoEvalGradient(Tao tao, Vec x, Vec G, void*ptr);
  * @return PetscErrorCode Error code
  */
 PetscErrorCode TaoEvalObjectiveAndGradient(Tao tao, Vec x, PetscReal *f, Vec G, void*ptr);
+
+/**
+ * @brief PETSc TAO interface routine for Hessian evaluation.
+ *
+ * The Hessian is matrix-free, hence this only stores the current design vector.
+ *
+ * @param tao TAO solver object
+ * @param x Design vector
+ * @param H Hessian matrix (MatShell)
+ * @param Hpre Hessian preconditioner matrix
+ * @param ptr Pointer to user context (OptimProblem instance)
+ * @return PetscErrorCode Error code
+ */
+PetscErrorCode TaoEvalHessian(Tao tao, Vec x, Mat H, Mat Hpre, void*ptr);
+
+/**
+ * @brief Matrix-free Hessian-vector product for the MatShell Hessian.
+ *
+ * @param H Hessian matrix (MatShell, context is the OptimProblem instance)
+ * @param v Direction vector
+ * @param Hv Vector to store the Hessian-vector product
+ * @return PetscErrorCode Error code
+ */
+PetscErrorCode HessianMult(Mat H, Vec v, Vec Hv);
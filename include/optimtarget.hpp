@@ -44,6 +44,16 @@ class OptimTarget{
     PetscInt iupp; ///< Last index (+1) of the local sub vector u,v
 
     Vec aux; ///< Auxiliary vector for gate optimization objective computation
+    Observables* observables; ///< Engine for evaluating diagonal observables, owned by the master equation
+
+    int cache_size; ///< Maximum number of initial conditions whose prepared states are cached (-1: all, 0: no caching)
+    std::vector<int> cache_index; ///< Cache entry for each global initial condition index, -1 if not cached
+    std::vector<int> cache_initID; ///< Identifier of the initial condition of each cache entry
+    std::vector<Vec> cache_rho0; ///< Prepared initial state of each cache entry (NULL if cheap to rebuild, e.g. for basis states)
+    std::vector<Vec> cache_target; ///< Prepared target state of each cache entry (NULL if the target does not depend on the initial state)
+    std::vector<double> cache_purity; ///< Purity of the initial state of each cache entry
+    std::vector<bool> cache_target_ready; ///< Flag for each cache entry: target state and purity have been stored
+    int cache_current; ///< Cache entry of the current initial condition, -1 if not cached
     bool quietmode; ///< Flag for quiet mode operation
 
   public:
@@ -59,9 +69,10 @@ class OptimTarget{
      * @param total_time Total evolution time
      * @param read_gate_rot Gate rotation parameters
      * @param rho_t0 Initial state vector
+     * @param cache_size_ Maximum number of initial conditions whose prepared initial and target states are cached (-1: all, 0: no caching)
      * @param quietmode_ Flag for quiet operation
      */
-    OptimTarget(std::vector<std::string> target_str, const std::string& objective_str, std::vector<std::string> initcond_str, MasterEq* mastereq, double total_time, std::vector<double> read_gate_rot, Vec rho_t0, bool quietmode_);
+    OptimTarget(std::vector<std::string> target_str, const std::string& objective_str, std::vector<std::string> initcond_str, MasterEq* mastereq, double total_time, std::vector<double> read_gate_rot, Vec rho_t0, int cache_size_, bool quietmode_);
 
     ~OptimTarget();
 
@@ -82,6 +93,9 @@ class OptimTarget{
     /**
      * @brief Prepares the initial condition state.
      *
+     * The first call for each initial condition builds the state and, if caching is enabled, stores it 
+     * (or only its identifier, for basis-type states that are cheap to rebuild). Later calls reuse the cache.
+     *
      * @param iinit Index in processor range [rank * ninit_local .. (rank+1) * ninit_local - 1]
      * @param ninit Total number of initial conditions
      * @param nlevels Number of levels per oscillator
@@ -91,13 +105,24 @@ class OptimTarget{
      */
     int prepareInitialState(const int iinit, const int ninit, const std::vector<int>& nlevels, const std::vector<int>& nessential,  Vec rho0);
 
+  private:
+    /**
+     * @brief Builds the initial condition state, without using the cache.
+     *
+     * See @ref prepareInitialState for the parameters.
+     */
+    int buildInitialState(const int iinit, const int ninit, const std::vector<int>& nlevels, const std::vector<int>& nessential,  Vec rho0);
+
+  public:
+
     /**
      * @brief Prepares the target state for gate optimization.
      *
      * For gate optimization, computes the rotated target state \f$V \rho V^{\dagger}\f$
      * for a given initial state \f$\rho\f$ and stores it locally as a class member. 
      * Also stores the purity of \f$rho\f$ needed for scaling the Hilbert-Schmidt 
-     * overlap in the trace objective function.
+     * overlap in the trace objective function. Both are taken from the cache if the 
+     * current initial condition has been prepared before.
      *
      * @param rho Initial state vector
      */
@@ -150,6 +175,44 @@ class OptimTarget{
      */
     void finalizeJ_diff(const double obj_cost_re, const double obj_cost_im, double* obj_cost_re_bar, double* obj_cost_im_bar); 
 
+    /**
+     * @brief Computes the directional derivative of the final-time objective function measure.
+     *
+     * Tangent-linear version of @ref evalJ for Hessian-vector products.
+     *
+     * @param[in] state Final-time state vector
+     * @param[in] state_dot Tangent (directional derivative) of the state vector
+     * @param[out] J_re_dot Pointer to store the derivative of the real part of the objective
+     * @param[out] J_im_dot Pointer to store the derivative of the imaginary part of the objective
+     */
+    void evalJ_tangent(const Vec state, const Vec state_dot, double* J_re_dot, double* J_im_dot);
+
+    /**
+     * @brief Applies the second derivative of the final-time objective function measure to a tangent state.
+     *
+     * Updates statebar += (J_re_bar * d^2 J_re / dstate^2 + J_im_bar * d^2 J_im / dstate^2) * state_dot, 
+     * which is the derivative of @ref evalJ_diff wrt the state along state_dot.
+     *
+     * @param state Final-time state vector
+     * @param state_dot Tangent of the state vector
+     * @param statebar Vector to update
+     * @param J_re_bar Adjoint of real part of objective
+     * @param J_im_bar Adjoint of imaginary part of objective
+     */
+    void evalJ_diff_tangent(const Vec state, const Vec state_dot, Vec statebar, const double J_re_bar, const double J_im_bar);
+
+    /**
+     * @brief Directional derivative of @ref finalizeJ_diff.
+     *
+     * @param[in] obj_cost_re Real part of objective cost
+     * @param[in] obj_cost_im Imaginary part of objective cost
+     * @param[in] obj_cost_re_dot Derivative of the real part of objective cost
+     * @param[in] obj_cost_im_dot Derivative of the imaginary part of objective cost
+     * @param[out] obj_cost_re_bar_dot Pointer to store the derivative of the adjoint of the real part
+     * @param[out] obj_cost_im_bar_dot Pointer to store the derivative of the adjoint of the imaginary part
+     */
+    void finalizeJ_diff_tangent(const double obj_cost_re, const double obj_cost_im, const double obj_cost_re_dot, const double obj_cost_im_dot, double* obj_cost_re_bar_dot, double* obj_cost_im_bar_dot);
+
     /**
      * @brief Computes Frobenius distance between target and current state.
      *
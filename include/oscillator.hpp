@@ -6,9 +6,12 @@
 #include <iomanip>
 #include <petscmat.h>
 #include <vector>
+#include <algorithm>
+#include <limits>
 #include <assert.h>
 #include "util.hpp"
 #include "config.hpp"
+#include "observables.hpp"
 #include <stdlib.h> 
 #include<random>
 
@@ -58,6 +61,8 @@ class Oscillator {
     double dephase_time; ///< Characteristic time for T2 dephasing collapse operations
 
     std::vector<double> params; ///< Control parameters for this oscillator
+    std::vector<double> params_dir; ///< Direction in the space of control parameters, used for Hessian-vector products
+    Observables* observables; ///< Engine for evaluating diagonal observables of the full system, owned by MasterEq
     double Tfinal; ///< Final evolution time
     std::vector<ControlBasis *> basisfunctions; ///< Control parameterization basis functions for each time segment
     std::vector<double> carrier_freq; ///< Frequencies of the carrier waves
@@ -71,6 +76,67 @@ class Oscillator {
 
     bool control_enforceBC; ///< Flag to enforce boundary conditions on controls
 
+    std::vector<double> control_times; ///< Sorted time points at which the controls are tabulated (stage times of the time-stepper)
+    std::vector<double> control_p; ///< Tabulated control p(t) at each time point in control_times
+    std::vector<double> control_q; ///< Tabulated control q(t) at each time point in control_times
+    std::vector<double> carrier_cos; ///< Tabulated cos(carrier_freq[f]*t), carrier frequencies are the fastest index
+    std::vector<double> carrier_sin; ///< Tabulated sin(carrier_freq[f]*t), carrier frequencies are the fastest index
+    std::vector<double> lab_cos; ///< Tabulated cos(ground_freq*t) for the lab-frame controls
+    std::vector<double> lab_sin; ///< Tabulated sin(ground_freq*t) for the lab-frame controls
+    bool control_table_valid; ///< Flag: control_p and control_q match the current control parameters
+
+    /**
+     * @brief Evaluates cos(omega*t) and sin(omega*t) at a sorted sequence of time points by phasor rotation.
+     *
+     * The phasor is advanced from one time point to the next by multiplication with exp(i*omega*dt). The rotations
+     * for recurring time differences dt (e.g. uniform time grids, or the same stages in each time step) are 
+     * computed once, and the phasor is re-anchored with exact values every few points to bound the round-off growth.
+     *
+     * @param[in] omega Angular frequency
+     * @param[in] times Sorted vector of time points
+     * @param[out] cos_out Array to store cos(omega*t), the k-th value is stored at cos_out[k*stride]
+     * @param[out] sin_out Array to store sin(omega*t), the k-th value is stored at sin_out[k*stride]
+     * @param[in] stride Distance between consecutive outputs
+     */
+    void carrierPhasors(const double omega, const std::vector<double>& times, double* cos_out, double* sin_out, const size_t stride);
+
+    /**
+     * @brief Evaluates the rotating-frame control functions p(t), q(t) from the control parameters.
+     *
+     * @param[in] t Time at which to evaluate
+     * @param[out] Re_ptr Pointer to store real part p(t)
+     * @param[out] Im_ptr Pointer to store imaginary part q(t)
+     * @return int Error code
+     */
+    int computeControl(const double t, double* Re_ptr, double* Im_ptr);
+
+    /**
+     * @brief Evaluates the basis expansion of p(t), q(t) for a given coefficient vector, without the pi-pulse overrides.
+     *
+     * Carrier waves are looked up from the control table, if t is tabulated.
+     *
+     * @param[in] t Time at which to evaluate
+     * @param[in] coeffs Coefficients of the basis functions (same layout as @ref params)
+     * @param[out] Re_ptr Pointer to store real part p(t)
+     * @param[out] Im_ptr Pointer to store imaginary part q(t)
+     */
+    void evalBasisExpansion(const double t, const std::vector<double>& coeffs, double* Re_ptr, double* Im_ptr);
+
+    /**
+     * @brief Tabulates p(t) and q(t) at all time points in control_times for the current parameters.
+     */
+    void tabulateControl();
+
+    /**
+     * @brief Finds a time point in the control table.
+     *
+     * Re-tabulates the controls if the parameters have changed since the last call.
+     *
+     * @param t Time to look up
+     * @return int Index into control_times, or -1 if t is not tabulated
+     */
+    int findControlTime(const double t);
+
   public:
     PiPulse pipulse; ///< Pi-pulse storage (dummy for compatibility)
     PetscInt dim_preOsc; ///< Dimension of coupled subsystems preceding this oscillator
@@ -206,10 +272,34 @@ class Oscillator {
      */
     void clearParams() { params.clear(); };
 
+    /**
+     * @brief Sets the time points at which the controls are tabulated.
+     *
+     * Controls evaluated at one of those times (up to round-off) are looked up from a table that is
+     * filled in one pass after the control parameters change. Other times are evaluated directly.
+     * Passing an empty vector disables the table.
+     *
+     * @param times Sorted vector of time points, typically all stage times of the time-stepper
+     */
+    void setControlTimes(const std::vector<double>& times);
+
+    /**
+     * @brief Adds a uniform random perturbation to the control parameters.
+     *
+     * Each parameter is shifted by a random value in [-amplitude, amplitude]. Step parameters
+     * are kept in [0,1], and boundary conditions are re-applied if they are enforced.
+     * Used to create distinct starting points for multi-start optimization.
+     *
+     * @param amplitude Maximum perturbation amplitude (rad/time)
+     * @param rand_engine Random number generator engine
+     */
+    void perturbParams(double amplitude, std::mt19937& rand_engine);
+
     /**
      * @brief Evaluates the rotating-frame control functions.
      *
-     * Computes the real and imaginary parts of the control function: Re = p(t), Im = q(t)
+     * Computes the real and imaginary parts of the control function: Re = p(t), Im = q(t). 
+     * Uses the control table if t is one of its time points, see @ref setControlTimes.
      *
      * @param[in] t Time at which to evaluate
      * @param[out] Re_ptr Pointer to store real part p(t)
@@ -229,6 +319,35 @@ class Oscillator {
      */
     int evalControl_diff(const double t, double* grad_for_this_oscillator, const double pbar, const double qbar);
 
+    /**
+     * @brief Sets the direction in the space of control parameters for Hessian-vector products.
+     *
+     * @param x Direction, same layout as the control parameters
+     */
+    void setParamsDirection(const double* x);
+
+    /**
+     * @brief Evaluates the directional derivative of the controls along the direction set by @ref setParamsDirection.
+     *
+     * Requires controls that are linear in the parameters, see @ref hasLinearControls, such that
+     * the directional derivative equals the controls evaluated with the direction as parameters. 
+     * Pi-pulse overrides don't depend on the parameters, their derivative is zero.
+     *
+     * @param[in] t Time at which to evaluate
+     * @param[out] Re_ptr Pointer to store the derivative of p(t)
+     * @param[out] Im_ptr Pointer to store the derivative of q(t)
+     */
+    void evalControlDirection(const double t, double* Re_ptr, double* Im_ptr);
+
+    /**
+     * @brief Checks whether the controls are linear in the control parameters.
+     *
+     * B-spline parameterizations are linear, step functions and B-spline amplitudes with phase are not.
+     *
+     * @return bool True if the second derivatives of p(t), q(t) wrt the parameters vanish
+     */
+    bool hasLinearControls();
+
     /**
      * @brief Evaluates lab-frame control function.
      *
@@ -238,10 +357,18 @@ class Oscillator {
      */
     int evalControl_Labframe(const double t, double* f_ptr);
 
+    /**
+     * @brief Sets the engine that evaluates the diagonal observables of the full system.
+     *
+     * @param observables_ Pointer to the observables engine of the master equation
+     */
+    void setObservables(Observables* observables_) { observables = observables_; }
+
     /**
      * @brief Computes expected energy for this oscillator.
      *
      * Returns the expected value of the number operator for this oscillator's subsystem.
+     * Delegates to the observables engine (one sweep over the local diagonal, one reduction).
      *
      * @param x State vector
      * @return double Expected energy value
@@ -261,6 +388,7 @@ class Oscillator {
      * @brief Computes population in each energy level of this oscillator.
      *
      * Extracts the diagonal elements of the reduced density matrix for this oscillator.
+     * Delegates to the observables engine (one sweep over the local diagonal, one reduction).
      *
      * @param x State vector
      * @param pop Reference to vector to store population values
@@ -284,6 +412,17 @@ class Oscillator {
      * @param skip_to_oscillator Offset to this oscillator's parameters in global vector
      */
     void evalControlVariationDiff(Vec G, double var_reg_bar, int skip_to_oscillator);
+
+    /**
+     * @brief Applies the Hessian of the control variation penalty to the direction set by @ref setParamsDirection.
+     *
+     * The penalty is quadratic in the parameters, hence its gradient evaluated at the direction is the Hessian-vector product.
+     *
+     * @param Hv Hessian-vector product to update
+     * @param var_reg_bar Adjoint of variation penalty
+     * @param skip_to_oscillator Offset to this oscillator's parameters in global vector
+     */
+    void evalControlVariationHessVec(Vec Hv, double var_reg_bar, int skip_to_oscillator);
 };
 
 
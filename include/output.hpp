@@ -1,10 +1,90 @@
 #include <sys/stat.h> 
 #include <petscmat.h>
 #include <iostream> 
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "config.hpp"
 #include "mastereq.hpp"
 #pragma once
 
+/**
+ * @brief One block of formatted text output, written by the background writer.
+ *
+ * Holds a number of rows with ncols values each. Each row is printed as fmt_first 
+ * for the first value, fmt_value for each remaining value, followed by fmt_end.
+ */
+struct OutputRecord {
+  FILE* file = NULL;          ///< File to write to
+  std::vector<double> values; ///< Row-major values, ncols per row
+  size_t ncols = 1;           ///< Number of values per row
+  const char* fmt_first = ""; ///< Format of the first value in each row (e.g. the time)
+  const char* fmt_value = ""; ///< Format of the remaining values in each row
+  const char* fmt_end = "\n"; ///< Appended at the end of each row
+  bool closefile = false;     ///< Flag: close the file after writing this record
+};
+
+/**
+ * @brief Background thread for formatting and writing text output.
+ *
+ * Records are handed over through a bounded ring buffer and written to disk by a 
+ * dedicated I/O thread, so that the time-stepping loop does not stall on text 
+ * formatting or disk access. If the buffer is full, the producer blocks until the
+ * writer catches up (backpressure). The writer thread never calls MPI. 
+ * If the writer is not started, records are written immediately.
+ */
+class OutputWriter {
+  std::vector<OutputRecord> ring; ///< Ring buffer of pending records
+  size_t head;                    ///< Position of the oldest pending record
+  size_t count;                   ///< Number of pending records
+  bool busy;                      ///< Flag: the writer is currently writing a record
+  bool stop;                      ///< Flag: the writer thread should terminate
+  bool running;                   ///< Flag: the writer thread has been started
+  std::thread worker;             ///< The I/O thread
+  std::mutex mtx;                 ///< Protects the ring buffer state
+  std::condition_variable cv_push; ///< Signals free space in the ring buffer, or an idle writer
+  std::condition_variable cv_pop;  ///< Signals new records in the ring buffer
+
+  /**
+   * @brief Main loop of the I/O thread.
+   */
+  void run();
+
+  public:
+    OutputWriter();
+    ~OutputWriter();
+
+    /**
+     * @brief Starts the I/O thread.
+     *
+     * @param capacity Maximum number of pending records before push() blocks
+     */
+    void start(size_t capacity);
+
+    /**
+     * @brief Hands a record over to the writer.
+     *
+     * The content of rec is swapped into the ring buffer, hence rec is undefined on return. 
+     *
+     * @param rec Record to be written
+     */
+    void push(OutputRecord& rec);
+
+    /**
+     * @brief Blocks until all pending records have been written.
+     */
+    void flush();
+
+    /**
+     * @brief Formats and writes one record.
+     *
+     * @param rec Record to be written
+     */
+    static void write(OutputRecord& rec);
+};
+
 /**
  * @brief Output management for quantum control simulations and optimization.
  *
@@ -19,6 +99,8 @@ class Output{
   int mpirank_petsc; ///< Rank of processor for PETSc parallelization
   int mpisize_petsc; ///< Size of communicator for PETSc parallelization
   int mpirank_init; ///< Rank of processor for initial condition parallelization
+  int mpirank_optim; ///< Rank of processor for optimization parallelization (multi-start group ID)
+  int mpisize_optim; ///< Size of communicator for optimization parallelization (number of multi-start groups)
 
   bool quietmode; ///< Flag for reduced screen output
   
@@ -38,6 +120,40 @@ class Output{
   FILE *expectedfile_comp; ///< File for expected energy evolution of the full composite system
   FILE *populationfile_comp; ///< File for population evolution of the full composite system
 
+  MPI_Comm comm_petsc; ///< MPI communicator for PETSc parallelization, used for collective binary state output
+  int fullstate_precision; ///< Bytes per value for binary full state output (8: double, 4: float), 0 for text output
+  MPI_File statefile; ///< Binary file for the full state evolution, written collectively by all PETSc processors
+  bool statefile_open; ///< Flag: statefile is currently open
+  MPI_Offset statefile_header; ///< Size of the header of the binary state file in bytes
+  MPI_Offset statefile_record; ///< Size of one time snapshot in the binary state file in bytes
+  long long statefile_nsnapshots; ///< Number of snapshots written to the binary state file so far
+  std::vector<double> state_blocked; ///< Local part of the state in blocked order, if the state is stored interleaved
+
+  OutputWriter writer; ///< Background writer for the text output files
+  OutputRecord trajectory_rec; ///< Producer-side record for trajectory rows, refilled in place and swapped with the writer's ring buffer
+
+  bool trajectory_container; ///< Flag: write all trajectory data into one binary container per run instead of separate files per initial condition
+  std::string containername; ///< Filename of the trajectory container
+  MPI_Comm comm_container; ///< Communicator on which the container is opened and written collectively (initial condition parallelization)
+  MPI_File containerfile; ///< Container file, opened once on all processors of comm_container that hold data
+  bool containerfile_open; ///< Flag: containerfile is currently open
+  std::vector<double> container_buf; ///< Local parts of the buffered snapshot rows of the current initial condition
+  long long container_flushrows; ///< Number of snapshot rows per collective write (output_buffer_size)
+  long long container_rowfirst; ///< First snapshot in the row buffer
+  long long container_nbuffered; ///< Number of snapshot rows in the row buffer
+  long long container_nflushed; ///< Number of collective writes issued for the current initial condition
+  PetscInt container_dim; ///< Dimension of u and v of the current initial condition
+  int container_slot; ///< Index of the current initial condition in the container (global initial condition index)
+  int container_ninit; ///< Number of initial conditions in the container
+  long long container_nsnap; ///< Number of time snapshots per initial condition
+  long long container_ncols; ///< Number of values per time snapshot (time, observables, full state)
+  MPI_Offset container_block; ///< Offset of the data block of the current initial condition
+  std::vector<long long> container_col_expected; ///< Column of the expected energy of each oscillator (-1 if not written)
+  std::vector<long long> container_col_population; ///< First column of the population of each oscillator (-1 if not written)
+  long long container_col_expected_comp; ///< Column of the composite expected energy (-1 if not written)
+  long long container_col_population_comp; ///< First column of the composite population (-1 if not written)
+  long long container_col_fullstate; ///< First column of the real part of the full state (-1 if not written)
+
   // VecScatter scat; ///< PETSc's scatter context for state communication across cores
   // Vec xseq; ///< Sequential vector for I/O operations
 
@@ -54,10 +170,11 @@ class Output{
      * @param config Configuration parameters from input file
      * @param comm_petsc MPI communicator for PETSc parallelization
      * @param comm_init MPI communicator for initial condition parallelization
+     * @param comm_optim MPI communicator for optimization parallelization (multi-start)
      * @param noscillators Number of oscillators in the system
      * @param quietmode Flag for reduced output (default: false)
      */
-    Output(Config& config, MPI_Comm comm_petsc, MPI_Comm comm_init, int noscillators, bool quietmode=false);
+    Output(Config& config, MPI_Comm comm_petsc, MPI_Comm comm_init, MPI_Comm comm_optim, int noscillators, bool quietmode=false);
 
     ~Output();
 
@@ -65,7 +182,8 @@ class Output{
      * @brief Writes optimization progress to history file.
      *
      * Called at every optimization iteration to log convergence data. 
-     * Optimization history will be written to <datadir>/optim_history.dat.
+     * Optimization history will be written to <datadir>/optim_history.dat, or to 
+     * <datadir>/optim_history_start<k>.dat for each multi-start group k.
      *
      * @param optim_iter Current optimization iteration
      * @param objective Total objective function value
@@ -81,12 +199,27 @@ class Output{
      */
     void writeOptimFile(int optim_iter, double objective, double gnorm, double stepsize, double Favg, double cost, double tikh_regul,  double penalty, double penalty_dpdm, double penalty_energy, double penalty_variation);
 
+    /**
+     * @brief Writes the merged summary of a multi-start optimization.
+     *
+     * Called once after all multi-start groups have finished, on the first processor only. 
+     * The summary is written to <datadir>/optim_multistart.dat.
+     *
+     * @param iters Number of optimization iterations for each multi-start group
+     * @param objectives Final objective function value for each multi-start group
+     * @param fidelities Final fidelity for each multi-start group
+     * @param status Final status for each multi-start group
+     * @param beststart ID of the group with the smallest objective function value
+     */
+    void writeMultistartFile(const std::vector<int>& iters, const std::vector<double>& objectives, const std::vector<double>& fidelities, const std::vector<MultistartStatus>& status, int beststart);
+
     /**
      * @brief Writes current control pulses per oscillator and control parameters.
      *
      * Called every optim_monitor_freq optimization iterations. 
      * Control pulses are written to <datadir>/control<ioscillator>.dat
      * Control parameters are written to <datadir>/params.dat
+     * The controls are evaluated right away, the files are written by the background writer.
      *
      * @param params Current parameter vector
      * @param mastereq Pointer to master equation solver
@@ -104,15 +237,35 @@ class Output{
      */
     void writeGradient(Vec grad);
 
+    /**
+     * @brief Writes a Hessian-vector product to file.
+     *
+     * Writes <datadir>/hessvec.dat (rank 0 only) with columns: direction, 
+     * Hessian-vector product (second-order adjoint) and its finite-difference approximation.
+     *
+     * @param v Direction vector
+     * @param Hv Hessian-vector product
+     * @param Hv_fd Finite-difference approximation of the Hessian-vector product
+     */
+    void writeHessVec(Vec v, Vec Hv, Vec Hv_fd);
+
     /**
      * @brief Opens data files for time evolution output.
      *
      * Prepares files for writing full state, expected energy, and population evolution data. Called before timestepping starts.
      *
+     * If binary full state output is selected, the state file <datadir>/<prefix>.iinit<initid>.bin is opened 
+     * collectively on all PETSc processors, and its header is written. 
+     *
+     * In container mode, the data block for the current initial condition in <datadir>/trajectories.bin is prepared instead. 
+     * The container is opened once, collectively on the initial condition communicator.
+     *
      * @param prefix Filename prefix for output files
      * @param initid Initial condition identifier
+     * @param mastereq Pointer to master equation solver
+     * @param ntime Total number of time steps
      */
-    void openTrajectoryDataFiles(std::string prefix, int initid);
+    void openTrajectoryDataFiles(std::string prefix, int initid, MasterEq* mastereq, int ntime);
 
     /**
      * @brief Writes time evolution data to files.
@@ -129,8 +282,128 @@ class Output{
     /**
      * @brief Closes open time evolution data files.
      *
-     * Properly closes and flushes all output files after time-stepping completion.
+     * Waits for the background writer to finish all pending output, then closes the files.
      */
     void closeTrajectoryDataFiles();
 
+    /**
+     * @brief Sets the position of the next initial condition in the trajectory container.
+     *
+     * Called before each forward solve whose trajectory might be written. Only used in container mode.
+     *
+     * @param iinit_global Global index of the initial condition (0 <= iinit_global < ninit)
+     * @param ninit Total number of initial conditions
+     */
+    void setInitialCondition(int iinit_global, int ninit);
+
+    /**
+     * @brief Marks an initial condition whose trajectory is not computed (e.g. outside of a mini-batch).
+     *
+     * In container mode, all initial conditions on the same PETSc rank write their blocks collectively. 
+     * A skipped initial condition takes part in these collective writes without contributing data.
+     *
+     * @param ntime Total number of time steps
+     */
+    void skipTrajectory(int ntime);
+
+  private:
+    /**
+     * @brief Opens the trajectory container and writes its header and index.
+     *
+     * Layout (all integers int64): magic "QUANDTRJ", version, ninit, nsnap, ncols, ndatasets,
+     * data offset, block stride, followed by ndatasets entries of (char name[32], first column, width),
+     * and by the initial condition ID of each slot. Each initial condition then owns one block of 
+     * nsnap x ncols doubles at <data offset> + slot * <block stride>. Each snapshot row starts with the time.
+     * Offsets and strides are aligned to 4096 bytes.
+     *
+     * @param initid Initial condition identifier
+     * @param mastereq Pointer to master equation solver
+     * @param ntime Total number of time steps
+     */
+    void openContainer(int initid, MasterEq* mastereq, int ntime);
+
+    /**
+     * @brief Writes one time snapshot of the current initial condition into the container.
+     *
+     * The first PETSc processor stores the time and observables, each PETSc processor stores its own slice of the full state. 
+     * The rows are buffered and written with one collective MPI_File_write_at_all over all initial conditions 
+     * once <output_buffer_size> rows are buffered, see @ref flushContainer.
+     *
+     * @param timestep Current time step number
+     * @param time Current time value
+     * @param state Current state vector
+     * @param obs Values of the observables, in container column order, starting after the time
+     * @param dim Dimension of u and v
+     */
+    void writeContainerRow(int timestep, double time, const Vec state, const std::vector<double>& obs, PetscInt dim);
+
+    /**
+     * @brief Writes the buffered snapshot rows of the current initial condition into its data block.
+     *
+     * Collective on comm_container: the processors of all initial conditions write their blocks at disjoint 
+     * offsets through a file view, processors without buffered rows take part with an empty write.
+     *
+     * @param dim Dimension of u and v
+     */
+    void flushContainer(PetscInt dim);
+
+    /**
+     * @brief Opens the container collectively on comm_container, unless it is already open.
+     */
+    void openContainerFile();
+
+    /**
+     * @brief Returns true if this processor writes data into the container (first PETSc processor, or full state output).
+     */
+    bool hasContainerData();
+
+    /**
+     * @brief Returns the number of values of one snapshot row that are stored on this processor.
+     *
+     * @param dim Dimension of u and v
+     */
+    PetscInt getContainerLocalRowSize(PetscInt dim);
+
+    /**
+     * @brief Returns the number of collective writes per initial condition.
+     *
+     * @param nsnap Number of time snapshots
+     */
+    long long getContainerNFlush(long long nsnap);
+
+    /**
+     * @brief Hands one row of trajectory output (time followed by values) to the background writer.
+     *
+     * @param file File to write to
+     * @param time Current time value
+     * @param values Values to be written after the time
+     * @param nvalues Number of values
+     * @param fmt_time Format of the time
+     * @param fmt_value Format of each value
+     */
+    void pushTrajectoryRecord(FILE* file, double time, const double* values, size_t nvalues, const char* fmt_time, const char* fmt_value);
+
+    /**
+     * @brief Writes one snapshot of the full state to the binary state file.
+     *
+     * Each PETSc processor writes its local slices of u and v at their global offsets with 
+     * collective MPI-IO, the first processor also writes the time stamp of the snapshot.
+     *
+     * @param time Current time value
+     * @param state Current state vector
+     * @param dim Dimension of u and v (N^2 for Lindblad, N for Schroedinger)
+     */
+    void writeStateBinary(double time, const Vec state, PetscInt dim);
+
+    /**
+     * @brief Returns the local part of a state in the blocked order [u_local, v_local] used by all output files.
+     *
+     * For the interleaved state layout, the local array is copied into @ref state_blocked.
+     *
+     * @param x Local array of the state vector
+     * @param localsize_u Number of complex elements stored on this processor
+     * @return const double* Local part of the state as [u_local, v_local]
+     */
+    const double* getBlockedState(const double* x, PetscInt localsize_u);
+
 };
@@ -35,6 +35,8 @@ class TimeStepper{
     Vec x; ///< Auxiliary vector for forward time stepping
     Vec xadj; ///< Auxiliary vector needed for adjoint (backward) time stepping
     Vec xprimal; ///< Auxiliary vector for backward time stepping
+    Vec x_full; ///< Full vectorized state for output and objectives, if the Hermitian-packed state is evolved
+    Vec xbar_full; ///< Full vectorized adjoint of the penalty integral, if the Hermitian-packed state is evolved (NULL until first use)
     std::vector<Vec> store_states; ///< Storage for primal states during forward evolution
     std::vector<Vec> dpdm_states; ///< Storage for states needed for second-order derivative penalty
     bool addLeakagePrevent; ///< Flag to include leakage prevention penalty term
@@ -44,6 +46,50 @@ class TimeStepper{
     PetscInt localsize_u; ///< Size of local sub vector u or v in state x=[u,v]
     PetscInt ilow; ///< First index of the local sub vector u,v
     PetscInt iupp; ///< Last index (+1) of the local sub vector u,v
+    int ntime_tabulated; ///< Number of time steps for which the control table has been set up (-1: none)
+    std::vector<Vec> hess_states; ///< Primal states at all time steps, stored by the tangent-linear forward solve
+    std::vector<Vec> hess_tangents; ///< Tangent states at all time steps, stored by the tangent-linear forward solve
+    Vec xdot; ///< Tangent state for Hessian-vector products (NULL until first use)
+    Vec xadj_dot; ///< Tangent of the adjoint state for Hessian-vector products (NULL until first use)
+    Vec xdot_full; ///< Full vectorized tangent state, if the Hermitian-packed state is evolved (NULL until first use)
+
+    /**
+     * @brief Allocates the storage for Hessian-vector products on first use, and extends it if the number of time steps has grown.
+     */
+    void initHessianStorage();
+
+    /**
+     * @brief Sets the evolved state from an initial condition, packing it if the Hermitian-packed state is used.
+     *
+     * @param initid Initial condition identifier
+     * @param rho_t0 Initial state vector
+     */
+    void setInitialState(int initid, Vec rho_t0);
+
+    /**
+     * @brief Adds the derivative of the guard-level occupation to the adjoint state. Linear in x.
+     *
+     * @param x Current state vector
+     * @param xbar Adjoint state vector to update
+     * @param penaltybar Adjoint of penalty term
+     */
+    void leakagePenalty_diff(const Vec x, Vec xbar, double penaltybar);
+
+    /**
+     * @brief Collects the times, other than tstart and tstop, at which one time step evaluates the controls.
+     *
+     * Base-class implementation is empty. Derived classes that evaluate the controls at intermediate stages add those.
+     *
+     * @param tstart Start time of the step
+     * @param tstop Stop time of the step
+     * @param times Vector to append the stage times to
+     */
+    virtual void addStageTimes(const double tstart, const double tstop, std::vector<double>& times);
+
+    /**
+     * @brief Sets up the control table for all grid and stage times of the current time grid.
+     */
+    void setControlTimes();
 
   public:
     MasterEq* mastereq; ///< Pointer to master equation solver
@@ -51,8 +97,10 @@ class TimeStepper{
     double total_time; ///< Final evolution time
     double dt; ///< Time step size
     bool writeTrajectoryDataFiles;  ///< Flag to determine whether or not trajectory data will be written to files during forward simulation */
+    bool useControlTable;  ///< Flag to tabulate the controls at all stage times once per control parameter update
 
     Vec redgrad; ///< Reduced gradient vector for optimization
+    Vec redhess; ///< Reduced Hessian-vector product (NULL until first use)
 
     double penalty_integral; ///< Sums the integral penalty term 
     double energy_penalty_integral; ///< Sums the energy penalty term
@@ -91,6 +139,26 @@ class TimeStepper{
      */
     Vec getState(size_t tindex);
 
+    /**
+     * @brief Returns the full vectorized state for an evolved state.
+     *
+     * For the Hermitian-packed state, x is unpacked into the auxiliary vector x_full, which is returned.
+     * Otherwise, x itself is returned.
+     *
+     * @param x Evolved state vector
+     * @return Vec Full vectorized state
+     */
+    Vec getFullState(const Vec x);
+
+    /**
+     * @brief Changes the number of time steps, keeping the final time fixed.
+     *
+     * Used for optimizing on coarser time grids. Storage of primal states is extended if needed.
+     *
+     * @param ntime_ New number of time steps
+     */
+    void setNTime(int ntime_);
+
     /**
      * @brief Solves the ODE forward in time.
      * 
@@ -116,6 +184,39 @@ class TimeStepper{
      */
     void solveAdjointODE(Vec rho_t0_bar, Vec finalstate, double Jbar_penalty, double Jbar_penalty_dpdm, double Jbar_penalty_energy);
 
+    /**
+     * @brief Solves the ODE and its tangent-linear equation forward in time.
+     *
+     * The tangent is the directional derivative of the state along the control direction set by 
+     * @ref MasterEq::setControlDirection, starting from zero. Primal and tangent states are stored 
+     * at all time steps for @ref solveSecondOrderAdjointODE.
+     *
+     * @param initid Initial condition identifier
+     * @param rho_t0 Initial state vector
+     * @return Vec Final state vector at time T
+     */
+    Vec solveTangentODE(int initid, Vec rho_t0);
+
+    /**
+     * @brief Returns the full vectorized tangent state at time T, after @ref solveTangentODE.
+     *
+     * @return Vec Final tangent state
+     */
+    Vec getFinalTangent();
+
+    /**
+     * @brief Solves the first- and second-order adjoint ODEs backward in time and accumulates the Hessian-vector product.
+     *
+     * Uses the trajectories stored by the last call to @ref solveTangentODE. The second-order adjoint is the 
+     * directional derivative of the adjoint state. The Hessian-vector product is accumulated in @ref redhess.
+     *
+     * @param rho_t0_bar Terminal condition for the adjoint state
+     * @param rho_t0_bar_dot Terminal condition for the second-order adjoint state
+     * @param Jbar_penalty Adjoint of penalty integral term
+     * @param Jbar_penalty_energy Adjoint of energy penalty term
+     */
+    void solveSecondOrderAdjointODE(Vec rho_t0_bar, Vec rho_t0_bar_dot, double Jbar_penalty, double Jbar_penalty_energy);
+
     /**
      * @brief Evaluates the penalty integral term.
      *
@@ -135,6 +236,17 @@ class TimeStepper{
      */
     void penaltyIntegral_diff(double time, const Vec x, Vec xbar, double Jbar);
 
+    /**
+     * @brief Directional derivative of @ref penaltyIntegral_diff along a tangent state.
+     *
+     * @param time Current time
+     * @param x Current state vector
+     * @param xdot Tangent state vector
+     * @param xbar_dot Second-order adjoint state vector to update
+     * @param Jbar Adjoint of penalty term
+     */
+    void penaltyIntegral_diff_tangent(double time, const Vec x, const Vec xdot, Vec xbar_dot, double Jbar);
+
     /**
      * @brief Evaluates second-order derivative penalty for the state.
      *
@@ -171,6 +283,15 @@ class TimeStepper{
      */
     void energyPenaltyIntegral_diff(double time, double Jbar, Vec redgrad);
 
+    /**
+     * @brief Adds the Hessian of the energy penalty integral applied to the control direction.
+     *
+     * @param time Current time
+     * @param Jbar Adjoint of energy penalty
+     * @param redhess Reduced Hessian-vector product to update
+     */
+    void energyPenaltyIntegral_hessvec(double time, double Jbar, Vec redhess);
+
     /**
      * @brief Evolves state forward by one time-step from tstart to tstop.
      *
@@ -195,6 +316,33 @@ class TimeStepper{
      * @param compute_gradient Flag to compute gradient
      */
     virtual void evolveBWD(const double tstart, const double tstop, const Vec x_stop, Vec x_adj, Vec grad, bool compute_gradient);
+
+    /**
+     * @brief Evolves the state and its tangent forward by one time-step.
+     *
+     * Base-class implementation errors out. Derived classes that support Hessian-vector products implement this.
+     *
+     * @param tstart Start time
+     * @param tstop Stop time
+     * @param x State vector to evolve
+     * @param xdot Tangent state vector to evolve
+     */
+    virtual void evolveFWD_tangent(const double tstart, const double tstop, Vec x, Vec xdot);
+
+    /**
+     * @brief Evolves the adjoint and second-order adjoint states backward by one time-step and updates the Hessian-vector product.
+     *
+     * Base-class implementation errors out. Derived classes that support Hessian-vector products implement this.
+     *
+     * @param tstart Start time (backward evolution)
+     * @param tstop Stop time (backward evolution)
+     * @param x_stop State at stop time
+     * @param xdot_stop Tangent state at stop time
+     * @param x_adj Adjoint state vector
+     * @param x_adj_dot Second-order adjoint state vector
+     * @param hessvec Hessian-vector product to update
+     */
+    virtual void evolveBWD_secondorder(const double tstart, const double tstop, const Vec x_stop, const Vec xdot_stop, Vec x_adj, Vec x_adj_dot, Vec hessvec);
 };
 
 /**
@@ -259,9 +407,9 @@ class ImplMidpoint : public TimeStepper {
   protected:
   Vec stage, stage_adj; ///< Intermediate stage vectors for forward and adjoint
   Vec rhs, rhs_adj; ///< Right-hand side vectors for forward and adjoint
-  KSP ksp; ///< PETSc's linear solver context for GMRES
+  KSP ksp; ///< PETSc's linear solver context for GMRES or the dense LU solver
   PC  preconditioner; ///< Preconditioner for linear solver
-  LinearSolverType linsolve_type; ///< Linear solver type (GMRES or NEUMANN)
+  LinearSolverType linsolve_type; ///< Linear solver type (GMRES, NEUMANN, or DENSELU for the dense small-system path)
   int linsolve_maxiter; ///< Maximum number of linear solver iterations
   double linsolve_abstol; ///< Absolute tolerance for linear solver
   double linsolve_reltol; ///< Relative tolerance for linear solver
@@ -269,6 +417,44 @@ class ImplMidpoint : public TimeStepper {
   double linsolve_error_avg; ///< Average error of linear solver
   int linsolve_counter; ///< Counter for linear solve calls
   Vec tmp, err; ///< Auxiliary vectors for Neumann iterations
+  Mat Mdense; ///< Dense matrix I - dt/2 A for the dense LU solver
+  double denselu_dt; ///< Time step size of the current dense LU factorization (0: none)
+  std::vector<double> denselu_coeffs; ///< Coefficients of the dense system matrix of the current dense LU factorization
+  Vec stage_dot, stage_adj_dot; ///< Tangents of the stage vectors for Hessian-vector products (NULL until first use)
+
+  /**
+   * @brief Solves (I - dt/2 A) y = b, or its transpose, with the configured linear solver.
+   *
+   * The RHS matrix is restored afterwards.
+   *
+   * @param A RHS system matrix
+   * @param dt Time step size
+   * @param b Right-hand side vector
+   * @param y Solution vector
+   * @param transpose Flag to solve the transposed system
+   */
+  void solveStage(Mat A, double dt, Vec b, Vec y, bool transpose);
+
+  /**
+   * @brief Sets up I - dt/2 A for the dense LU solver.
+   *
+   * The LU factorization costs O(n^3) and is only redone if A or dt changed since the last one. A is
+   * identified by its coefficients (see @ref MasterEq::getDenseCoeffs), so the solves of one time step
+   * (adjoint and gradient stage, tangent and second-order adjoint stages) share one factorization.
+   *
+   * @param A Dense RHS system matrix
+   * @param dt Time step size
+   */
+  void setupDenseLU(Mat A, double dt);
+
+  /**
+   * @brief Adds the midpoint of the step, at which the implicit midpoint rule evaluates the controls.
+   *
+   * @param tstart Start time of the step
+   * @param tstop Stop time of the step
+   * @param times Vector to append the stage times to
+   */
+  virtual void addStageTimes(const double tstart, const double tstop, std::vector<double>& times);
 
   public:
     /**
@@ -307,6 +493,36 @@ class ImplMidpoint : public TimeStepper {
      */
     virtual void evolveBWD(const double tstart, const double tstop, const Vec x_stop, Vec x_adj, Vec grad, bool compute_gradient);
 
+    /**
+     * @brief Evolves the state and its tangent forward using implicit midpoint rule.
+     *
+     * The tangent stage solves (I - dt/2 A) k' = A xdot + B x_mid, where B is the derivative of A 
+     * along the control direction and x_mid = x + dt/2 k.
+     *
+     * @param tstart Start time
+     * @param tstop Stop time
+     * @param x State vector to evolve
+     * @param xdot Tangent state vector to evolve
+     */
+    virtual void evolveFWD_tangent(const double tstart, const double tstop, Vec x, Vec xdot);
+
+    /**
+     * @brief Evolves the adjoint and second-order adjoint backward using implicit midpoint rule and adds to the Hessian-vector product.
+     *
+     * With the adjoint stage s = dt (I - dt/2 A)^{-T} x_adj, its tangent solves 
+     * (I - dt/2 A)^T s' = dt x_adj_dot + dt/2 B^T s. Then x_adj_dot += A^T s' + B^T s, x_adj += A^T s, and 
+     * the Hessian-vector product gains the gradient contributions of (xdot_mid, s) and (x_mid, s').
+     *
+     * @param tstart Start time (backward evolution)
+     * @param tstop Stop time (backward evolution)
+     * @param x_stop State at stop time
+     * @param xdot_stop Tangent state at stop time
+     * @param x_adj Adjoint state vector
+     * @param x_adj_dot Second-order adjoint state vector
+     * @param hessvec Hessian-vector product to update
+     */
+    virtual void evolveBWD_secondorder(const double tstart, const double tstop, const Vec x_stop, const Vec xdot_stop, Vec x_adj, Vec x_adj_dot, Vec hessvec);
+
     /**
      * @brief Solves (I - alpha*A) * x = b using Neumann iterations.
      *
@@ -332,9 +548,20 @@ class CompositionalImplMidpoint : public ImplMidpoint {
 
   std::vector<double> gamma; ///< Coefficients for compositional step sizes
   std::vector<Vec> x_stage; ///< Storage for primal states at intermediate stages
+  std::vector<Vec> xdot_stage; ///< Storage for tangent states at intermediate stages, allocated on first use
   Vec aux; ///< Auxiliary vector
+  Vec auxdot; ///< Auxiliary tangent vector, allocated with xdot_stage
   int order; ///< Order of the compositional method
 
+  /**
+   * @brief Adds the midpoints of all compositional stages of the step.
+   *
+   * @param tstart Start time of the step
+   * @param tstop Stop time of the step
+   * @param times Vector to append the stage times to
+   */
+  void addStageTimes(const double tstart, const double tstop, std::vector<double>& times);
+
   public:
     /**
      * @brief Constructor for compositional implicit midpoint scheme.
@@ -372,4 +599,27 @@ class CompositionalImplMidpoint : public ImplMidpoint {
      * @param compute_gradient Flag to compute gradient
      */
     void evolveBWD(const double tstart, const double tstop, const Vec x_stop, Vec x_adj, Vec grad, bool compute_gradient);
+
+    /**
+     * @brief Evolves the state and its tangent forward using compositional implicit midpoint rule.
+     *
+     * @param tstart Start time
+     * @param tstop Stop time
+     * @param x State vector to evolve
+     * @param xdot Tangent state vector to evolve
+     */
+    void evolveFWD_tangent(const double tstart, const double tstop, Vec x, Vec xdot);
+
+    /**
+     * @brief Evolves the adjoint and second-order adjoint backward using compositional implicit midpoint rule.
+     *
+     * @param tstart Start time (backward evolution)
+     * @param tstop Stop time (backward evolution)
+     * @param x_stop State at stop time
+     * @param xdot_stop Tangent state at stop time
+     * @param x_adj Adjoint state vector
+     * @param x_adj_dot Second-order adjoint state vector
+     * @param hessvec Hessian-vector product to update
+     */
+    void evolveBWD_secondorder(const double tstart, const double tstop, const Vec x_stop, const Vec xdot_stop, Vec x_adj, Vec x_adj_dot, Vec hessvec);
 };
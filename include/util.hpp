@@ -1,6 +1,7 @@
 #include <petscmat.h>
 #include <iostream>
 #include <vector>
+#include "defs.hpp"
 #ifdef WITH_SLEPC
 #include <slepceps.h>
 #endif
@@ -61,6 +62,101 @@ double getRampFactor_diff(const double time, const double tstart, const double t
  */
 PetscInt getVecID(const PetscInt row, const PetscInt col, const PetscInt dim);
 
+/**
+ * @brief Sets the storage layout of the state vector. Called once at startup, before any state is created.
+ *
+ * @param layout Blocked [u,v] or interleaved (re, im) layout
+ */
+void setStateLayout(const StateLayout layout);
+
+/**
+ * @brief Returns the storage layout of the state vector.
+ */
+StateLayout getStateLayout();
+
+/**
+ * @brief Returns the strides for accessing element k in the local array of a state vector.
+ *
+ * The real part of element k is stored at xptr[k*stride], its imaginary part at xptr[k*stride + offset_im].
+ *
+ * @param localsize_u Number of complex elements stored on this processor
+ * @param stride Distance between consecutive elements: 1 if blocked, 2 if interleaved
+ * @param offset_im Offset of the imaginary part: localsize_u if blocked, 1 if interleaved
+ */
+void getStateStrides(const PetscInt localsize_u, PetscInt* stride, PetscInt* offset_im);
+
+/**
+ * @brief Returns the global index in x of the real part of element i of the complex state.
+ *
+ * @param i Global index of the complex element
+ * @param localsize_u Number of complex elements stored on each processor
+ * @return PetscInt Global index of Re(x_i)
+ */
+PetscInt getIndexReal(const PetscInt i, const PetscInt localsize_u);
+
+/**
+ * @brief Returns the global index in x of the imaginary part of element i of the complex state.
+ *
+ * @param i Global index of the complex element
+ * @param localsize_u Number of complex elements stored on each processor
+ * @return PetscInt Global index of Im(x_i)
+ */
+PetscInt getIndexImag(const PetscInt i, const PetscInt localsize_u);
+
+/**
+ * @brief Returns the index of Re(rho_{row,col}), row <= col, in a Hermitian-packed density matrix.
+ *
+ * The packed state stores the upper triangle of the N x N density matrix column by column. Column c
+ * starts at c^2 and holds Re(rho_{0,c}), ..., Re(rho_{c,c}) followed by Im(rho_{0,c}), ..., Im(rho_{c-1,c}).
+ * The imaginary part of the diagonal is zero and not stored, so the packed state has N^2 real entries.
+ *
+ * @param row Matrix row index
+ * @param col Matrix column index, col >= row
+ * @return PetscInt Index of Re(rho_{row,col}) in the packed state
+ */
+PetscInt getPackedIndexReal(const PetscInt row, const PetscInt col);
+
+/**
+ * @brief Returns the index of Im(rho_{row,col}), row < col, in a Hermitian-packed density matrix.
+ *
+ * @param row Matrix row index
+ * @param col Matrix column index, col > row
+ * @return PetscInt Index of Im(rho_{row,col}) in the packed state
+ */
+PetscInt getPackedIndexImag(const PetscInt row, const PetscInt col);
+
+/**
+ * @brief Packs the upper triangle of a Hermitian vectorized density matrix, see @ref getPackedIndexReal. Serial only.
+ *
+ * @param x Full vectorized state (size 2N^2)
+ * @param xp Packed state (size N^2), output
+ */
+void packHermitianState(const Vec x, Vec xp);
+
+/**
+ * @brief Expands a packed state into the full vectorized Hermitian density matrix. Serial only.
+ *
+ * @param xp Packed state (size N^2)
+ * @param x Full vectorized state (size 2N^2), output
+ */
+void unpackHermitianState(const Vec xp, Vec x);
+
+/**
+ * @brief Transpose of @ref packHermitianState: Sets the upper triangle of x_bar from the packed xp_bar, and zeros elsewhere.
+ *
+ * @param xp_bar Packed adjoint state (size N^2)
+ * @param x_bar Full adjoint state (size 2N^2), output
+ */
+void packHermitianState_diff(const Vec xp_bar, Vec x_bar);
+
+/**
+ * @brief Transpose of @ref unpackHermitianState: Adds the contributions of both triangles of x_bar to the packed xp_bar.
+ *
+ * @param x_bar Full adjoint state (size 2N^2)
+ * @param xp_bar Packed adjoint state (size N^2), updated
+ */
+void unpackHermitianState_diff(const Vec x_bar, Vec xp_bar);
+
 /**
  * @brief Maps index from essential level system to full-dimension system.
  *
@@ -109,6 +205,8 @@ int isGuardLevel(const int i, const std::vector<int> &nlevels, const std::vector
  *
  * Computes the Kronecker product of an identity matrix with matrix A.
  * Output matrix must be pre-allocated with sufficient non-zeros A * dimI.
+ * Each processor only sets its locally owned rows of Out. A must be available
+ * on each processor (sequential matrix).
  *
  * @param[in] A Input matrix
  * @param[in] dimI Dimension of identity matrix
@@ -124,6 +222,8 @@ PetscErrorCode Ikron(const Mat A, const int dimI, const double alpha, Mat *Out,
  *
  * Computes the Kronecker product of matrix A with an identity matrix.
  * Output matrix must be pre-allocated with sufficient non-zeros A * dimI.
+ * Each processor only sets its locally owned rows of Out. A must be available
+ * on each processor (sequential matrix).
  *
  * @param[in] A Input matrix
  * @param[in] dimI Dimension of identity matrix
@@ -138,8 +238,9 @@ PetscErrorCode kronI(const Mat A, const int dimI, const double alpha, Mat *Out,
  * @brief Computes general Kronecker product \f$A \otimes B\f$.
  *
  * Computes the Kronecker product of two arbitrary matrices A and B.
- * Works in PETSc serial mode only. Output matrix must be pre-allocated
- * and should be assembled afterwards.
+ * Each processor only sets its locally owned rows of Out, one row at a time.
+ * A and B must be available on each processor (sequential matrices). Output
+ * matrix must be pre-allocated and should be assembled afterwards.
  *
  * @param A First input matrix
  * @param B Second input matrix
@@ -150,6 +251,83 @@ PetscErrorCode kronI(const Mat A, const int dimI, const double alpha, Mat *Out,
  */
 PetscErrorCode AkronB(const Mat A, const Mat B, const double alpha, Mat *Out, InsertMode insert_mode);
 
+/**
+ * @brief Collects the locally owned entries of a parallel sparse matrix and creates it with exact preallocation.
+ *
+ * Entries are added for the locally owned rows [ilow, iupp) only, duplicates are summed up.
+ * @ref createMat builds the local CSR arrays and passes them to PETSc in one call, such that
+ * neither mallocs nor off-processor communication happen during assembly.
+ */
+class SparseEntries {
+  protected:
+    PetscInt ilow; ///< First locally owned row
+    PetscInt iupp; ///< Last locally owned row (+1)
+    std::vector<PetscInt> rows; ///< Row index of each entry
+    std::vector<PetscInt> cols; ///< Global column index of each entry
+    std::vector<double> vals; ///< Value of each entry
+
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param ilow First locally owned row
+     * @param iupp Last locally owned row (+1)
+     */
+    SparseEntries(PetscInt ilow, PetscInt iupp);
+
+    /**
+     * @brief Checks if a row is owned by this processor.
+     *
+     * @param row Global row index
+     * @return true if ilow <= row < iupp
+     */
+    bool isLocal(PetscInt row) const { return ilow <= row && row < iupp; }
+
+    /**
+     * @brief Returns the first locally owned row.
+     */
+    PetscInt getILow() const { return ilow; }
+
+    /**
+     * @brief Returns the last locally owned row (+1).
+     */
+    PetscInt getIUpp() const { return iupp; }
+
+    /**
+     * @brief Adds a value to an entry of a locally owned row.
+     *
+     * @param row Global row index, must be locally owned
+     * @param col Global column index
+     * @param val Value to add
+     */
+    void add(PetscInt row, PetscInt col, double val) {
+      rows.push_back(row);
+      cols.push_back(col);
+      vals.push_back(val);
+    }
+
+    /**
+     * @brief Sorts the collected entries into CSR arrays of the local rows, summing up duplicates.
+     *
+     * The collected entries are released afterwards.
+     *
+     * @param[out] csr_i Row pointers (local rows)
+     * @param[out] csr_j Global column indices, sorted within each row
+     * @param[out] csr_v Values
+     */
+    void getCSR(std::vector<PetscInt>& csr_i, std::vector<PetscInt>& csr_j, std::vector<double>& csr_v);
+
+    /**
+     * @brief Creates and assembles the square MPIAIJ matrix from the collected entries.
+     *
+     * The collected entries are released afterwards.
+     *
+     * @param globalsize Global number of rows and columns
+     * @param[out] A Matrix to create
+     */
+    void createMat(PetscInt globalsize, Mat* A);
+};
+
 /**
  * @brief Tests if matrix A is anti-symmetric (A^T = -A).
  *
@@ -80,6 +80,7 @@ class Quandary:
     rand_seed            # Set a fixed random number generator seed. Default: None (non-reproducable)
     print_frequency_iter # Output frequency for optimization iterations. (Print every <x> iterations). Default: 1
     usematfree           # Switch to use matrix-free (rather than sparse-matrix) solver. Default: True
+    hamiltonian_binary   # Switch to write user-defined Hamiltonians in the binary sparse format instead of text. Default: False
     verbose              # Switch to turn on more screen output for debugging. Default: False
 
     Internal variables. 
@@ -156,6 +157,7 @@ class Quandary:
     rand_seed              : int  = None
     print_frequency_iter   : int  = 1
     usematfree             : bool = True 
+    hamiltonian_binary     : bool = False
     verbose                : bool = False
     # Internal configuration. Should not be changed by user.
     _ninit                : int         = -1
@@ -560,26 +562,35 @@ class Quandary:
         # If not standard Hamiltonian model, write provided Hamiltonians to a file
         if not self.standardmodel:
             # Write non-standard Hamiltonians to file  
-            # Write system Hamiltonian (complex)
-            self._hamiltonian_filename_Hsys= "hamiltonian_Hsys.dat"
-            H = self.Hsys
-            with open(os.path.join(datadir, self._hamiltonian_filename_Hsys), "w", newline='\n') as f:
-                f.write("# row col Hsys_real Hsys_imag \n")
-                nz = np.nonzero(H)
-                for i, j in zip(*nz):
-                    v = H[i, j]
-                    f.write(f"{i} {j} {v.real:.13e} {v.imag:.13e}\n")
-            # Write control Hamiltonians, if given
-            if len(self.Hc_re)>0 or len(self.Hc_im)>0:
-                self._hamiltonian_filename_Hc = "hamiltonian_Hc.dat"
-                with open(os.path.join(datadir, self._hamiltonian_filename_Hc), "w", newline='\n') as f:
-                    for iosc, (Hc_re, Hc_im) in enumerate(zip(self.Hc_re, self.Hc_im)):
-                        Hc = np.array(Hc_re) + 1j * np.array(Hc_im)
-                        nz = np.nonzero(Hc)
-                        f.write(f"# oscillator row col Hc_real Hc_imag \n")
-                        for i, j in zip(*nz):
-                            v = Hc[i, j]
-                            f.write(f"{iosc} {i} {j} {v.real:.13e} {v.imag:.13e}\n")
+            if self.hamiltonian_binary:
+                # Binary sparse format, read in parallel by Quandary
+                self._hamiltonian_filename_Hsys= "hamiltonian_Hsys.bin"
+                write_hamiltonian_binary(os.path.join(datadir, self._hamiltonian_filename_Hsys), [self.Hsys])
+                if len(self.Hc_re)>0 or len(self.Hc_im)>0:
+                    self._hamiltonian_filename_Hc = "hamiltonian_Hc.bin"
+                    Hc = [(Hc_re if hasattr(Hc_re, "tocoo") else np.array(Hc_re)) + 1j * (Hc_im if hasattr(Hc_im, "tocoo") else np.array(Hc_im)) for Hc_re, Hc_im in zip(self.Hc_re, self.Hc_im)]
+                    write_hamiltonian_binary(os.path.join(datadir, self._hamiltonian_filename_Hc), Hc)
+            else:
+                # Write system Hamiltonian (complex)
+                self._hamiltonian_filename_Hsys= "hamiltonian_Hsys.dat"
+                H = self.Hsys
+                with open(os.path.join(datadir, self._hamiltonian_filename_Hsys), "w", newline='\n') as f:
+                    f.write("# row col Hsys_real Hsys_imag \n")
+                    nz = np.nonzero(H)
+                    for i, j in zip(*nz):
+                        v = H[i, j]
+                        f.write(f"{i} {j} {v.real:.13e} {v.imag:.13e}\n")
+                # Write control Hamiltonians, if given
+                if len(self.Hc_re)>0 or len(self.Hc_im)>0:
+                    self._hamiltonian_filename_Hc = "hamiltonian_Hc.dat"
+                    with open(os.path.join(datadir, self._hamiltonian_filename_Hc), "w", newline='\n') as f:
+                        for iosc, (Hc_re, Hc_im) in enumerate(zip(self.Hc_re, self.Hc_im)):
+                            Hc = np.array(Hc_re) + 1j * np.array(Hc_im)
+                            nz = np.nonzero(Hc)
+                            f.write(f"# oscillator row col Hc_real Hc_imag \n")
+                            for i, j in zip(*nz):
+                                v = Hc[i, j]
+                                f.write(f"{iosc} {i} {j} {v.real:.13e} {v.imag:.13e}\n")
             if self.verbose:
                 print("Hamiltonian operators written to ", os.path.join(datadir, self._hamiltonian_filename_Hsys), os.path.join(datadir, self._hamiltonian_filename_Hc))
 
@@ -1045,6 +1056,166 @@ def map_to_oscillators(id, Ne, Ng):
 
     return localIDs 
 
+def _coo_to_csr(N, rows, cols, vals):
+    """Sort COO entries by (row, col), sum duplicates and drop zeros. Returns the CSR arrays (rowptr, cols, vals)."""
+    rows, cols, vals = np.asarray(rows, dtype=np.int64), np.asarray(cols, dtype=np.int64), np.asarray(vals, dtype=complex)
+    order = np.lexsort((cols, rows))
+    rows, cols, vals = rows[order], cols[order], vals[order]
+    if len(rows) > 0:
+        start = np.flatnonzero(np.concatenate(([True], (rows[1:] != rows[:-1]) | (cols[1:] != cols[:-1]))))
+        vals = np.add.reduceat(vals, start)
+        rows, cols = rows[start], cols[start]
+        keep = vals != 0
+        rows, cols, vals = rows[keep], cols[keep], vals[keep]
+    rowptr = np.concatenate(([0], np.cumsum(np.bincount(rows, minlength=N))))
+    return rowptr, cols, vals
+
+def _write_hamiltonian_csr(filename, N, operators):
+    """Write a list of CSR operators (rowptr, cols, vals) in Quandary's binary sparse format"""
+    nnz = sum(len(cols) for _, cols, _ in operators)
+    # Header after the magic: version, dimension, number of operators, number of nonzeros, reserved
+    header = np.array([1, N, len(operators), nnz, 0], dtype=np.int64)
+    with open(filename, "wb") as f:
+        f.write(b"QUANDHAM")
+        header.tofile(f)
+        offset = 0
+        for rowptr, _, _ in operators:
+            (offset + rowptr).astype(np.int64).tofile(f)
+            offset += rowptr[-1]
+        for _, cols, _ in operators:
+            cols.astype(np.int64).tofile(f)
+        for _, _, vals in operators:
+            vals.real.astype(np.float64).tofile(f)
+        for _, _, vals in operators:
+            vals.imag.astype(np.float64).tofile(f)
+
+def write_hamiltonian_binary(filename, operators):
+    """Write Hamiltonian operators in Quandary's binary sparse (CSR) format
+
+    Parameters:
+    ----------
+    filename  : Name of the binary file, e.g. <datadir>/hamiltonian_Hsys.bin
+    operators : List of complex (N x N) operators, either dense arrays or scipy.sparse matrices. One operator for the system Hamiltonian, or one per oscillator for the control Hamiltonians. Sparse operators are never densified.
+    """
+    N = operators[0].shape[0] if hasattr(operators[0], "shape") else len(operators[0])
+    csr = []
+    for H in operators:
+        if hasattr(H, "tocoo"):
+            H = H.tocoo()
+            csr.append(_coo_to_csr(N, H.row, H.col, H.data))
+        else:
+            H = np.asarray(H, dtype=complex)
+            rows, cols = np.nonzero(H)
+            csr.append(_coo_to_csr(N, rows, cols, H[rows, cols]))
+    _write_hamiltonian_csr(filename, N, csr)
+
+def convert_hamiltonian_to_binary(textfile, binfile, N):
+    """Convert a text Hamiltonian file (hamiltonian_file_Hsys or hamiltonian_file_Hc) into the binary sparse format
+
+    The nonzero entries are converted directly into CSR, so memory scales with the number of nonzeros, not with N^2.
+
+    Parameters:
+    ----------
+    textfile : Text file with lines "row col real imag" (system Hamiltonian) or "oscillator row col real imag" (control Hamiltonians)
+    binfile  : Name of the binary output file
+    N        : Dimension of the Hamiltonians (total number of levels)
+    """
+    data = np.loadtxt(textfile, comments="#", ndmin=2)
+    if data.shape[0] == 0:
+        data = np.zeros((0, 5))
+    if data.shape[1] == 4:
+        data = np.hstack((np.zeros((data.shape[0], 1)), data))
+    osc, rows, cols = data[:, 0].astype(np.int64), data[:, 1].astype(np.int64), data[:, 2].astype(np.int64)
+    vals = data[:, 3] + 1j*data[:, 4]
+    if np.any(rows < 0) or np.any(rows >= N) or np.any(cols < 0) or np.any(cols >= N):
+        raise ValueError(f"Entry out of range for dimension N={N} in {textfile}")
+    nops = int(osc.max()) + 1 if len(osc) > 0 else 1
+    csr = [_coo_to_csr(N, rows[osc == k], cols[osc == k], vals[osc == k]) for k in range(nops)]
+    _write_hamiltonian_csr(binfile, N, csr)
+
+def write_hamiltonian_kronecker(filename, terms, control=False):
+    """Write a Hamiltonian as a sum of Kronecker products of per-oscillator matrices (factored format)
+
+    Factored Hamiltonian files can be applied by the matrix-free solver, without ever forming the full matrices.
+
+    Parameters:
+    ----------
+    filename : Name of the file, e.g. <datadir>/hamiltonian_Hsys.dat
+    terms    : List of product terms. System Hamiltonian: tuples (coeff, factors). Control Hamiltonians: tuples (oscillator, "re"|"im", coeff, factors), where "re" terms are multiplied by p(t) and "im" terms by i*q(t). The factors are a dictionary {oscillator: complex (n_k x n_k) array}. Oscillators that are not listed carry the identity.
+    control  : Flag: terms are control Hamiltonians
+    """
+    with open(filename, "w") as f:
+        f.write("# kronecker\n")
+        for term in terms:
+            if control:
+                osc, part, coeff, factors = term
+                f.write("term {:d} {} {:1.14e} {:1.14e}\n".format(osc, part, np.real(coeff), np.imag(coeff)))
+            else:
+                coeff, factors = term
+                f.write("term {:1.14e} {:1.14e}\n".format(np.real(coeff), np.imag(coeff)))
+            for iosc, F in factors.items():
+                F = np.asarray(F, dtype=complex)
+                for row, col in zip(*np.nonzero(F)):
+                    f.write("{:d} {:d} {:d} {:1.14e} {:1.14e}\n".format(iosc, row, col, F[row, col].real, F[row, col].imag))
+
+def read_state_binary(filename):
+    """Read a binary full state file written with output_fullstate_format = binary or binary32
+
+    Parameters:
+    ----------
+    filename : Path to the binary state file <prefix>.iinit<m>.bin
+
+    Returns:
+    -------
+    time    : Array of time points (nsnapshots,)
+    state   : Complex array (nsnapshots, dim) holding the vectorized density matrix (Lindblad) or state vector (Schroedinger)
+    nlevels : List of number of levels per oscillator
+    """
+    with open(filename, "rb") as f:
+        head = np.fromfile(f, dtype=np.int64, count=6)
+        if head[0].tobytes() != b"QUANDARY":
+            raise ValueError(f"Not a Quandary binary state file: {filename}")
+        precision, dim, nosc = int(head[2]), int(head[4]), int(head[5])
+        nlevels = [int(n) for n in np.fromfile(f, dtype=np.int64, count=nosc)]
+        nsnapshots = int(np.fromfile(f, dtype=np.int64, count=1)[0])
+        valtype = np.float64 if precision == 8 else np.float32
+        record = np.dtype([("time", np.float64), ("u", valtype, (dim,)), ("v", valtype, (dim,))])
+        data = np.fromfile(f, dtype=record, count=nsnapshots)
+
+    return data["time"], data["u"] + 1j*data["v"], nlevels
+
+def read_trajectory_container(filename):
+    """Memory-map the trajectory container written with output_trajectory_format = container
+
+    Parameters:
+    ----------
+    filename : Path to the container file <datadir>/trajectories.bin
+
+    Returns:
+    -------
+    data : Dictionary holding the numpy arrays (memory-mapped, not copied): 'time' (ninit, nsnap), 
+           one array (ninit, nsnap, width) for each written dataset, e.g. 'expected0', 'population1', 
+           'population_composite', 'fullstate_Re', 'fullstate_Im', and 'initid' (ninit,) holding the 
+           ID of the initial condition of each block.
+    """
+    head = np.fromfile(filename, dtype=np.int64, count=8)
+    if head[0].tobytes() != b"QUANDTRJ":
+        raise ValueError(f"Not a Quandary trajectory container: {filename}")
+    ninit, nsnap, ncols, ndatasets, data_offset, block_stride = [int(h) for h in head[2:8]]
+    index = np.fromfile(filename, dtype=np.int64, count=8 + 6*ndatasets + ninit)
+
+    mm = np.memmap(filename, dtype=np.float64, mode="r")
+    blocks = np.ndarray(shape=(ninit, nsnap, ncols), dtype=np.float64, buffer=mm, offset=data_offset, strides=(block_stride, 8*ncols, 8))
+
+    data = {"time": blocks[:, :, 0], "initid": index[8 + 6*ndatasets:]}
+    for k in range(ndatasets):
+        entry = index[8 + 6*k : 8 + 6*(k+1)]
+        name = entry[:4].tobytes().rstrip(b"\0").decode()
+        col, width = int(entry[4]), int(entry[5])
+        data[name] = blocks[:, :, col:col+width]
+
+    return data
+
 def resolve_datadir(datadir: str) -> str:
     """Helper function to resolve the output directory using environment variable
 
@@ -45,15 +45,29 @@ void BSpline2nd::enforceBoundary(double* x, int carrier_id){
     }
 }
 
+void BSpline2nd::activeSplines(const double t, int* lmin, int* lmax){
+
+    // Figure out which basis functions are active at this time point
+    int k = floor((t - tstart) / dtknot);
+    *lmin = std::max(k, 0);
+    *lmax = std::min(k + 2, nsplines - 1);
+
+    // skip first and last two splines (set to zero) so that spline starts and ends at zero 
+    if (enforceZeroBoundary) {
+        *lmin = std::max(*lmin, 2);
+        *lmax = std::min(*lmax, nsplines - 3);
+    }
+}
+
 void BSpline2nd::evaluate(const double t, const std::vector<double>& coeff, int carrier_freq_id, double* Bl1_ptr, double* Bl2_ptr){
 
+    int lmin, lmax;
+    activeSplines(t, &lmin, &lmax);
+
     double sum1 = 0.0;
     double sum2 = 0.0;
-    /* Sum over basis function */
-    for (int l=0; l<nsplines; l++) {
-        if (enforceZeroBoundary) {
-            if (l<=1 || l >= nsplines- 2) continue; // skip first and last two splines (set to zero) so that spline starts and ends at zero 
-        }
+    /* Sum over active basis function */
+    for (int l=lmin; l<=lmax; l++) {
         double Blt = basisfunction(l,t);
         double alpha1 = coeff[skip + carrier_freq_id*nsplines*2 + l];
         double alpha2 = coeff[skip + carrier_freq_id*nsplines*2 + l + nsplines];
@@ -65,13 +79,32 @@ void BSpline2nd::evaluate(const double t, const std::vector<double>& coeff, int
 
 }
 
+void BSpline2nd::evaluateBatch(const int ntimes, const double* t, const std::vector<double>& coeff, int carrier_freq_id, double* Blt1, double* Blt2){
+    const double* alpha1 = coeff.data() + skip + carrier_freq_id*nsplines*2;
+    const double* alpha2 = alpha1 + nsplines;
+
+    for (int i=0; i<ntimes; i++) {
+        int lmin, lmax;
+        activeSplines(t[i], &lmin, &lmax);
+        double sum1 = 0.0;
+        double sum2 = 0.0;
+        for (int l=lmin; l<=lmax; l++) {
+            double Blt = basisfunction(l,t[i]);
+            sum1 += alpha1[l] * Blt;
+            sum2 += alpha2[l] * Blt;
+        }
+        Blt1[i] = sum1;
+        Blt2[i] = sum2;
+    }
+}
+
 void BSpline2nd::derivative(const double t, const std::vector<double>& /*coeff*/, double* coeff_diff, const double valbar1, const double valbar2, int carrier_freq_id) {
 
-    /* Iterate over basis function */
-    for (int l=0; l<nsplines; l++) {
-        if (enforceZeroBoundary){
-            if (l<=1 || l >= nsplines- 2) continue; // skip first and last two splines (set to zero) so that spline starts and ends at zero       
-        }
+    int lmin, lmax;
+    activeSplines(t, &lmin, &lmax);
+
+    /* Iterate over active basis function */
+    for (int l=lmin; l<=lmax; l++) {
         double Blt = basisfunction(l, t); 
         coeff_diff[skip + carrier_freq_id*nsplines*2 + l]            += Blt * valbar1;
         coeff_diff[skip + carrier_freq_id*nsplines*2 + l + nsplines] += Blt * valbar2;
@@ -125,14 +158,28 @@ void BSpline2ndAmplitude::enforceBoundary(double* x, int carrier_id){
     }
 }
 
+void BSpline2ndAmplitude::activeSplines(const double t, int* lmin, int* lmax){
+
+    // Figure out which basis functions are active at this time point
+    int k = floor((t - tstart) / dtknot);
+    *lmin = std::max(k, 0);
+    *lmax = std::min(k + 2, nsplines - 1);
+
+    // skip first and last two splines (set to zero) so that spline starts and ends at zero 
+    if (enforceZeroBoundary) {
+        *lmin = std::max(*lmin, 2);
+        *lmax = std::min(*lmax, nsplines - 3);
+    }
+}
+
 void BSpline2ndAmplitude::evaluate(const double t, const std::vector<double>& coeff, int carrier_freq_id, double* Bl1_ptr, double* Bl2_ptr){
 
-    /* Sum over basis function for amplitudes */
+    int lmin, lmax;
+    activeSplines(t, &lmin, &lmax);
+
+    /* Sum over active basis function for amplitudes */
     double ampsum = 0.0;
-    for (int l=0; l<nsplines; l++) {
-        if (enforceZeroBoundary){
-            if (l<=1 || l >= nsplines- 2) continue; // skip first and last two splines (set to zero) so that spline starts and ends at zero       
-        }
+    for (int l=lmin; l<=lmax; l++) {
         double Blt = basisfunction(l,t);
         double alpha1 = coeff[skip + carrier_freq_id*(nsplines+1) + l];
         ampsum += alpha1 * Blt;
@@ -147,12 +194,12 @@ void BSpline2ndAmplitude::derivative(const double t, const std::vector<double>&
     double cos_omt = cos(valbar1*t + scaling * coeff[skip + carrier_freq_id*(nsplines+1) + nsplines]);
     double sin_omt = sin(valbar1*t + scaling * coeff[skip + carrier_freq_id*(nsplines+1) + nsplines]);
 
-    /* Iterate over basis function */
+    int lmin, lmax;
+    activeSplines(t, &lmin, &lmax);
+
+    /* Iterate over active basis function */
     double ampsum = 0.0;
-    for (int l=0; l<nsplines; l++) {
-        if (enforceZeroBoundary){
-            if (l<=1 || l >= nsplines- 2) continue; // skip first and last two splines (set to zero) so that spline starts and ends at zero       
-        }
+    for (int l=lmin; l<=lmax; l++) {
         double Blt = basisfunction(l, t); 
         double alpha1 = coeff[skip + carrier_freq_id*(nsplines+1) + l];
         ampsum += alpha1 * Blt;
@@ -4,6 +4,8 @@ Gate::Gate(){
   dim_ess = 0;
   dim_rho = 0;
   quietmode=false;
+  scat = NULL;
+  xall = NULL;
 }
 
 Gate::Gate(const std::vector<int>& nlevels_, const std::vector<int>& nessential_, double time_, const std::vector<double>& gate_rot_freq_, LindbladType lindbladtype_, bool quietmode_){
@@ -44,96 +46,67 @@ Gate::Gate(const std::vector<int>& nlevels_, const std::vector<int>& nessential_
   MatAssemblyEnd(V_re, MAT_FINAL_ASSEMBLY);
   MatAssemblyEnd(V_im, MAT_FINAL_ASSEMBLY);
 
-  /* Allocate vectorized Gate in full dimensions */
-  /* If Lindblad solver: Gate G = V_full x V_full, where V is the full-dimension gate (inserting identities for all non-essential levels) */ 
-  /* Else Schroedinger solver: Gate G = V_full */
-  PetscInt dim_gate;
-  if (lindbladtype != LindbladType::NONE) dim_gate = dim_rho*dim_rho;
-  else dim_gate = dim_rho;
-  MatCreate(PETSC_COMM_WORLD, &VxV_re);
-  MatCreate(PETSC_COMM_WORLD, &VxV_im);
-  // parallel matrix, TODO: Preallocate!
-  PetscInt globalsize_u = dim_gate; // Size to be applied to global subvectors u and v
-  PetscInt localsize_u = dim_gate / mpisize_petsc;  
-  MatSetSizes(VxV_re, localsize_u, localsize_u, globalsize_u, globalsize_u);
-  MatSetSizes(VxV_im, localsize_u, localsize_u, globalsize_u, globalsize_u);
-  MatSetUp(VxV_re);
-  MatSetUp(VxV_im);
-  MatAssemblyBegin(VxV_re, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(VxV_re, MAT_FINAL_ASSEMBLY);
-  MatAssemblyBegin(VxV_im, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(VxV_im, MAT_FINAL_ASSEMBLY);
-
-  /* Allocate auxiliare vectors */
-  MatCreateVecs(VxV_re, &x, NULL);
-
-
-  /* Create vector strides for accessing u,v in state x=[u,v] */
-  PetscInt ilow = mpirank_petsc * localsize_u;  
-  ISCreateStride(PETSC_COMM_WORLD, localsize_u, ilow*2, 1, &isu); 
-  ISCreateStride(PETSC_COMM_WORLD, localsize_u, ilow*2+localsize_u, 1, &isv); 
+  /* The full state is gathered on first application of the gate */
+  scat = NULL;
+  xall = NULL;
 }
 
 Gate::~Gate(){
   if (dim_rho == 0) return;
-  MatDestroy(&VxV_re);
-  MatDestroy(&VxV_im);
   MatDestroy(&V_re);
   MatDestroy(&V_im);
-  VecDestroy(&x);
-  ISDestroy(&isu);
-  ISDestroy(&isv);
+  if (scat != NULL) {
+    VecScatterDestroy(&scat);
+    VecDestroy(&xall);
+  }
 }
 
 void Gate::assembleGate(){
 
-  /* Rorate the gate to rotational frame. */
-  const PetscScalar* vals_vre, *vals_vim;
-  PetscScalar *out_re, *out_im;
-  PetscInt *cols;
-  PetscMalloc1(dim_ess, &out_re); 
-  PetscMalloc1(dim_ess, &out_im); 
-  PetscMalloc1(dim_ess, &cols); 
-  // get the frequency of the diagonal scaling e^{iwt} for each row rotation matrix R=R1\otimes R2\otimes...
+  /* Rotate the gate to rotational frame: scale each row by e^{i freq(row) T}, with R=R1\otimes R2\otimes... */
+  /* Frequencies of all rows at once: freq(row) = sum_k r_k * w_k for the essential multi-index (r_0,...,r_{Q-1}) of row. 
+   * The multi-index is advanced like an odometer instead of being recomputed by divisions. */
+  size_t noscillators = nessential.size();
+  std::vector<double> rot_re(dim_ess), rot_im(dim_ess);
+  std::vector<int> digit(noscillators, 0);
   for (PetscInt row=0; row<dim_ess; row++){
-    PetscInt r = row;
     double freq = 0.0;
-    for (size_t iosc=0; iosc<nlevels.size(); iosc++){
-      // compute dimension of essential levels of all following subsystems 
-      PetscInt dim_post = 1;
-      for (size_t josc=iosc+1; josc<nlevels.size();josc++) {
-        dim_post *= nessential[josc];
-      }
-      // compute the frequency 
-      PetscInt rk = r / dim_post;
-      freq = freq + rk * gate_rot_freq[iosc];
-      r = r % dim_post;
+    for (size_t iosc=0; iosc<noscillators; iosc++) freq += digit[iosc] * gate_rot_freq[iosc];
+    rot_re[row] = cos(freq*final_time);
+    rot_im[row] = sin(freq*final_time);
+    for (int iosc = (int) noscillators-1; iosc >= 0; iosc--) {
+      if (++digit[iosc] < nessential[iosc]) break;
+      digit[iosc] = 0;
     }
-    double ra = cos(freq*final_time);
-    double rb = sin(freq*final_time);
-    /* Get row in V that is to be scaled by the rotation */
-    MatGetRow(V_re, row, NULL, NULL, &vals_vre);  // V_re, V_im is stored dense , so ncols = dim_ess!
-    MatGetRow(V_im, row, NULL, NULL, &vals_vim);
-    // Compute the rotated real and imaginary part
-    for (int c=0; c<dim_ess; c++){        
-      out_re[c] = ra * vals_vre[c] - rb * vals_vim[c];
-      out_im[c] = ra * vals_vim[c] + rb * vals_vre[c];
-      cols[c] = c;
+  }
+
+  /* Apply the rotation on the raw dense (column-major) arrays, and keep a row-major copy for applying the gate */
+  Ve_re.assign(dim_ess*dim_ess, 0.0);
+  Ve_im.assign(dim_ess*dim_ess, 0.0);
+  PetscScalar *vre, *vim;
+  PetscInt lda_re, lda_im;
+  MatDenseGetLDA(V_re, &lda_re);
+  MatDenseGetLDA(V_im, &lda_im);
+  MatDenseGetArray(V_re, &vre);
+  MatDenseGetArray(V_im, &vim);
+  for (PetscInt col=0; col<dim_ess; col++){
+    for (PetscInt row=0; row<dim_ess; row++){
+      double a = vre[col*lda_re + row];
+      double b = vim[col*lda_im + row];
+      double out_re = rot_re[row] * a - rot_im[row] * b;
+      double out_im = rot_re[row] * b + rot_im[row] * a;
+      vre[col*lda_re + row] = out_re;
+      vim[col*lda_im + row] = out_im;
+      Ve_re[row*dim_ess + col] = out_re;
+      Ve_im[row*dim_ess + col] = out_im;
     }
-    MatRestoreRow(V_re, row, NULL, NULL, &vals_vre);
-    MatRestoreRow(V_im, row, NULL, NULL, &vals_vim);
-    // Insert the new values
-    MatSetValues(V_re, 1, &row, dim_ess, cols, out_re, INSERT_VALUES);
-    MatSetValues(V_im, 1, &row, dim_ess, cols, out_im, INSERT_VALUES);
-    MatAssemblyBegin(V_re, MAT_FINAL_ASSEMBLY);
-    MatAssemblyBegin(V_im, MAT_FINAL_ASSEMBLY);
-    MatAssemblyEnd(V_re, MAT_FINAL_ASSEMBLY);
-    MatAssemblyEnd(V_im, MAT_FINAL_ASSEMBLY);
   }
-  // clean up
-  PetscFree(out_re);
-  PetscFree(out_im);
-  PetscFree(cols);
+  MatDenseRestoreArray(V_re, &vre);
+  MatDenseRestoreArray(V_im, &vim);
+  MatAssemblyBegin(V_re, MAT_FINAL_ASSEMBLY);
+  MatAssemblyBegin(V_im, MAT_FINAL_ASSEMBLY);
+  MatAssemblyEnd(V_re, MAT_FINAL_ASSEMBLY);
+  MatAssemblyEnd(V_im, MAT_FINAL_ASSEMBLY);
 
 #ifdef SANITY_CHECK
   bool isunitary = isUnitary(V_re, V_im);
@@ -145,141 +118,126 @@ void Gate::assembleGate(){
 #endif
 
 
- if (lindbladtype != LindbladType::NONE){ // Lindblad solver. Gate is G = V\kron V
-  /* Assemble vectorized gate G=V\kron V where V = PV_eP^T for essential dimension gate V_e (user input) and projection P lifting V_e to the full dimension by inserting identity blocks for non-essential levels. */
-  // Each element in V\kron V is a product V(i,j)*V(r,c), for rows and columns i,j,r,c!
-  PetscInt ilow, iupp;
-  MatGetOwnershipRange(VxV_re, &ilow, &iupp);
-  double val;
-  double vre_ij, vim_ij;
-  double vre_rc, vim_rc;
-  // iterate over rows of V_f (full dimension gate)
-  for (PetscInt row_f=0;row_f<dim_rho; row_f++) {
-    if (isEssential(row_f, nlevels, nessential)) { // place \bar v_xx*V_f blocks for all cols in V_e[row_e]
-      PetscInt row_e = mapFullToEss(row_f, nlevels, nessential);
-      assert(row_f == mapEssToFull(row_e, nlevels, nessential));
-      // iterate over columns in this row_e
-      for (PetscInt col_e=0; col_e<dim_ess; col_e++) {
-        vre_ij = 0.0; vim_ij = 0.0;
-        MatGetValues(V_re, 1, &row_e, 1, &col_e, &vre_ij);
-        MatGetValues(V_im, 1, &row_e, 1, &col_e, &vim_ij);
-        // for all nonzeros in this row, place block \bar Ve_{i,j} * (V_f) at starting position G[a,b]
-        if (fabs(vre_ij) > 1e-14 || fabs(vim_ij) > 1e-14 ) {
-          PetscInt a = row_f * dim_rho;
-          PetscInt b = mapEssToFull(col_e, nlevels, nessential) * dim_rho;
-          // iterate over rows in V_f
-          for (PetscInt r=0; r<dim_rho; r++) {
-            PetscInt rowout = a + r;  // row in G
-            if (ilow <= rowout && rowout < iupp) {
-              if (isEssential(r, nlevels, nessential)){ // place ve_ij*ve_rc at G[a+r, b+map(ce)]
-                PetscInt re = mapFullToEss(r, nlevels, nessential);
-                for (PetscInt ce=0; ce<dim_ess; ce++) {
-                  PetscInt colout = b + mapEssToFull(ce, nlevels, nessential); // column in G
-                  vre_rc = 0.0; vim_rc = 0.0;
-                  MatGetValues(V_re, 1, &re, 1, &ce, &vre_rc);
-                  MatGetValues(V_im, 1, &re, 1, &ce, &vim_rc);
-                  val = vre_ij*vre_rc + vim_ij*vim_rc;
-                  if (fabs(val) > 1e-14) MatSetValue(VxV_re, rowout, colout, val, INSERT_VALUES);
-                  val = vre_ij*vim_rc - vim_ij*vre_rc;
-                  if (fabs(val) > 1e-14) MatSetValue(VxV_im, rowout, colout, val, INSERT_VALUES);
-                }  
-              } else { // place ve_ij*1.0 at G[a+row, a+row]
-              PetscInt colout = b + r;
-                  val = vre_ij;
-                  if (fabs(val) > 1e-14) MatSetValue(VxV_re, rowout, colout, val, INSERT_VALUES);
-                  val = vim_rc;
-                  if (fabs(val) > 1e-14) MatSetValue(VxV_im, rowout, colout, val, INSERT_VALUES);
-              }              
+  /* Maps between essential and full-dimension indices. The full gate V_f = P V_e P^T acts as identity on non-essential levels. */
+  ess2full.assign(dim_ess, 0);
+  full2ess.assign(dim_rho, -1);
+  for (PetscInt i=0; i<dim_rho; i++) {
+    if (isEssential(i, nlevels, nessential)) {
+      PetscInt ie = mapFullToEss(i, nlevels, nessential);
+      assert(i == mapEssToFull(ie, nlevels, nessential));
+      ess2full[ie] = i;
+      full2ess[i] = ie;
+    }
+  }
+}
+
+
+
+void Gate::applyGate(const Vec state, Vec VrhoV){
+  /* Exit, if this is a dummy gate */
+  if (dim_rho == 0) return;
+
+  PetscInt dim = dim_rho;
+  if (lindbladtype != LindbladType::NONE) dim = dim_rho*dim_rho;
+  PetscInt localsize_u = dim / mpisize_petsc;
+  PetscInt stride_x, offset_im;
+  getStateStrides(localsize_u, &stride_x, &offset_im);
+
+  /* Gather the full state onto the first processor. The local part of each processor is [u_local, v_local], or interleaved. */
+  if (scat == NULL) VecScatterCreateToZero(state, &scat, &xall);
+  VecScatterBegin(scat, state, xall, INSERT_VALUES, SCATTER_FORWARD);
+  VecScatterEnd(scat, state, xall, INSERT_VALUES, SCATTER_FORWARD);
+
+  /* The first processor applies the gate and overwrites the gathered state with the result */
+  if (mpirank_petsc == 0) {
+    rho_re.resize(dim);
+    rho_im.resize(dim);
+    PetscScalar* xptr;
+    VecGetArray(xall, &xptr);
+    for (int rank=0; rank<mpisize_petsc; rank++) {
+      for (PetscInt k=0; k<localsize_u; k++) {
+        rho_re[rank*localsize_u + k] = xptr[2*rank*localsize_u + k*stride_x];
+        rho_im[rank*localsize_u + k] = xptr[2*rank*localsize_u + k*stride_x + offset_im];
+      }
+    }
+
+    if (lindbladtype != LindbladType::NONE){ // Lindblad solver: rho' = V rho V^dagger
+      /* W = V_f rho, all columns (rho and W are column-major) */
+      W_re.resize(dim);
+      W_im.resize(dim);
+      for (PetscInt c=0; c<dim_rho; c++) {
+        const double* rcol_re = rho_re.data() + c*dim_rho;
+        const double* rcol_im = rho_im.data() + c*dim_rho;
+        for (PetscInt r=0; r<dim_rho; r++) {
+          PetscInt re = full2ess[r];
+          double wre = 0.0, wim = 0.0;
+          if (re < 0) { // identity on non-essential levels
+            wre = rcol_re[r];
+            wim = rcol_im[r];
+          } else {
+            const double* vrow_re = Ve_re.data() + re*dim_ess;
+            const double* vrow_im = Ve_im.data() + re*dim_ess;
+            for (PetscInt ce=0; ce<dim_ess; ce++) {
+              PetscInt cf = ess2full[ce];
+              wre += vrow_re[ce] * rcol_re[cf] - vrow_im[ce] * rcol_im[cf];
+              wim += vrow_re[ce] * rcol_im[cf] + vrow_im[ce] * rcol_re[cf];
             }
           }
+          W_re[c*dim_rho + r] = wre;
+          W_im[c*dim_rho + r] = wim;
         }
       }
-    } else { // place Vf block starting at G[a,a], a=row_f * N
-      PetscInt a = row_f * dim_rho;
-      // iterate over rows in V_f
-      for (PetscInt r=0; r<dim_rho; r++) {
-        PetscInt rowout = a + r;  // row in G
-        if (ilow <= rowout && rowout < iupp) {
-          if (isEssential(r, nlevels, nessential)){ // place ve_rc at G[a+r, a+map(ce)]
-            PetscInt re = mapFullToEss(r, nlevels, nessential);
-            for (PetscInt ce=0; ce<dim_ess; ce++) {
-              PetscInt colout = a + mapEssToFull(ce, nlevels, nessential); // column in G
-              vre_rc = 0.0; vim_rc = 0.0;
-              MatGetValues(V_re, 1, &re, 1, &ce, &vre_rc);
-              MatGetValues(V_im, 1, &re, 1, &ce, &vim_rc);
-              val = vre_rc;
-              if (fabs(val) > 1e-14) MatSetValue(VxV_re, rowout, colout, val, INSERT_VALUES);
-              val = vim_rc;
-              if (fabs(val) > 1e-14) MatSetValue(VxV_im, rowout, colout, val, INSERT_VALUES);
-            }  
-          } else { // place 1.0 at G[a+r, a+r]
-              PetscInt colout = a + r;
-              val = 1.0;
-              if (fabs(val) > 1e-14) MatSetValue(VxV_re, rowout, colout, val, INSERT_VALUES);
-          }              
+      /* rho' = W V_f^dagger, i.e. rho'(r,c) = sum_k W(r,k) conj(V_f(c,k)) */
+      for (PetscInt i=0; i<dim; i++) {
+        PetscInt r = i % dim_rho;
+        PetscInt c = i / dim_rho;
+        PetscInt ce = full2ess[c];
+        double ore = 0.0, oim = 0.0;
+        if (ce < 0) { // identity on non-essential levels
+          ore = W_re[c*dim_rho + r];
+          oim = W_im[c*dim_rho + r];
+        } else {
+          const double* vrow_re = Ve_re.data() + ce*dim_ess;
+          const double* vrow_im = Ve_im.data() + ce*dim_ess;
+          for (PetscInt ke=0; ke<dim_ess; ke++) {
+            PetscInt kf = ess2full[ke];
+            double wre = W_re[kf*dim_rho + r];
+            double wim = W_im[kf*dim_rho + r];
+            ore += wre * vrow_re[ke] + wim * vrow_im[ke];
+            oim += wim * vrow_re[ke] - wre * vrow_im[ke];
+          }
         }
+        PetscInt pos = 2*(i / localsize_u)*localsize_u + (i % localsize_u)*stride_x;
+        xptr[pos] = ore;
+        xptr[pos + offset_im] = oim;
       }
-    }
-  }
- } else { // Schroedinger solver. Gate is V_full
-  PetscInt ilow, iupp;
-  MatGetOwnershipRange(VxV_re, &ilow, &iupp);
-  double vre_ij, vim_ij;
-  // iterate over rows of V_f (full dimension gate)
-  for (PetscInt row_f=0;row_f<dim_rho; row_f++) {
-    if (isEssential(row_f, nlevels, nessential)) {  // place V_e(r_e, c_e) at V_f(r_f,c_e) for all cols c_e in V_e[r_e]
-      PetscInt row_e = mapFullToEss(row_f, nlevels, nessential);
-      assert(row_f == mapEssToFull(row_e, nlevels, nessential));
-      if (ilow <= row_f && row_f < iupp) {
-        // iterate over columns in this row_e
-        for (PetscInt col_e=0; col_e<dim_ess; col_e++) {
-          vre_ij = 0.0; vim_ij = 0.0;
-          MatGetValues(V_re, 1, &row_e, 1, &col_e, &vre_ij);
-          MatGetValues(V_im, 1, &row_e, 1, &col_e, &vim_ij);
-          // for all nonzeros in this row, place Ve_{i,j} at G[row_f,mapEssToFull(coll_e)]
-          PetscInt col_f = mapEssToFull(col_e, nlevels, nessential);
-          if (fabs(vre_ij) > 1e-14) MatSetValue(VxV_re, row_f, col_f, vre_ij, INSERT_VALUES);
-          if (fabs(vim_ij) > 1e-14) MatSetValue(VxV_im, row_f, col_f, vim_ij, INSERT_VALUES);
+    } else { // Schroedinger solver: psi' = V psi
+      for (PetscInt r=0; r<dim; r++) {
+        PetscInt re = full2ess[r];
+        double ore = 0.0, oim = 0.0;
+        if (re < 0) {
+          ore = rho_re[r];
+          oim = rho_im[r];
+        } else {
+          const double* vrow_re = Ve_re.data() + re*dim_ess;
+          const double* vrow_im = Ve_im.data() + re*dim_ess;
+          for (PetscInt ce=0; ce<dim_ess; ce++) {
+            PetscInt cf = ess2full[ce];
+            ore += vrow_re[ce] * rho_re[cf] - vrow_im[ce] * rho_im[cf];
+            oim += vrow_re[ce] * rho_im[cf] + vrow_im[ce] * rho_re[cf];
+          }
         }
+        PetscInt pos = 2*(r / localsize_u)*localsize_u + (r % localsize_u)*stride_x;
+        xptr[pos] = ore;
+        xptr[pos + offset_im] = oim;
       }
-    } else { // place 1.0 at diagonal
-      if (ilow <= row_f && row_f < iupp) MatSetValue(VxV_re, row_f, row_f, 1.0, INSERT_VALUES);
     }
+    VecRestoreArray(xall, &xptr);
   }
- }
- 
-  MatAssemblyBegin(VxV_re, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(VxV_re, MAT_FINAL_ASSEMBLY);
-  MatAssemblyBegin(VxV_im, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(VxV_im, MAT_FINAL_ASSEMBLY);
 
-}
-
-
-
-void Gate::applyGate(const Vec state, Vec VrhoV){
-  /* Exit, if this is a dummy gate */
-  if (dim_rho == 0) return;
-
-  /* Get real and imag part of the state q = u + iv */
-  Vec u, v;
-  VecGetSubVector(state, isu, &u);
-  VecGetSubVector(state, isv, &v);
-
-  /* (a) Real part Re(VxV q) = VxV_re u - VxV_im v */
-  MatMult(VxV_im, v, x);            // 
-  VecScale(x, -1.0);                // x = -VxV_im * v 
-  MatMultAdd(VxV_re, u, x, x);      // x += VxV_re * u
-  VecISCopy(VrhoV, isu, SCATTER_FORWARD, x); 
-
-  /* (b) Imaginary part Im(VxV q) = VxV_re v + VxV_im u */
-  MatMult(VxV_re, v, x);            // x  = VxV_re * v
-  MatMultAdd(VxV_im, u, x, x);      // x += VxV_im * u
-  VecISCopy(VrhoV, isv, SCATTER_FORWARD, x); 
-
-  /* Restore state from index set */
-  VecRestoreSubVector(state, isu, &u);
-  VecRestoreSubVector(state, isv, &v);
+  /* Scatter the result back to the distributed output */
+  VecScatterBegin(scat, xall, VrhoV, INSERT_VALUES, SCATTER_REVERSE);
+  VecScatterEnd(scat, xall, VrhoV, INSERT_VALUES, SCATTER_REVERSE);
 }
 
 
@@ -510,15 +468,21 @@ FromFile::FromFile(const std::vector<int>& nlevels_, const std::vector<int>& nes
   if (mpirank_world == 0) read_vector(filename.c_str(), vec.data(), nelems, quietmode);
   MPI_Bcast(vec.data(), nelems, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
-  // Set up the matrix
-  for (int i=0; i<dim_ess*dim_ess; i++){
-    // Position in the matrix
-    int row = i % dim_ess;
-    int col = i/dim_ess; 
-    // Insert real and imaginary values
-    MatSetValue(V_re, row, col, vec[i], INSERT_VALUES);
-    MatSetValue(V_im, row, col, vec[i+dim_ess*dim_ess], INSERT_VALUES);
+  // Set up the matrix. The file stores the gate column-wise, same as the dense storage.
+  PetscScalar *vre, *vim;
+  PetscInt lda_re, lda_im;
+  MatDenseGetLDA(V_re, &lda_re);
+  MatDenseGetLDA(V_im, &lda_im);
+  MatDenseGetArray(V_re, &vre);
+  MatDenseGetArray(V_im, &vim);
+  for (int col=0; col<dim_ess; col++){
+    for (int row=0; row<dim_ess; row++){
+      vre[col*lda_re + row] = vec[col*dim_ess + row];
+      vim[col*lda_im + row] = vec[dim_ess*dim_ess + col*dim_ess + row];
+    }
   }
+  MatDenseRestoreArray(V_re, &vre);
+  MatDenseRestoreArray(V_im, &vim);
 
   MatAssemblyBegin(V_re, MAT_FINAL_ASSEMBLY);
   MatAssemblyBegin(V_im, MAT_FINAL_ASSEMBLY);
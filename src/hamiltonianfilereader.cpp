@@ -1,11 +1,13 @@
 #include "hamiltonianfilereader.hpp"
+#include <algorithm>
 
 HamiltonianFileReader::HamiltonianFileReader(){
 }
 
 
-HamiltonianFileReader::HamiltonianFileReader(std::string hamiltonian_file_Hsys_, std::string hamiltonian_file_Hc_, LindbladType lindbladtype_, PetscInt dim_rho_, bool quietmode_) {
+HamiltonianFileReader::HamiltonianFileReader(std::string hamiltonian_file_Hsys_, std::string hamiltonian_file_Hc_, const std::vector<int>& nlevels_, LindbladType lindbladtype_, PetscInt dim_rho_, bool quietmode_) {
 
+  nlevels = nlevels_;
   lindbladtype = lindbladtype_;
   dim_rho = dim_rho_;
   hamiltonian_file_Hsys = hamiltonian_file_Hsys_;
@@ -18,107 +20,310 @@ HamiltonianFileReader::HamiltonianFileReader(std::string hamiltonian_file_Hsys_,
 HamiltonianFileReader::~HamiltonianFileReader(){
 }
 
-void HamiltonianFileReader::receiveHsys(Mat& Ad, Mat& Bd){
-  MatSetOption(Bd, MAT_NEW_NONZERO_ALLOCATION_ERR, PETSC_FALSE);
+void HamiltonianFileReader::addEntry(SparseEntries& A, SparseEntries& B, PetscInt row, PetscInt col, double real, double imag){
+  // Real(-i*H) = Imag(H), Imag(-i*H) = -Real(H)
+  if (lindbladtype == LindbladType::NONE) {
+    // Schroedinger 
+    if (!A.isLocal(row)) return;
+    if (fabs(imag) > 1e-15) A.add(row, col, imag);
+    if (fabs(real) > 1e-15) B.add(row, col, -real);
+  } else {
+    // Lindblad: Vectorize I_N \kron X - X^T \kron I_N. Only visit the k's that hit a local row.
+    PetscInt ilow = A.getILow();
+    PetscInt iupp = A.getIUpp();
+    // I_N \kron X: rows row + dim_rho*k
+    PetscInt kstart = std::max((PetscInt)0, (ilow - row + dim_rho - 1) / dim_rho);
+    PetscInt kstop  = std::min(dim_rho, (iupp - row + dim_rho - 1) / dim_rho);
+    for (PetscInt k = kstart; k < kstop; k++) {
+      PetscInt rowk = row + dim_rho * k;
+      PetscInt colk = col + dim_rho * k;
+      if (fabs(imag) > 1e-15) A.add(rowk, colk, imag);
+      if (fabs(real) > 1e-15) B.add(rowk, colk, -real);
+    }
+    // - X^T \kron I_N: rows col*dim_rho + k
+    kstart = std::max((PetscInt)0, ilow - col*dim_rho);
+    kstop  = std::min(dim_rho, iupp - col*dim_rho);
+    for (PetscInt k = kstart; k < kstop; k++) {
+      PetscInt rowk = col * dim_rho + k;
+      PetscInt colk = row * dim_rho + k;
+      if (fabs(imag) > 1e-15) A.add(rowk, colk, -imag);
+      if (fabs(real) > 1e-15) B.add(rowk, colk, real);
+    }
+  }
+}
 
+bool HamiltonianFileReader::isBinary(const std::string& filename){
+  std::ifstream infile(filename, std::ios::binary);
+  char magic[8] = {0};
+  infile.read(magic, 8);
+  return infile.gcount() == 8 && std::string(magic, 8).compare("QUANDHAM") == 0;
+}
 
-  // Only rank 0 reads the file and sets all values
-  if (mpirank_world == 0) {
-    std::ifstream infile(hamiltonian_file_Hsys);
-    if (!infile.is_open()) {
-        std::cerr << "Could not open " << hamiltonian_file_Hsys << std::endl;
-        MPI_Abort(MPI_COMM_WORLD, 1);
+void HamiltonianFileReader::readBinary(const std::string& filename, SparseEntries* A, SparseEntries* B, size_t noperators){
+
+  std::ifstream infile(filename, std::ios::binary);
+  if (!infile.is_open()) {
+      std::cerr << "Could not open " << filename << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  /* Header: magic, version, dimension, number of operators, number of nonzeros, reserved */
+  int64_t header[6];
+  infile.read((char*) header, sizeof(header));
+  int64_t version = header[1];
+  int64_t dimH = header[2];
+  int64_t nops = header[3];
+  int64_t nnz  = header[4];
+  if (!infile || version != 1 || dimH != dim_rho || nops > (int64_t) noperators) {
+      std::cerr << "Wrong header in binary Hamiltonian file " << filename << ": version " << version << ", dimension " << dimH << " (expected " << dim_rho << "), " << nops << " operators (at most " << noperators << " expected)." << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  std::streamoff off_rowptr = sizeof(header);
+  std::streamoff off_cols = off_rowptr + sizeof(int64_t) * nops * (dimH + 1);
+  std::streamoff off_re   = off_cols + sizeof(int64_t) * nnz;
+  std::streamoff off_im   = off_re + sizeof(double) * nnz;
+
+  /* Rows of the Hamiltonian needed on this processor. Schroedinger: the own rows. */
+  /* Lindblad: All rows, since the entries are expanded into rows (I_N kron H) and columns (H^T kron I_N) of the superoperator. */
+  PetscInt rlow = 0;
+  PetscInt rupp = dim_rho;
+  if (lindbladtype == LindbladType::NONE) {
+    rlow = A[0].getILow();
+    rupp = A[0].getIUpp();
+  }
+
+  std::vector<int64_t> rowptr(rupp - rlow + 1);
+  std::vector<int64_t> cols;
+  std::vector<double> re, im;
+  for (int64_t iop = 0; iop < nops; iop++) {
+    // Row pointers of the needed rows, then the contiguous range of their entries
+    infile.seekg(off_rowptr + sizeof(int64_t) * (iop * (dimH + 1) + rlow));
+    infile.read((char*) rowptr.data(), sizeof(int64_t) * rowptr.size());
+    int64_t first = rowptr.front();
+    int64_t n = rowptr.back() - first;
+    cols.resize(n);
+    re.resize(n);
+    im.resize(n);
+    infile.seekg(off_cols + sizeof(int64_t) * first);
+    infile.read((char*) cols.data(), sizeof(int64_t) * n);
+    infile.seekg(off_re + sizeof(double) * first);
+    infile.read((char*) re.data(), sizeof(double) * n);
+    infile.seekg(off_im + sizeof(double) * first);
+    infile.read((char*) im.data(), sizeof(double) * n);
+    if (!infile) {
+      std::cerr << "Error reading binary Hamiltonian file " << filename << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    std::string line;
-    while (std::getline(infile, line)) {
-        if (line.empty() || line[0] == '#') continue;
-        std::istringstream iss(line);
-        PetscInt row, col;
-        double real, imag;
-        if (!(iss >> row >> col >> real >> imag)) continue;
-        // Assemble: Ad = Real(-i*Hsys) = Imag(Hsys)
-        // Assemble: Bd = Imag(-i*Hsys) = -Real(Hsys)
-        if (lindbladtype == LindbladType::NONE) {
-            // Schroedinger 
-            if (fabs(imag) > 1e-15) MatSetValue(Ad, row, col, imag, INSERT_VALUES);
-            if (fabs(real) > 1e-15) MatSetValue(Bd, row, col, -real, INSERT_VALUES);
-        } else {
-            // Lindblad: Vectorize I_N \kron X - X^T \kron I_N
-            for (PetscInt k = 0; k < dim_rho; k++) {
-              PetscInt rowk = row + dim_rho * k;
-              PetscInt colk = col + dim_rho * k;
-              if (fabs(imag) > 1e-15) MatSetValue(Ad, rowk, colk, imag, INSERT_VALUES);
-              if (fabs(real) > 1e-15) MatSetValue(Bd, rowk, colk, -real, INSERT_VALUES);
-              rowk = col * dim_rho + k;
-              colk = row * dim_rho + k;
-              if (fabs(imag) > 1e-15) MatSetValue(Ad, rowk, colk, -imag, INSERT_VALUES);
-              if (fabs(real) > 1e-15) MatSetValue(Bd, rowk, colk, real, INSERT_VALUES);
-            }
-        }
+
+    for (PetscInt row = rlow; row < rupp; row++) {
+      for (int64_t e = rowptr[row - rlow] - first; e < rowptr[row - rlow + 1] - first; e++) {
+        addEntry(A[iop], B[iop], row, cols[e], re[e], im[e]);
+      }
     }
-    infile.close();
   }
-  MatAssemblyBegin(Ad, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(Ad, MAT_FINAL_ASSEMBLY);
-  MatAssemblyBegin(Bd, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(Bd, MAT_FINAL_ASSEMBLY);
+  infile.close();
 }
 
-void HamiltonianFileReader::receiveHc(std::vector<Mat>& Ac_vec, std::vector<Mat>& Bc_vec){
+bool HamiltonianFileReader::isKronecker(const std::string& filename){
+  std::ifstream infile(filename);
+  std::string line;
+  if (!std::getline(infile, line)) return false;
+  return line.compare(0, 11, "# kronecker") == 0;
+}
 
-  if (hamiltonian_file_Hc.compare("none") == 0 ) return;
+void HamiltonianFileReader::readKronecker(const std::string& filename, bool control, std::vector<KronProduct>& prods, std::vector<int>& groups){
 
-  for (size_t i=0; i<Ac_vec.size(); ++i) {
-    MatSetOption(Ac_vec[i], MAT_NEW_NONZERO_ALLOCATION_ERR, PETSC_FALSE);
-    MatSetOption(Bc_vec[i], MAT_NEW_NONZERO_ALLOCATION_ERR, PETSC_FALSE);
+  std::ifstream infile(filename);
+  if (!infile.is_open()) {
+      std::cerr << "Could not open " << filename << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
   }
+  int noscillators = nlevels.size();
+  std::string line;
+  while (std::getline(infile, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    std::string first;
+    if (!(iss >> first)) continue;
 
-  // Only rank 0 reads the file and sets all values
-  if (mpirank_world == 0) {
-    std::ifstream infile(hamiltonian_file_Hc);
-    if (!infile.is_open()) {
-        std::cerr << "Could not open " << hamiltonian_file_Hc<< std::endl;
+    /* Start a new product term */
+    if (first.compare("term") == 0) {
+      KronProduct prod;
+      int group = 0;
+      bool ok = true;
+      bool imagcontrol = false;
+      if (control) {
+        int osc;
+        std::string part;
+        ok = (bool)(iss >> osc >> part) && osc >= 0 && osc < noscillators && (part.compare("re") == 0 || part.compare("im") == 0);
+        if (ok) {
+          imagcontrol = part.compare("im") == 0;
+          group = imagcontrol ? 2 + 2*osc : 1 + 2*osc;
+        }
+      }
+      ok = ok && (iss >> prod.coeff_re >> prod.coeff_im);
+      if (!ok) {
+        std::cerr << "Wrong term line in Hamiltonian file " << filename << ": " << line << std::endl;
         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      // Imaginary control terms are multiplied by i*q(t)
+      if (imagcontrol) {
+        double cre = prod.coeff_re;
+        prod.coeff_re = -prod.coeff_im;
+        prod.coeff_im = cre;
+      }
+      prods.push_back(prod);
+      groups.push_back(group);
+      continue;
     }
-    std::string line;
-    while (std::getline(infile, line)) {
-        if (line.empty() || line[0] == '#') continue;
-        std::istringstream iss(line);
-        int osc;
-        PetscInt row, col;
-        double real, imag;
-        if (!(iss >> osc >> row >> col >> real >> imag)) continue;
-        // printf("osc %d row %d col %d real %f imag %f\n", osc, row, col, real, imag);
-        // Assemble: Ac = Real(-i*Hc) = Imag(Hc)
-        // Assemble: Bc = Imag(-i*Hc) = -Real(Hc)
-        if (lindbladtype == LindbladType::NONE) {
-          // Schroedinger
-          if (fabs(imag) > 1e-15)  MatSetValue(Ac_vec[osc], row, col, imag, INSERT_VALUES);
-          if (fabs(real) > 1e-15) MatSetValue(Bc_vec[osc], row, col, -real, INSERT_VALUES);
-        } else {
-            // Lindblad: Vectorize I_N \kron X - X^T \kron I_N
-            for (PetscInt k = 0; k < dim_rho; k++) {
-              PetscInt rowk = row + dim_rho * k;
-              PetscInt colk = col + dim_rho * k;
-              if (fabs(imag) > 1e-15) MatSetValue(Ac_vec[osc], rowk, colk, imag, INSERT_VALUES);
-              if (fabs(real) > 1e-15) MatSetValue(Bc_vec[osc], rowk, colk, -real, INSERT_VALUES);
-              rowk = col * dim_rho + k;
-              colk = row * dim_rho + k;
-              if (fabs(imag) > 1e-15) MatSetValue(Ac_vec[osc], rowk, colk, -imag, INSERT_VALUES);
-              if (fabs(real) > 1e-15) MatSetValue(Bc_vec[osc], rowk, colk, real, INSERT_VALUES);
-            }
+
+    /* Factor entry of the current term: oscillator row col real imag */
+    int osc;
+    PetscInt row, col;
+    double real, imag;
+    std::istringstream entry(line);
+    if (!(entry >> osc >> row >> col >> real >> imag) || prods.size() == 0 || osc < 0 || osc >= noscillators || row < 0 || row >= nlevels[osc] || col < 0 || col >= nlevels[osc]) {
+      std::cerr << "Wrong factor entry in Hamiltonian file " << filename << ": " << line << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    KronProduct& prod = prods.back();
+    size_t k = std::find(prod.osc.begin(), prod.osc.end(), osc) - prod.osc.begin();
+    if (k == prod.osc.size()) {
+      prod.osc.push_back(osc);
+      prod.F_re.push_back(std::vector<double>(nlevels[osc]*nlevels[osc], 0.0));
+      prod.F_im.push_back(std::vector<double>(nlevels[osc]*nlevels[osc], 0.0));
+    }
+    prod.F_re[k][row*nlevels[osc] + col] += real;
+    prod.F_im[k][row*nlevels[osc] + col] += imag;
+  }
+  infile.close();
+}
+
+void HamiltonianFileReader::expandKronecker(const KronProduct& prod, int group, SparseEntries& A, SparseEntries& B){
+
+  /* Entries (row, col, value) of the product, built up one oscillator at a time. The first oscillator is the slowest. */
+  std::vector<PetscInt> rows(1, 0), cols(1, 0);
+  std::vector<double> re(1, prod.coeff_re), im(1, prod.coeff_im);
+  for (size_t iosc = 0; iosc < nlevels.size(); iosc++) {
+    int n = nlevels[iosc];
+    size_t k = std::find(prod.osc.begin(), prod.osc.end(), (int)iosc) - prod.osc.begin();
+    std::vector<PetscInt> newrows, newcols;
+    std::vector<double> newre, newim;
+    for (size_t e = 0; e < rows.size(); e++) {
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+          double fr = (i == j) ? 1.0 : 0.0;
+          double fi = 0.0;
+          if (k < prod.osc.size()) {
+            fr = prod.F_re[k][i*n + j];
+            fi = prod.F_im[k][i*n + j];
+          }
+          if (fr == 0.0 && fi == 0.0) continue;
+          newrows.push_back(rows[e]*n + i);
+          newcols.push_back(cols[e]*n + j);
+          newre.push_back(re[e]*fr - im[e]*fi);
+          newim.push_back(re[e]*fi + im[e]*fr);
         }
+      }
     }
-    infile.close();
+    rows.swap(newrows);
+    cols.swap(newcols);
+    re.swap(newre);
+    im.swap(newim);
   }
 
-  // All ranks participate in assembly for all oscillators
-  for (size_t i = 0; i < Ac_vec.size(); ++i) {
-      MatAssemblyBegin(Ac_vec[i], MAT_FINAL_ASSEMBLY);
-      MatAssemblyEnd(Ac_vec[i], MAT_FINAL_ASSEMBLY);
+  for (size_t e = 0; e < rows.size(); e++) {
+    // Controls: the real part of (-i*H) is multiplied by q(t), the imaginary part by p(t)
+    bool p_wrong = group > 0 && group % 2 == 1 && fabs(im[e]) > 1e-15;
+    bool q_wrong = group > 0 && group % 2 == 0 && fabs(re[e]) > 1e-15;
+    if (p_wrong || q_wrong) {
+      std::cerr << "The sparse-matrix solver requires real 're' and imaginary 'im' control terms. Use the matrix-free solver for general factored control Hamiltonians." << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    addEntry(A, B, rows[e], cols[e], re[e], im[e]);
+  }
+}
+
+void HamiltonianFileReader::receiveKronecker(KronOperator& kronop){
+
+  std::vector<KronProduct> prods;
+  std::vector<int> groups;
+  if (hamiltonian_file_Hsys.compare("none") != 0) readKronecker(hamiltonian_file_Hsys, false, prods, groups);
+  if (hamiltonian_file_Hc.compare("none") != 0) readKronecker(hamiltonian_file_Hc, true, prods, groups);
+
+  for (size_t i = 0; i < prods.size(); i++) {
+    kronop.addHamiltonian(groups[i], prods[i]);
+  }
+}
+
+void HamiltonianFileReader::receiveHsys(SparseEntries& Ad, SparseEntries& Bd){
+
+  if (isBinary(hamiltonian_file_Hsys)) {
+    readBinary(hamiltonian_file_Hsys, &Ad, &Bd, 1);
+    return;
+  }
+
+  if (isKronecker(hamiltonian_file_Hsys)) {
+    std::vector<KronProduct> prods;
+    std::vector<int> groups;
+    readKronecker(hamiltonian_file_Hsys, false, prods, groups);
+    for (size_t i = 0; i < prods.size(); i++) expandKronecker(prods[i], groups[i], Ad, Bd);
+    return;
+  }
+
+  // Each rank reads the file and keeps the entries of its own rows
+  std::ifstream infile(hamiltonian_file_Hsys);
+  if (!infile.is_open()) {
+      std::cerr << "Could not open " << hamiltonian_file_Hsys << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
   }
-  for (size_t i = 0; i < Bc_vec.size(); ++i) {
-      MatAssemblyBegin(Bc_vec[i], MAT_FINAL_ASSEMBLY);
-      MatAssemblyEnd(Bc_vec[i], MAT_FINAL_ASSEMBLY);
+  std::string line;
+  while (std::getline(infile, line)) {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream iss(line);
+      PetscInt row, col;
+      double real, imag;
+      if (!(iss >> row >> col >> real >> imag)) continue;
+      addEntry(Ad, Bd, row, col, real, imag);
   }
-}
\ No newline at end of file
+  infile.close();
+}
+
+void HamiltonianFileReader::receiveHc(std::vector<SparseEntries>& Ac_vec, std::vector<SparseEntries>& Bc_vec){
+
+  if (hamiltonian_file_Hc.compare("none") == 0 ) return;
+
+  if (isBinary(hamiltonian_file_Hc)) {
+    readBinary(hamiltonian_file_Hc, Ac_vec.data(), Bc_vec.data(), Ac_vec.size());
+    return;
+  }
+
+  if (isKronecker(hamiltonian_file_Hc)) {
+    std::vector<KronProduct> prods;
+    std::vector<int> groups;
+    readKronecker(hamiltonian_file_Hc, true, prods, groups);
+    for (size_t i = 0; i < prods.size(); i++) {
+      int osc = (groups[i] - 1) / 2;
+      expandKronecker(prods[i], groups[i], Ac_vec[osc], Bc_vec[osc]);
+    }
+    return;
+  }
+
+  // Each rank reads the file and keeps the entries of its own rows
+  std::ifstream infile(hamiltonian_file_Hc);
+  if (!infile.is_open()) {
+      std::cerr << "Could not open " << hamiltonian_file_Hc<< std::endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  std::string line;
+  while (std::getline(infile, line)) {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream iss(line);
+      int osc;
+      PetscInt row, col;
+      double real, imag;
+      if (!(iss >> osc >> row >> col >> real >> imag)) continue;
+      addEntry(Ac_vec[osc], Bc_vec[osc], row, col, real, imag);
+  }
+  infile.close();
+}
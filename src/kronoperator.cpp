@@ -0,0 +1,240 @@
+#include "kronoperator.hpp"
+#include <algorithm>
+#include <math.h>
+
+KronOperator::KronOperator(){
+  noscillators = 0;
+  lindbladtype = LindbladType::NONE;
+  dim_rho = 0;
+  dim = 0;
+}
+
+KronOperator::KronOperator(const std::vector<int>& nlevels_, LindbladType lindbladtype_) : KronOperator() {
+  nlevels = nlevels_;
+  lindbladtype = lindbladtype_;
+  noscillators = nlevels.size();
+
+  dim_rho = 1;
+  for (int iosc = 0; iosc < noscillators; iosc++) dim_rho *= nlevels[iosc];
+
+  /* Modes of the state tensor. Schroedinger: one per oscillator, the last one is fastest. */
+  /* Lindblad: x_{r + c*N}, i.e. column modes 0..m-1 (slow) followed by row modes m..2m-1 (fast). */
+  std::vector<PetscInt> postdim(noscillators, 1);
+  for (int iosc = noscillators-2; iosc >= 0; iosc--) postdim[iosc] = postdim[iosc+1] * nlevels[iosc+1];
+  if (lindbladtype == LindbladType::NONE) {
+    dim = dim_rho;
+    for (int iosc = 0; iosc < noscillators; iosc++) {
+      modesize.push_back(nlevels[iosc]);
+      modestride.push_back(postdim[iosc]);
+    }
+  } else {
+    dim = dim_rho * dim_rho;
+    for (int iosc = 0; iosc < noscillators; iosc++) {
+      modesize.push_back(nlevels[iosc]);
+      modestride.push_back(postdim[iosc] * dim_rho);
+    }
+    for (int iosc = 0; iosc < noscillators; iosc++) {
+      modesize.push_back(nlevels[iosc]);
+      modestride.push_back(postdim[iosc]);
+    }
+  }
+
+  /* Constant group and one p- and q-group per oscillator */
+  group_coeff.assign(1 + 2*noscillators, 0.0);
+  group_coeff[0] = 1.0;
+
+  buf[0].resize(2*dim);
+  buf[1].resize(2*dim);
+  acc.resize(2*dim);
+}
+
+KronOperator::~KronOperator(){}
+
+void KronOperator::pushTerm(int group, double c_re, double c_im, const std::vector<int>& modes, const std::vector<std::vector<double>>& F_re, const std::vector<std::vector<double>>& F_im){
+
+  SuperTerm term;
+  term.group = group;
+  term.coeff_re = c_re;
+  term.coeff_im = c_im;
+  term.modes = modes;
+  term.F_re = F_re;
+  term.F_im = F_im;
+
+  /* Conjugate transposes for the adjoint */
+  for (size_t k = 0; k < modes.size(); k++) {
+    PetscInt n = modesize[modes[k]];
+    std::vector<double> FH_re(n*n), FH_im(n*n);
+    for (PetscInt i = 0; i < n; i++) {
+      for (PetscInt j = 0; j < n; j++) {
+        FH_re[j*n + i] =  F_re[k][i*n + j];
+        FH_im[j*n + i] = -F_im[k][i*n + j];
+      }
+    }
+    term.FH_re.push_back(FH_re);
+    term.FH_im.push_back(FH_im);
+  }
+  terms.push_back(term);
+}
+
+void KronOperator::addHamiltonian(int group, const KronProduct& prod){
+
+  if (lindbladtype == LindbladType::NONE) {
+    // -i c F
+    pushTerm(group, prod.coeff_im, -prod.coeff_re, prod.osc, prod.F_re, prod.F_im);
+    return;
+  }
+
+  // Identity commutes with rho, nothing to add
+  if (prod.osc.size() == 0) return;
+
+  // -i c F rho: F on the row modes
+  std::vector<int> rowmodes, colmodes;
+  for (size_t k = 0; k < prod.osc.size(); k++) {
+    rowmodes.push_back(noscillators + prod.osc[k]);
+    colmodes.push_back(prod.osc[k]);
+  }
+  pushTerm(group, prod.coeff_im, -prod.coeff_re, rowmodes, prod.F_re, prod.F_im);
+
+  // +i c rho F: F^T on the column modes
+  std::vector<std::vector<double>> FT_re, FT_im;
+  for (size_t k = 0; k < prod.osc.size(); k++) {
+    PetscInt n = nlevels[prod.osc[k]];
+    std::vector<double> T_re(n*n), T_im(n*n);
+    for (PetscInt i = 0; i < n; i++) {
+      for (PetscInt j = 0; j < n; j++) {
+        T_re[j*n + i] = prod.F_re[k][i*n + j];
+        T_im[j*n + i] = prod.F_im[k][i*n + j];
+      }
+    }
+    FT_re.push_back(T_re);
+    FT_im.push_back(T_im);
+  }
+  pushTerm(group, -prod.coeff_im, prod.coeff_re, colmodes, FT_re, FT_im);
+}
+
+void KronOperator::addDissipation(int iosc, double gammaT1, double gammaT2){
+
+  if (lindbladtype == LindbladType::NONE) return;
+
+  PetscInt n = nlevels[iosc];
+  std::vector<double> a(n*n, 0.0), num(n*n, 0.0), num2(n*n, 0.0), zero(n*n, 0.0);
+  for (PetscInt i = 0; i < n; i++) {
+    if (i < n-1) a[i*n + i+1] = sqrt(i+1);
+    num[i*n + i] = i;
+    num2[i*n + i] = i*i;
+  }
+  int colmode = iosc;
+  int rowmode = noscillators + iosc;
+
+  // T1 decay, L = a: gamma (a rho a^dagger) - gamma/2 (a^dagger a rho + rho a^dagger a)
+  if (gammaT1 > 0.0) {
+    pushTerm(0, gammaT1, 0.0, {rowmode, colmode}, {a, a}, {zero, zero});
+    pushTerm(0, -gammaT1/2., 0.0, {rowmode}, {num}, {zero});
+    pushTerm(0, -gammaT1/2., 0.0, {colmode}, {num}, {zero});
+  }
+  // T2 dephasing, L = a^dagger a: gamma (L rho L) - gamma/2 (L^2 rho + rho L^2)
+  if (gammaT2 > 0.0) {
+    pushTerm(0, gammaT2, 0.0, {rowmode, colmode}, {num, num}, {zero, zero});
+    pushTerm(0, -gammaT2/2., 0.0, {rowmode}, {num2}, {zero});
+    pushTerm(0, -gammaT2/2., 0.0, {colmode}, {num2}, {zero});
+  }
+}
+
+void KronOperator::setControls(const std::vector<double>& p, const std::vector<double>& q){
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    group_coeff[1 + 2*iosc] = p[iosc];
+    group_coeff[2 + 2*iosc] = q[iosc];
+  }
+}
+
+void KronOperator::applyFactor(int mode, const std::vector<double>& F_re, const std::vector<double>& F_im, const double* x, double* y) const {
+
+  PetscInt n = modesize[mode];
+  PetscInt s = modestride[mode];
+  PetscInt nouter = dim / (n*s);
+  const double* x_re = x;
+  const double* x_im = x + dim;
+  double* y_re = y;
+  double* y_im = y + dim;
+  std::fill(y, y + 2*dim, 0.0);
+
+  /* y[o, i, q] = sum_j F[i,j] x[o, j, q], skipping zero factor entries */
+  for (PetscInt o = 0; o < nouter; o++) {
+    PetscInt base = o*n*s;
+    for (PetscInt i = 0; i < n; i++) {
+      double* yr = y_re + base + i*s;
+      double* yi = y_im + base + i*s;
+      for (PetscInt j = 0; j < n; j++) {
+        double fr = F_re[i*n + j];
+        double fi = F_im[i*n + j];
+        if (fr == 0.0 && fi == 0.0) continue;
+        const double* xr = x_re + base + j*s;
+        const double* xi = x_im + base + j*s;
+        for (PetscInt q = 0; q < s; q++) {
+          yr[q] += fr*xr[q] - fi*xi[q];
+          yi[q] += fr*xi[q] + fi*xr[q];
+        }
+      }
+    }
+  }
+}
+
+void KronOperator::addTerm(const SuperTerm& term, double c_re, double c_im, bool adjoint, const double* x, double* y){
+
+  /* Contract the factors one mode at a time */
+  const double* src = x;
+  for (size_t k = 0; k < term.modes.size(); k++) {
+    double* dst = buf[k % 2].data();
+    if (adjoint) applyFactor(term.modes[k], term.FH_re[k], term.FH_im[k], src, dst);
+    else         applyFactor(term.modes[k], term.F_re[k],  term.F_im[k],  src, dst);
+    src = dst;
+  }
+
+  /* y += c * src */
+  for (PetscInt i = 0; i < dim; i++) {
+    double sr = src[i];
+    double si = src[i + dim];
+    y[i]       += c_re*sr - c_im*si;
+    y[i + dim] += c_re*si + c_im*sr;
+  }
+}
+
+void KronOperator::apply(const double* x, double* y, bool adjoint){
+
+  std::fill(y, y + 2*dim, 0.0);
+  for (size_t it = 0; it < terms.size(); it++) {
+    const SuperTerm& term = terms[it];
+    double g = group_coeff[term.group];
+    if (fabs(g) < 1e-14) continue;
+    // Transpose of the real-valued RHS is the conjugate transpose of the complex operator
+    double c_re = g * term.coeff_re;
+    double c_im = adjoint ? -g * term.coeff_im : g * term.coeff_im;
+    addTerm(term, c_re, c_im, adjoint, x, y);
+  }
+}
+
+double KronOperator::groupInnerProduct(int group, const double* x, const double* xbar){
+
+  std::fill(acc.begin(), acc.end(), 0.0);
+  bool found = false;
+  for (size_t it = 0; it < terms.size(); it++) {
+    if (terms[it].group != group) continue;
+    addTerm(terms[it], terms[it].coeff_re, terms[it].coeff_im, false, x, acc.data());
+    found = true;
+  }
+  if (!found) return 0.0;
+
+  double dot = 0.0;
+  for (PetscInt i = 0; i < 2*dim; i++) dot += xbar[i] * acc[i];
+  return dot;
+}
+
+size_t KronOperator::getFactorMemory() const {
+  size_t n = 0;
+  for (size_t it = 0; it < terms.size(); it++) {
+    for (size_t k = 0; k < terms[it].modes.size(); k++) {
+      n += 4 * terms[it].F_re[k].size();  // F and its conjugate transpose, real and imaginary parts
+    }
+  }
+  return n * sizeof(double);
+}
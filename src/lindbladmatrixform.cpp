@@ -0,0 +1,203 @@
+#include "lindbladmatrixform.hpp"
+#include <algorithm>
+
+LindbladMatrixForm::LindbladMatrixForm(){
+  N = 0;
+}
+
+LindbladMatrixForm::LindbladMatrixForm(PetscInt N_, int ngroups) : LindbladMatrixForm() {
+  N = N_;
+  group_coeff.assign(ngroups, 0.0);
+  group_coeff[0] = 1.0;
+  work.resize(2*N*N);
+  acc.resize(2*N*N);
+}
+
+LindbladMatrixForm::~LindbladMatrixForm(){}
+
+void LindbladMatrixForm::addTerm(int group, bool imag, const std::vector<PetscInt>& csr_i, const std::vector<PetscInt>& csr_j, const std::vector<double>& csr_v){
+
+  if (csr_j.size() == 0) return;
+
+  SmallCSR T;
+  T.rowptr = csr_i;
+  T.cols = csr_j;
+  T.re.assign(csr_v.size(), 0.0);
+  T.im.assign(csr_v.size(), 0.0);
+  if (imag) T.im = csr_v;
+  else T.re = csr_v;
+  terms.push_back(T);
+  term_group.push_back(group);
+}
+
+void LindbladMatrixForm::addJump(double gamma, const std::vector<PetscInt>& csr_i, const std::vector<PetscInt>& csr_j, const std::vector<double>& csr_v){
+
+  if (gamma <= 0.0 || csr_j.size() == 0) return;
+
+  SmallCSR L;
+  L.rowptr = csr_i;
+  L.cols = csr_j;
+  L.re = csr_v;
+  L.im.assign(csr_v.size(), 0.0);
+  jumps.push_back(L);
+  jump_gamma.push_back(gamma);
+
+  /* -gamma/2 L^T L = -gamma/2 sum_r L[r,:]^T L[r,:] */
+  SparseEntries LTL(0, N);
+  for (PetscInt r = 0; r < N; r++) {
+    for (PetscInt e1 = csr_i[r]; e1 < csr_i[r+1]; e1++) {
+      for (PetscInt e2 = csr_i[r]; e2 < csr_i[r+1]; e2++) {
+        LTL.add(csr_j[e1], csr_j[e2], -gamma/2. * csr_v[e1] * csr_v[e2]);
+      }
+    }
+  }
+  std::vector<PetscInt> ltl_i, ltl_j;
+  std::vector<double> ltl_v;
+  LTL.getCSR(ltl_i, ltl_j, ltl_v);
+  addTerm(0, false, ltl_i, ltl_j, ltl_v);
+}
+
+void LindbladMatrixForm::finalize(){
+
+  /* Pattern of M: union of the patterns of all terms */
+  M.rowptr.assign(N+1, 0);
+  M.cols.clear();
+  std::vector<PetscInt> rowcols;
+  for (PetscInt r = 0; r < N; r++) {
+    rowcols.clear();
+    for (size_t t = 0; t < terms.size(); t++) {
+      rowcols.insert(rowcols.end(), terms[t].cols.begin() + terms[t].rowptr[r], terms[t].cols.begin() + terms[t].rowptr[r+1]);
+    }
+    std::sort(rowcols.begin(), rowcols.end());
+    rowcols.erase(std::unique(rowcols.begin(), rowcols.end()), rowcols.end());
+    M.cols.insert(M.cols.end(), rowcols.begin(), rowcols.end());
+    M.rowptr[r+1] = M.cols.size();
+  }
+  M.re.assign(M.cols.size(), 0.0);
+  M.im.assign(M.cols.size(), 0.0);
+
+  /* Position of each term entry in the pattern */
+  term_slots.resize(terms.size());
+  for (size_t t = 0; t < terms.size(); t++) {
+    term_slots[t].resize(terms[t].cols.size());
+    for (PetscInt r = 0; r < N; r++) {
+      for (PetscInt e = terms[t].rowptr[r]; e < terms[t].rowptr[r+1]; e++) {
+        term_slots[t][e] = std::lower_bound(M.cols.begin() + M.rowptr[r], M.cols.begin() + M.rowptr[r+1], terms[t].cols[e]) - M.cols.begin();
+      }
+    }
+  }
+
+  setCoefficients(std::vector<double>(group_coeff.size() - 1, 0.0));
+}
+
+void LindbladMatrixForm::setCoefficients(const std::vector<double>& coeffs){
+
+  for (size_t g = 1; g < group_coeff.size(); g++) group_coeff[g] = coeffs[g-1];
+
+  std::fill(M.re.begin(), M.re.end(), 0.0);
+  std::fill(M.im.begin(), M.im.end(), 0.0);
+  for (size_t t = 0; t < terms.size(); t++) {
+    double c = group_coeff[term_group[t]];
+    if (c == 0.0) continue;
+    const std::vector<PetscInt>& slots = term_slots[t];
+    for (size_t e = 0; e < slots.size(); e++) {
+      M.re[slots[e]] += c * terms[t].re[e];
+      M.im[slots[e]] += c * terms[t].im[e];
+    }
+  }
+}
+
+void LindbladMatrixForm::leftMult(const SmallCSR& T, bool conjtranspose, const double* x, double* y) const {
+
+  const double* x_re = x;
+  const double* x_im = x + N*N;
+  double* y_re = y;
+  double* y_im = y + N*N;
+  double s = conjtranspose ? -1.0 : 1.0;
+
+  /* One column of x at a time */
+  for (PetscInt c = 0; c < N; c++) {
+    const double* xr = x_re + c*N;
+    const double* xi = x_im + c*N;
+    double* yr = y_re + c*N;
+    double* yi = y_im + c*N;
+    for (PetscInt k = 0; k < N; k++) {
+      for (PetscInt e = T.rowptr[k]; e < T.rowptr[k+1]; e++) {
+        double tr = T.re[e];
+        double ti = s * T.im[e];
+        PetscInt j = T.cols[e];
+        if (!conjtranspose) {
+          // y[k,c] += T[k,j] x[j,c]
+          yr[k] += tr*xr[j] - ti*xi[j];
+          yi[k] += tr*xi[j] + ti*xr[j];
+        } else {
+          // y[j,c] += conj(T[k,j]) x[k,c]
+          yr[j] += tr*xr[k] - ti*xi[k];
+          yi[j] += tr*xi[k] + ti*xr[k];
+        }
+      }
+    }
+  }
+}
+
+void LindbladMatrixForm::rightMult(const SmallCSR& T, bool conjtranspose, const double* x, double* y) const {
+
+  const double* x_re = x;
+  const double* x_im = x + N*N;
+  double* y_re = y;
+  double* y_im = y + N*N;
+  double s = conjtranspose ? -1.0 : 1.0;
+
+  /* Axpys on whole columns: x T adds T[k,j] x[:,k] to y[:,j], x T^dagger adds conj(T[k,j]) x[:,j] to y[:,k] */
+  for (PetscInt k = 0; k < N; k++) {
+    for (PetscInt e = T.rowptr[k]; e < T.rowptr[k+1]; e++) {
+      double tr = T.re[e];
+      double ti = s * T.im[e];
+      PetscInt j = T.cols[e];
+      PetscInt src = conjtranspose ? j : k;
+      PetscInt dst = conjtranspose ? k : j;
+      const double* xr = x_re + src*N;
+      const double* xi = x_im + src*N;
+      double* yr = y_re + dst*N;
+      double* yi = y_im + dst*N;
+      for (PetscInt r = 0; r < N; r++) {
+        yr[r] += tr*xr[r] - ti*xi[r];
+        yi[r] += tr*xi[r] + ti*xr[r];
+      }
+    }
+  }
+}
+
+void LindbladMatrixForm::apply(const double* x, double* y, bool adjoint){
+
+  std::fill(y, y + 2*N*N, 0.0);
+
+  // Forward: M rho + rho M^dagger. Adjoint: M^dagger rho + rho M.
+  leftMult(M, adjoint, x, y);
+  rightMult(M, !adjoint, x, y);
+
+  // Collapse terms: gamma L rho L^T, or gamma L^T rho L for the adjoint
+  for (size_t j = 0; j < jumps.size(); j++) {
+    std::fill(work.begin(), work.end(), 0.0);
+    leftMult(jumps[j], adjoint, x, work.data());
+    for (size_t i = 0; i < work.size(); i++) work[i] *= jump_gamma[j];
+    rightMult(jumps[j], !adjoint, work.data(), y);
+  }
+}
+
+double LindbladMatrixForm::groupInnerProduct(int group, const double* x, const double* xbar){
+
+  std::fill(acc.begin(), acc.end(), 0.0);
+  bool found = false;
+  for (size_t t = 0; t < terms.size(); t++) {
+    if (term_group[t] != group) continue;
+    leftMult(terms[t], false, x, acc.data());
+    rightMult(terms[t], true, x, acc.data());
+    found = true;
+  }
+  if (!found) return 0.0;
+
+  double dot = 0.0;
+  for (size_t i = 0; i < acc.size(); i++) dot += xbar[i] * acc[i];
+  return dot;
+}
@@ -26,9 +26,9 @@ int main(int argc,char **argv)
   char filename[255];
   PetscErrorCode ierr;
 
-  /* Initialize MPI */
-  int mpisize_world, mpirank_world;
-  MPI_Init(&argc, &argv);
+  /* Initialize MPI. Only the main thread calls MPI, the background output writer does not. */
+  int mpisize_world, mpirank_world, mpi_thread_level;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &mpi_thread_level);
   MPI_Comm_rank(MPI_COMM_WORLD, &mpirank_world);
   MPI_Comm_size(MPI_COMM_WORLD, &mpisize_world);
 
@@ -98,6 +98,7 @@ int main(int argc,char **argv)
   else if (runtypestr.compare("gradient")     == 0)    runtype = RunType::GRADIENT;
   else if (runtypestr.compare("optimization")== 0)     runtype = RunType::OPTIMIZATION;
   else if (runtypestr.compare("evalcontrols")== 0)     runtype = RunType::EVALCONTROLS;
+  else if (runtypestr.compare("hessian")== 0)          runtype = RunType::HESSIAN;
   else {
     printf("\n\n WARNING: Unknown runtype: %s.\n\n", runtypestr.c_str());
     runtype = RunType::NONE;
@@ -170,18 +171,26 @@ int main(int argc,char **argv)
   MPI_Comm comm_optim, comm_init, comm_petsc;
 
   /* Get the size of communicators  */
-  // Number of cores for optimization. Under development, set to 1 for now. 
-  // int np_optim= config.GetIntParam("np_optim", 1);
-  // np_optim= min(np_optim, mpisize_world); 
-  int np_optim= 1;
+  // Number of processor groups for optimization. Each group runs an independent optimization from its own starting point (multi-start). 
+  int np_optim= config.GetIntParam("np_optim", 1, false);
+  if (np_optim > 1 && runtype != RunType::OPTIMIZATION) {
+    if (mpirank_world == 0 && !quietmode) printf("# Warning: np_optim > 1 is only used for runtype 'optimization'. Setting np_optim = 1.\n");
+    np_optim = 1;
+  }
+  np_optim = std::max(1, std::min(np_optim, mpisize_world));
+  if (mpisize_world % np_optim != 0) {
+    if (mpirank_world == 0) printf("ERROR: Number of threads (%d) must be an integer multiple of np_optim (%d)!\n", mpisize_world, np_optim);
+    exit(1);
+  }
+  int mpisize_group = mpisize_world / np_optim;
   // Number of cores for initial condition distribution. Since this gives perfect speedup, choose maximum.
-  int np_init = std::min(ninit, mpisize_world); 
+  int np_init = std::min(ninit, mpisize_group); 
   // Number of cores for Petsc: All the remaining ones. 
   int np_petsc = mpisize_world / (np_init * np_optim);
 
   /* Sanity check for communicator sizes */ 
-  if (mpisize_world % ninit != 0 && ninit % mpisize_world != 0) {
-    if (mpirank_world == 0) printf("ERROR: Number of threads (%d) must be integer multiplier or divisor of the number of initial conditions (%d)!\n", mpisize_world, ninit);
+  if (mpisize_group % ninit != 0 && ninit % mpisize_group != 0) {
+    if (mpirank_world == 0) printf("ERROR: Number of threads per optim group (%d) must be integer multiplier or divisor of the number of initial conditions (%d)!\n", mpisize_group, ninit);
     exit(1);
   }
 
@@ -192,7 +201,7 @@ int main(int argc,char **argv)
   MPI_Comm_rank(comm_init, &mpirank_init);
   MPI_Comm_size(comm_init, &mpisize_init);
 
-  // Time-parallel Optimization
+  // Parallel optimization (multi-start)
   int color_optim = mpirank_world % np_petsc + mpirank_init * np_petsc;
   MPI_Comm_split(MPI_COMM_WORLD, color_optim, mpirank_world, &comm_optim);
   MPI_Comm_rank(comm_optim, &mpirank_optim);
@@ -207,7 +216,7 @@ int main(int argc,char **argv)
   /* Set Petsc using petsc's communicator */
   PETSC_COMM_WORLD = comm_petsc;
 
-  if (mpirank_world == 0 && !quietmode)  std::cout<< "Parallel distribution: " << mpisize_init << " np_init  X  " << mpisize_petsc<< " np_petsc  " << std::endl;
+  if (mpirank_world == 0 && !quietmode)  std::cout<< "Parallel distribution: " << mpisize_init << " np_init  X  " << mpisize_petsc<< " np_petsc  X  " << mpisize_optim << " np_optim  " << std::endl;
 
 #ifdef WITH_SLEPC
   ierr = SlepcInitialize(&argc, &argv, (char*)0, NULL);if (ierr) return ierr;
@@ -320,7 +329,14 @@ int main(int argc,char **argv)
   // for (int i = Jkl.size(); i < (noscillators-1) * noscillators / 2; i++) Jkl.push_back(0.0);
   // Sanity check for matrix free solver
   bool usematfree = config.GetBoolParam("usematfree", false);
-  if (usematfree && nlevels.size() > 5){
+  // Hamiltonian files in the factored (Kronecker) format are applied matrix-free for any number of oscillators
+  std::string hamiltonian_file_Hsys = config.GetStrParam("hamiltonian_file_Hsys", "none", true, false);
+  std::string hamiltonian_file_Hc = config.GetStrParam("hamiltonian_file_Hc", "none", true, false);
+  bool hamiltonian_from_file = hamiltonian_file_Hsys.compare("none") != 0 || hamiltonian_file_Hc.compare("none") != 0;
+  bool hamiltonian_kronecker = hamiltonian_from_file;
+  if (hamiltonian_file_Hsys.compare("none") != 0 && !HamiltonianFileReader::isKronecker(hamiltonian_file_Hsys)) hamiltonian_kronecker = false;
+  if (hamiltonian_file_Hc.compare("none") != 0 && !HamiltonianFileReader::isKronecker(hamiltonian_file_Hc)) hamiltonian_kronecker = false;
+  if (usematfree && nlevels.size() > 5 && !hamiltonian_kronecker){
         printf("Warning: Matrix free solver is only implemented for systems with 2, 3, 4, or 5 oscillators. Switching to sparse-matrix solver now.\n");
         usematfree = false;
   }
@@ -338,18 +354,77 @@ int main(int argc,char **argv)
     }
   }
   // Check if Hamiltonian should be read from file
-  std::string hamiltonian_file_Hsys = config.GetStrParam("hamiltonian_file_Hsys", "none", true, false);
-  std::string hamiltonian_file_Hc = config.GetStrParam("hamiltonian_file_Hc", "none", true, false);
-  if ((hamiltonian_file_Hsys.compare("none") != 0 ||hamiltonian_file_Hc.compare("none") != 0 ) && usematfree) {
-    if (mpirank_world==0 && !quietmode) printf("# Warning: Matrix-free solver can not be used when Hamiltonian is read fromfile. Switching to sparse-matrix version.\n");
+  if (hamiltonian_from_file && !hamiltonian_kronecker && usematfree) {
+    if (mpirank_world==0 && !quietmode) printf("# Warning: Matrix-free solver can only be used when Hamiltonian files are in the factored (Kronecker) format. Switching to sparse-matrix version.\n");
     usematfree = false;
   }
-  // Initialize Master equation
-  MasterEq* mastereq = new MasterEq(nlevels, nessential, oscil_vec, crosskerr, Jkl, eta, lindbladtype, usematfree, hamiltonian_file_Hsys, hamiltonian_file_Hc, quietmode);
+  // Merged sparse matrix for the sparse-matrix solver
+  bool usemergedsparse = config.GetBoolParam("usemergedsparse", false, false);
+  // Stored transposes of the sparse matrices for the adjoint
+  bool usesparsetranspose = config.GetBoolParam("usesparsetranspose", false, false);
+  // Matrix-form Lindblad solver with N x N operators
+  bool usematrixform = config.GetBoolParam("usematrixform", false, false);
+  if (usematrixform && mpisize_petsc > 1) {
+    if (mpirank_world==0 && !quietmode) printf("# Warning: The matrix-form Lindblad solver is serial. Switching to the vectorized sparse-matrix version.\n");
+    usematrixform = false;
+  }
+  // Row tile size of the matrix-free Lindblad kernels
+  int matfree_tilesize = config.GetIntParam("matfree_tilesize", 0, false);
+  // Storage layout of the state vector: blocked [u,v] or interleaved (re, im)
+  std::string state_layout_str = config.GetStrParam("state_layout", "blocked", true, false);
+  StateLayout state_layout;
+  if      (state_layout_str.compare("blocked")     == 0) state_layout = StateLayout::BLOCKED;
+  else if (state_layout_str.compare("interleaved") == 0) state_layout = StateLayout::INTERLEAVED;
+  else {
+    printf("\n\n ERROR: Unknown state layout: %s. Choose blocked or interleaved.\n\n", state_layout_str.c_str());
+    exit(1);
+  }
+  if (state_layout == StateLayout::INTERLEAVED && ((usematrixform && lindbladtype != LindbladType::NONE) || (usematfree && hamiltonian_kronecker))) {
+    if (mpirank_world==0 && !quietmode) printf("# Warning: The interleaved state layout is not available for the matrix-form or Kronecker solvers. Switching to the blocked layout.\n");
+    state_layout = StateLayout::BLOCKED;
+  }
+  setStateLayout(state_layout);
+  // Evolve only the upper triangle of the Hermitian density matrix
+  bool hermitian_packed = config.GetBoolParam("hermitian_packed", false, false);
+  if (hermitian_packed && (lindbladtype == LindbladType::NONE || mpisize_petsc > 1 || config.GetDoubleParam("optim_penalty_dpdm", 0.0, false) > 1e-13)) {
+    if (mpirank_world==0 && !quietmode) printf("# Warning: The Hermitian-packed state is only available for serial Lindblad solvers without the dpdm penalty. Switching to the full state.\n");
+    hermitian_packed = false;
+  }
+  // The built-in initial conditions are Hermitian. An initial density matrix read from file is checked here.
+  if (hermitian_packed && initcondstr[0].compare("file") == 0 && initcondstr.size() == 2) {
+    int dim_ess = 1;
+    for (size_t iosc = 0; iosc < nessential.size(); iosc++) dim_ess *= nessential[iosc];
+    int isHermitian = 1;
+    if (mpirank_world == 0) {
+      std::vector<double> rho(2*dim_ess*dim_ess);
+      read_vector(initcondstr[1].c_str(), rho.data(), 2*dim_ess*dim_ess, true);
+      for (int j = 0; j < dim_ess; j++) {
+        for (int k = 0; k < j; k++) {
+          double re_kj = rho[k + j*dim_ess], re_jk = rho[j + k*dim_ess];
+          double im_kj = rho[k + j*dim_ess + dim_ess*dim_ess], im_jk = rho[j + k*dim_ess + dim_ess*dim_ess];
+          if (fabs(re_kj - re_jk) > 1e-12 || fabs(im_kj + im_jk) > 1e-12) isHermitian = 0;
+        }
+        if (fabs(rho[j + j*dim_ess + dim_ess*dim_ess]) > 1e-12) isHermitian = 0;
+      }
+    }
+    MPI_Bcast(&isHermitian, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!isHermitian) {
+      if (mpirank_world==0 && !quietmode) printf("# Warning: The Hermitian-packed state requires a Hermitian initial condition, but the one read from %s is not Hermitian. Switching to the full state.\n", initcondstr[1].c_str());
+      hermitian_packed = false;
+    }
+  }
+  // Apply the RHS of small systems as one dense matrix, with a dense LU solve in the implicit midpoint rule
+  int dense_maxdim = config.GetIntParam("dense_maxdim", 0, false);
+  // Initialize Master equation. Time the assembly of the system matrices.
+  double SetupStartTime = MPI_Wtime();
+  MasterEq* mastereq = new MasterEq(nlevels, nessential, oscil_vec, crosskerr, Jkl, eta, lindbladtype, usematfree, usemergedsparse, usesparsetranspose, usematrixform, matfree_tilesize, hermitian_packed, dense_maxdim, hamiltonian_file_Hsys, hamiltonian_file_Hc, quietmode);
+  double mySetupTime = MPI_Wtime() - SetupStartTime;
+  double SetupTime = mySetupTime;
+  MPI_Allreduce(&mySetupTime, &SetupTime, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
 
 
   /* Output */
-  Output* output = new Output(config, comm_petsc, comm_init, nlevels.size(), quietmode);
+  Output* output = new Output(config, comm_petsc, comm_init, comm_optim, nlevels.size(), quietmode);
 
   // Some screen output 
   if (mpirank_world == 0 && !quietmode) {
@@ -396,9 +471,10 @@ int main(int argc,char **argv)
     printf("\n\n ERROR: Unknow timestepping type: %s.\n\n", timesteppertypestr.c_str());
     exit(1);
   }
+  mytimestepper->useControlTable = config.GetBoolParam("control_table", true, false);
 
   /* --- Initialize optimization --- */
-  OptimProblem* optimctx = new OptimProblem(config, mytimestepper, comm_init, comm_optim, ninit, output, quietmode);
+  OptimProblem* optimctx = new OptimProblem(config, mytimestepper, comm_init, comm_optim, ninit, output, rand_engine, quietmode);
 
   /* Set upt solution and gradient vector */
   Vec xinit;
@@ -465,6 +541,62 @@ int main(int argc,char **argv)
     optimctx->getSolution(&opt);
   }
 
+  /* --- Hessian-vector product along a random direction, checked against finite differences of the gradient --- */
+  if (runtype == RunType::HESSIAN) {
+    optimctx->getStartingPoint(xinit);
+    VecCopy(xinit, optimctx->xinit); // Store the initial guess
+    optimctx->checkHessianSupport();
+    optimctx->timestepper->writeTrajectoryDataFiles = false;
+    if (mpirank_world == 0 && !quietmode) printf("\nStarting Hessian-vector product... \n");
+
+    /* Random unit direction, identical on all processors */
+    Vec v, Hv, Hv_fd, xpert, gpert;
+    VecDuplicate(xinit, &v);
+    VecDuplicate(xinit, &Hv);
+    VecDuplicate(xinit, &Hv_fd);
+    VecDuplicate(xinit, &xpert);
+    VecDuplicate(xinit, &gpert);
+    std::uniform_real_distribution<double> unit_dist(-1.0, 1.0);
+    for (PetscInt i=0; i<optimctx->getNdesign(); i++) VecSetValue(v, i, unit_dist(rand_engine), INSERT_VALUES);
+    VecAssemblyBegin(v); VecAssemblyEnd(v);
+    double vnorm;
+    VecNorm(v, NORM_2, &vnorm);
+    VecScale(v, 1.0/vnorm);
+
+    /* Central finite differences of two adjoint gradients */
+    double hess_eps = config.GetDoubleParam("optim_hessian_eps", 1e-6, false);
+    VecWAXPY(xpert, hess_eps, v, xinit);
+    optimctx->evalGradF(xpert, Hv_fd);
+    VecWAXPY(xpert, -hess_eps, v, xinit);
+    optimctx->evalGradF(xpert, gpert);
+    VecAXPY(Hv_fd, -1.0, gpert);
+    VecScale(Hv_fd, 1.0/(2.0*hess_eps));
+
+    /* Gradient at the point of interest, then the Hessian-vector product (second-order adjoint) */
+    optimctx->evalGradF(xinit, grad);
+    VecNorm(grad, NORM_2, &gnorm);
+    optimctx->setHessianPoint(xinit);
+    optimctx->evalHessVec(v, Hv);
+
+    double hvnorm, errnorm;
+    VecNorm(Hv, NORM_2, &hvnorm);
+    VecWAXPY(gpert, -1.0, Hv_fd, Hv);
+    VecNorm(gpert, NORM_2, &errnorm);
+    if (mpirank_world == 0 && !quietmode) {
+      printf("\nGradient norm: %1.14e\n", gnorm);
+      printf("Hessian-vector product norm: %1.14e\n", hvnorm);
+      printf("Relative difference to finite differences: %1.8e\n", errnorm / hvnorm);
+    }
+    optimctx->output->writeGradient(grad);
+    optimctx->output->writeHessVec(v, Hv, Hv_fd);
+
+    VecDestroy(&v);
+    VecDestroy(&Hv);
+    VecDestroy(&Hv_fd);
+    VecDestroy(&xpert);
+    VecDestroy(&gpert);
+  }
+
   /* Only evaluate and write control pulses (no propagation) */
   if (runtype == RunType::EVALCONTROLS) {
     std::vector<double> pt, qt;
@@ -504,6 +636,7 @@ int main(int argc,char **argv)
   if (mpirank_world == 0 && !quietmode) {
     printf("\n");
     printf(" Used Time:        %.2f seconds\n", UsedTime);
+    printf(" Setup Time:       %.4f seconds\n", SetupTime);
     printf(" Processors used:  %d\n", mpisize_world);
     printf(" Global Memory:    %.2f MB    [~ %.2f MB per proc]\n", globalMB, globalMB / mpisize_world);
     printf("\n");
@@ -514,7 +647,7 @@ int main(int argc,char **argv)
   if (mpirank_world == 0) {
     snprintf(filename, 254, "%s/timing.dat", output->datadir.c_str());
     FILE* timefile = fopen(filename, "w");
-    fprintf(timefile, "%d  %1.8e\n", mpisize_world, UsedTime);
+    fprintf(timefile, "%d  %1.8e  %1.8e\n", mpisize_world, UsedTime, SetupTime);
     fclose(timefile);
   }
 
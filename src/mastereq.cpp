@@ -1,4 +1,5 @@
 #include "mastereq.hpp"
+#include <algorithm>
 
 MasterEq::MasterEq(){
   dim = 0;
@@ -7,11 +8,27 @@ MasterEq::MasterEq(){
   Ad     = NULL;
   Bd     = NULL;
   usematfree = false;
+  usemergedsparse = false;
+  usesparsetranspose = false;
+  usematrixform = false;
+  hermitianpacked = false;
+  packedkernels = false;
+  usedense = false;
+  matrixform = NULL;
+  RHS_packed = NULL;
+  RHSdense = NULL;
+  dense_const = NULL;
+  dense_aux = NULL;
+  dir_aux = NULL;
+  Ad_T = NULL;
+  Bd_T = NULL;
   quietmode = false;
+  observables = NULL;
+  kronop = NULL;
 }
 
 
-MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nessential_, Oscillator** oscil_vec_, const std::vector<double>& crosskerr_, const std::vector<double>& Jkl_, const std::vector<double>& eta_, LindbladType lindbladtype_, bool usematfree_, const std::string& hamiltonian_file_Hsys_, const std::string& hamiltonian_file_Hc_, bool quietmode_) {
+MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nessential_, Oscillator** oscil_vec_, const std::vector<double>& crosskerr_, const std::vector<double>& Jkl_, const std::vector<double>& eta_, LindbladType lindbladtype_, bool usematfree_, bool usemergedsparse_, bool usesparsetranspose_, bool usematrixform_, int matfree_tilesize_, bool hermitianpacked_, int dense_maxdim_, const std::string& hamiltonian_file_Hsys_, const std::string& hamiltonian_file_Hc_, bool quietmode_) {
   nlevels = nlevels_;
   nessential = nessential_;
   noscillators = nlevels.size();
@@ -20,6 +37,20 @@ MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nes
   Jkl = Jkl_;
   eta = eta_;
   usematfree = usematfree_;
+  usematrixform = usematrixform_ && !usematfree && lindbladtype_ != LindbladType::NONE;
+  // The sparse solver for the interleaved state layout always uses the merged 2x2-blocked matrix
+  usemergedsparse = (usemergedsparse_ || getStateLayout() == StateLayout::INTERLEAVED) && !usematfree && !usematrixform;
+  usesparsetranspose = usesparsetranspose_ && !usematfree && !usematrixform;
+  hermitianpacked = hermitianpacked_ && lindbladtype_ != LindbladType::NONE;
+  matrixform = NULL;
+  RHS_packed = NULL;
+  RHSdense = NULL;
+  dense_const = NULL;
+  dense_aux = NULL;
+  dir_aux = NULL;
+  Ad_T = NULL;
+  Bd_T = NULL;
+  kronop = NULL;
   lindbladtype = lindbladtype_;
   hamiltonian_file_Hsys = hamiltonian_file_Hsys_;
   hamiltonian_file_Hc = hamiltonian_file_Hc_;
@@ -74,15 +105,30 @@ MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nes
     exit(1);
   }
 
+  /* Small systems: apply the RHS as one dense matrix, built from the merged sparse terms */
+  bool kronecker = usematfree && (hamiltonian_file_Hsys.compare("none") != 0 || hamiltonian_file_Hc.compare("none") != 0);
+  usedense = dense_maxdim_ > 0 && 2*dim <= dense_maxdim_ && mpisize_petsc == 1 && !usematrixform && !hermitianpacked && !kronecker;
+  if (usedense) {
+    usematfree = false;
+    usemergedsparse = true;
+    usesparsetranspose = false;
+  }
+  /* The matrix-free kernels apply the RHS to the Hermitian-packed state directly. Other solvers unpack it around the full RHS. */
+  packedkernels = hermitianpacked && usematfree && !kronecker;
+
   // Set local sizes of subvectors u,v in state x=[u,v]
   localsize_u = dim / mpisize_petsc; 
   ilow = mpirank_petsc * localsize_u;
   iupp = ilow + localsize_u;         
 
+  /* Precompute index maps for evaluating energies, populations and leakage */
+  observables = new Observables(nlevels, nessential, lindbladtype, ilow, iupp);
+  for (int iosc = 0; iosc < noscillators; iosc++) oscil_vec[iosc]->setObservables(observables);
+
   /* Create matrix shell for applying system matrix (RHS), */
-  /* dimension: 2*dim x 2*dim for the real-valued system */
-  PetscInt globalsize_x = 2 * dim;  // size of global state vector x=[u,v]
-  PetscInt localsize_x  = 2 * dim / mpisize_petsc;  // local size of state vector x=[u,v]
+  /* dimension: 2*dim x 2*dim for the real-valued system, or dim x dim on the Hermitian-packed state */
+  PetscInt globalsize_x = packedkernels ? dim : 2 * dim;  // size of global state vector x=[u,v]
+  PetscInt localsize_x  = globalsize_x / mpisize_petsc;  // local size of state vector x=[u,v]
   MatCreateShell(PETSC_COMM_WORLD, localsize_x, localsize_x, globalsize_x, globalsize_x, (void**) &RHSctx, &RHS);
   MatSetOptionsPrefix(RHS, "system");
   MatSetFromOptions(RHS); MatSetUp(RHS);
@@ -111,17 +157,51 @@ MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nes
       exit(1);
   }
 
-  /* Initialize Hamiltonian matrices */
-  if (!usematfree) {
+  /* Initialize Hamiltonian matrices, or the Kronecker operator for factored Hamiltonian files */
+  if (usematrixform) {
+    initMatrixForm();
+  } else if (!usematfree) {
     initSparseMatSolver();
-  } 
+    if (usedense) initDenseMat();
+  } else if (hamiltonian_file_Hsys.compare("none") != 0 || hamiltonian_file_Hc.compare("none") != 0) {
+    initKronOperator();
+  }
 
   /* Create vector strides for accessing Re and Im part in x */
-  ISCreateStride(PETSC_COMM_WORLD, localsize_u, ilow*2, 1, &isu);
-  ISCreateStride(PETSC_COMM_WORLD, localsize_u, ilow*2+localsize_u, 1, &isv);
+  PetscInt stride_x, offset_im;
+  getStateStrides(localsize_u, &stride_x, &offset_im);
+  ISCreateStride(PETSC_COMM_WORLD, localsize_u, ilow*2, stride_x, &isu);
+  ISCreateStride(PETSC_COMM_WORLD, localsize_u, ilow*2+offset_im, stride_x, &isv);
 
   /* Allocate MatShell context for applying RHS */
   RHSctx.dim = dim;
+  RHSctx.stride_x = stride_x;
+  RHSctx.offset_im = offset_im;
+
+  /* Tiles of the matrix-free Lindblad kernels: fix leading row (ket) indices until a tile has at most matfree_tilesize_ rows,
+   * and leading column (bra) indices until it has at most matfree_tilesize_ columns */
+  RHSctx.rowtiledepth = 0;
+  RHSctx.coltiledepth = 0;
+  RHSctx.nrowtiles = 1;
+  RHSctx.ntiles = 1;
+  if (usematfree && lindbladtype != LindbladType::NONE && matfree_tilesize_ > 0) {
+    PetscInt tilerows = dim_rho;
+    while (RHSctx.rowtiledepth < noscillators && tilerows > matfree_tilesize_) {
+      tilerows /= nlevels[RHSctx.rowtiledepth];
+      RHSctx.nrowtiles *= nlevels[RHSctx.rowtiledepth];
+      RHSctx.rowtiledepth++;
+    }
+    PetscInt tilecols = dim_rho;
+    int ncoltiles = 1;
+    while (RHSctx.coltiledepth < noscillators && tilecols > matfree_tilesize_) {
+      tilecols /= nlevels[RHSctx.coltiledepth];
+      ncoltiles *= nlevels[RHSctx.coltiledepth];
+      RHSctx.coltiledepth++;
+    }
+    RHSctx.ntiles = RHSctx.nrowtiles * ncoltiles;
+    if (mpirank_world == 0 && !quietmode) printf("Matrix-free solver: %d x %d tiles of %lld rows and %lld columns each.\n", RHSctx.nrowtiles, ncoltiles, (long long)tilerows, (long long)tilecols);
+  }
+  RHSctx.hermitianpacked = packedkernels;
   RHSctx.isu = &isu;
   RHSctx.isv = &isv;
   RHSctx.crosskerr = crosskerr;
@@ -130,7 +210,7 @@ MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nes
   RHSctx.addT1 = addT1;
   RHSctx.addT2 = addT2;
   RHSctx.lindbladtype = lindbladtype;
-  if (!usematfree){
+  if (!usematfree && !usematrixform){
     RHSctx.Ac_vec = Ac_vec;
     RHSctx.Bc_vec = Bc_vec;
     RHSctx.Ad_vec = Ad_vec;
@@ -138,7 +218,19 @@ MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nes
     RHSctx.Ad = &Ad;
     RHSctx.Bd = &Bd;
     RHSctx.aux = &aux;
+    RHSctx.RHSmerged = &merged.A;
+    RHSctx.RHSmerged_T = usesparsetranspose ? &merged_T.A : NULL;
+    // Transposes of the individual terms are only kept if the terms are not merged
+    RHSctx.Ad_T = Ad_T != NULL ? &Ad_T : NULL;
+    RHSctx.Bd_T = Bd_T != NULL ? &Bd_T : NULL;
+    RHSctx.Ac_vec_T = Ac_vec_T;
+    RHSctx.Bc_vec_T = Bc_vec_T;
+    RHSctx.Ad_vec_T = Ad_vec_T;
+    RHSctx.Bd_vec_T = Bd_vec_T;
   }
+  RHSctx.kronop = kronop;
+  RHSctx.matrixform = matrixform;
+  RHSctx.RHSdense = usedense ? &RHSdense : NULL;
   RHSctx.nlevels = nlevels;
   RHSctx.oscil_vec = oscil_vec;
   RHSctx.time = 0.0;
@@ -150,15 +242,49 @@ MasterEq::MasterEq(const std::vector<int>& nlevels_, const std::vector<int>& nes
   for (int iosc = 0; iosc < noscillators*(noscillators-1)/2; iosc++) RHSctx.Bd_coeffs.push_back(0.0);
   for (int iosc = 0; iosc < noscillators*(noscillators-1)/2; iosc++) RHSctx.Ad_coeffs.push_back(0.0);
 
+  /* Assemble the merged sparse matrices once, so that their pattern is fixed from here on */
+  if (usemergedsparse) {
+    updateMergedSparseMat(merged);
+    if (usesparsetranspose) updateMergedSparseMat(merged_T);
+  }
+  if ((usemergedsparse || usesparsetranspose) && !quietmode) reportSparseMemory();
+
   /* Set the MatMult routine for applying the RHS to a vector x */
   set_RHS_MatMult_operation();
+
+  /* Create matrix shell for the Hermitian-packed state, dimension N^2 x N^2. It wraps the RHS on the full state. */
+  if (hermitianpacked && !packedkernels) {
+    MatCreateVecs(RHS, &packed_xfull, &packed_yfull);
+    packedctx.RHS = &RHS;
+    packedctx.xfull = &packed_xfull;
+    packedctx.yfull = &packed_yfull;
+    MatCreateShell(PETSC_COMM_WORLD, dim, dim, dim, dim, (void**) &packedctx, &RHS_packed);
+    MatSetOptionsPrefix(RHS_packed, "system");
+    MatSetFromOptions(RHS_packed); MatSetUp(RHS_packed);
+    MatAssemblyBegin(RHS_packed, MAT_FINAL_ASSEMBLY); MatAssemblyEnd(RHS_packed, MAT_FINAL_ASSEMBLY);
+    MatShellSetOperation(RHS_packed, MATOP_MULT, (void(*)(void)) applyRHS_hermitianpacked);
+    MatShellSetOperation(RHS_packed, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_hermitianpacked_transpose);
+  }
+  if (hermitianpacked && mpirank_world == 0 && !quietmode) printf("# Hermitian-packed state: %lld real entries instead of %lld.\n", (long long)dim, (long long)(2*dim));
 }
 
 
 MasterEq::~MasterEq(){
   if (dim > 0){
     MatDestroy(&RHS);
-    if (!usematfree){
+    if (usedense) {
+      MatDestroy(&RHSdense);
+      MatDestroy(&dense_const);
+      for (size_t i = 0; i < dense_terms.size(); i++) MatDestroy(&(dense_terms[i]));
+      VecDestroy(&dense_aux);
+    }
+    if (dir_aux != NULL) VecDestroy(&dir_aux);
+    if (RHS_packed != NULL) {
+      MatDestroy(&RHS_packed);
+      VecDestroy(&packed_xfull);
+      VecDestroy(&packed_yfull);
+    }
+    if (!usematfree && !usematrixform){
       MatDestroy(&Ad);
       MatDestroy(&Bd);
       for (size_t k=0; k<Ad_vec.size(); k++) {
@@ -172,6 +298,9 @@ MasterEq::~MasterEq(){
         }
       }
       VecDestroy(&aux);
+      if (merged.A != NULL) MatDestroy(&merged.A);
+      if (merged_T.A != NULL) MatDestroy(&merged_T.A);
+      destroyTransposedTerms();
       for (size_t i=0; i<Ac_vec.size(); i++){
         if (Ac_vec[i] != NULL) {
           MatDestroy(&(Ac_vec[i]));
@@ -183,90 +312,234 @@ MasterEq::~MasterEq(){
         }
       }
     }
+    if (kronop != NULL) delete kronop;
+    if (matrixform != NULL) delete matrixform;
     ISDestroy(&isu);
     ISDestroy(&isv);
+    delete observables;
   }
 }
 
 
 void MasterEq::initSparseMatSolver(){
 
-  /* Allocate system matrices. Those will be applied to subvectors u and v */
+  /* System matrices will be applied to subvectors u and v. Each processor collects the entries of its */
+  /* own rows [ilow, iupp) first, the matrices are then created with exact preallocation. */
   PetscInt globalsize = dim; // Global size of subvectors u or v 
-  PetscInt localsize = globalsize / mpisize_petsc;   // local subvector size
 
   // Time-independent system Hamiltonian
   // Ad = real(-i Hsys) and Bd = imag(-i Hsys)
-  MatCreate(PETSC_COMM_WORLD, &Ad);
-  MatCreate(PETSC_COMM_WORLD, &Bd);
-  MatSetSizes(Ad, localsize, localsize, globalsize, globalsize);
-  MatSetSizes(Bd, localsize, localsize, globalsize, globalsize);
-  MatSetType(Ad, MATMPIAIJ);
-  MatSetType(Bd, MATMPIAIJ);
-  if (addT1 || addT2) MatMPIAIJSetPreallocation(Ad, noscillators+5, NULL, noscillators+5, NULL);
-  MatMPIAIJSetPreallocation(Bd, 1, NULL, 1, NULL);
-  MatSetUp(Ad);
-  MatSetUp(Bd);
-  MatSetFromOptions(Ad);
-  MatSetFromOptions(Bd);
-
-  MatSetOption(Ad, MAT_NEW_NONZERO_ALLOCATION_ERR, PETSC_FALSE);
+  SparseEntries Ad_entries(ilow, iupp);
+  SparseEntries Bd_entries(ilow, iupp);
 
   // One control operator per oscillator
   // Ac = real(-i Hc) and Bc = imag(-i Hc)
+  std::vector<SparseEntries> Ac_entries(noscillators, SparseEntries(ilow, iupp));
+  std::vector<SparseEntries> Bc_entries(noscillators, SparseEntries(ilow, iupp));
+
+  // Time-dependent system Hamiltonian matrices (other than controls), only if Jkl>0
+  std::vector<SparseEntries> Adkl_entries;
+  std::vector<SparseEntries> Bdkl_entries;
+  for (size_t k = 0; k < Jkl.size(); k++) {
+    if (fabs(Jkl[k]) > 1e-12) {
+      Adkl_entries.push_back(SparseEntries(ilow, iupp));
+      Bdkl_entries.push_back(SparseEntries(ilow, iupp));
+    }
+  }
+
+  PetscInt dimmat = dim_rho; // this is N!
+
+  /* Hamiltonian terms, vectorized for the Lindblad solver */
+  collectHamiltonianEntries(lindbladtype, Ad_entries, Bd_entries, Ac_entries, Bc_entries, Adkl_entries, Bdkl_entries);
+
+  // // Test if Bd is symmetric 
+  // PetscBool isSymm;
+  // double norm = 0.0;
+  // MatIsSymmetric(Bd, 1e-12, &isSymm);
+  // if (!isSymm) {
+  //   printf("ERROR: System hamiltonian is not hermitian!\n");
+  //   exit(1);
+  // }
+  // // Test if Ad is anti-symmetric
+  // Mat AdTest;
+  // MatTranspose(Ad, MAT_INITIAL_MATRIX, &AdTest);
+  // MatAXPY(AdTest, 1.0, Ad, DIFFERENT_NONZERO_PATTERN);
+  // MatNorm(AdTest, NORM_FROBENIUS, &norm);
+  // if (norm > 1e-12) {
+  //   printf("ERROR: System hamiltonian is not hermitian!\n");
+  //   exit(1);
+  // }
+  // MatDestroy(&AdTest);
+
+  /* Set Ad = Lindblad terms */
+  if (addT1 || addT2) {  // leave matrix empty if no T1 or T2 decay
+
+    PetscInt r1,r1a, r1b;
+    PetscInt col1;
+    double val;
+    for (int iosc = 0; iosc < noscillators; iosc++) {
+
+      /* Get T1, T2 times */
+      double gammaT1 = 0.0;
+      double gammaT2 = 0.0;
+      if (oscil_vec[iosc]->getDecayTime()   > 1e-14) gammaT1 = 1./(oscil_vec[iosc]->getDecayTime());
+      if (oscil_vec[iosc]->getDephaseTime() > 1e-14) gammaT2 = 1./(oscil_vec[iosc]->getDephaseTime());
+
+      // Dimensions 
+      int nk     = oscil_vec[iosc]->getNLevels();
+      PetscInt npostk = oscil_vec[iosc]->dim_postOsc;
+
+      /* Iterate over local rows of Ad */
+      for (PetscInt row = ilow; row<iupp; row++){
+
+        /* Add Ad += gamma_j * L \kron L */
+        r1 = row % (dimmat*nk*npostk);
+        r1a = r1 / (dimmat*npostk);
+        r1b = r1 % (npostk*dimmat);
+        r1b = r1b % (nk*npostk);
+        r1b = r1b / npostk;
+        // T1  decay (L1 = a_j)
+        if (addT1) { 
+          if (r1a < nk-1 && r1b < nk-1) {
+            val = gammaT1 * sqrt( (r1a+1) * (r1b+1) );
+            col1 = row + npostk * dimmat + npostk;
+            if (fabs(val)>1e-14) Ad_entries.add(row, col1, val);
+          }
+        }
+        // T2  dephasing (L1 = a_j^Ta_j)
+        if (addT2) { 
+          val = gammaT2 * r1a * r1b ;
+          if (fabs(val)>1e-14) Ad_entries.add(row, row, val);
+        }
+
+        /* Add Ad += - gamma_j/2  I_n  \kron L^TL  */
+        r1 = row % (nk*npostk);
+        r1 = r1 / npostk;
+        if (addT1) {
+          val = - gammaT1/2. * r1;
+          if (fabs(val)>1e-14) Ad_entries.add(row, row, val);
+        }
+        if (addT2) {
+          val = -gammaT2/2. * r1*r1;
+          if (fabs(val)>1e-14) Ad_entries.add(row, row, val);
+        }
+
+        /* Add Ad += - gamma_j/2  L^TL \kron I_n */
+        r1 = row % (nk*npostk*dimmat);
+        r1 = r1 / (npostk*dimmat);
+        if (addT1) {
+          val = -gammaT1/2. * r1;
+          if (fabs(val)>1e-14) Ad_entries.add(row, row, val);
+        }
+        if (addT2) {
+          val = -gammaT2/2. * r1*r1;
+          if (fabs(val)>1e-14) Ad_entries.add(row, row, val);
+        }
+      }
+    }
+  }
+
+  /* Create and assemble all system matrices from the locally collected entries */
+  Ad_entries.createMat(globalsize, &Ad);
+  Bd_entries.createMat(globalsize, &Bd);
   for (int iosc = 0; iosc < noscillators; iosc++) {
     Mat myAcMatk = nullptr, myBcMatk = nullptr;
-    MatCreate(PETSC_COMM_WORLD, &myAcMatk);
-    MatCreate(PETSC_COMM_WORLD, &myBcMatk);
-    MatSetType(myAcMatk, MATMPIAIJ);
-    MatSetType(myBcMatk, MATMPIAIJ);
-    MatSetSizes(myAcMatk, localsize, localsize, globalsize, globalsize);
-    MatSetSizes(myBcMatk, localsize, localsize, globalsize, globalsize);
-    if (lindbladtype != LindbladType::NONE) {
-      MatMPIAIJSetPreallocation(myAcMatk, 4, NULL, 4, NULL);
-      MatMPIAIJSetPreallocation(myBcMatk, 4, NULL, 4, NULL);
-    } else {
-      MatMPIAIJSetPreallocation(myAcMatk, 2, NULL, 2, NULL);
-      MatMPIAIJSetPreallocation(myBcMatk, 2, NULL, 2, NULL);
-    }
-    MatSetUp(myAcMatk);
-    MatSetUp(myBcMatk);
-    MatSetFromOptions(myAcMatk);
-    MatSetFromOptions(myBcMatk); 
+    Ac_entries[iosc].createMat(globalsize, &myAcMatk);
+    Bc_entries[iosc].createMat(globalsize, &myBcMatk);
     Ac_vec.push_back(myAcMatk);
     Bc_vec.push_back(myBcMatk);
   }
-  // Time-dependent system Hamiltonian matrices (other than controls)
-  int id_kl = 0;
-  for (int iosc = 0; iosc < noscillators; iosc++) {
-    for (int josc=iosc+1; josc<noscillators; josc++){
-      if (fabs(Jkl[id_kl]) > 1e-12) { // only allocate if Jkl>0
-        Mat myAdkl = nullptr; 
-        Mat myBdkl = nullptr;
-        MatCreate(PETSC_COMM_WORLD, &myAdkl);
-        MatCreate(PETSC_COMM_WORLD, &myBdkl);
-        MatSetType(myAdkl, MATMPIAIJ);
-        MatSetType(myBdkl, MATMPIAIJ);
-        MatSetSizes(myAdkl, localsize, localsize, globalsize, globalsize);
-        MatSetSizes(myBdkl, localsize, localsize, globalsize, globalsize);
-        if (lindbladtype != LindbladType::NONE) {
-          MatMPIAIJSetPreallocation(myAdkl, 4, NULL, 4, NULL);
-          MatMPIAIJSetPreallocation(myBdkl, 4, NULL, 4, NULL);
-        } else {
-          MatMPIAIJSetPreallocation(myAdkl, 2, NULL, 2, NULL);
-          MatMPIAIJSetPreallocation(myBdkl, 2, NULL, 2, NULL);
-        }
-        MatSetUp(myAdkl);
-        MatSetUp(myBdkl);
-        MatSetFromOptions(myAdkl);
-        MatSetFromOptions(myBdkl);
-        Ad_vec.push_back(myAdkl);
-        Bd_vec.push_back(myBdkl);
-      }
-      id_kl++;
+  for (size_t kl = 0; kl < Adkl_entries.size(); kl++) {
+    Mat myAdkl = nullptr, myBdkl = nullptr;
+    Adkl_entries[kl].createMat(globalsize, &myAdkl);
+    Bdkl_entries[kl].createMat(globalsize, &myBdkl);
+    Ad_vec.push_back(myAdkl);
+    Bd_vec.push_back(myBdkl);
+  }
+
+    // printf("Ad =");
+    // MatView(Ad, NULL);
+    // printf("Bd =");
+    // MatView(Bd, NULL);
+    // for (int iosc =0; iosc < Ac_vec.size(); iosc++){
+    //   printf("Ac %d=", iosc);
+    //   MatView(Ac_vec[iosc][0], NULL);
+    // }
+    // for (int iosc =0; iosc < Bc_vec.size(); iosc++){
+    //   printf("Bc %d=", iosc);
+    //   MatView(Bc_vec[iosc][0], NULL);
+    // }
+
+
+//   // Test: Print out Hamiltonian terms.
+  // printf("\n\n HEYHEY! Printing out the system matrices: \n\n");
+  // printf("Ad=\n");
+  // MatView(Ad, NULL);
+  // printf("Bd=\n");
+  // MatView(Bd, NULL);
+  // for (int i=0; i<Bc_vec.size(); i++){
+  //   printf("Oscil %d, Bc :\n",i);
+  //   MatView(Bc_vec[i], NULL);
+  // }
+  // for (int i=0; i<Ac_vec.size(); i++){
+  //   printf("Oscil %d, Ac:\n", i);
+  //   MatView(Ac_vec[i], NULL);
+  // }
+//   for (int kl=0; kl<Ad_vec.size(); kl++) {
+//     printf("Bd_vec[%d]=\n", kl);
+//     MatView(Bd_vec[kl], NULL);
+//     printf("Ad_vec[%d]=\n", kl);
+//     MatView(Ad_vec[kl], NULL);
+//   }
+//  // exit(1);
+
+
+  /* Allocate some auxiliary vectors */
+  MatCreateVecs(Bd, &aux, NULL);
+
+  /* Store transposed copies of all terms, if requested. Those are constant. */
+  if (usesparsetranspose) {
+    MatTranspose(Ad, MAT_INITIAL_MATRIX, &Ad_T);
+    MatTranspose(Bd, MAT_INITIAL_MATRIX, &Bd_T);
+    for (size_t i = 0; i < Ac_vec.size(); i++) {
+      Mat AcT, BcT;
+      MatTranspose(Ac_vec[i], MAT_INITIAL_MATRIX, &AcT);
+      MatTranspose(Bc_vec[i], MAT_INITIAL_MATRIX, &BcT);
+      Ac_vec_T.push_back(AcT);
+      Bc_vec_T.push_back(BcT);
+    }
+    for (size_t kl = 0; kl < Ad_vec.size(); kl++) {
+      Mat AdT, BdT;
+      MatTranspose(Ad_vec[kl], MAT_INITIAL_MATRIX, &AdT);
+      MatTranspose(Bd_vec[kl], MAT_INITIAL_MATRIX, &BdT);
+      Ad_vec_T.push_back(AdT);
+      Bd_vec_T.push_back(BdT);
     }
   }
 
+  /* Merge all terms into one real-valued matrix, if requested */
+  if (usemergedsparse) {
+    // Oscillator pair kl of each allocated coupling matrix (only allocated if Jkl != 0)
+    merged_coupling.clear();
+    for (size_t k = 0; k < Jkl.size(); k++) {
+      if (fabs(Jkl[k]) > 1e-12) merged_coupling.push_back(k);
+    }
+    initMergedSparseMat(merged, Ad, Bd, Ac_vec, Bc_vec, Ad_vec, Bd_vec, false);
+    if (usesparsetranspose) {
+      initMergedSparseMat(merged_T, Ad_T, Bd_T, Ac_vec_T, Bc_vec_T, Ad_vec_T, Bd_vec_T, true);
+    }
+  }
+
+  /* Transposed terms are only needed to build the merged transpose */
+  if (usemergedsparse && usesparsetranspose) destroyTransposedTerms();
+}
+
+void MasterEq::collectHamiltonianEntries(LindbladType type, SparseEntries& Ad_entries, SparseEntries& Bd_entries, std::vector<SparseEntries>& Ac_entries, std::vector<SparseEntries>& Bc_entries, std::vector<SparseEntries>& Adkl_entries, std::vector<SparseEntries>& Bdkl_entries){
+
+  /* Rows to collect */
+  PetscInt rlow = Bd_entries.getILow();
+  PetscInt rupp = Bd_entries.getIUpp();
+
   PetscInt dimmat = dim_rho; // this is N!
 
   /* If a Hamiltonian file is given, read the system matrices from file. */ 
@@ -274,9 +547,9 @@ void MasterEq::initSparseMatSolver(){
     if (mpirank_world==0 && !quietmode) printf("\n# Reading Hamiltonian model from files.\n");
 
     /* Read Hamiltonians from file */
-    HamiltonianFileReader* py = new HamiltonianFileReader(hamiltonian_file_Hsys, hamiltonian_file_Hc, lindbladtype, dim_rho, quietmode);
-    py->receiveHsys(Ad, Bd);
-    py->receiveHc(Ac_vec, Bc_vec); 
+    HamiltonianFileReader* py = new HamiltonianFileReader(hamiltonian_file_Hsys, hamiltonian_file_Hc, nlevels, type, dim_rho, quietmode);
+    py->receiveHsys(Ad_entries, Bd_entries);
+    py->receiveHc(Ac_entries, Bc_entries); 
 
     if (mpirank_world==0&& !quietmode) printf("# Done. \n\n");
     delete py;
@@ -297,23 +570,23 @@ void MasterEq::initSparseMatSolver(){
       /* Set control Hamiltonian system matrix real(-iHc) */
       /* Lindblad solver:     Ac = I_N \kron (a - a^T) - (a - a^T)^T \kron I_N   \in C^{N^2 x N^2}*/
       /* Schroedinger solver: Ac = a - a^T   \in C^{N x N}  */
-      for (PetscInt row = ilow; row<iupp; row++){
+      for (PetscInt row = rlow; row<rupp; row++){
         // A_c or I_N \kron A_c
         col1 = row + npostk;
         col2 = row - npostk;
-        if (lindbladtype != LindbladType::NONE) r1 = row % dimmat;   // I_N \kron A_c 
+        if (type != LindbladType::NONE) r1 = row % dimmat;   // I_N \kron A_c 
         else r1 = row;   // A_c
         r1 = r1 % (nk*npostk);
         r1 = r1 / npostk;
         if (r1 < nk-1) {
           val = sqrt(r1+1);
-          if (fabs(val)>1e-14) MatSetValue(Ac_vec[iosc], row, col1, val, ADD_VALUES);
+          if (fabs(val)>1e-14) Ac_entries[iosc].add(row, col1, val);
         }
         if (r1 > 0) {
           val = -sqrt(r1);
-          if (fabs(val)>1e-14) MatSetValue(Ac_vec[iosc], row, col2, val, ADD_VALUES);
+          if (fabs(val)>1e-14) Ac_entries[iosc].add(row, col2, val);
         } 
-        if (lindbladtype != LindbladType::NONE){
+        if (type != LindbladType::NONE){
           //- A_c \kron I_N
           col1 = row + npostk*dimmat;
           col2 = row - npostk*dimmat;
@@ -321,11 +594,11 @@ void MasterEq::initSparseMatSolver(){
           r1 = r1 / (dimmat * npostk);
           if (r1 < nk-1) {
             val =  sqrt(r1+1);
-            if (fabs(val)>1e-14) MatSetValue(Ac_vec[iosc], row, col1, val, ADD_VALUES);
+            if (fabs(val)>1e-14) Ac_entries[iosc].add(row, col1, val);
           }
           if (r1 > 0) {
             val = -sqrt(r1);
-            if (fabs(val)>1e-14) MatSetValue(Ac_vec[iosc], row, col2, val, ADD_VALUES);
+            if (fabs(val)>1e-14) Ac_entries[iosc].add(row, col2, val);
           }
         }
       }
@@ -334,23 +607,23 @@ void MasterEq::initSparseMatSolver(){
       /* Lindblas solver Bc = - I_N \kron (a + a^T) + (a + a^T)^T \kron I_N */
       /* Schroedinger solver: Bc = -(a+a^T) */
       /* Iterate over local rows of Bc_vec */
-      for (int row = ilow; row<iupp; row++){
+      for (int row = rlow; row<rupp; row++){
         // B_c or  I_n \kron B_c 
         col1 = row + npostk;
         col2 = row - npostk;
-        if (lindbladtype != LindbladType::NONE) r1 = row % dimmat; // I_n \kron B_c
+        if (type != LindbladType::NONE) r1 = row % dimmat; // I_n \kron B_c
         else r1 = row;  // -Bc
         r1 = r1 % (nk*npostk);
         r1 = r1 / npostk;
         if (r1 < nk-1) {
           val = -sqrt(r1+1);
-          if (fabs(val)>1e-14) MatSetValue(Bc_vec[iosc], row, col1, val, ADD_VALUES);
+          if (fabs(val)>1e-14) Bc_entries[iosc].add(row, col1, val);
         }
         if (r1 > 0) {
           val = -sqrt(r1);
-          if (fabs(val)>1e-14) MatSetValue(Bc_vec[iosc], row, col2, val, ADD_VALUES);
+          if (fabs(val)>1e-14) Bc_entries[iosc].add(row, col2, val);
         } 
-        if (lindbladtype != LindbladType::NONE){
+        if (type != LindbladType::NONE){
           //+ B_c \kron I_N
           col1 = row + npostk*dimmat;
           col2 = row - npostk*dimmat;
@@ -358,11 +631,11 @@ void MasterEq::initSparseMatSolver(){
           r1 = r1 / (dimmat * npostk);
           if (r1 < nk-1) {
             val =  sqrt(r1+1);
-            if (fabs(val)>1e-14) MatSetValue(Bc_vec[iosc], row, col1, val, ADD_VALUES);
+            if (fabs(val)>1e-14) Bc_entries[iosc].add(row, col1, val);
           }
           if (r1 > 0) {
             val = sqrt(r1);
-            if (fabs(val)>1e-14) MatSetValue(Bc_vec[iosc], row, col2, val, ADD_VALUES);
+            if (fabs(val)>1e-14) Bc_entries[iosc].add(row, col2, val);
           }   
         }
       }
@@ -375,7 +648,7 @@ void MasterEq::initSparseMatSolver(){
     /* Schrodinger solver:
        Ad_kl(t) =  (ak^Tal - akal^T)
        Bd_kl(t) = -(ak^Tal + akal^T)  */
-    id_kl=0;
+    int id_kl=0;
     int matid=0;
     for (int iosc = 0; iosc < noscillators; iosc++) {
       // Dimensions of ioscillator
@@ -390,7 +663,7 @@ void MasterEq::initSparseMatSolver(){
           PetscInt npostj = oscil_vec[josc]->dim_postOsc;
 
           /* Iterate over local rows of Ad_vec / Bd_vec */
-          for (PetscInt row = ilow; row<iupp; row++){
+          for (PetscInt row = rlow; row<rupp; row++){
             // Add +/- I_N \kron (ak^Tal -/+ akal^T) (Lindblad)
             // or  +/- (ak^Tal -/+ akal^T) (Schrodinger)
             r1 = row % (dimmat / nprek);
@@ -401,17 +674,17 @@ void MasterEq::initSparseMatSolver(){
             if (r1a > 0 && r1b < nj-1) {
               val = Jkl[id_kl] * sqrt(r1a * (r1b+1));
               col = row - npostk + npostj;
-               if (fabs(val)>1e-14) MatSetValue(Ad_vec[matid], row, col,  val, ADD_VALUES);
-               if (fabs(val)>1e-14) MatSetValue(Bd_vec[matid], row, col, -val, ADD_VALUES);
+               if (fabs(val)>1e-14) Adkl_entries[matid].add(row, col,  val);
+               if (fabs(val)>1e-14) Bdkl_entries[matid].add(row, col, -val);
             }
             if (r1a < nk-1  && r1b > 0) {
               val = Jkl[id_kl] * sqrt((r1a+1) * r1b);
               col = row + npostk - npostj;
-              if (fabs(val)>1e-14) MatSetValue(Ad_vec[matid], row, col, -val, ADD_VALUES);
-              if (fabs(val)>1e-14) MatSetValue(Bd_vec[matid], row, col, -val, ADD_VALUES);
+              if (fabs(val)>1e-14) Adkl_entries[matid].add(row, col, -val);
+              if (fabs(val)>1e-14) Bdkl_entries[matid].add(row, col, -val);
             }
 
-            if (lindbladtype != LindbladType::NONE) {
+            if (type != LindbladType::NONE) {
               // Add -/+ (al^Tak -/+ alak^T) \kron I
               r1 = row % (dimmat * dimmat / nprek );
               r1a = r1 / (npostk*dimmat);
@@ -421,14 +694,14 @@ void MasterEq::initSparseMatSolver(){
               if (r1a < nk-1 && r1b > 0) {
                 val = Jkl[id_kl] * sqrt((r1a+1) * r1b);
                 col = row + npostk*dimmat - npostj*dimmat;
-                if (fabs(val)>1e-14) MatSetValue(Ad_vec[matid], row, col, -val, ADD_VALUES);
-                if (fabs(val)>1e-14) MatSetValue(Bd_vec[matid], row, col, +val, ADD_VALUES);
+                if (fabs(val)>1e-14) Adkl_entries[matid].add(row, col, -val);
+                if (fabs(val)>1e-14) Bdkl_entries[matid].add(row, col, +val);
               }
               if (r1a > 0 && r1b < nj-1) {
                 val = Jkl[id_kl] * sqrt(r1a * (r1b+1));
                 col = row - npostk*dimmat + npostj*dimmat;
-                if (fabs(val)>1e-14) MatSetValue(Ad_vec[matid], row, col, val, ADD_VALUES);
-                if (fabs(val)>1e-14) MatSetValue(Bd_vec[matid], row, col, val, ADD_VALUES);
+                if (fabs(val)>1e-14) Adkl_entries[matid].add(row, col, val);
+                if (fabs(val)>1e-14) Bdkl_entries[matid].add(row, col, val);
               }
             }
           }
@@ -449,10 +722,10 @@ void MasterEq::initSparseMatSolver(){
 
       /* Diagonal: detuning and anharmonicity  */
       /* Iterate over local rows of Bd */
-      for (PetscInt row = ilow; row<iupp; row++){
+      for (PetscInt row = rlow; row<rupp; row++){
 
         // Indices for -I_N \kron B_d
-        if (lindbladtype != LindbladType::NONE) r1 = row % dimmat;
+        if (type != LindbladType::NONE) r1 = row % dimmat;
         else r1 = row;
         r1 = r1 % (nk * npostk);
         r1 = r1 / npostk;
@@ -460,12 +733,12 @@ void MasterEq::initSparseMatSolver(){
         r2 = row / dimmat;
         r2 = r2 % (nk * npostk);
         r2 = r2 / npostk;
-        if (lindbladtype == LindbladType::NONE) r2 = 0;
+        if (type == LindbladType::NONE) r2 = 0;
 
         // -Bd, or -I_N \kron B_d + B_d \kron I_N
         val  = - ( detunek * r1 - xik / 2. * (r1*r1 - r1) );
         val +=     detunek * r2 - xik / 2. * (r2*r2 - r2)  ;
-        if (fabs(val)>1e-14) MatSetValue(Bd, row, row, val, ADD_VALUES);
+        if (fabs(val)>1e-14) Bd_entries.add(row, row, val);
       }
 
       /* zz-coupling term  -xi_ij * 2 * PI * (N_i*N_j) for j > i */
@@ -475,8 +748,8 @@ void MasterEq::initSparseMatSolver(){
         double xikj = crosskerr[coupling_id];
         coupling_id++;
 
-        for (PetscInt row = ilow; row<iupp; row++){
-          if (lindbladtype != LindbladType::NONE) r1 = row % dimmat;
+        for (PetscInt row = rlow; row<rupp; row++){
+          if (type != LindbladType::NONE) r1 = row % dimmat;
           else r1 = row;
           r1 = r1 % (nk * npostk);
           r1a = r1 / npostk;
@@ -490,168 +763,386 @@ void MasterEq::initSparseMatSolver(){
           r2b = r2 % npostk;
           r2b = r2b % (nj*npostj);
           r2b = r2b / npostj;
-          if (lindbladtype == LindbladType::NONE) r2a = 0;
-          if (lindbladtype == LindbladType::NONE) r2b = 0;
+          if (type == LindbladType::NONE) r2a = 0;
+          if (type == LindbladType::NONE) r2b = 0;
 
           // -I_N \kron B_d + B_d \kron I_N
           val =  xikj * r1a * r1b  - xikj * r2a * r2b;
-          if (fabs(val)>1e-14) MatSetValue(Bd, row, row, val, ADD_VALUES);
+          if (fabs(val)>1e-14) Bd_entries.add(row, row, val);
         }
       }
     }
   }
+}
 
-  /* Assemble all system matrices */
-  MatAssemblyBegin(Bd, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(Bd, MAT_FINAL_ASSEMBLY);
-  MatAssemblyBegin(Ad, MAT_FINAL_ASSEMBLY);
-  MatAssemblyEnd(Ad, MAT_FINAL_ASSEMBLY);
-  for (size_t iosc = 0; iosc < Ac_vec.size(); iosc++){
-    MatAssemblyBegin(Ac_vec[iosc], MAT_FINAL_ASSEMBLY);
-    MatAssemblyEnd(Ac_vec[iosc], MAT_FINAL_ASSEMBLY);
+void MasterEq::initMatrixForm(){
+
+  /* Hamiltonian terms at size N x N. Only the Lindblad solver uses the matrix form, so this is serial. */
+  SparseEntries Ad_entries(0, dim_rho);
+  SparseEntries Bd_entries(0, dim_rho);
+  std::vector<SparseEntries> Ac_entries(noscillators, SparseEntries(0, dim_rho));
+  std::vector<SparseEntries> Bc_entries(noscillators, SparseEntries(0, dim_rho));
+  std::vector<SparseEntries> Adkl_entries;
+  std::vector<SparseEntries> Bdkl_entries;
+  matrixform_coupling.clear();
+  for (size_t k = 0; k < Jkl.size(); k++) {
+    if (fabs(Jkl[k]) > 1e-12) {
+      Adkl_entries.push_back(SparseEntries(0, dim_rho));
+      Bdkl_entries.push_back(SparseEntries(0, dim_rho));
+      matrixform_coupling.push_back(k);
+    }
   }
-  for (size_t iosc = 0; iosc < Bc_vec.size(); iosc++){
-    MatAssemblyBegin(Bc_vec[iosc], MAT_FINAL_ASSEMBLY);
-    MatAssemblyEnd(Bc_vec[iosc], MAT_FINAL_ASSEMBLY);
+  collectHamiltonianEntries(LindbladType::NONE, Ad_entries, Bd_entries, Ac_entries, Bc_entries, Adkl_entries, Bdkl_entries);
+
+  /* Groups: 0 constant, 1+2k for p_k(t), 2+2k for q_k(t), then sin(eta_kl t) and cos(eta_kl t) for each coupling */
+  int ngroups = 1 + 2*noscillators + 2*matrixform_coupling.size();
+  matrixform = new LindbladMatrixForm(dim_rho, ngroups);
+  std::vector<PetscInt> csr_i, csr_j;
+  std::vector<double> csr_v;
+  // Real parts A of M=-iH are added as real terms, imaginary parts B as imaginary terms
+  Ad_entries.getCSR(csr_i, csr_j, csr_v);
+  matrixform->addTerm(0, false, csr_i, csr_j, csr_v);
+  Bd_entries.getCSR(csr_i, csr_j, csr_v);
+  matrixform->addTerm(0, true, csr_i, csr_j, csr_v);
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    Bc_entries[iosc].getCSR(csr_i, csr_j, csr_v);
+    matrixform->addTerm(1 + 2*iosc, true, csr_i, csr_j, csr_v);
+    Ac_entries[iosc].getCSR(csr_i, csr_j, csr_v);
+    matrixform->addTerm(2 + 2*iosc, false, csr_i, csr_j, csr_v);
   }
-  for (size_t i=0; i<Ad_vec.size(); i++){
-      MatAssemblyBegin(Ad_vec[i], MAT_FINAL_ASSEMBLY);
-      MatAssemblyEnd(Ad_vec[i], MAT_FINAL_ASSEMBLY);
+  for (size_t kl = 0; kl < matrixform_coupling.size(); kl++) {
+    Adkl_entries[kl].getCSR(csr_i, csr_j, csr_v);
+    matrixform->addTerm(1 + 2*noscillators + 2*kl, false, csr_i, csr_j, csr_v);
+    Bdkl_entries[kl].getCSR(csr_i, csr_j, csr_v);
+    matrixform->addTerm(2 + 2*noscillators + 2*kl, true, csr_i, csr_j, csr_v);
   }
-  for (size_t i=0; i<Bd_vec.size(); i++){
-      MatAssemblyBegin(Bd_vec[i], MAT_FINAL_ASSEMBLY);
-      MatAssemblyEnd(Bd_vec[i], MAT_FINAL_ASSEMBLY);
+
+  /* Collapse operators: T1 decay L = a_k, T2 dephasing L = a_k^T a_k */
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    double gammaT1 = 0.0;
+    double gammaT2 = 0.0;
+    if (addT1 && oscil_vec[iosc]->getDecayTime()   > 1e-14) gammaT1 = 1./(oscil_vec[iosc]->getDecayTime());
+    if (addT2 && oscil_vec[iosc]->getDephaseTime() > 1e-14) gammaT2 = 1./(oscil_vec[iosc]->getDephaseTime());
+    int nk = oscil_vec[iosc]->getNLevels();
+    PetscInt npostk = oscil_vec[iosc]->dim_postOsc;
+
+    SparseEntries L1(0, dim_rho);
+    SparseEntries L2(0, dim_rho);
+    for (PetscInt row = 0; row < dim_rho; row++) {
+      PetscInt r1 = (row % (nk*npostk)) / npostk;
+      if (r1 < nk-1) L1.add(row, row + npostk, sqrt(r1+1));
+      if (r1 > 0) L2.add(row, row, r1);
+    }
+    L1.getCSR(csr_i, csr_j, csr_v);
+    matrixform->addJump(gammaT1, csr_i, csr_j, csr_v);
+    L2.getCSR(csr_i, csr_j, csr_v);
+    matrixform->addJump(gammaT2, csr_i, csr_j, csr_v);
   }
+  matrixform->finalize();
 
-  // // Test if Bd is symmetric 
-  // PetscBool isSymm;
-  // double norm = 0.0;
-  // MatIsSymmetric(Bd, 1e-12, &isSymm);
-  // if (!isSymm) {
-  //   printf("ERROR: System hamiltonian is not hermitian!\n");
-  //   exit(1);
-  // }
-  // // Test if Ad is anti-symmetric
-  // Mat AdTest;
-  // MatTranspose(Ad, MAT_INITIAL_MATRIX, &AdTest);
-  // MatAXPY(AdTest, 1.0, Ad, DIFFERENT_NONZERO_PATTERN);
-  // MatNorm(AdTest, NORM_FROBENIUS, &norm);
-  // if (norm > 1e-12) {
-  //   printf("ERROR: System hamiltonian is not hermitian!\n");
-  //   exit(1);
-  // }
-  // MatDestroy(&AdTest);
+  if (mpirank_world==0 && !quietmode) {
+    printf("# Matrix-form Lindblad solver: %zu nonzeros in the N x N operator (vs. N^2 x N^2 superoperator).\n", matrixform->getNNZ());
+  }
+}
 
-  /* Set Ad = Lindblad terms */
-  if (addT1 || addT2) {  // leave matrix empty if no T1 or T2 decay
+void MasterEq::initKronOperator(){
 
-    PetscInt r1,r1a, r1b;
-    PetscInt col1;
-    double val;
-    for (int iosc = 0; iosc < noscillators; iosc++) {
+  if (mpirank_world==0 && !quietmode) printf("\n# Reading factored Hamiltonian model from files.\n");
 
-      /* Get T1, T2 times */
-      double gammaT1 = 0.0;
-      double gammaT2 = 0.0;
-      if (oscil_vec[iosc]->getDecayTime()   > 1e-14) gammaT1 = 1./(oscil_vec[iosc]->getDecayTime());
-      if (oscil_vec[iosc]->getDephaseTime() > 1e-14) gammaT2 = 1./(oscil_vec[iosc]->getDephaseTime());
+  kronop = new KronOperator(nlevels, lindbladtype);
+  HamiltonianFileReader* py = new HamiltonianFileReader(hamiltonian_file_Hsys, hamiltonian_file_Hc, nlevels, lindbladtype, dim_rho, quietmode);
+  py->receiveKronecker(*kronop);
+  delete py;
 
-      // Dimensions 
-      int nk     = oscil_vec[iosc]->getNLevels();
-      PetscInt npostk = oscil_vec[iosc]->dim_postOsc;
+  /* Lindblad collapse operators */
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    double gammaT1 = 0.0;
+    double gammaT2 = 0.0;
+    if (addT1 && oscil_vec[iosc]->getDecayTime()   > 1e-14) gammaT1 = 1./(oscil_vec[iosc]->getDecayTime());
+    if (addT2 && oscil_vec[iosc]->getDephaseTime() > 1e-14) gammaT2 = 1./(oscil_vec[iosc]->getDephaseTime());
+    kronop->addDissipation(iosc, gammaT1, gammaT2);
+  }
 
-      /* Iterate over local rows of Ad */
-      for (PetscInt row = ilow; row<iupp; row++){
+  if (mpirank_world==0 && !quietmode) {
+    printf("# Kronecker operator: %zu terms, %.2f KB of factors.\n\n", kronop->getNTerms(), kronop->getFactorMemory() / 1024.);
+  }
+}
 
-        /* Add Ad += gamma_j * L \kron L */
-        r1 = row % (dimmat*nk*npostk);
-        r1a = r1 / (dimmat*npostk);
-        r1b = r1 % (npostk*dimmat);
-        r1b = r1b % (nk*npostk);
-        r1b = r1b / npostk;
-        // T1  decay (L1 = a_j)
-        if (addT1) { 
-          if (r1a < nk-1 && r1b < nk-1) {
-            val = gammaT1 * sqrt( (r1a+1) * (r1b+1) );
-            col1 = row + npostk * dimmat + npostk;
-            if (fabs(val)>1e-14) MatSetValue(Ad, row, col1, val, ADD_VALUES);
+void MasterEq::reportSparseMemory(){
+
+  double nnz = 0.0, nnz_T = 0.0;
+  MatInfo info;
+  auto count = [&](Mat A, double& n) {
+    if (A == NULL) return;
+    MatGetInfo(A, MAT_GLOBAL_SUM, &info);
+    n += info.nz_allocated;
+  };
+  count(Ad, nnz); count(Bd, nnz);
+  for (size_t i = 0; i < Ac_vec.size(); i++) { count(Ac_vec[i], nnz); count(Bc_vec[i], nnz); }
+  for (size_t i = 0; i < Ad_vec.size(); i++) { count(Ad_vec[i], nnz); count(Bd_vec[i], nnz); }
+  if (usemergedsparse) count(merged.A, nnz);
+  if (usesparsetranspose) {
+    if (usemergedsparse) count(merged_T.A, nnz_T);
+    else {
+      count(Ad_T, nnz_T); count(Bd_T, nnz_T);
+      for (size_t i = 0; i < Ac_vec_T.size(); i++) { count(Ac_vec_T[i], nnz_T); count(Bc_vec_T[i], nnz_T); }
+      for (size_t i = 0; i < Ad_vec_T.size(); i++) { count(Ad_vec_T[i], nnz_T); count(Bd_vec_T[i], nnz_T); }
+    }
+  }
+  // AIJ storage: one value and one column index per nonzero
+  double bytes_per_nz = sizeof(PetscScalar) + sizeof(PetscInt);
+  if (mpirank_world == 0) {
+    printf("# Sparse operators: %.0f nonzeros (%.2f MB)", nnz, nnz * bytes_per_nz / 1e6);
+    if (usesparsetranspose) printf(", stored transposes: %.0f nonzeros (%.2f MB)", nnz_T, nnz_T * bytes_per_nz / 1e6);
+    printf("\n");
+  }
+}
+
+void MasterEq::destroyTransposedTerms(){
+  if (Ad_T != NULL) MatDestroy(&Ad_T);
+  if (Bd_T != NULL) MatDestroy(&Bd_T);
+  for (size_t i = 0; i < Ac_vec_T.size(); i++) MatDestroy(&(Ac_vec_T[i]));
+  for (size_t i = 0; i < Bc_vec_T.size(); i++) MatDestroy(&(Bc_vec_T[i]));
+  for (size_t i = 0; i < Ad_vec_T.size(); i++) MatDestroy(&(Ad_vec_T[i]));
+  for (size_t i = 0; i < Bd_vec_T.size(); i++) MatDestroy(&(Bd_vec_T[i]));
+  Ac_vec_T.clear();
+  Bc_vec_T.clear();
+  Ad_vec_T.clear();
+  Bd_vec_T.clear();
+}
+
+void MasterEq::initMergedSparseMat(MergedSparseMat& M, Mat Ad_, Mat Bd_, const std::vector<Mat>& Ac_, const std::vector<Mat>& Bc_, const std::vector<Mat>& Adkl_, const std::vector<Mat>& Bdkl_, bool transpose){
+
+  /* Collect all terms. A-type terms act as [[T, 0], [0, T]] on x=[u,v], B-type terms as [[0, -T], [T, 0]], */
+  /* or as [[0, T], [-T, 0]] when building the transpose from transposed terms. */
+  /* Time-dependent terms are ordered as: (Ac, Bc) per oscillator, then (Ad_kl, Bd_kl) per coupling. */
+  std::vector<Mat> terms;
+  std::vector<bool> isB;
+  terms.push_back(Ad_); isB.push_back(false);
+  terms.push_back(Bd_); isB.push_back(true);
+  for (size_t iosc = 0; iosc < Ac_.size(); iosc++) {
+    terms.push_back(Ac_[iosc]); isB.push_back(false);
+    terms.push_back(Bc_[iosc]); isB.push_back(true);
+  }
+  for (size_t kl = 0; kl < Adkl_.size(); kl++) {
+    terms.push_back(Adkl_[kl]); isB.push_back(false);
+    terms.push_back(Bdkl_[kl]); isB.push_back(true);
+  }
+  size_t nconst = 2;
+
+  /* Global index in x of the real or imaginary part of column c, and local row of the real part of row r. */
+  /* With the interleaved layout, each element forms one 2x2 block [[a, -b], [b, a]] of a BAIJ matrix. */
+  bool interleaved = getStateLayout() == StateLayout::INTERLEAVED;
+  PetscInt localsize_x = 2*localsize_u;
+  PetscInt xlow = 2*ilow;
+  auto xcol = [&](PetscInt c, bool imag) {
+    return imag ? getIndexImag(c, localsize_u) : getIndexReal(c, localsize_u);
+  };
+  PetscInt stride_x, offset_im;
+  getStateStrides(localsize_u, &stride_x, &offset_im);
+
+  /* First pass: Union of the nonzero pattern of all terms, for the local rows of x */
+  std::vector<std::vector<PetscInt>> rowcols(localsize_x);
+  for (size_t iterm = 0; iterm < terms.size(); iterm++) {
+    for (PetscInt row = ilow; row < iupp; row++) {
+      PetscInt ncols;
+      const PetscInt *cols;
+      MatGetRow(terms[iterm], row, &ncols, &cols, NULL);
+      PetscInt lrow_u = (row - ilow) * stride_x;
+      PetscInt lrow_v = lrow_u + offset_im;
+      for (PetscInt j = 0; j < ncols; j++) {
+        if (interleaved) {
+          // Complete 2x2 blocks, as stored by the BAIJ format
+          for (PetscInt lrow : {lrow_u, lrow_v}) {
+            rowcols[lrow].push_back(xcol(cols[j], false));
+            rowcols[lrow].push_back(xcol(cols[j], true));
           }
+        } else {
+          rowcols[lrow_u].push_back(xcol(cols[j], isB[iterm]));
+          rowcols[lrow_v].push_back(xcol(cols[j], !isB[iterm]));
         }
-        // T2  dephasing (L1 = a_j^Ta_j)
-        if (addT2) { 
-          val = gammaT2 * r1a * r1b ;
-          if (fabs(val)>1e-14) MatSetValue(Ad, row, row, val, ADD_VALUES);
-        }
+      }
+      MatRestoreRow(terms[iterm], row, &ncols, &cols, NULL);
+    }
+  }
 
-        /* Add Ad += - gamma_j/2  I_n  \kron L^TL  */
-        r1 = row % (nk*npostk);
-        r1 = r1 / npostk;
-        if (addT1) {
-          val = - gammaT1/2. * r1;
-          if (fabs(val)>1e-14) MatSetValue(Ad, row, row, val, ADD_VALUES);
-        }
-        if (addT2) {
-          val = -gammaT2/2. * r1*r1;
-          if (fabs(val)>1e-14) MatSetValue(Ad, row, row, val, ADD_VALUES);
-        }
+  /* Compress into CSR and count diagonal / off-diagonal block nonzeros for exact preallocation */
+  std::vector<PetscInt> d_nnz(localsize_x, 0);
+  std::vector<PetscInt> o_nnz(localsize_x, 0);
+  M.rowptr.assign(localsize_x+1, 0);
+  M.cols.clear();
+  for (PetscInt lrow = 0; lrow < localsize_x; lrow++) {
+    std::vector<PetscInt>& rc = rowcols[lrow];
+    std::sort(rc.begin(), rc.end());
+    rc.erase(std::unique(rc.begin(), rc.end()), rc.end());
+    for (size_t j = 0; j < rc.size(); j++) {
+      if (xlow <= rc[j] && rc[j] < xlow + localsize_x) d_nnz[lrow]++;
+      else o_nnz[lrow]++;
+    }
+    M.cols.insert(M.cols.end(), rc.begin(), rc.end());
+    M.rowptr[lrow+1] = M.cols.size();
+    std::vector<PetscInt>().swap(rc);
+  }
 
-        /* Add Ad += - gamma_j/2  L^TL \kron I_n */
-        r1 = row % (nk*npostk*dimmat);
-        r1 = r1 / (npostk*dimmat);
-        if (addT1) {
-          val = -gammaT1/2. * r1;
-          if (fabs(val)>1e-14) MatSetValue(Ad, row, row, val, ADD_VALUES);
+  /* Second pass: Record the value positions of each term */
+  M.constvals.assign(M.cols.size(), 0.0);
+  M.vals.assign(M.cols.size(), 0.0);
+  M.slots.assign(terms.size() - nconst, std::vector<PetscInt>());
+  M.termvals.assign(terms.size() - nconst, std::vector<double>());
+  auto slot = [&](PetscInt lrow, PetscInt col) {
+    const PetscInt* begin = M.cols.data() + M.rowptr[lrow];
+    const PetscInt* end   = M.cols.data() + M.rowptr[lrow+1];
+    return M.rowptr[lrow] + (PetscInt)(std::lower_bound(begin, end, col) - begin);
+  };
+  for (size_t iterm = 0; iterm < terms.size(); iterm++) {
+    for (PetscInt row = ilow; row < iupp; row++) {
+      PetscInt ncols;
+      const PetscInt *cols;
+      const PetscScalar *vals;
+      MatGetRow(terms[iterm], row, &ncols, &cols, &vals);
+      PetscInt lrow_u = (row - ilow) * stride_x;
+      PetscInt lrow_v = lrow_u + offset_im;
+      for (PetscInt j = 0; j < ncols; j++) {
+        PetscInt slot_u = slot(lrow_u, xcol(cols[j], isB[iterm]));
+        PetscInt slot_v = slot(lrow_v, xcol(cols[j], !isB[iterm]));
+        // A-type: +T in both blocks. B-type: -T in the u-rows and +T in the v-rows (signs swapped for the transpose).
+        double val_u = vals[j];
+        double val_v = vals[j];
+        if (isB[iterm]) {
+          if (transpose) val_v = -vals[j];
+          else           val_u = -vals[j];
         }
-        if (addT2) {
-          val = -gammaT2/2. * r1*r1;
-          if (fabs(val)>1e-14) MatSetValue(Ad, row, row, val, ADD_VALUES);
+        if (iterm < nconst) {
+          M.constvals[slot_u] += val_u;
+          M.constvals[slot_v] += val_v;
+        } else {
+          M.slots[iterm-nconst].push_back(slot_u);
+          M.termvals[iterm-nconst].push_back(val_u);
+          M.slots[iterm-nconst].push_back(slot_v);
+          M.termvals[iterm-nconst].push_back(val_v);
         }
       }
+      MatRestoreRow(terms[iterm], row, &ncols, &cols, &vals);
     }
-    /* Assemble Ad again */
-    MatAssemblyBegin(Ad, MAT_FINAL_ASSEMBLY);
-    MatAssemblyEnd(Ad, MAT_FINAL_ASSEMBLY);
   }
 
-    // printf("Ad =");
-    // MatView(Ad, NULL);
-    // printf("Bd =");
-    // MatView(Bd, NULL);
-    // for (int iosc =0; iosc < Ac_vec.size(); iosc++){
-    //   printf("Ac %d=", iosc);
-    //   MatView(Ac_vec[iosc][0], NULL);
-    // }
-    // for (int iosc =0; iosc < Bc_vec.size(); iosc++){
-    //   printf("Bc %d=", iosc);
-    //   MatView(Bc_vec[iosc][0], NULL);
-    // }
+  /* Create the merged matrix with exact preallocation */
+  MatCreate(PETSC_COMM_WORLD, &M.A);
+  MatSetSizes(M.A, localsize_x, localsize_x, 2*dim, 2*dim);
+  if (interleaved) {
+    // Block rows hold complete 2x2 blocks, so that the nonzeros per block row are those of its first row, halved.
+    std::vector<PetscInt> d_nnz_block(localsize_u), o_nnz_block(localsize_u);
+    for (PetscInt brow = 0; brow < localsize_u; brow++) {
+      d_nnz_block[brow] = d_nnz[2*brow] / 2;
+      o_nnz_block[brow] = o_nnz[2*brow] / 2;
+    }
+    MatSetType(M.A, MATMPIBAIJ);
+    MatMPIBAIJSetPreallocation(M.A, 2, 0, d_nnz_block.data(), 0, o_nnz_block.data());
+  } else {
+    MatSetType(M.A, MATMPIAIJ);
+    MatMPIAIJSetPreallocation(M.A, 0, d_nnz.data(), 0, o_nnz.data());
+  }
+  MatSetUp(M.A);
+  MatSetOption(M.A, MAT_NO_OFF_PROC_ENTRIES, PETSC_TRUE);
+  MatSetOption(M.A, MAT_NEW_NONZERO_LOCATION_ERR, PETSC_TRUE);
+}
 
+void MasterEq::updateMergedSparseMat(MergedSparseMat& M){
 
-//   // Test: Print out Hamiltonian terms.
-  // printf("\n\n HEYHEY! Printing out the system matrices: \n\n");
-  // printf("Ad=\n");
-  // MatView(Ad, NULL);
-  // printf("Bd=\n");
-  // MatView(Bd, NULL);
-  // for (int i=0; i<Bc_vec.size(); i++){
-  //   printf("Oscil %d, Bc :\n",i);
-  //   MatView(Bc_vec[i], NULL);
-  // }
-  // for (int i=0; i<Ac_vec.size(); i++){
-  //   printf("Oscil %d, Ac:\n", i);
-  //   MatView(Ac_vec[i], NULL);
-  // }
-//   for (int kl=0; kl<Ad_vec.size(); kl++) {
-//     printf("Bd_vec[%d]=\n", kl);
-//     MatView(Bd_vec[kl], NULL);
-//     printf("Ad_vec[%d]=\n", kl);
-//     MatView(Ad_vec[kl], NULL);
-//   }
-//  // exit(1);
+  /* Time-independent part */
+  std::copy(M.constvals.begin(), M.constvals.end(), M.vals.begin());
 
+  /* Add each time-dependent term scaled by its current coefficient */
+  for (size_t iterm = 0; iterm < M.slots.size(); iterm++) {
+    double coeff = getMergedTermCoeff(iterm);
+    if (fabs(coeff) < 1e-12) continue;
+    const std::vector<PetscInt>& slots = M.slots[iterm];
+    const std::vector<double>& termvals = M.termvals[iterm];
+    for (size_t j = 0; j < slots.size(); j++) {
+      M.vals[slots[j]] += coeff * termvals[j];
+    }
+  }
 
-  /* Allocate some auxiliary vectors */
-  MatCreateVecs(Bd, &aux, NULL);
+  /* Rewrite the values of the local rows. The pattern is fixed, no communication needed. */
+  PetscInt xlow = 2*ilow;
+  for (PetscInt lrow = 0; lrow < 2*localsize_u; lrow++) {
+    PetscInt row = xlow + lrow;
+    PetscInt ncols = M.rowptr[lrow+1] - M.rowptr[lrow];
+    MatSetValues(M.A, 1, &row, ncols, M.cols.data() + M.rowptr[lrow], M.vals.data() + M.rowptr[lrow], INSERT_VALUES);
+  }
+  MatAssemblyBegin(M.A, MAT_FINAL_ASSEMBLY);
+  MatAssemblyEnd(M.A, MAT_FINAL_ASSEMBLY);
+}
+
+double MasterEq::getMergedTermCoeff(size_t iterm){
+  size_t nosc = Ac_vec.size();
+  if (iterm < 2*nosc) {  // Controls: q for Ac, p for Bc
+    size_t iosc = iterm / 2;
+    return iterm % 2 == 0 ? RHSctx.control_Im[iosc] : RHSctx.control_Re[iosc];
+  } else {  // Couplings: sin(eta*t) for Ad_kl, cos(eta*t) for Bd_kl
+    int k = merged_coupling[(iterm - 2*nosc) / 2];
+    return (iterm - 2*nosc) % 2 == 0 ? RHSctx.Ad_coeffs[k] : RHSctx.Bd_coeffs[k];
+  }
+}
+
+void MasterEq::initDenseMat(){
+
+  /* Row of each stored value of the merged matrix. Serial, so local rows are global rows. */
+  PetscInt n = 2*dim;
+  std::vector<PetscInt> slotrow(merged.cols.size());
+  for (PetscInt row = 0; row < n; row++) {
+    for (PetscInt j = merged.rowptr[row]; j < merged.rowptr[row+1]; j++) slotrow[j] = row;
+  }
+
+  /* Scatter the constant part and each time-dependent term into dense column-major matrices */
+  PetscScalar* ptr;
+  MatCreateDense(PETSC_COMM_WORLD, n, n, n, n, NULL, &dense_const);
+  MatDenseGetArray(dense_const, &ptr);
+  for (size_t j = 0; j < merged.cols.size(); j++) {
+    ptr[slotrow[j] + merged.cols[j]*n] = merged.constvals[j];
+  }
+  MatDenseRestoreArray(dense_const, &ptr);
+  MatAssemblyBegin(dense_const, MAT_FINAL_ASSEMBLY); MatAssemblyEnd(dense_const, MAT_FINAL_ASSEMBLY);
+  for (size_t iterm = 0; iterm < merged.slots.size(); iterm++) {
+    Mat D;
+    MatCreateDense(PETSC_COMM_WORLD, n, n, n, n, NULL, &D);
+    MatDenseGetArray(D, &ptr);
+    for (size_t j = 0; j < merged.slots[iterm].size(); j++) {
+      PetscInt slot = merged.slots[iterm][j];
+      ptr[slotrow[slot] + merged.cols[slot]*n] += merged.termvals[iterm][j];
+    }
+    MatDenseRestoreArray(D, &ptr);
+    MatAssemblyBegin(D, MAT_FINAL_ASSEMBLY); MatAssemblyEnd(D, MAT_FINAL_ASSEMBLY);
+    dense_terms.push_back(D);
+  }
+  MatDuplicate(dense_const, MAT_COPY_VALUES, &RHSdense);
+  dense_coeffs.assign(dense_terms.size(), 0.0);
+  MatCreateVecs(RHSdense, &dense_aux, NULL);
+
+  /* The merged sparse matrix was only needed to collect the terms */
+  MatDestroy(&merged.A);
+  merged = MergedSparseMat();
+  usemergedsparse = false;
+
+  if (mpirank_world == 0 && !quietmode) {
+    printf("# Dense small-system solver: %zu dense %lld x %lld matrices (%.2f MB).\n", dense_terms.size() + 2, (long long)n, (long long)n, (dense_terms.size() + 2) * n * n * sizeof(PetscScalar) / 1e6);
+  }
+}
+
+void MasterEq::updateDenseMat(){
+
+  /* Skip the rewrite if the coefficients are unchanged, e.g. when the RHS is assembled again at the same time */
+  std::vector<double> coeffs(dense_terms.size());
+  for (size_t iterm = 0; iterm < dense_terms.size(); iterm++) coeffs[iterm] = getMergedTermCoeff(iterm);
+  if (coeffs == dense_coeffs) return;
+  dense_coeffs = coeffs;
+
+  /* Time-independent part, then add each time-dependent term scaled by its current coefficient */
+  MatCopy(dense_const, RHSdense, SAME_NONZERO_PATTERN);
+  for (size_t iterm = 0; iterm < dense_terms.size(); iterm++) {
+    if (fabs(coeffs[iterm]) < 1e-12) continue;
+    MatAXPY(RHSdense, coeffs[iterm], dense_terms[iterm], SAME_NONZERO_PATTERN);
+  }
 }
 
 int MasterEq::assemble_RHS(const double t){
@@ -674,20 +1165,116 @@ int MasterEq::assemble_RHS(const double t){
     RHSctx.Ad_coeffs[k] = sin(eta[k]*t); 
   }
 
+  // Pass the controls to the operators
+  updateRHSCoefficients();
+
   return 0;
 }
 
-Mat MasterEq::getRHS() { return RHS; }
+void MasterEq::updateRHSCoefficients(){
+
+  // Pass the controls to the Kronecker operator
+  if (kronop != NULL) kronop->setControls(RHSctx.control_Re, RHSctx.control_Im);
+
+  // Rewrite the values of the N x N operator of the matrix-form solver
+  if (matrixform != NULL) {
+    std::vector<double> coeffs;
+    for (int iosc = 0; iosc < noscillators; iosc++) {
+      coeffs.push_back(RHSctx.control_Re[iosc]);
+      coeffs.push_back(RHSctx.control_Im[iosc]);
+    }
+    for (size_t kl = 0; kl < matrixform_coupling.size(); kl++) {
+      coeffs.push_back(RHSctx.Ad_coeffs[matrixform_coupling[kl]]);
+      coeffs.push_back(RHSctx.Bd_coeffs[matrixform_coupling[kl]]);
+    }
+    matrixform->setCoefficients(coeffs);
+  }
+
+  // Rewrite the dense system matrix of the small-system solver
+  if (usedense) updateDenseMat();
+
+  // Rewrite the values of the merged sparse matrix and its transpose
+  if (usemergedsparse) {
+    updateMergedSparseMat(merged);
+    if (usesparsetranspose) updateMergedSparseMat(merged_T);
+  }
+}
+
+Mat MasterEq::getRHS() {
+  if (usedense) return RHSdense;  // Applied directly, without the shell
+  return RHS_packed != NULL ? RHS_packed : RHS;
+}
 
 // Gradient of RHS wrt parameters: grad += alpha * x^T * (d RHS / d params)^T * xbar 
 void MasterEq::compute_dRHS_dParams(const double t, const Vec x, const Vec xbar, const double alpha, Vec grad) {
 
-  if (!usematfree) {  // Sparse-matrix application of RHS 
-    compute_dRHS_dParams_sparsemat(t, x, xbar,  alpha, grad, nlevels, isu, isv, Ac_vec, Bc_vec, aux, oscil_vec);
+  /* Hermitian-packed state wrapped around the full RHS: the packed RHS is P A U, so evaluate with U x and P^T xbar */
+  Vec xfull = x;
+  Vec xbarfull = xbar;
+  if (RHS_packed != NULL) {
+    unpackHermitianState(x, packed_xfull);
+    packHermitianState_diff(xbar, packed_yfull);
+    xfull = packed_xfull;
+    xbarfull = packed_yfull;
+  }
+
+  if (usedense) {  // Dense small-system solver
+    compute_dRHS_dParams_dense(t, xfull, xbarfull, alpha, grad, dense_terms, dense_aux, noscillators, oscil_vec);
+
+  } else if (usematrixform) {  // Matrix-form Lindblad solver
+    compute_dRHS_dParams_matrixform(t, xfull, xbarfull, alpha, grad, matrixform, noscillators, oscil_vec);
+
+  } else if (!usematfree) {  // Sparse-matrix application of RHS 
+    compute_dRHS_dParams_sparsemat(t, xfull, xbarfull,  alpha, grad, nlevels, isu, isv, Ac_vec, Bc_vec, aux, oscil_vec);
+
+  } else if (kronop != NULL) {  // Kronecker operator for factored Hamiltonians
+    compute_dRHS_dParams_kron(t, xfull, xbarfull, alpha, grad, kronop, noscillators, oscil_vec);
 
   } else {  // matrix-free application of RHS
-    compute_dRHS_dParams_matfree(dim, t, x, xbar,  alpha, grad, nlevels, lindbladtype, oscil_vec);
+    compute_dRHS_dParams_matfree(dim, t, xfull, xbarfull,  alpha, grad, nlevels, lindbladtype, oscil_vec, packedkernels);
+  }
+}
+
+void MasterEq::setControlDirection(const Vec v) {
+
+  const PetscScalar* ptr;
+  VecGetArrayRead(v, &ptr);
+  int shift=0;
+  for (size_t ioscil = 0; ioscil < getNOscillators(); ioscil++) {
+    getOscillator(ioscil)->setParamsDirection(ptr + shift);
+    shift += getOscillator(ioscil)->getNParams();
+  }
+  VecRestoreArrayRead(v, &ptr);
+}
+
+void MasterEq::applyControlDerivative(const double t, const Vec x, Vec y, bool transpose) {
+
+  if (dir_aux == NULL) VecDuplicate(x, &dir_aux);
+  Mat A = getRHS();
+
+  /* RHS with the directional derivatives of the controls. The coupling coefficients are kept, they cancel below. */
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    double p, q;
+    oscil_vec[iosc]->evalControlDirection(t, &p, &q);
+    RHSctx.control_Re[iosc] = p;
+    RHSctx.control_Im[iosc] = q;
+  }
+  updateRHSCoefficients();
+  if (!transpose) MatMult(A, x, y);
+  else            MatMultTranspose(A, x, y);
+
+  /* Subtract the RHS with zero controls */
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    RHSctx.control_Re[iosc] = 0.0;
+    RHSctx.control_Im[iosc] = 0.0;
   }
+  updateRHSCoefficients();
+  if (!transpose) MatMult(A, x, dir_aux);
+  else            MatMultTranspose(A, x, dir_aux);
+  VecAXPY(y, -1.0, dir_aux);
+
+  /* Restore the RHS at time t */
+  assemble_RHS(t);
 }
 
 void MasterEq::setControlAmplitudes(const Vec x) {
@@ -706,17 +1293,41 @@ void MasterEq::setControlAmplitudes(const Vec x) {
   VecRestoreArrayRead(x, &ptr);
 }
 
+void MasterEq::setControlTimes(const std::vector<double>& times) {
+  for (size_t ioscil = 0; ioscil < getNOscillators(); ioscil++) {
+    getOscillator(ioscil)->setControlTimes(times);
+  }
+}
+
 /* Pass MatMult operations for the RHS action onto a vector to Petsc */
 void MasterEq::set_RHS_MatMult_operation(){
 
+  // Interface routines for applying the dense system matrix of small systems
+  if (usedense) {
+    MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_dense);
+    MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_dense_transpose);
+
+  // Interface routines for applying the RHS in matrix form
+  } else if (usematrixform) {
+    MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_matrixform);
+    MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_matrixform_transpose);
+
   // Interface routines for applying the RHS as sparse submatrices matrices
-  if (!usematfree) { 
-    MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_sparsemat);
-    MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_sparsemat_transpose);
+  } else if (!usematfree) { 
+    if (usemergedsparse) {
+      MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_sparsemat_merged);
+      MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_sparsemat_merged_transpose);
+    } else {
+      MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_sparsemat);
+      MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_sparsemat_transpose);
+    }
 
   // Interface routines for applying RHS in a matrix-free way
   } else { 
-    if (noscillators == 1) {
+    if (kronop != NULL) {
+      MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_kron);
+      MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_kron_transpose);
+    } else if (noscillators == 1) {
       MatShellSetOperation(RHS, MATOP_MULT, (void(*)(void)) applyRHS_matfree_1Osc);
       MatShellSetOperation(RHS, MATOP_MULT_TRANSPOSE, (void(*)(void)) applyRHS_matfree_transpose_1Osc);
     } else if (noscillators == 2) {
@@ -830,95 +1441,318 @@ int applyRHS_sparsemat(Mat RHS, Vec x, Vec y){
   return 0;
 }
 
-/* Sparse-matrix solver: Define the action of RHS^T on a vector x */
-int applyRHS_sparsemat_transpose(Mat RHS, Vec x, Vec y) {
-  double p,q;
+/* Applies y = A^T x, as forward multiply if the transpose A_T is stored (non-NULL) */
+static void multTranspose(Mat A, Mat A_T, Vec x, Vec y) {
+  if (A_T != NULL) MatMult(A_T, x, y);
+  else MatMultTranspose(A, x, y);
+}
+
+/* Applies z = y + A^T x, as forward multiply if the transpose A_T is stored (non-NULL) */
+static void multTransposeAdd(Mat A, Mat A_T, Vec x, Vec y, Vec z) {
+  if (A_T != NULL) MatMultAdd(A_T, x, y, z);
+  else MatMultTransposeAdd(A, x, y, z);
+}
+
+/* Sparse-matrix solver: Define the action of RHS^T on a vector x */
+int applyRHS_sparsemat_transpose(Mat RHS, Vec x, Vec y) {
+  double p,q;
+
+  /* Get time from shell context */
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  /* Get u, v from x and y  */
+  Vec u, v;
+  Vec uout, vout;
+  VecGetSubVector(x, *shellctx->isu, &u);
+  VecGetSubVector(x, *shellctx->isv, &v);
+  VecGetSubVector(y, *shellctx->isu, &uout);
+  VecGetSubVector(y, *shellctx->isv, &vout);
+
+  // uout = Re^T*u + Im^T*v
+  //      = (Ad + sum_k q_kA_k)^T*u + (Bd + sum_k p_kB_k)^T*v
+          // + sum_kl J_kl*sin(eta_kl*t) * Ad_kl^T * u
+          //         +J_kl*cos(eta_kl*t) * Bd_kl^T * v  ]   cross terms
+  // vout = -Im^T*u + Re^T*v
+  //      = -(Bd + sum_k p_kB_k)^T*u + (Ad + sum_k q_kA_k)^T*v
+        // + sum_kl - J_kl*cos(eta_kl*t) * Bd_kl^T * u
+        //          + J_kl*sin(eta_kl*t) * Ad_kl^T * v  ]   cross terms
+
+  // Stored transposes, if available
+  bool stored = shellctx->Ad_T != NULL;
+  Mat AdT = stored ? *shellctx->Ad_T : NULL;
+  Mat BdT = stored ? *shellctx->Bd_T : NULL;
+
+  // Constant part uout = Ad^Tu + Bd^Tv
+  multTranspose(*shellctx->Bd, BdT, v, uout);
+  multTransposeAdd(*shellctx->Ad, AdT, u, uout, uout);
+  // Constant part vout = -Bd^Tu + Ad^Tv
+  multTranspose(*shellctx->Bd, BdT, u, vout);
+  VecScale(vout, -1.0);
+  multTransposeAdd(*shellctx->Ad, AdT, v, vout, vout);
+
+  /* Time-dependent control term */
+  for (size_t iosc = 0; iosc < shellctx->nlevels.size(); iosc++) {
+
+    p = shellctx->control_Re[iosc];
+    q = shellctx->control_Im[iosc];
+    Mat AcT = stored ? shellctx->Ac_vec_T[iosc] : NULL;
+    Mat BcT = stored ? shellctx->Bc_vec_T[iosc] : NULL;
+
+      // uout += q^k*Ac^Tu
+      multTranspose(shellctx->Ac_vec[iosc], AcT, u, *shellctx->aux);
+      VecAXPY(uout, q, *shellctx->aux);
+      // vout += q^kAc^Tv
+      multTranspose(shellctx->Ac_vec[iosc], AcT, v, *shellctx->aux);
+      VecAXPY(vout, q, *shellctx->aux);
+
+      // uout += p^kBc^Tv
+      multTranspose(shellctx->Bc_vec[iosc], BcT, v, *shellctx->aux);
+      VecAXPY(uout, p, *shellctx->aux);
+      // vout -= p^kBc^Tu
+      multTranspose(shellctx->Bc_vec[iosc], BcT, u, *shellctx->aux);
+      VecAXPY(vout, -1.*p, *shellctx->aux);
+    }
+
+
+  /* --- Time-dependent system Hamiltonian (Jaynes-Cumming) --- */
+  int id_kl = 0;
+  int noscillators = shellctx->nlevels.size();
+  for (int k= 0; k< noscillators*(noscillators-1)/2; k++) {
+    if (fabs(shellctx->Jkl[k]) > 1e-12) { 
+      double coeff_re = shellctx->Bd_coeffs[k]; // = cos(etakl*t) 
+      double coeff_im = shellctx->Ad_coeffs[k]; // = sin(etakl*t)
+      Mat AdklT = stored ? shellctx->Ad_vec_T[id_kl] : NULL;
+      Mat BdklT = stored ? shellctx->Bd_vec_T[id_kl] : NULL;
+      if (fabs(coeff_re) > 1e-12) {
+        // uout += +Jkl*cos*Bdklv^T
+        multTranspose(shellctx->Bd_vec[id_kl], BdklT, v, *shellctx->aux);
+        VecAXPY(uout,  coeff_re, *shellctx->aux);
+        // vout += - Jkl*cos*Bdklu^T
+        multTranspose(shellctx->Bd_vec[id_kl], BdklT, u, *shellctx->aux);
+        VecAXPY(vout, - coeff_re, *shellctx->aux);
+      }
+      if (fabs(coeff_im) > 1e-12) {
+        // uout += J_kl*sin*Adklu^T
+        multTranspose(shellctx->Ad_vec[id_kl], AdklT, u, *shellctx->aux);
+        VecAXPY(uout, coeff_im, *shellctx->aux);
+        //vout += Jkl*sin*Adklv^T
+        multTranspose(shellctx->Ad_vec[id_kl], AdklT, v, *shellctx->aux);
+        VecAXPY(vout, coeff_im, *shellctx->aux);
+      }
+      id_kl++;
+    }
+  }
+
+  /* Restore */
+  VecRestoreSubVector(x, *shellctx->isu, &u);
+  VecRestoreSubVector(x, *shellctx->isv, &v);
+  VecRestoreSubVector(y, *shellctx->isu, &uout);
+  VecRestoreSubVector(y, *shellctx->isv, &vout);
+
+  return 0;
+}
+
+/* Merged sparse-matrix solver: The RHS is one assembled matrix, see assemble_RHS */
+int applyRHS_sparsemat_merged(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  MatMult(*shellctx->RHSmerged, x, y);
+
+  return 0;
+}
+
+/* Merged sparse-matrix solver: Action of RHS^T */
+int applyRHS_sparsemat_merged_transpose(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  // Forward multiply with the stored transpose, if available
+  if (shellctx->RHSmerged_T != NULL) MatMult(*shellctx->RHSmerged_T, x, y);
+  else MatMultTranspose(*shellctx->RHSmerged, x, y);
+
+  return 0;
+}
+
+/* Kronecker operator: Action of RHS */
+int applyRHS_kron(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  const double* xptr;
+  double* yptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(y, &yptr);
+  shellctx->kronop->apply(xptr, yptr, false);
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+/* Kronecker operator: Action of RHS^T */
+int applyRHS_kron_transpose(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  const double* xptr;
+  double* yptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(y, &yptr);
+  shellctx->kronop->apply(xptr, yptr, true);
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+/* Matrix-form Lindblad solver: Action of RHS */
+int applyRHS_matrixform(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  const double* xptr;
+  double* yptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(y, &yptr);
+  shellctx->matrixform->apply(xptr, yptr, false);
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+/* Matrix-form Lindblad solver: Action of RHS^T */
+int applyRHS_matrixform_transpose(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  const double* xptr;
+  double* yptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(y, &yptr);
+  shellctx->matrixform->apply(xptr, yptr, true);
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+/* Dense small-system solver: Action of RHS */
+int applyRHS_dense(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+  MatMult(*shellctx->RHSdense, x, y);
+
+  return 0;
+}
+
+/* Dense small-system solver: Action of RHS^T */
+int applyRHS_dense_transpose(Mat RHS, Vec x, Vec y){
+
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+  MatMultTranspose(*shellctx->RHSdense, x, y);
+
+  return 0;
+}
+
+// Compute gradient of RHS wrt parameters (Dense small-system version)
+void compute_dRHS_dParams_dense(const double t, const Vec x, const Vec xbar, const double alpha, Vec grad, std::vector<Mat>& dense_terms, Vec aux, int noscillators, Oscillator** oscil_vec){
+
+  double* grad_ptr;
+  VecGetArray(grad, &grad_ptr);
+  int col_shift = 0;
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    // qbar = xbar^T Ac x, pbar = xbar^T Bc x with the real-valued control terms
+    double pbar, qbar;
+    MatMult(dense_terms[2*iosc], x, aux);   VecDot(aux, xbar, &qbar);
+    MatMult(dense_terms[2*iosc+1], x, aux); VecDot(aux, xbar, &pbar);
+
+    oscil_vec[iosc]->evalControl_diff(t, grad_ptr + col_shift, alpha*pbar, alpha*qbar);
+    col_shift += oscil_vec[iosc]->getNParams();
+  }
+  VecRestoreArray(grad, &grad_ptr);
+}
+
+/* Hermitian-packed state: Action of RHS, y = P A U x */
+int applyRHS_hermitianpacked(Mat RHS, Vec x, Vec y){
+
+  PackedShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  unpackHermitianState(x, *shellctx->xfull);
+  MatMult(*shellctx->RHS, *shellctx->xfull, *shellctx->yfull);
+  packHermitianState(*shellctx->yfull, y);
+
+  return 0;
+}
+
+/* Hermitian-packed state: Action of RHS^T, y = U^T A^T P^T x */
+int applyRHS_hermitianpacked_transpose(Mat RHS, Vec x, Vec y){
 
-  /* Get time from shell context */
-  MatShellCtx *shellctx;
+  PackedShellCtx *shellctx;
   MatShellGetContext(RHS, (void**) &shellctx);
 
-  /* Get u, v from x and y  */
-  Vec u, v;
-  Vec uout, vout;
-  VecGetSubVector(x, *shellctx->isu, &u);
-  VecGetSubVector(x, *shellctx->isv, &v);
-  VecGetSubVector(y, *shellctx->isu, &uout);
-  VecGetSubVector(y, *shellctx->isv, &vout);
+  packHermitianState_diff(x, *shellctx->xfull);
+  MatMultTranspose(*shellctx->RHS, *shellctx->xfull, *shellctx->yfull);
+  VecZeroEntries(y);
+  unpackHermitianState_diff(*shellctx->yfull, y);
 
-  // uout = Re^T*u + Im^T*v
-  //      = (Ad + sum_k q_kA_k)^T*u + (Bd + sum_k p_kB_k)^T*v
-          // + sum_kl J_kl*sin(eta_kl*t) * Ad_kl^T * u
-          //         +J_kl*cos(eta_kl*t) * Bd_kl^T * v  ]   cross terms
-  // vout = -Im^T*u + Re^T*v
-  //      = -(Bd + sum_k p_kB_k)^T*u + (Ad + sum_k q_kA_k)^T*v
-        // + sum_kl - J_kl*cos(eta_kl*t) * Bd_kl^T * u
-        //          + J_kl*sin(eta_kl*t) * Ad_kl^T * v  ]   cross terms
+  return 0;
+}
 
-  // Constant part uout = Ad^Tu + Bd^Tv
-  MatMultTranspose(*shellctx->Bd, v, uout);
-  MatMultTransposeAdd(*shellctx->Ad, u, uout, uout);
-  // Constant part vout = -Bd^Tu + Ad^Tv
-  MatMultTranspose(*shellctx->Bd, u, vout);
-  VecScale(vout, -1.0);
-  MatMultTransposeAdd(*shellctx->Ad, v, vout, vout);
+// Compute gradient of RHS wrt parameters (Matrix-form Lindblad version)
+void compute_dRHS_dParams_matrixform(const double t, const Vec x, const Vec xbar, const double alpha, Vec grad, LindbladMatrixForm* matrixform, int noscillators, Oscillator** oscil_vec){
 
-  /* Time-dependent control term */
-  for (size_t iosc = 0; iosc < shellctx->nlevels.size(); iosc++) {
+  const double* xptr, *xbarptr;
+  double* grad_ptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArrayRead(xbar, &xbarptr);
+  VecGetArray(grad, &grad_ptr);
 
-    p = shellctx->control_Re[iosc];
-    q = shellctx->control_Im[iosc];
+  int col_shift = 0;
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    double pbar = matrixform->groupInnerProduct(1 + 2*iosc, xptr, xbarptr);
+    double qbar = matrixform->groupInnerProduct(2 + 2*iosc, xptr, xbarptr);
+    oscil_vec[iosc]->evalControl_diff(t, grad_ptr + col_shift, alpha*pbar, alpha*qbar);
+    col_shift += oscil_vec[iosc]->getNParams();
+  }
 
-      // uout += q^k*Ac^Tu
-      MatMultTranspose(shellctx->Ac_vec[iosc], u, *shellctx->aux);
-      VecAXPY(uout, q, *shellctx->aux);
-      // vout += q^kAc^Tv
-      MatMultTranspose(shellctx->Ac_vec[iosc], v, *shellctx->aux);
-      VecAXPY(vout, q, *shellctx->aux);
+  VecRestoreArray(grad, &grad_ptr);
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArrayRead(xbar, &xbarptr);
+}
 
-      // uout += p^kBc^Tv
-      MatMultTranspose(shellctx->Bc_vec[iosc], v, *shellctx->aux);
-      VecAXPY(uout, p, *shellctx->aux);
-      // vout -= p^kBc^Tu
-      MatMultTranspose(shellctx->Bc_vec[iosc], u, *shellctx->aux);
-      VecAXPY(vout, -1.*p, *shellctx->aux);
-    }
+// Compute gradient of RHS wrt parameters (Kronecker operator version)
+void compute_dRHS_dParams_kron(const double t, const Vec x, const Vec xbar, const double alpha, Vec grad, KronOperator* kronop, int noscillators, Oscillator** oscil_vec){
 
+  const double* xptr, *xbarptr;
+  double* grad_ptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArrayRead(xbar, &xbarptr);
+  VecGetArray(grad, &grad_ptr);
 
-  /* --- Time-dependent system Hamiltonian (Jaynes-Cumming) --- */
-  int id_kl = 0;
-  int noscillators = shellctx->nlevels.size();
-  for (int k= 0; k< noscillators*(noscillators-1)/2; k++) {
-    if (fabs(shellctx->Jkl[k]) > 1e-12) { 
-      double coeff_re = shellctx->Bd_coeffs[k]; // = cos(etakl*t) 
-      double coeff_im = shellctx->Ad_coeffs[k]; // = sin(etakl*t)
-      if (fabs(coeff_re) > 1e-12) {
-        // uout += +Jkl*cos*Bdklv^T
-        MatMultTranspose(shellctx->Bd_vec[id_kl], v, *shellctx->aux);
-        VecAXPY(uout,  coeff_re, *shellctx->aux);
-        // vout += - Jkl*cos*Bdklu^T
-        MatMultTranspose(shellctx->Bd_vec[id_kl], u, *shellctx->aux);
-        VecAXPY(vout, - coeff_re, *shellctx->aux);
-      }
-      if (fabs(coeff_im) > 1e-12) {
-        // uout += J_kl*sin*Adklu^T
-        MatMultTranspose(shellctx->Ad_vec[id_kl], u, *shellctx->aux);
-        VecAXPY(uout, coeff_im, *shellctx->aux);
-        //vout += Jkl*sin*Adklv^T
-        MatMultTranspose(shellctx->Ad_vec[id_kl], v, *shellctx->aux);
-        VecAXPY(vout, coeff_im, *shellctx->aux);
-      }
-      id_kl++;
-    }
+  int col_shift = 0;
+  for (int iosc = 0; iosc < noscillators; iosc++) {
+    // xbar^T (d RHS / d p) x and xbar^T (d RHS / d q) x
+    double pbar = kronop->groupInnerProduct(1 + 2*iosc, xptr, xbarptr);
+    double qbar = kronop->groupInnerProduct(2 + 2*iosc, xptr, xbarptr);
+    oscil_vec[iosc]->evalControl_diff(t, grad_ptr + col_shift, alpha*pbar, alpha*qbar);
+    col_shift += oscil_vec[iosc]->getNParams();
   }
 
-  /* Restore */
-  VecRestoreSubVector(x, *shellctx->isu, &u);
-  VecRestoreSubVector(x, *shellctx->isv, &v);
-  VecRestoreSubVector(y, *shellctx->isu, &uout);
-  VecRestoreSubVector(y, *shellctx->isv, &vout);
-
-  return 0;
+  VecRestoreArray(grad, &grad_ptr);
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArrayRead(xbar, &xbarptr);
 }
 
 // Compute gradient of RHS wrt parameters (Sparse matrix version)
@@ -966,28 +1800,22 @@ void compute_dRHS_dParams_sparsemat(const double t,const Vec x,const Vec xbar, c
     VecRestoreSubVector(xbar, isv, &vbar);
 }
 
-// Compute gradient of RHS wrt parameters (Matrix-free version)
-void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x,const Vec xbar, const double alpha, Vec grad, std::vector<int>& nlevels, LindbladType lindbladtype, Oscillator** oscil_vec){
+/* Collect the coefficients of the gradient wrt the controls in matrix-free manner. x and xbar are arrays, or HermitianPackedReaders. */
+template <typename XPtr>
+void compute_dRHS_dParams_matfree_coeffs(const PetscInt stride_x, const PetscInt offset_im, const std::vector<int>& nlevels, LindbladType lindbladtype, const XPtr& xptr, const XPtr& xbarptr, double* coeff_p, double* coeff_q){
   double res_p_re,  res_p_im, res_q_re, res_q_im;
-
   int noscillators = nlevels.size();
 
-  const double* xptr, *xbarptr;
-  VecGetArrayRead(x, &xptr);
-  VecGetArrayRead(xbar, &xbarptr);
-
-  double* coeff_p = new double [noscillators];
-  double* coeff_q = new double [noscillators];
-  for (int i=0; i<noscillators; i++){
-    coeff_p[i] = 0.0;
-    coeff_q[i] = 0.0;
-  }
+  /* Hermitian-packed state: only the upper triangle of P^T xbar is nonzero */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  int N = 1;
+  for (int i = 0; i < noscillators; i++) N *= nlevels[i];
 
   if (noscillators == 1) {
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
     int n0 = nlevels[0];
-    int stridei0  = TensorGetIndex(n0, 1,0);
-    int stridei0p = TensorGetIndex(n0, 0,1);
+    int stridei0  = stride_x * TensorGetIndex(n0, 1,0);
+    int stridei0p = stride_x * TensorGetIndex(n0, 0,1);
     /* Switch for Lindblad vs Schroedinger solver */
     int n0p = n0;
     if (lindbladtype == LindbladType::NONE) { // Schroedinger
@@ -999,16 +1827,17 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
     // Iterate over indices of xbar
     for (int i0p = 0; i0p < n0p; i0p++)  {
         for (int i0 = 0; i0 < n0; i0++)  {
+            if (packed && it % N > it / N) { it += stride_x; continue; }  // Below the diagonal: zero in P^T xbar
             /* Get xbar */
             double xbarre = xbarptr[it];
-            double xbarim = xbarptr[it + dim];
+            double xbarim = xbarptr[it + offset_im];
 
             /* --- Oscillator 0 --- */
-            dRHSdp_getcoeffs(dim, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+            dRHSdp_getcoeffs(offset_im, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
             coeff_p[0] += res_p_re * xbarre + res_p_im * xbarim;
             coeff_q[0] += res_q_re * xbarre + res_q_im * xbarim;
 
-            it++;
+            it += stride_x;
           }
       }
   }
@@ -1016,10 +1845,10 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
     int n0 = nlevels[0];
     int n1 = nlevels[1];
-    int stridei0  = TensorGetIndex(n0,n1, 1,0,0,0);
-    int stridei1  = TensorGetIndex(n0,n1, 0,1,0,0);
-    int stridei0p = TensorGetIndex(n0,n1, 0,0,1,0);
-    int stridei1p = TensorGetIndex(n0,n1, 0,0,0,1);
+    int stridei0  = stride_x * TensorGetIndex(n0,n1, 1,0,0,0);
+    int stridei1  = stride_x * TensorGetIndex(n0,n1, 0,1,0,0);
+    int stridei0p = stride_x * TensorGetIndex(n0,n1, 0,0,1,0);
+    int stridei1p = stride_x * TensorGetIndex(n0,n1, 0,0,0,1);
     /* Switch for Lindblad vs Schroedinger solver */
     int n0p = n0;
     int n1p = n1;
@@ -1035,20 +1864,21 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
       for (int i1p = 0; i1p < n1p; i1p++)  {
         for (int i0 = 0; i0 < n0; i0++)  {
           for (int i1 = 0; i1 < n1; i1++)  {
+            if (packed && it % N > it / N) { it += stride_x; continue; }  // Below the diagonal: zero in P^T xbar
             /* Get xbar */
             double xbarre = xbarptr[it];
-            double xbarim = xbarptr[it + dim];
+            double xbarim = xbarptr[it + offset_im];
 
             /* --- Oscillator 0 --- */
-            dRHSdp_getcoeffs(dim, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+            dRHSdp_getcoeffs(offset_im, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
             coeff_p[0] += res_p_re * xbarre + res_p_im * xbarim;
             coeff_q[0] += res_q_re * xbarre + res_q_im * xbarim;
             /* --- Oscillator 1 --- */
-            dRHSdp_getcoeffs(dim, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+            dRHSdp_getcoeffs(offset_im, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
             coeff_p[1] += res_p_re * xbarre + res_p_im * xbarim;
             coeff_q[1] += res_q_re * xbarre + res_q_im * xbarim;
 
-            it++;
+            it += stride_x;
           }
         }
       }
@@ -1058,12 +1888,12 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
     int n0 = nlevels[0];
     int n1 = nlevels[1];
     int n2 = nlevels[2];
-    int stridei0  = TensorGetIndex(n0,n1,n2, 1,0,0,0,0,0);
-    int stridei1  = TensorGetIndex(n0,n1,n2, 0,1,0,0,0,0);
-    int stridei2  = TensorGetIndex(n0,n1,n2, 0,0,1,0,0,0);
-    int stridei0p = TensorGetIndex(n0,n1,n2, 0,0,0,1,0,0);
-    int stridei1p = TensorGetIndex(n0,n1,n2, 0,0,0,0,1,0);
-    int stridei2p = TensorGetIndex(n0,n1,n2, 0,0,0,0,0,1);
+    int stridei0  = stride_x * TensorGetIndex(n0,n1,n2, 1,0,0,0,0,0);
+    int stridei1  = stride_x * TensorGetIndex(n0,n1,n2, 0,1,0,0,0,0);
+    int stridei2  = stride_x * TensorGetIndex(n0,n1,n2, 0,0,1,0,0,0);
+    int stridei0p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,1,0,0);
+    int stridei1p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,0,1,0);
+    int stridei2p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,0,0,1);
     /* Switch for Lindblad vs Schroedinger solver */
     int n0p = n0;
     int n1p = n1;
@@ -1082,24 +1912,25 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
           for (int i0 = 0; i0 < n0; i0++)  {
             for (int i1 = 0; i1 < n1; i1++)  {
               for (int i2 = 0; i2 < n2; i2++)  {
+                if (packed && it % N > it / N) { it += stride_x; continue; }  // Below the diagonal: zero in P^T xbar
                 /* Get xbar */
                 double xbarre = xbarptr[it];
-                double xbarim = xbarptr[it + dim];
+                double xbarim = xbarptr[it + offset_im];
 
                 /* --- Oscillator 0 --- */
-                dRHSdp_getcoeffs(dim, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                dRHSdp_getcoeffs(offset_im, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                 coeff_p[0] += res_p_re * xbarre + res_p_im * xbarim;
                 coeff_q[0] += res_q_re * xbarre + res_q_im * xbarim;
                 /* --- Oscillator 1 --- */
-                dRHSdp_getcoeffs(dim, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                dRHSdp_getcoeffs(offset_im, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                 coeff_p[1] += res_p_re * xbarre + res_p_im * xbarim;
                 coeff_q[1] += res_q_re * xbarre + res_q_im * xbarim;
                 /* --- Oscillator 2 --- */
-                dRHSdp_getcoeffs(dim, it, n2, n2p, i2, i2p, stridei2, stridei2p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                dRHSdp_getcoeffs(offset_im, it, n2, n2p, i2, i2p, stridei2, stridei2p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                 coeff_p[2] += res_p_re * xbarre + res_p_im * xbarim;
                 coeff_q[2] += res_q_re * xbarre + res_q_im * xbarim;
 
-                it++;
+                it += stride_x;
               }
             }
           }
@@ -1112,14 +1943,14 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
     int n1 = nlevels[1];
     int n2 = nlevels[2];
     int n3 = nlevels[3];
-    int stridei0  = TensorGetIndex(n0,n1,n2,n3, 1,0,0,0,0,0,0,0);
-    int stridei1  = TensorGetIndex(n0,n1,n2,n3, 0,1,0,0,0,0,0,0);
-    int stridei2  = TensorGetIndex(n0,n1,n2,n3, 0,0,1,0,0,0,0,0);
-    int stridei3  = TensorGetIndex(n0,n1,n2,n3, 0,0,0,1,0,0,0,0);
-    int stridei0p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,1,0,0,0);
-    int stridei1p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,1,0,0);
-    int stridei2p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,1,0);
-    int stridei3p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,0,1);
+    int stridei0  = stride_x * TensorGetIndex(n0,n1,n2,n3, 1,0,0,0,0,0,0,0);
+    int stridei1  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,1,0,0,0,0,0,0);
+    int stridei2  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,1,0,0,0,0,0);
+    int stridei3  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,1,0,0,0,0);
+    int stridei0p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,1,0,0,0);
+    int stridei1p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,1,0,0);
+    int stridei2p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,1,0);
+    int stridei3p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,0,1);
     /* Switch for Lindblad vs Schroedinger solver */
     int n0p = n0;
     int n1p = n1;
@@ -1142,28 +1973,29 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
               for (int i1 = 0; i1 < n1; i1++)  {
                 for (int i2 = 0; i2 < n2; i2++)  {
                   for (int i3 = 0; i3 < n3; i3++)  {
+                    if (packed && it % N > it / N) { it += stride_x; continue; }  // Below the diagonal: zero in P^T xbar
                     /* Get xbar */
                     double xbarre = xbarptr[it];
-                    double xbarim = xbarptr[it + dim];
+                    double xbarim = xbarptr[it + offset_im];
 
                     /* --- Oscillator 0 --- */
-                    dRHSdp_getcoeffs(dim, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                    dRHSdp_getcoeffs(offset_im, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                     coeff_p[0] += res_p_re * xbarre + res_p_im * xbarim;
                     coeff_q[0] += res_q_re * xbarre + res_q_im * xbarim;
                     /* --- Oscillator 1 --- */
-                    dRHSdp_getcoeffs(dim, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                    dRHSdp_getcoeffs(offset_im, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                     coeff_p[1] += res_p_re * xbarre + res_p_im * xbarim;
                     coeff_q[1] += res_q_re * xbarre + res_q_im * xbarim;
                     /* --- Oscillator 2 --- */
-                    dRHSdp_getcoeffs(dim, it, n2, n2p, i2, i2p, stridei2, stridei2p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                    dRHSdp_getcoeffs(offset_im, it, n2, n2p, i2, i2p, stridei2, stridei2p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                     coeff_p[2] += res_p_re * xbarre + res_p_im * xbarim;
                     coeff_q[2] += res_q_re * xbarre + res_q_im * xbarim;
                     /* --- Oscillator 3 --- */
-                    dRHSdp_getcoeffs(dim, it, n3, n3p, i3, i3p, stridei3, stridei3p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                    dRHSdp_getcoeffs(offset_im, it, n3, n3p, i3, i3p, stridei3, stridei3p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                     coeff_p[3] += res_p_re * xbarre + res_p_im * xbarim;
                     coeff_q[3] += res_q_re * xbarre + res_q_im * xbarim;
 
-                    it++;
+                    it += stride_x;
                   }
                 }
               }
@@ -1179,16 +2011,16 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
     int n2 = nlevels[2];
     int n3 = nlevels[3];
     int n4 = nlevels[4];
-    int stridei0  = TensorGetIndex(n0,n1,n2,n3,n4, 1,0,0,0,0,0,0,0,0,0);
-    int stridei1  = TensorGetIndex(n0,n1,n2,n3,n4, 0,1,0,0,0,0,0,0,0,0);
-    int stridei2  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,1,0,0,0,0,0,0,0);
-    int stridei3  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,1,0,0,0,0,0,0);
-    int stridei4  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,1,0,0,0,0,0);
-    int stridei0p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,1,0,0,0,0);
-    int stridei1p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,1,0,0,0);
-    int stridei2p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,1,0,0);
-    int stridei3p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,1,0);
-    int stridei4p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,0,1);
+    int stridei0  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 1,0,0,0,0,0,0,0,0,0);
+    int stridei1  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,1,0,0,0,0,0,0,0,0);
+    int stridei2  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,1,0,0,0,0,0,0,0);
+    int stridei3  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,1,0,0,0,0,0,0);
+    int stridei4  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,1,0,0,0,0,0);
+    int stridei0p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,1,0,0,0,0);
+    int stridei1p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,1,0,0,0);
+    int stridei2p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,1,0,0);
+    int stridei3p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,1,0);
+    int stridei4p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,0,1);
     /* Switch for Lindblad vs Schroedinger solver */
     int n0p = n0;
     int n1p = n1;
@@ -1215,32 +2047,33 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
                   for (int i2 = 0; i2 < n2; i2++)  {
                     for (int i3 = 0; i3 < n3; i3++)  {
                       for (int i4 = 0; i4 < n4; i4++)  {
+                        if (packed && it % N > it / N) { it += stride_x; continue; }  // Below the diagonal: zero in P^T xbar
                         /* Get xbar */
                         double xbarre = xbarptr[it];
-                        double xbarim = xbarptr[it + dim];
+                        double xbarim = xbarptr[it + offset_im];
 
                         /* --- Oscillator 0 --- */
-                        dRHSdp_getcoeffs(dim, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                        dRHSdp_getcoeffs(offset_im, it, n0, n0p, i0, i0p, stridei0, stridei0p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                         coeff_p[0] += res_p_re * xbarre + res_p_im * xbarim;
                         coeff_q[0] += res_q_re * xbarre + res_q_im * xbarim;
                         /* --- Oscillator 1 --- */
-                        dRHSdp_getcoeffs(dim, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                        dRHSdp_getcoeffs(offset_im, it, n1, n1p, i1, i1p, stridei1, stridei1p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                         coeff_p[1] += res_p_re * xbarre + res_p_im * xbarim;
                         coeff_q[1] += res_q_re * xbarre + res_q_im * xbarim;
                         /* --- Oscillator 2 --- */
-                        dRHSdp_getcoeffs(dim, it, n2, n2p, i2, i2p, stridei2, stridei2p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                        dRHSdp_getcoeffs(offset_im, it, n2, n2p, i2, i2p, stridei2, stridei2p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                         coeff_p[2] += res_p_re * xbarre + res_p_im * xbarim;
                         coeff_q[2] += res_q_re * xbarre + res_q_im * xbarim;
                         /* --- Oscillator 3 --- */
-                        dRHSdp_getcoeffs(dim, it, n3, n3p, i3, i3p, stridei3, stridei3p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                        dRHSdp_getcoeffs(offset_im, it, n3, n3p, i3, i3p, stridei3, stridei3p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                         coeff_p[3] += res_p_re * xbarre + res_p_im * xbarim;
                         coeff_q[3] += res_q_re * xbarre + res_q_im * xbarim;
                         /* --- Oscillator 4 --- */
-                        dRHSdp_getcoeffs(dim, it, n4, n4p, i4, i4p, stridei4, stridei4p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
+                        dRHSdp_getcoeffs(offset_im, it, n4, n4p, i4, i4p, stridei4, stridei4p, xptr, &res_p_re, &res_p_im, &res_q_re, &res_q_im);
                         coeff_p[4] += res_p_re * xbarre + res_p_im * xbarim;
                         coeff_q[4] += res_q_re * xbarre + res_q_im * xbarim;
 
-                        it++;
+                        it += stride_x;
                       }
                     }
                   }
@@ -1255,6 +2088,35 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
     printf("This should never happen!\n"); 
     exit(1);
   }
+}
+
+// Compute gradient of RHS wrt parameters (Matrix-free version)
+void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x,const Vec xbar, const double alpha, Vec grad, std::vector<int>& nlevels, LindbladType lindbladtype, Oscillator** oscil_vec, bool hermitianpacked){
+  int noscillators = nlevels.size();
+
+  const double* xptr, *xbarptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArrayRead(xbar, &xbarptr);
+
+  /* Strides for accessing Re and Im part of each element in x (serial) */
+  PetscInt stride_x, offset_im;
+  getStateStrides(dim, &stride_x, &offset_im);
+
+  double* coeff_p = new double [noscillators];
+  double* coeff_q = new double [noscillators];
+  for (int i=0; i<noscillators; i++){
+    coeff_p[i] = 0.0;
+    coeff_q[i] = 0.0;
+  }
+
+  /* Hermitian-packed state: read x as U x and xbar as P^T xbar, in blocked layout */
+  if (hermitianpacked) {
+    int N = 1;
+    for (int i = 0; i < noscillators; i++) N *= nlevels[i];
+    compute_dRHS_dParams_matfree_coeffs(1, dim, nlevels, lindbladtype, HermitianPackedReader<false>(xptr, N), HermitianPackedReader<false>(xbarptr, N), coeff_p, coeff_q);
+  } else {
+    compute_dRHS_dParams_matfree_coeffs(stride_x, offset_im, nlevels, lindbladtype, xptr, xbarptr, coeff_p, coeff_q);
+  }
   VecRestoreArrayRead(x, &xptr);
   VecRestoreArrayRead(xbar, &xbarptr);
 
@@ -1275,20 +2137,14 @@ void compute_dRHS_dParams_matfree(const PetscInt dim, const double t,const Vec x
   delete [] coeff_q;
 }
 
-/* Matfree-solver for 1 Oscillator: Define the action of RHS on a vector x */
-template <int n0>
-int applyRHS_matfree(Mat RHS, Vec x, Vec y){
-
-  /* Get the shell context */
-  MatShellCtx *shellctx;
-  MatShellGetContext(RHS, (void**) &shellctx);
-
-  /* Get access to x and y */
-  const double* xptr;
-  double* yptr;
-  VecGetArrayRead(x, &xptr);
-  VecGetArray(y, &yptr);
+/* Matfree-solver for 1 Oscillator: Define the action of RHS on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, typename XPtr>
+void applyRHS_matfree_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
 
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
 
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
@@ -1303,8 +2159,8 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   double qt0 = shellctx->control_Im[0];
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,1,0);
-  int stridei0p = TensorGetIndex(n0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,1,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -1312,64 +2168,67 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
     n0p = 1; // Cut down so that below loop has i0p=0 and i1p=0/
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-      for (int i0 = 0; i0 < n0; i0++)  {
-
-          /* --- Diagonal part ---*/
-          //Get input x values
-          double xre = xptr[it];
-          double xim = xptr[it + shellctx->dim];
-          // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
-          //                    vout = (-hd(ik) + hd(ik'))*uin
-          double hd  = H_detune(detuning_freq0, i0)
-                     + H_selfkerr(xi0, i0);
-          double hdp = 0.0;
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            hdp = H_detune(detuning_freq0, i0p)
-                + H_selfkerr(xi0, i0p);
-          }
-          double yre = ( hd - hdp ) * xim;
-          double yim = (-hd + hdp ) * xre;
-
-          // Decay l1, diagonal part: xout += l1diag xin
-          // Dephasing l2: xout += l2(ik, ikp) xin
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            double l1diag = L1diag(decay0, i0, i0p);
-            double l2 = L2(dephase0, i0, i0p);
-            yre += (l2 + l1diag) * xre;
-            yim += (l2 + l1diag) * xim;
-          }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[1] = {n0};
+  const int nlevp[1] = {n0p};
+  int lo[1], hi[1], lop[1], hip[1];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 1, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 1, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+      int it = stride_x * (rowstart + col * n0);
+      for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+        if (packed && it > col * (n0 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+        /* --- Diagonal part ---*/
+        //Get input x values
+        double xre = xptr[it];
+        double xim = xptr[it + offset_im];
+        // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
+        //                    vout = (-hd(ik) + hd(ik'))*uin
+        double hd  = H_detune(detuning_freq0, i0)
+                   + H_selfkerr(xi0, i0);
+        double hdp = 0.0;
+        if (shellctx->lindbladtype != LindbladType::NONE) {
+          hdp = H_detune(detuning_freq0, i0p)
+              + H_selfkerr(xi0, i0p);
+        }
+        double yre = ( hd - hdp ) * xim;
+        double yim = (-hd + hdp ) * xre;
+
+        // Decay l1, diagonal part: xout += l1diag xin
+        // Dephasing l2: xout += l2(ik, ikp) xin
+        if (shellctx->lindbladtype != LindbladType::NONE) {
+          double l1diag = L1diag(decay0, i0, i0p);
+          double l2 = L2(dephase0, i0, i0p);
+          yre += (l2 + l1diag) * xre;
+          yim += (l2 + l1diag) * xim;
+        }
 
-          /* --- Offdiagonal: Jkl coupling term --- */
+        /* --- Offdiagonal: Jkl coupling term --- */
 
-          /* --- Offdiagonal part of decay L1 */
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            L1decay(shellctx->dim, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
-          }
+        /* --- Offdiagonal part of decay L1 */
+        if (shellctx->lindbladtype != LindbladType::NONE) {
+          L1decay(offset_im, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+        }
 
-          /* --- Control hamiltonian --- */
-          // Oscillator 0 
-          control(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
+        /* --- Control hamiltonian --- */
+        // Oscillator 0 
+        control(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
 
-          /* Update */
-          yptr[it]   = yre;
-          yptr[it + shellctx->dim] = yim;
-          it++;
+        /* Update */
+        matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+        it += stride_x;
       }
+      col++;
+    }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-/* Matrix-free solver for 1 Oscillators: Define the action of RHS^T on a vector x */
+/* Matfree-solver for 1 Oscillator: Define the action of RHS on a vector x */
 template <int n0>
-int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+int applyRHS_matfree(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -1381,6 +2240,27 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   VecGetArrayRead(x, &xptr);
   VecGetArray(y, &yptr);
 
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_kernel<n0>(shellctx, HermitianPackedReader<false, n0>(xptr), yptr);
+  else
+    applyRHS_matfree_kernel<n0>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+/* Matrix-free solver for 1 Oscillators: Define the action of RHS^T on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, typename XPtr>
+void applyRHS_matfree_transpose_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
+
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
   double detuning_freq0 = shellctx->oscil_vec[0]->getDetuning();
@@ -1394,8 +2274,8 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   double qt0 = shellctx->control_Im[0];
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0, 1,0);
-  int stridei0p = TensorGetIndex(n0, 0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0, 1,0);
+  int stridei0p = stride_x * TensorGetIndex(n0, 0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -1403,66 +2283,68 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
     n0p = 1; // Cut down so that below loop has i0p=0 and i1p=0/
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-      for (int i0 = 0; i0 < n0; i0++)  {
-
-          /* --- Diagonal part ---*/
-          //Get input x values
-          double xre = xptr[it];
-          double xim = xptr[it + shellctx->dim];
-          // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
-          //                         vout = (-hd(ik) + hd(ik'))*uin
-          double hd  = H_detune(detuning_freq0, i0)
-                     + H_selfkerr(xi0, i0);
-          double hdp = 0.0;
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            hdp = H_detune(detuning_freq0, i0p)
-                  + H_selfkerr(xi0, i0p);
-          }
-          double yre = (-hd + hdp ) * xim;
-          double yim = ( hd - hdp ) * xre;
-
-          // Decay l1^T, diagonal part: xout += l1diag xin
-          // Dephasing l2^T: xout += l2(ik, ikp) xin
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            double l1diag = L1diag(decay0, i0, i0p);
-            double l2 = L2(dephase0, i0, i0p);
-            yre += (l2 + l1diag) * xre;
-            yim += (l2 + l1diag) * xim;
-          }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[1] = {n0};
+  const int nlevp[1] = {n0p};
+  int lo[1], hi[1], lop[1], hip[1];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 1, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 1, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+      int it = stride_x * (rowstart + col * n0);
+      for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+        if (packed && it > col * (n0 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+        /* --- Diagonal part ---*/
+        //Get input x values
+        double xre = xptr[it];
+        double xim = xptr[it + offset_im];
+        // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
+        //                         vout = (-hd(ik) + hd(ik'))*uin
+        double hd  = H_detune(detuning_freq0, i0)
+                   + H_selfkerr(xi0, i0);
+        double hdp = 0.0;
+        if (shellctx->lindbladtype != LindbladType::NONE) {
+          hdp = H_detune(detuning_freq0, i0p)
+                + H_selfkerr(xi0, i0p);
+        }
+        double yre = (-hd + hdp ) * xim;
+        double yim = ( hd - hdp ) * xre;
+
+        // Decay l1^T, diagonal part: xout += l1diag xin
+        // Dephasing l2^T: xout += l2(ik, ikp) xin
+        if (shellctx->lindbladtype != LindbladType::NONE) {
+          double l1diag = L1diag(decay0, i0, i0p);
+          double l2 = L2(dephase0, i0, i0p);
+          yre += (l2 + l1diag) * xre;
+          yim += (l2 + l1diag) * xim;
+        }
 
-          /* --- Offdiagonal coupling term J_kl --- */
+        /* --- Offdiagonal coupling term J_kl --- */
  
-          /* --- Offdiagonal part of decay L1^T */
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            // Oscillators 0
-            L1decay_T(shellctx->dim, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
-          }
+        /* --- Offdiagonal part of decay L1^T */
+        if (shellctx->lindbladtype != LindbladType::NONE) {
+          // Oscillators 0
+          L1decay_T(offset_im, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+        }
 
-          /* --- Control hamiltonian  --- */
-          // Oscillator 0
-          control_T(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
+        /* --- Control hamiltonian  --- */
+        // Oscillator 0
+        control_T(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
 
-          /* Update */
-          yptr[it]   = yre;
-          yptr[it + shellctx->dim] = yim;
-          it++;
+        /* Update */
+        matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+        it += stride_x;
       }
+      col++;
+    }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-
-/* Matfree-solver for 2 Oscillators: Define the action of RHS on a vector x */
-template <int n0, int n1>
-int applyRHS_matfree(Mat RHS, Vec x, Vec y){
+/* Matrix-free solver for 1 Oscillators: Define the action of RHS^T on a vector x */
+template <int n0>
+int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -1474,6 +2356,27 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   VecGetArrayRead(x, &xptr);
   VecGetArray(y, &yptr);
 
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_transpose_kernel<n0>(shellctx, HermitianPackedReader<true, n0>(xptr), yptr);
+  else
+    applyRHS_matfree_transpose_kernel<n0>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+
+/* Matfree-solver for 2 Oscillators: Define the action of RHS on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, typename XPtr>
+void applyRHS_matfree_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
 
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
@@ -1503,10 +2406,10 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   double sin01 = sin(eta01 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1, 1,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1, 0,1,0,0);
-  int stridei0p = TensorGetIndex(n0,n1, 0,0,1,0);
-  int stridei1p = TensorGetIndex(n0,n1, 0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1, 1,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1, 0,1,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1, 0,0,1,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1, 0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -1516,78 +2419,80 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
     n1p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i0 = 0; i0 < n0; i0++)  {
-        for (int i1 = 0; i1 < n1; i1++)  {
-
-          /* --- Diagonal part ---*/
-          //Get input x values
-          double xre = xptr[it];
-          double xim = xptr[it + shellctx->dim];
-          // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
-          //                    vout = (-hd(ik) + hd(ik'))*uin
-          double hd  = H_detune(detuning_freq0, detuning_freq1, i0, i1)
-                     + H_selfkerr(xi0, xi1, i0, i1)
-                     + H_crosskerr(xi01, i0, i1);
-          double hdp = 0.0;
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            hdp = H_detune(detuning_freq0, detuning_freq1, i0p, i1p)
-                + H_selfkerr(xi0, xi1, i0p, i1p)
-                + H_crosskerr(xi01, i0p, i1p);
-          }
-          double yre = ( hd - hdp ) * xim;
-          double yim = (-hd + hdp ) * xre;
-
-          // Decay l1, diagonal part: xout += l1diag xin
-          // Dephasing l2: xout += l2(ik, ikp) xin
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            double l1diag = L1diag(decay0, decay1, i0, i1, i0p, i1p);
-            double l2 = L2(dephase0, dephase1, i0, i1, i0p, i1p);
-            yre += (l2 + l1diag) * xre;
-            yim += (l2 + l1diag) * xim;
-          }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[2] = {n0, n1};
+  const int nlevp[2] = {n0p, n1p};
+  int lo[2], hi[2], lop[2], hip[2];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 2, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 2, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+        int it = stride_x * (rowstart + col * n0*n1);
+        for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+          for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+            if (packed && it > col * (n0*n1 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+            /* --- Diagonal part ---*/
+            //Get input x values
+            double xre = xptr[it];
+            double xim = xptr[it + offset_im];
+            // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
+            //                    vout = (-hd(ik) + hd(ik'))*uin
+            double hd  = H_detune(detuning_freq0, detuning_freq1, i0, i1)
+                       + H_selfkerr(xi0, xi1, i0, i1)
+                       + H_crosskerr(xi01, i0, i1);
+            double hdp = 0.0;
+            if (shellctx->lindbladtype != LindbladType::NONE) {
+              hdp = H_detune(detuning_freq0, detuning_freq1, i0p, i1p)
+                  + H_selfkerr(xi0, xi1, i0p, i1p)
+                  + H_crosskerr(xi01, i0p, i1p);
+            }
+            double yre = ( hd - hdp ) * xim;
+            double yim = (-hd + hdp ) * xre;
+
+            // Decay l1, diagonal part: xout += l1diag xin
+            // Dephasing l2: xout += l2(ik, ikp) xin
+            if (shellctx->lindbladtype != LindbladType::NONE) {
+              double l1diag = L1diag(decay0, decay1, i0, i1, i0p, i1p);
+              double l2 = L2(dephase0, dephase1, i0, i1, i0p, i1p);
+              yre += (l2 + l1diag) * xre;
+              yim += (l2 + l1diag) * xim;
+            }
 
-          /* --- Offdiagonal: Jkl coupling term --- */
-          // oscillator 0<->1 
-          Jkl_coupling(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+            /* --- Offdiagonal: Jkl coupling term --- */
+            // oscillator 0<->1 
+            Jkl_coupling(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
 
-          /* --- Offdiagonal part of decay L1 */
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            // Oscillators 0
-            L1decay(shellctx->dim, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
-            // Oscillator 1
-            L1decay(shellctx->dim, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
-          }
+            /* --- Offdiagonal part of decay L1 */
+            if (shellctx->lindbladtype != LindbladType::NONE) {
+              // Oscillators 0
+              L1decay(offset_im, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+              // Oscillator 1
+              L1decay(offset_im, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+            }
 
-          /* --- Control hamiltonian --- */
-          // Oscillator 0 
-          control(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-          // Oscillator 1
-          control(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
+            /* --- Control hamiltonian --- */
+            // Oscillator 0 
+            control(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
+            // Oscillator 1
+            control(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
 
-          /* Update */
-          yptr[it]   = yre;
-          yptr[it + shellctx->dim] = yim;
-          it++;
+            /* Update */
+            matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+            it += stride_x;
+          }
         }
+        col++;
       }
     }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-
-/* Matrix-free solver for 2 Oscillators: Define the action of RHS^T on a vector x */
+/* Matfree-solver for 2 Oscillators: Define the action of RHS on a vector x */
 template <int n0, int n1>
-int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+int applyRHS_matfree(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -1599,6 +2504,28 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   VecGetArrayRead(x, &xptr);
   VecGetArray(y, &yptr);
 
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_kernel<n0,n1>(shellctx, HermitianPackedReader<false, n0*n1>(xptr), yptr);
+  else
+    applyRHS_matfree_kernel<n0,n1>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+
+/* Matrix-free solver for 2 Oscillators: Define the action of RHS^T on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, typename XPtr>
+void applyRHS_matfree_transpose_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
+
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
   double xi1  = shellctx->oscil_vec[1]->getSelfkerr();
@@ -1627,10 +2554,10 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   double sin01 = sin(eta01 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1, 1,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1, 0,1,0,0);
-  int stridei0p = TensorGetIndex(n0,n1, 0,0,1,0);
-  int stridei1p = TensorGetIndex(n0,n1, 0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1, 1,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1, 0,1,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1, 0,0,1,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1, 0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -1640,66 +2567,95 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
     n1p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i0 = 0; i0 < n0; i0++)  {
-        for (int i1 = 0; i1 < n1; i1++)  {
-
-          /* --- Diagonal part ---*/
-          //Get input x values
-          double xre = xptr[it];
-          double xim = xptr[it + shellctx->dim];
-          // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
-          //                         vout = (-hd(ik) + hd(ik'))*uin
-          double hd  = H_detune(detuning_freq0, detuning_freq1, i0, i1)
-                     + H_selfkerr(xi0, xi1, i0, i1)
-                     + H_crosskerr(xi01, i0, i1);
-          double hdp = 0.0;
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            hdp = H_detune(detuning_freq0, detuning_freq1, i0p, i1p)
-                  + H_selfkerr(xi0, xi1, i0p, i1p)
-                  + H_crosskerr(xi01, i0p, i1p);
-          }
-          double yre = (-hd + hdp ) * xim;
-          double yim = ( hd - hdp ) * xre;
-
-          // Decay l1^T, diagonal part: xout += l1diag xin
-          // Dephasing l2^T: xout += l2(ik, ikp) xin
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            double l1diag = L1diag(decay0, decay1, i0, i1, i0p, i1p);
-            double l2 = L2(dephase0, dephase1, i0, i1, i0p, i1p);
-            yre += (l2 + l1diag) * xre;
-            yim += (l2 + l1diag) * xim;
-          }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[2] = {n0, n1};
+  const int nlevp[2] = {n0p, n1p};
+  int lo[2], hi[2], lop[2], hip[2];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 2, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 2, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+        int it = stride_x * (rowstart + col * n0*n1);
+        for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+          for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+            if (packed && it > col * (n0*n1 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+            /* --- Diagonal part ---*/
+            //Get input x values
+            double xre = xptr[it];
+            double xim = xptr[it + offset_im];
+            // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
+            //                         vout = (-hd(ik) + hd(ik'))*uin
+            double hd  = H_detune(detuning_freq0, detuning_freq1, i0, i1)
+                       + H_selfkerr(xi0, xi1, i0, i1)
+                       + H_crosskerr(xi01, i0, i1);
+            double hdp = 0.0;
+            if (shellctx->lindbladtype != LindbladType::NONE) {
+              hdp = H_detune(detuning_freq0, detuning_freq1, i0p, i1p)
+                    + H_selfkerr(xi0, xi1, i0p, i1p)
+                    + H_crosskerr(xi01, i0p, i1p);
+            }
+            double yre = (-hd + hdp ) * xim;
+            double yim = ( hd - hdp ) * xre;
+
+            // Decay l1^T, diagonal part: xout += l1diag xin
+            // Dephasing l2^T: xout += l2(ik, ikp) xin
+            if (shellctx->lindbladtype != LindbladType::NONE) {
+              double l1diag = L1diag(decay0, decay1, i0, i1, i0p, i1p);
+              double l2 = L2(dephase0, dephase1, i0, i1, i0p, i1p);
+              yre += (l2 + l1diag) * xre;
+              yim += (l2 + l1diag) * xim;
+            }
 
-          /* --- Offdiagonal coupling term J_kl --- */
-          // oscillator 0<->1
-          Jkl_coupling_T(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+            /* --- Offdiagonal coupling term J_kl --- */
+            // oscillator 0<->1
+            Jkl_coupling_T(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
  
-          /* --- Offdiagonal part of decay L1^T */
-          if (shellctx->lindbladtype != LindbladType::NONE) {
-            // Oscillators 0
-            L1decay_T(shellctx->dim, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+            /* --- Offdiagonal part of decay L1^T */
+            if (shellctx->lindbladtype != LindbladType::NONE) {
+              // Oscillators 0
+              L1decay_T(offset_im, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+              // Oscillator 1
+              L1decay_T(offset_im, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+            }
+
+            /* --- Control hamiltonian  --- */
+            // Oscillator 0
+            control_T(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
             // Oscillator 1
-            L1decay_T(shellctx->dim, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+            control_T(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
+
+            /* Update */
+            matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+            it += stride_x;
           }
+        }
+        col++;
+      }
+    }
+  }
+}
+
+/* Matrix-free solver for 2 Oscillators: Define the action of RHS^T on a vector x */
+template <int n0, int n1>
+int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+
+  /* Get the shell context */
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
 
-          /* --- Control hamiltonian  --- */
-          // Oscillator 0
-          control_T(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-          // Oscillator 1
-          control_T(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
+  /* Get access to x and y */
+  const double* xptr;
+  double* yptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(y, &yptr);
 
-          /* Update */
-          yptr[it]   = yre;
-          yptr[it + shellctx->dim] = yim;
-          it++;
-        }
-      }
-    }
-  }
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_transpose_kernel<n0,n1>(shellctx, HermitianPackedReader<true, n0*n1>(xptr), yptr);
+  else
+    applyRHS_matfree_transpose_kernel<n0,n1>(shellctx, xptr, yptr);
 
   /* Restore x and y */
   VecRestoreArrayRead(x, &xptr);
@@ -1709,19 +2665,15 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
 }
 
 
-/* Matfree-solver for 3 Oscillators: Define the action of RHS on a vector x */
-template <int n0, int n1, int n2>
-int applyRHS_matfree(Mat RHS, Vec x, Vec y){
+/* Matfree-solver for 3 Oscillators: Define the action of RHS on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, int n2, typename XPtr>
+void applyRHS_matfree_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
 
-   /* Get the shell context */
-  MatShellCtx *shellctx;
-  MatShellGetContext(RHS, (void**) &shellctx);
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
 
-  /* Get access to x and y */
-  const double* xptr;
-  double* yptr;
-  VecGetArrayRead(x, &xptr);
-  VecGetArray(y, &yptr); 
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
   double xi1  = shellctx->oscil_vec[1]->getSelfkerr();   
@@ -1764,12 +2716,12 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   double sin12 = sin(eta12 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1,n2, 1,0,0,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1,n2, 0,1,0,0,0,0);
-  int stridei2  = TensorGetIndex(n0,n1,n2, 0,0,1,0,0,0);
-  int stridei0p = TensorGetIndex(n0,n1,n2, 0,0,0,1,0,0);
-  int stridei1p = TensorGetIndex(n0,n1,n2, 0,0,0,0,1,0);
-  int stridei2p = TensorGetIndex(n0,n1,n2, 0,0,0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1,n2, 1,0,0,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1,n2, 0,1,0,0,0,0);
+  int stridei2  = stride_x * TensorGetIndex(n0,n1,n2, 0,0,1,0,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,1,0,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,0,1,0);
+  int stridei2p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -1781,91 +2733,94 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
     n2p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i2p = 0; i2p < n2p; i2p++)  {
-        for (int i0 = 0; i0 < n0; i0++)  {
-          for (int i1 = 0; i1 < n1; i1++)  {
-            for (int i2 = 0; i2 < n2; i2++)  {
-
-              /* --- Diagonal part ---*/
-              //Get input x values
-              double xre = xptr[it];
-              double xim = xptr[it + shellctx->dim];
-              // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
-              //                    vout = (-hd(ik) + hd(ik'))*uin
-              double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0, i1, i2)
-                         + H_selfkerr(xi0, xi1, xi2, i0, i1, i2)
-                         + H_crosskerr(xi01, xi02, xi12, i0, i1, i2);
-              double hdp =0.0;
-              if (shellctx->lindbladtype != LindbladType::NONE) {
-                hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0p, i1p, i2p)
-                      + H_selfkerr(xi0, xi1, xi2, i0p, i1p, i2p)
-                      + H_crosskerr(xi01, xi02, xi12, i0p, i1p, i2p);
-              }
-              double yre = ( hd - hdp ) * xim;
-              double yim = (-hd + hdp ) * xre;
-
-              // Decay l1, diagonal part: xout += l1diag xin
-              // Dephasing l2: xout += l2(ik, ikp) xin
-              if (shellctx->lindbladtype != LindbladType::NONE) {
-                double l1diag = L1diag(decay0, decay1, decay2, i0, i1, i2, i0p, i1p, i2p);
-                double l2 = L2(dephase0, dephase1, dephase2, i0, i1, i2, i0p, i1p, i2p);
-                yre += (l2 + l1diag) * xre;
-                yim += (l2 + l1diag) * xim;
-              }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[3] = {n0, n1, n2};
+  const int nlevp[3] = {n0p, n1p, n2p};
+  int lo[3], hi[3], lop[3], hip[3];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 3, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 3, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        for (int i2p = lop[2]; i2p < hip[2]; i2p++)  {
+          if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+          int it = stride_x * (rowstart + col * n0*n1*n2);
+          for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+            for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+              for (int i2 = lo[2]; i2 < hi[2]; i2++)  {
+                if (packed && it > col * (n0*n1*n2 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+                /* --- Diagonal part ---*/
+                //Get input x values
+                double xre = xptr[it];
+                double xim = xptr[it + offset_im];
+                // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
+                //                    vout = (-hd(ik) + hd(ik'))*uin
+                double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0, i1, i2)
+                           + H_selfkerr(xi0, xi1, xi2, i0, i1, i2)
+                           + H_crosskerr(xi01, xi02, xi12, i0, i1, i2);
+                double hdp =0.0;
+                if (shellctx->lindbladtype != LindbladType::NONE) {
+                  hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0p, i1p, i2p)
+                        + H_selfkerr(xi0, xi1, xi2, i0p, i1p, i2p)
+                        + H_crosskerr(xi01, xi02, xi12, i0p, i1p, i2p);
+                }
+                double yre = ( hd - hdp ) * xim;
+                double yim = (-hd + hdp ) * xre;
+
+                // Decay l1, diagonal part: xout += l1diag xin
+                // Dephasing l2: xout += l2(ik, ikp) xin
+                if (shellctx->lindbladtype != LindbladType::NONE) {
+                  double l1diag = L1diag(decay0, decay1, decay2, i0, i1, i2, i0p, i1p, i2p);
+                  double l2 = L2(dephase0, dephase1, dephase2, i0, i1, i2, i0p, i1p, i2p);
+                  yre += (l2 + l1diag) * xre;
+                  yim += (l2 + l1diag) * xim;
+                }
 
-              /* --- Offdiagonal: Jkl coupling  --- */
-              // oscillator 0<->1 
-              Jkl_coupling(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
-              // oscillator 0<->2
-              Jkl_coupling(shellctx->dim, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
-              // oscillator 1<->2
-              Jkl_coupling(shellctx->dim, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
-
-              /* --- Offdiagonal part of decay L1 */
-              if (shellctx->lindbladtype != LindbladType::NONE) {
-                // Oscillators 0
-                L1decay(shellctx->dim, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
-                // Oscillator 1
-                L1decay(shellctx->dim, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
-                // Oscillator 2
-                L1decay(shellctx->dim, it, n2, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
-              }
+                /* --- Offdiagonal: Jkl coupling  --- */
+                // oscillator 0<->1 
+                Jkl_coupling(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+                // oscillator 0<->2
+                Jkl_coupling(offset_im, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
+                // oscillator 1<->2
+                Jkl_coupling(offset_im, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
+
+                /* --- Offdiagonal part of decay L1 */
+                if (shellctx->lindbladtype != LindbladType::NONE) {
+                  // Oscillators 0
+                  L1decay(offset_im, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                  // Oscillator 1
+                  L1decay(offset_im, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                  // Oscillator 2
+                  L1decay(offset_im, it, n2, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                }
 
-              /* --- Control hamiltonian ---  */
-              // Oscillator 0 
-              control(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-              // Oscillator 1
-              control(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
-              // Oscillator 1
-              control(shellctx->dim, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
+                /* --- Control hamiltonian ---  */
+                // Oscillator 0 
+                control(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
+                // Oscillator 1
+                control(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
+                // Oscillator 1
+                control(offset_im, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
               
-              /* --- Update --- */
-              yptr[it]   = yre;
-              yptr[it + shellctx->dim] = yim;
-              it++;
+                /* --- Update --- */
+                matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+                it += stride_x;
+              }
             }
           }
+          col++;
         }
       }
     }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-/* Matfree-solver for 3 Oscillators: Define the action of RHS^T on a vector x */
+/* Matfree-solver for 3 Oscillators: Define the action of RHS on a vector x */
 template <int n0, int n1, int n2>
-int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+int applyRHS_matfree(Mat RHS, Vec x, Vec y){
 
-  /* Get the shell context */
+   /* Get the shell context */
   MatShellCtx *shellctx;
   MatShellGetContext(RHS, (void**) &shellctx);
 
@@ -1875,6 +2830,26 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   VecGetArrayRead(x, &xptr);
   VecGetArray(y, &yptr);
 
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_kernel<n0,n1,n2>(shellctx, HermitianPackedReader<false, n0*n1*n2>(xptr), yptr);
+  else
+    applyRHS_matfree_kernel<n0,n1,n2>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+/* Matfree-solver for 3 Oscillators: Define the action of RHS^T on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, int n2, typename XPtr>
+void applyRHS_matfree_transpose_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
 
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
@@ -1918,12 +2893,12 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   double sin12 = sin(eta12 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1,n2, 1,0,0,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1,n2, 0,1,0,0,0,0);
-  int stridei2  = TensorGetIndex(n0,n1,n2, 0,0,1,0,0,0);
-  int stridei0p = TensorGetIndex(n0,n1,n2, 0,0,0,1,0,0);
-  int stridei1p = TensorGetIndex(n0,n1,n2, 0,0,0,0,1,0);
-  int stridei2p = TensorGetIndex(n0,n1,n2, 0,0,0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1,n2, 1,0,0,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1,n2, 0,1,0,0,0,0);
+  int stridei2  = stride_x * TensorGetIndex(n0,n1,n2, 0,0,1,0,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,1,0,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,0,1,0);
+  int stridei2p = stride_x * TensorGetIndex(n0,n1,n2, 0,0,0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -1935,92 +2910,93 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
     n2p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i2p = 0; i2p < n2p; i2p++)  {
-        for (int i0 = 0; i0 < n0; i0++)  {
-          for (int i1 = 0; i1 < n1; i1++)  {
-            for (int i2 = 0; i2 < n2; i2++)  {
-
-              /* --- Diagonal part ---*/
-              //Get input x values
-              double xre = xptr[it];
-              double xim = xptr[it + shellctx->dim];
-              // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
-              //                         vout = (-hd(ik) + hd(ik'))*uin
-              double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0, i1, i2)
-                         + H_selfkerr(xi0, xi1, xi2, i0, i1, i2)
-                         + H_crosskerr(xi01, xi02, xi12, i0, i1, i2);
-              double hdp = 0.0;
-              if (shellctx->lindbladtype != LindbladType::NONE) {
-                hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0p, i1p, i2p)
-                    + H_selfkerr(xi0, xi1, xi2, i0p, i1p, i2p)
-                    + H_crosskerr(xi01, xi02, xi12, i0p, i1p, i2p);
-              }
-              double yre = (-hd + hdp ) * xim;
-              double yim = ( hd - hdp ) * xre;
-
-              // Decay l1^T, diagonal part: xout += l1diag xin
-              // Dephasing l2^T: xout += l2(ik, ikp) xin
-              if (shellctx->lindbladtype != LindbladType::NONE) {
-                double l1diag = L1diag(decay0, decay1, decay2, i0, i1, i2, i0p, i1p, i2p);
-                double l2 = L2(dephase0, dephase1, dephase2, i0, i1, i2, i0p, i1p, i2p);
-                yre += (l2 + l1diag) * xre;
-                yim += (l2 + l1diag) * xim;
-              }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[3] = {n0, n1, n2};
+  const int nlevp[3] = {n0p, n1p, n2p};
+  int lo[3], hi[3], lop[3], hip[3];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 3, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 3, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        for (int i2p = lop[2]; i2p < hip[2]; i2p++)  {
+          if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+          int it = stride_x * (rowstart + col * n0*n1*n2);
+          for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+            for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+              for (int i2 = lo[2]; i2 < hi[2]; i2++)  {
+                if (packed && it > col * (n0*n1*n2 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+                /* --- Diagonal part ---*/
+                //Get input x values
+                double xre = xptr[it];
+                double xim = xptr[it + offset_im];
+                // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
+                //                         vout = (-hd(ik) + hd(ik'))*uin
+                double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0, i1, i2)
+                           + H_selfkerr(xi0, xi1, xi2, i0, i1, i2)
+                           + H_crosskerr(xi01, xi02, xi12, i0, i1, i2);
+                double hdp = 0.0;
+                if (shellctx->lindbladtype != LindbladType::NONE) {
+                  hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, i0p, i1p, i2p)
+                      + H_selfkerr(xi0, xi1, xi2, i0p, i1p, i2p)
+                      + H_crosskerr(xi01, xi02, xi12, i0p, i1p, i2p);
+                }
+                double yre = (-hd + hdp ) * xim;
+                double yim = ( hd - hdp ) * xre;
+
+                // Decay l1^T, diagonal part: xout += l1diag xin
+                // Dephasing l2^T: xout += l2(ik, ikp) xin
+                if (shellctx->lindbladtype != LindbladType::NONE) {
+                  double l1diag = L1diag(decay0, decay1, decay2, i0, i1, i2, i0p, i1p, i2p);
+                  double l2 = L2(dephase0, dephase1, dephase2, i0, i1, i2, i0p, i1p, i2p);
+                  yre += (l2 + l1diag) * xre;
+                  yim += (l2 + l1diag) * xim;
+                }
 
-              /* --- Offdiagonal coupling term J_kl --- */
-              // oscillator 0<->1
-              Jkl_coupling_T(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
-              // oscillator 0<->2
-              Jkl_coupling_T(shellctx->dim, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
-              // oscillator 1<->2
-              Jkl_coupling_T(shellctx->dim, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
+                /* --- Offdiagonal coupling term J_kl --- */
+                // oscillator 0<->1
+                Jkl_coupling_T(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+                // oscillator 0<->2
+                Jkl_coupling_T(offset_im, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
+                // oscillator 1<->2
+                Jkl_coupling_T(offset_im, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
               
 
-              /* --- Offdiagonal part of decay L1^T */
-              if (shellctx->lindbladtype != LindbladType::NONE) {
-                // Oscillators 0
-                L1decay_T(shellctx->dim, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                /* --- Offdiagonal part of decay L1^T */
+                if (shellctx->lindbladtype != LindbladType::NONE) {
+                  // Oscillators 0
+                  L1decay_T(offset_im, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                  // Oscillator 1
+                  L1decay_T(offset_im, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                  // Oscillator 2
+                  L1decay_T(offset_im, it, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                }
+
+                /* --- Control hamiltonian  --- */
+                // Oscillator 0
+                control_T(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
                 // Oscillator 1
-                L1decay_T(shellctx->dim, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                control_T(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
                 // Oscillator 2
-                L1decay_T(shellctx->dim, it, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
-              }
+                control_T(offset_im, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
 
-              /* --- Control hamiltonian  --- */
-              // Oscillator 0
-              control_T(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-              // Oscillator 1
-              control_T(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
-              // Oscillator 2
-              control_T(shellctx->dim, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
-
-              /* Update */
-              yptr[it]   = yre;
-              yptr[it + shellctx->dim] = yim;
-              it++;
+                /* Update */
+                matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+                it += stride_x;
+              }
             }
           }
+          col++;
         }
       }
     }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-
-
-/* Matfree-solver for 4 Oscillators: Define the action of RHS on a vector x */
-template <int n0, int n1, int n2, int n3>
-int applyRHS_matfree(Mat RHS, Vec x, Vec y){
+/* Matfree-solver for 3 Oscillators: Define the action of RHS^T on a vector x */
+template <int n0, int n1, int n2>
+int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -2030,7 +3006,30 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   const double* xptr;
   double* yptr;
   VecGetArrayRead(x, &xptr);
-  VecGetArray(y, &yptr); 
+  VecGetArray(y, &yptr);
+
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_transpose_kernel<n0,n1,n2>(shellctx, HermitianPackedReader<true, n0*n1*n2>(xptr), yptr);
+  else
+    applyRHS_matfree_transpose_kernel<n0,n1,n2>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+
+
+/* Matfree-solver for 4 Oscillators: Define the action of RHS on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, int n2, int n3, typename XPtr>
+void applyRHS_matfree_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
 
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
@@ -2097,14 +3096,14 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   double sin23 = sin(eta23 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1,n2,n3, 1,0,0,0,0,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1,n2,n3, 0,1,0,0,0,0,0,0);
-  int stridei2  = TensorGetIndex(n0,n1,n2,n3, 0,0,1,0,0,0,0,0);
-  int stridei3  = TensorGetIndex(n0,n1,n2,n3, 0,0,0,1,0,0,0,0);
-  int stridei0p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,1,0,0,0);
-  int stridei1p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,1,0,0);
-  int stridei2p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,1,0);
-  int stridei3p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1,n2,n3, 1,0,0,0,0,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,1,0,0,0,0,0,0);
+  int stridei2  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,1,0,0,0,0,0);
+  int stridei3  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,1,0,0,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,1,0,0,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,1,0,0);
+  int stridei2p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,1,0);
+  int stridei3p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -2118,103 +3117,105 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
     n3p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i2p = 0; i2p < n2p; i2p++)  {
-        for (int i3p = 0; i3p < n3p; i3p++)  {
-          for (int i0 = 0; i0 < n0; i0++)  {
-            for (int i1 = 0; i1 < n1; i1++)  {
-              for (int i2 = 0; i2 < n2; i2++)  {
-                for (int i3 = 0; i3 < n3; i3++)  {
-
-                  /* --- Diagonal part ---*/
-                  double xre = xptr[it];
-                  double xim = xptr[it + shellctx->dim];
-                  // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
-                  //                    vout = (-hd(ik) + hd(ik'))*uin
-                  double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0, i1, i2, i3)
-                             + H_selfkerr(xi0, xi1, xi2, xi3, i0, i1, i2, i3)
-                             + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0, i1, i2, i3);
-                  double hdp = 0.0;
-                  if (shellctx->lindbladtype != LindbladType::NONE) {
-                    hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0p, i1p, i2p, i3p)
-                          + H_selfkerr(xi0, xi1, xi2, xi3, i0p, i1p, i2p, i3p)
-                          + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0p, i1p, i2p, i3p);
-                  }
-                  double yre = ( hd - hdp ) * xim;
-                  double yim = (-hd + hdp ) * xre;
-
-                  if (shellctx->lindbladtype != LindbladType::NONE) {
-                    // Decay l1, diagonal part: xout += l1diag xin
-                    // Dephasing l2: xout += l2(ik, ikp) xin
-                    double l1diag = L1diag(decay0, decay1, decay2, decay3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
-                    double l2 = L2(dephase0, dephase1, dephase2, dephase3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
-                    yre += (l2 + l1diag) * xre;
-                    yim += (l2 + l1diag) * xim;
-                  }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[4] = {n0, n1, n2, n3};
+  const int nlevp[4] = {n0p, n1p, n2p, n3p};
+  int lo[4], hi[4], lop[4], hip[4];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 4, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 4, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        for (int i2p = lop[2]; i2p < hip[2]; i2p++)  {
+          for (int i3p = lop[3]; i3p < hip[3]; i3p++)  {
+            if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+            int it = stride_x * (rowstart + col * n0*n1*n2*n3);
+            for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+              for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+                for (int i2 = lo[2]; i2 < hi[2]; i2++)  {
+                  for (int i3 = lo[3]; i3 < hi[3]; i3++)  {
+                    if (packed && it > col * (n0*n1*n2*n3 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+                    /* --- Diagonal part ---*/
+                    double xre = xptr[it];
+                    double xim = xptr[it + offset_im];
+                    // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
+                    //                    vout = (-hd(ik) + hd(ik'))*uin
+                    double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0, i1, i2, i3)
+                               + H_selfkerr(xi0, xi1, xi2, xi3, i0, i1, i2, i3)
+                               + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0, i1, i2, i3);
+                    double hdp = 0.0;
+                    if (shellctx->lindbladtype != LindbladType::NONE) {
+                      hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0p, i1p, i2p, i3p)
+                            + H_selfkerr(xi0, xi1, xi2, xi3, i0p, i1p, i2p, i3p)
+                            + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0p, i1p, i2p, i3p);
+                    }
+                    double yre = ( hd - hdp ) * xim;
+                    double yim = (-hd + hdp ) * xre;
+
+                    if (shellctx->lindbladtype != LindbladType::NONE) {
+                      // Decay l1, diagonal part: xout += l1diag xin
+                      // Dephasing l2: xout += l2(ik, ikp) xin
+                      double l1diag = L1diag(decay0, decay1, decay2, decay3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
+                      double l2 = L2(dephase0, dephase1, dephase2, dephase3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
+                      yre += (l2 + l1diag) * xre;
+                      yim += (l2 + l1diag) * xim;
+                    }
 
-                  /* --- Offdiagonal: Jkl coupling  --- */
-                  // oscillator 0<->1 
-                  Jkl_coupling(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
-                  // oscillator 0<->2
-                  Jkl_coupling(shellctx->dim, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
-                  // oscillator 0<->3
-                  Jkl_coupling(shellctx->dim, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
-                  // oscillator 1<->2
-                  Jkl_coupling(shellctx->dim, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
-                  // oscillator 1<->3
-                  Jkl_coupling(shellctx->dim, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
-                  // oscillator 2<->3
-                  Jkl_coupling(shellctx->dim, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
-
-                  /* --- Offdiagonal part of decay L1 */
-                  if (shellctx->lindbladtype != LindbladType::NONE) {
-                    // Oscillators 0
-                    L1decay(shellctx->dim, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                    /* --- Offdiagonal: Jkl coupling  --- */
+                    // oscillator 0<->1 
+                    Jkl_coupling(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+                    // oscillator 0<->2
+                    Jkl_coupling(offset_im, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
+                    // oscillator 0<->3
+                    Jkl_coupling(offset_im, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
+                    // oscillator 1<->2
+                    Jkl_coupling(offset_im, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
+                    // oscillator 1<->3
+                    Jkl_coupling(offset_im, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
+                    // oscillator 2<->3
+                    Jkl_coupling(offset_im, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
+
+                    /* --- Offdiagonal part of decay L1 */
+                    if (shellctx->lindbladtype != LindbladType::NONE) {
+                      // Oscillators 0
+                      L1decay(offset_im, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                      // Oscillator 1
+                      L1decay(offset_im, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                      // Oscillator 2
+                      L1decay(offset_im, it, n2, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                      // Oscillator 3
+                      L1decay(offset_im, it, n3, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
+                    }
+              
+                    /* --- Control hamiltonian ---  */
+                    // Oscillator 0 
+                    control(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
                     // Oscillator 1
-                    L1decay(shellctx->dim, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                    control(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
                     // Oscillator 2
-                    L1decay(shellctx->dim, it, n2, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
-                    // Oscillator 3
-                    L1decay(shellctx->dim, it, n3, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
-                  }
-              
-                  /* --- Control hamiltonian ---  */
-                  // Oscillator 0 
-                  control(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-                  // Oscillator 1
-                  control(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
-                  // Oscillator 2
-                  control(shellctx->dim, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
-                  // Oscillator 2
-                  control(shellctx->dim, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
+                    control(offset_im, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
+                    // Oscillator 2
+                    control(offset_im, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
               
-                  /* --- Update --- */
-                  yptr[it]   = yre;
-                  yptr[it + shellctx->dim] = yim;
-                  it++;
+                    /* --- Update --- */
+                    matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+                    it += stride_x;
+                  }
                 }
               }
             }
+            col++;
           }
         }
       }
     }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-
-/* Matfree-solver for 4 Oscillators: Define the action of RHS^T on a vector x */
+/* Matfree-solver for 4 Oscillators: Define the action of RHS on a vector x */
 template <int n0, int n1, int n2, int n3>
-int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+int applyRHS_matfree(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -2226,6 +3227,28 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   VecGetArrayRead(x, &xptr);
   VecGetArray(y, &yptr);
 
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_kernel<n0,n1,n2,n3>(shellctx, HermitianPackedReader<false, n0*n1*n2*n3>(xptr), yptr);
+  else
+    applyRHS_matfree_kernel<n0,n1,n2,n3>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+
+/* Matfree-solver for 4 Oscillators: Define the action of RHS^T on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, int n2, int n3, typename XPtr>
+void applyRHS_matfree_transpose_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
+
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
   double xi1  = shellctx->oscil_vec[1]->getSelfkerr();   
@@ -2291,14 +3314,14 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   double sin23 = sin(eta23 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1,n2,n3, 1,0,0,0,0,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1,n2,n3, 0,1,0,0,0,0,0,0);
-  int stridei2  = TensorGetIndex(n0,n1,n2,n3, 0,0,1,0,0,0,0,0);
-  int stridei3  = TensorGetIndex(n0,n1,n2,n3, 0,0,0,1,0,0,0,0);
-  int stridei0p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,1,0,0,0);
-  int stridei1p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,1,0,0);
-  int stridei2p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,1,0);
-  int stridei3p = TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1,n2,n3, 1,0,0,0,0,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,1,0,0,0,0,0,0);
+  int stridei2  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,1,0,0,0,0,0);
+  int stridei3  = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,1,0,0,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,1,0,0,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,1,0,0);
+  int stridei2p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,1,0);
+  int stridei3p = stride_x * TensorGetIndex(n0,n1,n2,n3, 0,0,0,0,0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -2313,104 +3336,106 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   }
 
 
-   /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i2p = 0; i2p < n2p; i2p++)  {
-        for (int i3p = 0; i3p < n3p; i3p++)  {
-          for (int i0 = 0; i0 < n0; i0++)  {
-            for (int i1 = 0; i1 < n1; i1++)  {
-              for (int i2 = 0; i2 < n2; i2++)  {
-                for (int i3 = 0; i3 < n3; i3++)  {
-                  double xre = xptr[it];
-                  double xim = xptr[it + shellctx->dim];
-
-                  /* --- Diagonal part ---*/
-                  // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
-                  //                         vout = (-hd(ik) + hd(ik'))*uin
-                  double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0, i1, i2, i3)
-                             + H_selfkerr(xi0, xi1, xi2, xi3, i0, i1, i2, i3)
-                             + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0, i1, i2, i3);
-                  double hdp = 0.0;
-                  if (shellctx->lindbladtype != LindbladType::NONE) {
-                    hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0p, i1p, i2p, i3p)
-                             + H_selfkerr(xi0, xi1, xi2, xi3, i0p, i1p, i2p, i3p)
-                             + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0p, i1p, i2p, i3p);
-                  }
-                  double yre = (-hd + hdp ) * xim;
-                  double yim = ( hd - hdp ) * xre;
-
-                  // Decay l1^T, diagonal part: xout += l1diag xin
-                  // Dephasing l2^T: xout += l2(ik, ikp) xin
-                  if (shellctx->lindbladtype != LindbladType::NONE) {
-                    double l1diag = L1diag(decay0, decay1, decay2, decay3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
-                    double l2 = L2(dephase0, dephase1, dephase2, dephase3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
-                    yre += (l2 + l1diag) * xre;
-                    yim += (l2 + l1diag) * xim;
-                  }
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[4] = {n0, n1, n2, n3};
+  const int nlevp[4] = {n0p, n1p, n2p, n3p};
+  int lo[4], hi[4], lop[4], hip[4];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 4, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 4, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        for (int i2p = lop[2]; i2p < hip[2]; i2p++)  {
+          for (int i3p = lop[3]; i3p < hip[3]; i3p++)  {
+            if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+            int it = stride_x * (rowstart + col * n0*n1*n2*n3);
+            for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+              for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+                for (int i2 = lo[2]; i2 < hi[2]; i2++)  {
+                  for (int i3 = lo[3]; i3 < hi[3]; i3++)  {
+                    if (packed && it > col * (n0*n1*n2*n3 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+                    double xre = xptr[it];
+                    double xim = xptr[it + offset_im];
+
+                    /* --- Diagonal part ---*/
+                    // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
+                    //                         vout = (-hd(ik) + hd(ik'))*uin
+                    double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0, i1, i2, i3)
+                               + H_selfkerr(xi0, xi1, xi2, xi3, i0, i1, i2, i3)
+                               + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0, i1, i2, i3);
+                    double hdp = 0.0;
+                    if (shellctx->lindbladtype != LindbladType::NONE) {
+                      hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, i0p, i1p, i2p, i3p)
+                               + H_selfkerr(xi0, xi1, xi2, xi3, i0p, i1p, i2p, i3p)
+                               + H_crosskerr(xi01, xi02, xi03, xi12, xi13, xi23, i0p, i1p, i2p, i3p);
+                    }
+                    double yre = (-hd + hdp ) * xim;
+                    double yim = ( hd - hdp ) * xre;
+
+                    // Decay l1^T, diagonal part: xout += l1diag xin
+                    // Dephasing l2^T: xout += l2(ik, ikp) xin
+                    if (shellctx->lindbladtype != LindbladType::NONE) {
+                      double l1diag = L1diag(decay0, decay1, decay2, decay3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
+                      double l2 = L2(dephase0, dephase1, dephase2, dephase3, i0, i1, i2, i3, i0p, i1p, i2p, i3p);
+                      yre += (l2 + l1diag) * xre;
+                      yim += (l2 + l1diag) * xim;
+                    }
 
-                  /* --- Offdiagonal coupling term J_kl --- */
-                  // oscillator 0<->1
-                  Jkl_coupling_T(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
-                  // oscillator 0<->2
-                  Jkl_coupling_T(shellctx->dim, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
-                  // oscillator 0<->3
-                  Jkl_coupling_T(shellctx->dim, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
-                  // oscillator 1<->2
-                  Jkl_coupling_T(shellctx->dim, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
-                  // oscillator 1<->3
-                  Jkl_coupling_T(shellctx->dim, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
-                  // oscillator 2<->3
-                  Jkl_coupling_T(shellctx->dim, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
+                    /* --- Offdiagonal coupling term J_kl --- */
+                    // oscillator 0<->1
+                    Jkl_coupling_T(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+                    // oscillator 0<->2
+                    Jkl_coupling_T(offset_im, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
+                    // oscillator 0<->3
+                    Jkl_coupling_T(offset_im, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
+                    // oscillator 1<->2
+                    Jkl_coupling_T(offset_im, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
+                    // oscillator 1<->3
+                    Jkl_coupling_T(offset_im, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
+                    // oscillator 2<->3
+                    Jkl_coupling_T(offset_im, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
               
 
-                  /* --- Offdiagonal part of decay L1^T */
-                  if (shellctx->lindbladtype != LindbladType::NONE) {
-                    // Oscillators 0
-                    L1decay_T(shellctx->dim, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                    /* --- Offdiagonal part of decay L1^T */
+                    if (shellctx->lindbladtype != LindbladType::NONE) {
+                      // Oscillators 0
+                      L1decay_T(offset_im, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                      // Oscillator 1
+                      L1decay_T(offset_im, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                      // Oscillator 2
+                      L1decay_T(offset_im, it, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                      // Oscillator 3
+                      L1decay_T(offset_im, it, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
+                    }
+
+                    /* --- Control hamiltonian  --- */
+                    // Oscillator 0
+                    control_T(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
                     // Oscillator 1
-                    L1decay_T(shellctx->dim, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                    control_T(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
                     // Oscillator 2
-                    L1decay_T(shellctx->dim, it, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                    control_T(offset_im, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
                     // Oscillator 3
-                    L1decay_T(shellctx->dim, it, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
-                  }
+                    control_T(offset_im, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
 
-                  /* --- Control hamiltonian  --- */
-                  // Oscillator 0
-                  control_T(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-                  // Oscillator 1
-                  control_T(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
-                  // Oscillator 2
-                  control_T(shellctx->dim, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
-                  // Oscillator 3
-                  control_T(shellctx->dim, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
-
-                  /* Update */
-                  yptr[it]   = yre;
-                  yptr[it + shellctx->dim] = yim;
-                  it++;
+                    /* Update */
+                    matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+                    it += stride_x;
+                  }
                 }
               }
             }
+            col++;
           }
         }
       }
     }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-
-/* Matfree-solver for 5 Oscillators: Define the action of RHS on a vector x */
-template <int n0, int n1, int n2, int n3, int n4>
-int applyRHS_matfree(Mat RHS, Vec x, Vec y){
+/* Matfree-solver for 4 Oscillators: Define the action of RHS^T on a vector x */
+template <int n0, int n1, int n2, int n3>
+int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -2420,7 +3445,29 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   const double* xptr;
   double* yptr;
   VecGetArrayRead(x, &xptr);
-  VecGetArray(y, &yptr); 
+  VecGetArray(y, &yptr);
+
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_transpose_kernel<n0,n1,n2,n3>(shellctx, HermitianPackedReader<true, n0*n1*n2*n3>(xptr), yptr);
+  else
+    applyRHS_matfree_transpose_kernel<n0,n1,n2,n3>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+
+/* Matfree-solver for 5 Oscillators: Define the action of RHS on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, int n2, int n3, int n4, typename XPtr>
+void applyRHS_matfree_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
 
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
@@ -2515,16 +3562,16 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
   double sin34 = sin(eta34 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1,n2,n3,n4, 1,0,0,0,0,0,0,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1,n2,n3,n4, 0,1,0,0,0,0,0,0,0,0);
-  int stridei2  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,1,0,0,0,0,0,0,0);
-  int stridei3  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,1,0,0,0,0,0,0);
-  int stridei4  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,1,0,0,0,0,0);
-  int stridei0p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,1,0,0,0,0);
-  int stridei1p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,1,0,0,0);
-  int stridei2p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,1,0,0);
-  int stridei3p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,1,0);
-  int stridei4p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 1,0,0,0,0,0,0,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,1,0,0,0,0,0,0,0,0);
+  int stridei2  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,1,0,0,0,0,0,0,0);
+  int stridei3  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,1,0,0,0,0,0,0);
+  int stridei4  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,1,0,0,0,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,1,0,0,0,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,1,0,0,0);
+  int stridei2p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,1,0,0);
+  int stridei3p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,1,0);
+  int stridei4p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -2540,119 +3587,121 @@ int applyRHS_matfree(Mat RHS, Vec x, Vec y){
     n4p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i2p = 0; i2p < n2p; i2p++)  {
-        for (int i3p = 0; i3p < n3p; i3p++)  {
-          for (int i4p = 0; i4p < n4p; i4p++)  {
-            for (int i0 = 0; i0 < n0; i0++)  {
-              for (int i1 = 0; i1 < n1; i1++)  {
-                for (int i2 = 0; i2 < n2; i2++)  {
-                  for (int i3 = 0; i3 < n3; i3++)  {
-                    for (int i4 = 0; i4 < n4; i4++)  {
-
-                      /* --- Diagonal part ---*/
-                      double xre = xptr[it];
-                      double xim = xptr[it + shellctx->dim];
-                      // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
-                      //                    vout = (-hd(ik) + hd(ik'))*uin
-                      double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0, i1, i2, i3, i4)
-                                 + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0, i1, i2, i3, i4)
-                                 + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34, i0, i1, i2, i3, i4);
-                      double hdp = 0.0;
-                      if (shellctx->lindbladtype != LindbladType::NONE) {
-                        hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0p, i1p, i2p, i3p, i4p)
-                                 + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0p, i1p, i2p, i3p, i4p)
-                                 + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34, i0p, i1p, i2p, i3p, i4p);
-                      }
-                      double yre = ( hd - hdp ) * xim;
-                      double yim = (-hd + hdp ) * xre;
-
-                      if (shellctx->lindbladtype != LindbladType::NONE) {
-                        // Decay l1, diagonal part: xout += l1diag xin
-                        // Dephasing l2: xout += l2(ik, ikp) xin
-                        double l1diag = L1diag(decay0, decay1, decay2, decay3, decay4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
-                        double l2 = L2(dephase0, dephase1, dephase2, dephase3, dephase4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
-                        yre += (l2 + l1diag) * xre;
-                        yim += (l2 + l1diag) * xim;
-                      }
-
-                      /* --- Offdiagonal: Jkl coupling  --- */
-                      // oscillator 0<->1 
-                      Jkl_coupling(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
-                      // oscillator 0<->2
-                      Jkl_coupling(shellctx->dim, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
-                      // oscillator 0<->3
-                      Jkl_coupling(shellctx->dim, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
-                      // oscillator 0<->4
-                      Jkl_coupling(shellctx->dim, it, n0, n4, n0p, n4p, i0, i0p, i4, i4p, stridei0, stridei0p, stridei4, stridei4p, xptr, J04, cos04, sin04, &yre, &yim);
-                      // oscillator 1<->2
-                      Jkl_coupling(shellctx->dim, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
-                      // oscillator 1<->3
-                      Jkl_coupling(shellctx->dim, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
-                      // oscillator 1<->4
-                      Jkl_coupling(shellctx->dim, it, n1, n4, n1p, n4p, i1, i1p, i4, i4p, stridei1, stridei1p, stridei4, stridei4p, xptr, J14, cos14, sin14, &yre, &yim);
-                      // oscillator 2<->3
-                      Jkl_coupling(shellctx->dim, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
-                      // oscillator 2<->4
-                      Jkl_coupling(shellctx->dim, it, n2, n4, n2p, n4p, i2, i2p, i4, i4p, stridei2, stridei2p, stridei4, stridei4p, xptr, J24, cos24, sin24, &yre, &yim);
-                      // oscillator 3<->4
-                      Jkl_coupling(shellctx->dim, it, n3, n4, n3p, n4p, i3, i3p, i4, i4p, stridei3, stridei3p, stridei4, stridei4p, xptr, J34, cos34, sin34, &yre, &yim);
-
-                      /* --- Offdiagonal part of decay L1 */
-                      if (shellctx->lindbladtype != LindbladType::NONE) {
-                        // Oscillator 0
-                        L1decay(shellctx->dim, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[5] = {n0, n1, n2, n3, n4};
+  const int nlevp[5] = {n0p, n1p, n2p, n3p, n4p};
+  int lo[5], hi[5], lop[5], hip[5];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 5, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 5, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        for (int i2p = lop[2]; i2p < hip[2]; i2p++)  {
+          for (int i3p = lop[3]; i3p < hip[3]; i3p++)  {
+            for (int i4p = lop[4]; i4p < hip[4]; i4p++)  {
+              if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+              int it = stride_x * (rowstart + col * n0*n1*n2*n3*n4);
+              for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+                for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+                  for (int i2 = lo[2]; i2 < hi[2]; i2++)  {
+                    for (int i3 = lo[3]; i3 < hi[3]; i3++)  {
+                      for (int i4 = lo[4]; i4 < hi[4]; i4++)  {
+                        if (packed && it > col * (n0*n1*n2*n3*n4 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+                        /* --- Diagonal part ---*/
+                        double xre = xptr[it];
+                        double xim = xptr[it + offset_im];
+                        // drift Hamiltonian: uout = ( hd(ik) - hd(ik'))*vin
+                        //                    vout = (-hd(ik) + hd(ik'))*uin
+                        double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0, i1, i2, i3, i4)
+                                   + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0, i1, i2, i3, i4)
+                                   + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34, i0, i1, i2, i3, i4);
+                        double hdp = 0.0;
+                        if (shellctx->lindbladtype != LindbladType::NONE) {
+                          hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0p, i1p, i2p, i3p, i4p)
+                                   + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0p, i1p, i2p, i3p, i4p)
+                                   + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34, i0p, i1p, i2p, i3p, i4p);
+                        }
+                        double yre = ( hd - hdp ) * xim;
+                        double yim = (-hd + hdp ) * xre;
+
+                        if (shellctx->lindbladtype != LindbladType::NONE) {
+                          // Decay l1, diagonal part: xout += l1diag xin
+                          // Dephasing l2: xout += l2(ik, ikp) xin
+                          double l1diag = L1diag(decay0, decay1, decay2, decay3, decay4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
+                          double l2 = L2(dephase0, dephase1, dephase2, dephase3, dephase4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
+                          yre += (l2 + l1diag) * xre;
+                          yim += (l2 + l1diag) * xim;
+                        }
+
+                        /* --- Offdiagonal: Jkl coupling  --- */
+                        // oscillator 0<->1 
+                        Jkl_coupling(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+                        // oscillator 0<->2
+                        Jkl_coupling(offset_im, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
+                        // oscillator 0<->3
+                        Jkl_coupling(offset_im, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
+                        // oscillator 0<->4
+                        Jkl_coupling(offset_im, it, n0, n4, n0p, n4p, i0, i0p, i4, i4p, stridei0, stridei0p, stridei4, stridei4p, xptr, J04, cos04, sin04, &yre, &yim);
+                        // oscillator 1<->2
+                        Jkl_coupling(offset_im, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
+                        // oscillator 1<->3
+                        Jkl_coupling(offset_im, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
+                        // oscillator 1<->4
+                        Jkl_coupling(offset_im, it, n1, n4, n1p, n4p, i1, i1p, i4, i4p, stridei1, stridei1p, stridei4, stridei4p, xptr, J14, cos14, sin14, &yre, &yim);
+                        // oscillator 2<->3
+                        Jkl_coupling(offset_im, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
+                        // oscillator 2<->4
+                        Jkl_coupling(offset_im, it, n2, n4, n2p, n4p, i2, i2p, i4, i4p, stridei2, stridei2p, stridei4, stridei4p, xptr, J24, cos24, sin24, &yre, &yim);
+                        // oscillator 3<->4
+                        Jkl_coupling(offset_im, it, n3, n4, n3p, n4p, i3, i3p, i4, i4p, stridei3, stridei3p, stridei4, stridei4p, xptr, J34, cos34, sin34, &yre, &yim);
+
+                        /* --- Offdiagonal part of decay L1 */
+                        if (shellctx->lindbladtype != LindbladType::NONE) {
+                          // Oscillator 0
+                          L1decay(offset_im, it, n0, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                          // Oscillator 1
+                          L1decay(offset_im, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                          // Oscillator 2
+                          L1decay(offset_im, it, n2, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                          // Oscillator 3
+                          L1decay(offset_im, it, n3, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
+                          // Oscillator 4
+                          L1decay(offset_im, it, n4, i4, i4p, stridei4, stridei4p, xptr, decay4, &yre, &yim);
+                        }
+
+                        /* --- Control hamiltonian ---  */
+                        // Oscillator 0 
+                        control(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
                         // Oscillator 1
-                        L1decay(shellctx->dim, it, n1, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                        control(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
                         // Oscillator 2
-                        L1decay(shellctx->dim, it, n2, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                        control(offset_im, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
                         // Oscillator 3
-                        L1decay(shellctx->dim, it, n3, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
+                        control(offset_im, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
                         // Oscillator 4
-                        L1decay(shellctx->dim, it, n4, i4, i4p, stridei4, stridei4p, xptr, decay4, &yre, &yim);
-                      }
-
-                      /* --- Control hamiltonian ---  */
-                      // Oscillator 0 
-                      control(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-                      // Oscillator 1
-                      control(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
-                      // Oscillator 2
-                      control(shellctx->dim, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
-                      // Oscillator 3
-                      control(shellctx->dim, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
-                      // Oscillator 4
-                      control(shellctx->dim, it, n4, i4, n4p, i4p, stridei4, stridei4p, xptr, pt4, qt4, &yre, &yim);
+                        control(offset_im, it, n4, i4, n4p, i4p, stridei4, stridei4p, xptr, pt4, qt4, &yre, &yim);
               
-                      /* --- Update --- */
-                      yptr[it]   = yre;
-                      yptr[it + shellctx->dim] = yim;
-                      it++;
+                        /* --- Update --- */
+                        matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+                        it += stride_x;
+                      }
                     }
                   }
                 }
               }
+              col++;
             }
           }
         }
       }
     }
   }
-
-  /* Restore x and y */
-  VecRestoreArrayRead(x, &xptr);
-  VecRestoreArray(y, &yptr);
-
-  return 0;
 }
 
-
-/* Matfree-solver for 5 Oscillators: Define the action of RHS^T on a vector x */
+/* Matfree-solver for 5 Oscillators: Define the action of RHS on a vector x */
 template <int n0, int n1, int n2, int n3, int n4>
-int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+int applyRHS_matfree(Mat RHS, Vec x, Vec y){
 
   /* Get the shell context */
   MatShellCtx *shellctx;
@@ -2664,6 +3713,28 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   VecGetArrayRead(x, &xptr);
   VecGetArray(y, &yptr);
 
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_kernel<n0,n1,n2,n3,n4>(shellctx, HermitianPackedReader<false, n0*n1*n2*n3*n4>(xptr), yptr);
+  else
+    applyRHS_matfree_kernel<n0,n1,n2,n3,n4>(shellctx, xptr, yptr);
+
+  /* Restore x and y */
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(y, &yptr);
+
+  return 0;
+}
+
+
+/* Matfree-solver for 5 Oscillators: Define the action of RHS^T on a vector x, given as an array or a HermitianPackedReader */
+template <int n0, int n1, int n2, int n3, int n4, typename XPtr>
+void applyRHS_matfree_transpose_kernel(MatShellCtx* shellctx, const XPtr& xptr, double* yptr){
+
+  /* Hermitian-packed state: blocked layout, only outputs with row <= col are computed */
+  const bool packed = !std::is_pointer<XPtr>::value;
+  const PetscInt stride_x = packed ? 1 : shellctx->stride_x;
+  const PetscInt offset_im = packed ? shellctx->dim : shellctx->offset_im;
+
   /* Evaluate coefficients */
   double xi0  = shellctx->oscil_vec[0]->getSelfkerr();
   double xi1  = shellctx->oscil_vec[1]->getSelfkerr();   
@@ -2757,16 +3828,16 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
   double sin34 = sin(eta34 * shellctx->time);
 
   /* compute strides for accessing x at i0+1, i0-1, i0p+1, i0p-1, i1+1, i1-1, i1p+1, i1p-1: */
-  int stridei0  = TensorGetIndex(n0,n1,n2,n3,n4, 1,0,0,0,0,0,0,0,0,0);
-  int stridei1  = TensorGetIndex(n0,n1,n2,n3,n4, 0,1,0,0,0,0,0,0,0,0);
-  int stridei2  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,1,0,0,0,0,0,0,0);
-  int stridei3  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,1,0,0,0,0,0,0);
-  int stridei4  = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,1,0,0,0,0,0);
-  int stridei0p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,1,0,0,0,0);
-  int stridei1p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,1,0,0,0);
-  int stridei2p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,1,0,0);
-  int stridei3p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,1,0);
-  int stridei4p = TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,0,1);
+  int stridei0  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 1,0,0,0,0,0,0,0,0,0);
+  int stridei1  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,1,0,0,0,0,0,0,0,0);
+  int stridei2  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,1,0,0,0,0,0,0,0);
+  int stridei3  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,1,0,0,0,0,0,0);
+  int stridei4  = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,1,0,0,0,0,0);
+  int stridei0p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,1,0,0,0,0);
+  int stridei1p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,1,0,0,0);
+  int stridei2p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,1,0,0);
+  int stridei3p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,1,0);
+  int stridei4p = stride_x * TensorGetIndex(n0,n1,n2,n3,n4, 0,0,0,0,0,0,0,0,0,1);
 
   /* Switch for Lindblad vs Schroedinger solver */
   int n0p = n0;
@@ -2782,108 +3853,137 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
     n4p = 1;
   }
 
-  /* Iterate over indices of output vector y */
-  int it = 0;
-  for (int i0p = 0; i0p < n0p; i0p++)  {
-    for (int i1p = 0; i1p < n1p; i1p++)  {
-      for (int i2p = 0; i2p < n2p; i2p++)  {
-        for (int i3p = 0; i3p < n3p; i3p++)  {
-          for (int i4p = 0; i4p < n4p; i4p++)  {
-            for (int i0 = 0; i0 < n0; i0++)  {
-              for (int i1 = 0; i1 < n1; i1++)  {
-                for (int i2 = 0; i2 < n2; i2++)  {
-                  for (int i3 = 0; i3 < n3; i3++)  {
-                    for (int i4 = 0; i4 < n4; i4++)  {
-
-                      double xre = xptr[it];
-                      double xim = xptr[it + shellctx->dim];
-
-                      /* --- Diagonal part ---*/
-                      // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
-                      //                         vout = (-hd(ik) + hd(ik'))*uin
-                      double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0, i1, i2, i3, i4)
-                                 + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0, i1, i2, i3, i4)
-                                 + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34,i0, i1, i2, i3, i4);
-                      double hdp = 0.0;
-                      if (shellctx->lindbladtype != LindbladType::NONE) { 
-                        hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0p, i1p, i2p, i3p, i4p)
-                                 + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0p, i1p, i2p, i3p, i4p)
-                                 + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34, i0p, i1p, i2p, i3p, i4p);
-                      }
-                      double yre = (-hd + hdp ) * xim;
-                      double yim = ( hd - hdp ) * xre;
-
-                      // Decay l1^T, diagonal part: xout += l1diag xin
-                      // Dephasing l2^T: xout += l2(ik, ikp) xin
-                      if (shellctx->lindbladtype != LindbladType::NONE) {
-                        double l1diag = L1diag(decay0, decay1, decay2, decay3, decay4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
-                        double l2 = L2(dephase0, dephase1, dephase2, dephase3, dephase4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
-                        yre += (l2 + l1diag) * xre;
-                        yim += (l2 + l1diag) * xim;
-                      }
-
-                      /* --- Offdiagonal coupling term J_kl --- */
-                      // oscillator 0<->1
-                      Jkl_coupling_T(shellctx->dim, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
-                      // oscillator 0<->2
-                      Jkl_coupling_T(shellctx->dim, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
-                      // oscillator 0<->3
-                      Jkl_coupling_T(shellctx->dim, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
-                      // oscillator 0<->4
-                      Jkl_coupling_T(shellctx->dim, it, n0, n4, n0p, n4p, i0, i0p, i4, i4p, stridei0, stridei0p, stridei4, stridei4p, xptr, J04, cos04, sin04, &yre, &yim);
-                      // oscillator 1<->2
-                      Jkl_coupling_T(shellctx->dim, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
-                      // oscillator 1<->3
-                      Jkl_coupling_T(shellctx->dim, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
-                      // oscillator 1<->4
-                      Jkl_coupling_T(shellctx->dim, it, n1, n4, n1p, n4p, i1, i1p, i4, i4p, stridei1, stridei1p, stridei4, stridei4p, xptr, J14, cos14, sin14, &yre, &yim);
-                      // oscillator 2<->3
-                      Jkl_coupling_T(shellctx->dim, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
-                      // oscillator 2<->4
-                      Jkl_coupling_T(shellctx->dim, it, n2, n4, n2p, n4p, i2, i2p, i4, i4p, stridei2, stridei2p, stridei4, stridei4p, xptr, J24, cos24, sin24, &yre, &yim);
-                      // oscillator 3<->4
-                      Jkl_coupling_T(shellctx->dim, it, n3, n4, n3p, n4p, i3, i3p, i4, i4p, stridei3, stridei3p, stridei4, stridei4p, xptr, J34, cos34, sin34, &yre, &yim);
+  /* Iterate over indices of output vector y, one tile (row block x column block) of the vectorized density matrix at a time */
+  const int nlev[5] = {n0, n1, n2, n3, n4};
+  const int nlevp[5] = {n0p, n1p, n2p, n3p, n4p};
+  int lo[5], hi[5], lop[5], hip[5];
+  for (int tile = 0; tile < shellctx->ntiles; tile++) {
+    int rowstart = matfreeTileBounds(tile % shellctx->nrowtiles, shellctx->rowtiledepth, 5, nlev, lo, hi);
+    int col = matfreeTileBounds(tile / shellctx->nrowtiles, shellctx->coltiledepth, 5, nlevp, lop, hip);
+    for (int i0p = lop[0]; i0p < hip[0]; i0p++)  {
+      for (int i1p = lop[1]; i1p < hip[1]; i1p++)  {
+        for (int i2p = lop[2]; i2p < hip[2]; i2p++)  {
+          for (int i3p = lop[3]; i3p < hip[3]; i3p++)  {
+            for (int i4p = lop[4]; i4p < hip[4]; i4p++)  {
+              if (packed && col < rowstart) { col++; continue; }  // Tile lies below the diagonal
+              int it = stride_x * (rowstart + col * n0*n1*n2*n3*n4);
+              for (int i0 = lo[0]; i0 < hi[0]; i0++)  {
+                for (int i1 = lo[1]; i1 < hi[1]; i1++)  {
+                  for (int i2 = lo[2]; i2 < hi[2]; i2++)  {
+                    for (int i3 = lo[3]; i3 < hi[3]; i3++)  {
+                      for (int i4 = lo[4]; i4 < hi[4]; i4++)  {
+                        if (packed && it > col * (n0*n1*n2*n3*n4 + 1)) { it += stride_x; continue; }  // Below the diagonal: not stored in the packed state
+
+                        double xre = xptr[it];
+                        double xim = xptr[it + offset_im];
+
+                        /* --- Diagonal part ---*/
+                        // drift Hamiltonian Hd^T: uout = ( hd(ik) - hd(ik'))*vin
+                        //                         vout = (-hd(ik) + hd(ik'))*uin
+                        double hd  = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0, i1, i2, i3, i4)
+                                   + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0, i1, i2, i3, i4)
+                                   + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34,i0, i1, i2, i3, i4);
+                        double hdp = 0.0;
+                        if (shellctx->lindbladtype != LindbladType::NONE) { 
+                          hdp = H_detune(detuning_freq0, detuning_freq1, detuning_freq2, detuning_freq3, detuning_freq4, i0p, i1p, i2p, i3p, i4p)
+                                   + H_selfkerr(xi0, xi1, xi2, xi3, xi4, i0p, i1p, i2p, i3p, i4p)
+                                   + H_crosskerr(xi01, xi02, xi03, xi04, xi12, xi13, xi14, xi23, xi24, xi34, i0p, i1p, i2p, i3p, i4p);
+                        }
+                        double yre = (-hd + hdp ) * xim;
+                        double yim = ( hd - hdp ) * xre;
+
+                        // Decay l1^T, diagonal part: xout += l1diag xin
+                        // Dephasing l2^T: xout += l2(ik, ikp) xin
+                        if (shellctx->lindbladtype != LindbladType::NONE) {
+                          double l1diag = L1diag(decay0, decay1, decay2, decay3, decay4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
+                          double l2 = L2(dephase0, dephase1, dephase2, dephase3, dephase4, i0, i1, i2, i3, i4, i0p, i1p, i2p, i3p, i4p);
+                          yre += (l2 + l1diag) * xre;
+                          yim += (l2 + l1diag) * xim;
+                        }
+
+                        /* --- Offdiagonal coupling term J_kl --- */
+                        // oscillator 0<->1
+                        Jkl_coupling_T(offset_im, it, n0, n1, n0p, n1p, i0, i0p, i1, i1p, stridei0, stridei0p, stridei1, stridei1p, xptr, J01, cos01, sin01, &yre, &yim);
+                        // oscillator 0<->2
+                        Jkl_coupling_T(offset_im, it, n0, n2, n0p, n2p, i0, i0p, i2, i2p, stridei0, stridei0p, stridei2, stridei2p, xptr, J02, cos02, sin02, &yre, &yim);
+                        // oscillator 0<->3
+                        Jkl_coupling_T(offset_im, it, n0, n3, n0p, n3p, i0, i0p, i3, i3p, stridei0, stridei0p, stridei3, stridei3p, xptr, J03, cos03, sin03, &yre, &yim);
+                        // oscillator 0<->4
+                        Jkl_coupling_T(offset_im, it, n0, n4, n0p, n4p, i0, i0p, i4, i4p, stridei0, stridei0p, stridei4, stridei4p, xptr, J04, cos04, sin04, &yre, &yim);
+                        // oscillator 1<->2
+                        Jkl_coupling_T(offset_im, it, n1, n2, n1p, n2p, i1, i1p, i2, i2p, stridei1, stridei1p, stridei2, stridei2p, xptr, J12, cos12, sin12, &yre, &yim);
+                        // oscillator 1<->3
+                        Jkl_coupling_T(offset_im, it, n1, n3, n1p, n3p, i1, i1p, i3, i3p, stridei1, stridei1p, stridei3, stridei3p, xptr, J13, cos13, sin13, &yre, &yim);
+                        // oscillator 1<->4
+                        Jkl_coupling_T(offset_im, it, n1, n4, n1p, n4p, i1, i1p, i4, i4p, stridei1, stridei1p, stridei4, stridei4p, xptr, J14, cos14, sin14, &yre, &yim);
+                        // oscillator 2<->3
+                        Jkl_coupling_T(offset_im, it, n2, n3, n2p, n3p, i2, i2p, i3, i3p, stridei2, stridei2p, stridei3, stridei3p, xptr, J23, cos23, sin23, &yre, &yim);
+                        // oscillator 2<->4
+                        Jkl_coupling_T(offset_im, it, n2, n4, n2p, n4p, i2, i2p, i4, i4p, stridei2, stridei2p, stridei4, stridei4p, xptr, J24, cos24, sin24, &yre, &yim);
+                        // oscillator 3<->4
+                        Jkl_coupling_T(offset_im, it, n3, n4, n3p, n4p, i3, i3p, i4, i4p, stridei3, stridei3p, stridei4, stridei4p, xptr, J34, cos34, sin34, &yre, &yim);
               
-                      /* --- Offdiagonal part of decay L1^T */
-                      if (shellctx->lindbladtype != LindbladType::NONE) { 
-                        // Oscillators 0
-                        L1decay_T(shellctx->dim, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                        /* --- Offdiagonal part of decay L1^T */
+                        if (shellctx->lindbladtype != LindbladType::NONE) { 
+                          // Oscillators 0
+                          L1decay_T(offset_im, it, i0, i0p, stridei0, stridei0p, xptr, decay0, &yre, &yim);
+                          // Oscillator 1
+                          L1decay_T(offset_im, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                          // Oscillator 2
+                          L1decay_T(offset_im, it, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                          // Oscillator 3
+                          L1decay_T(offset_im, it, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
+                          // Oscillator 4
+                          L1decay_T(offset_im, it, i4, i4p, stridei4, stridei4p, xptr, decay4, &yre, &yim);
+                        }
+
+                        /* --- Control hamiltonian  --- */
+                        // Oscillator 0
+                        control_T(offset_im, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
                         // Oscillator 1
-                        L1decay_T(shellctx->dim, it, i1, i1p, stridei1, stridei1p, xptr, decay1, &yre, &yim);
+                        control_T(offset_im, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
                         // Oscillator 2
-                        L1decay_T(shellctx->dim, it, i2, i2p, stridei2, stridei2p, xptr, decay2, &yre, &yim);
+                        control_T(offset_im, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
                         // Oscillator 3
-                        L1decay_T(shellctx->dim, it, i3, i3p, stridei3, stridei3p, xptr, decay3, &yre, &yim);
+                        control_T(offset_im, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
                         // Oscillator 4
-                        L1decay_T(shellctx->dim, it, i4, i4p, stridei4, stridei4p, xptr, decay4, &yre, &yim);
-                      }
+                        control_T(offset_im, it, n4, i4, n4p, i4p, stridei4, stridei4p, xptr, pt4, qt4, &yre, &yim);
 
-                      /* --- Control hamiltonian  --- */
-                      // Oscillator 0
-                      control_T(shellctx->dim, it, n0, i0, n0p, i0p, stridei0, stridei0p, xptr, pt0, qt0, &yre, &yim);
-                      // Oscillator 1
-                      control_T(shellctx->dim, it, n1, i1, n1p, i1p, stridei1, stridei1p, xptr, pt1, qt1, &yre, &yim);
-                      // Oscillator 2
-                      control_T(shellctx->dim, it, n2, i2, n2p, i2p, stridei2, stridei2p, xptr, pt2, qt2, &yre, &yim);
-                      // Oscillator 3
-                      control_T(shellctx->dim, it, n3, i3, n3p, i3p, stridei3, stridei3p, xptr, pt3, qt3, &yre, &yim);
-                      // Oscillator 4
-                      control_T(shellctx->dim, it, n4, i4, n4p, i4p, stridei4, stridei4p, xptr, pt4, qt4, &yre, &yim);
-
-                      /* Update */
-                      yptr[it]   = yre;
-                      yptr[it + shellctx->dim] = yim;
-                      it++;
+                        /* Update */
+                        matfreeStore(xptr, yptr, it, offset_im, yre, yim);
+                        it += stride_x;
+                      }
                     }
                   }
                 }
               }
+              col++;
             }
           }
         }
       }
     }
   }
+}
+
+/* Matfree-solver for 5 Oscillators: Define the action of RHS^T on a vector x */
+template <int n0, int n1, int n2, int n3, int n4>
+int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
+
+  /* Get the shell context */
+  MatShellCtx *shellctx;
+  MatShellGetContext(RHS, (void**) &shellctx);
+
+  /* Get access to x and y */
+  const double* xptr;
+  double* yptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(y, &yptr);
+
+  if (shellctx->hermitianpacked)
+    applyRHS_matfree_transpose_kernel<n0,n1,n2,n3,n4>(shellctx, HermitianPackedReader<true, n0*n1*n2*n3*n4>(xptr), yptr);
+  else
+    applyRHS_matfree_transpose_kernel<n0,n1,n2,n3,n4>(shellctx, xptr, yptr);
 
   /* Restore x and y */
   VecRestoreArrayRead(x, &xptr);
@@ -2896,81 +3996,19 @@ int applyRHS_matfree_transpose(Mat RHS, Vec x, Vec y){
 
 double MasterEq::expectedEnergy(const Vec x){
 
-  /* Iterate over diagonal elements (N) to add up expected energy level */
-  PetscInt  id_global_x; 
-  double expected = 0.0;
-  for (PetscInt i=0; i<dim_rho; i++) { 
-    /* Get diagonal element in number operator */
-    PetscInt num_diag = i ;
-
-    /* Get diagonal element and sum up */
-    double xdiag = 0.0;
-    if (lindbladtype != LindbladType::NONE){ // Lindblad solver: += i * rho_ii
-      PetscInt ivec = getVecID(i,i,dim_rho); 
-      if (ilow <= ivec && ivec < iupp) { // Picks the processor who owns u_ii, v_ii for i=0,...,dim_rho
-        id_global_x =  ivec + mpirank_petsc*localsize_u; // Global index of u_ii in x=[u,v]
-        VecGetValues(x, 1, &id_global_x, &xdiag);
-        expected += num_diag * xdiag;
-      }
-    }
-    else { // Schoedinger solver: += i * | psi_i |^2
-      if (ilow <= i && i < iupp) { // Picks the processor who own u_i, v_i for i=0,...,dim_rho
-        id_global_x =  i + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
-        VecGetValues(x, 1, &id_global_x, &xdiag);
-        expected += num_diag * xdiag * xdiag;
-        id_global_x += localsize_u; // Global index of v_i in x=[u,v]
-        VecGetValues(x, 1, &id_global_x, &xdiag);
-        expected += num_diag * xdiag * xdiag;
-      }
-    }
-  }
-  
-  /* Sum up from all Petsc processors */
-  double myexp = expected;
-  MPI_Allreduce(&myexp, &expected, 1, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+  /* Sum up i * rho_ii (Lindblad) or i * |psi_i|^2 (Schroedinger) over the diagonal */
+  observables->compute(x, Observables::ENERGY);
 
-  return expected;
+  return observables->getEnergy();
 }
 
 
 void MasterEq::population(const Vec x, std::vector<double> &pop){
 
-  pop.clear();
-  for (PetscInt k=0; k<dim_rho; k++){
-    pop.push_back(0.0);
-  }
+  /* Diagonal elements of the density matrix, gathered from all Petsc processors */
+  observables->compute(x, Observables::POPULATION);
+  observables->getPopulation(pop);
   assert (pop.size() == static_cast<size_t>(dim_rho));
-
-  std::vector<double> mypop(dim_rho, 0.0);
-
-  /* Iterate over diagonal elements of the density matrix */
-  PetscInt id_global_x;
-  for (PetscInt i=0; i < dim_rho; i++) {
-    double popi = 0.0;
-    /* Get the diagonal element */
-    if (lindbladtype != LindbladType::NONE) { // Lindblad solver
-      PetscInt ivec = getVecID(i, i, dim_rho);  // Position in vectorized rho
-      if (ilow <= ivec && ivec < iupp)  {
-        id_global_x =  ivec + mpirank_petsc*localsize_u; // Global index of u_ii in x=[u,v]
-        VecGetValues(x, 1, &id_global_x, &popi);
-      }
-    } else { // Schroedinger solver
-      if (ilow <= i && i < iupp)  {
-        double val = 0.0;
-        id_global_x =  i + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
-        VecGetValues(x, 1, &id_global_x, &val);
-        popi = val * val;
-        id_global_x += localsize_u; // Global index of v_i in x=[u,v]
-        VecGetValues(x, 1, &id_global_x, &val);
-        popi += val * val;
-      }
-    }
-    mypop[i] = popi;
-  } 
-
-  /* Gather poppulation from all Petsc processors */
-  for (size_t i=0; i<mypop.size(); i++) {pop[i] = mypop[i];}
-  MPI_Allreduce(mypop.data(), pop.data(), dim_rho, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
 }
 
 /* --- 1 Oscillator cases --- */
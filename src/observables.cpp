@@ -0,0 +1,108 @@
+#include "observables.hpp"
+#include <algorithm>
+
+Observables::Observables(){
+  lindbladtype = LindbladType::NONE;
+  dim_rho = 0;
+  localsize_u = 0;
+  stride_x = 1;
+  offset_im = 0;
+  nscalar = 3;
+  serial = true;
+}
+
+Observables::Observables(const std::vector<int>& nlevels_, const std::vector<int>& nessential, LindbladType lindbladtype_, PetscInt ilow, PetscInt iupp) : Observables() {
+  nlevels = nlevels_;
+  lindbladtype = lindbladtype_;
+  localsize_u = iupp - ilow;
+  getStateStrides(localsize_u, &stride_x, &offset_im);
+  size_t noscillators = nlevels.size();
+
+  dim_rho = 1;
+  for (size_t iosc = 0; iosc < noscillators; iosc++) dim_rho *= nlevels[iosc];
+
+  /* Collect the locally owned diagonal elements, their energy levels per oscillator, and guard levels */
+  for (PetscInt i = 0; i < dim_rho; i++) {
+    PetscInt vecID = i;
+    if (lindbladtype != LindbladType::NONE) vecID = getVecID(i, i, dim_rho);
+    if (ilow <= vecID && vecID < iupp) {
+      diag_global.push_back(i);
+      diag_local.push_back(vecID - ilow);
+      PetscInt index = i;
+      PetscInt postdim = dim_rho;
+      for (size_t iosc = 0; iosc < noscillators; iosc++) {
+        postdim /= nlevels[iosc];
+        diag_levels.push_back(index / postdim);
+        index = index % postdim;
+      }
+      bool guard = isGuardLevel(i, nlevels, nessential);
+      diag_guard.push_back(guard ? 1 : 0);
+      if (guard) guard_local.push_back(vecID - ilow);
+    }
+  }
+
+  /* Layout of the packed buffer: energy, leakage, measure, energy per oscillator, populations per oscillator, composite populations */
+  size_t offset = 3 + noscillators;
+  for (size_t iosc = 0; iosc < noscillators; iosc++) {
+    pop_offset.push_back(offset);
+    offset += nlevels[iosc];
+  }
+  nscalar = offset;
+  result.resize(offset + dim_rho, 0.0);
+
+  /* The local buffer is only needed for the reduction over several processors */
+  int mpisize_petsc;
+  MPI_Comm_size(PETSC_COMM_WORLD, &mpisize_petsc);
+  serial = mpisize_petsc == 1;
+  if (!serial) mybuf.resize(offset + dim_rho, 0.0);
+}
+
+Observables::~Observables(){}
+
+void Observables::compute(const Vec x, int quantities, PetscInt measure_state){
+
+  size_t noscillators = nlevels.size();
+  size_t nbuf = nscalar;
+  if (quantities & POPULATION) nbuf += dim_rho;
+
+  bool want_osc = (quantities & (ENERGY_OSC | POPULATION_OSC));
+  /* Serial: accumulate into the results directly */
+  double* buf = serial ? result.data() : mybuf.data();
+  std::fill(buf, buf + nbuf, 0.0);
+  double* pop_comp = buf + nscalar;
+
+  /* Stream over the local part of the diagonal once */
+  const PetscScalar* xptr;
+  VecGetArrayRead(x, &xptr);
+  for (size_t k = 0; k < diag_local.size(); k++) {
+    double u = xptr[diag_local[k]*stride_x];
+    double v = xptr[diag_local[k]*stride_x + offset_im];
+    // Lindblad: rho_ii. Schroedinger: |psi_i|^2
+    double p = lindbladtype != LindbladType::NONE ? u : u*u + v*v;
+    PetscInt i = diag_global[k];
+
+    if (quantities & ENERGY) buf[0] += i * p;
+    if ((quantities & LEAKAGE) && diag_guard[k]) buf[1] += u*u + v*v;
+    if (quantities & MEASURE) buf[2] += fabs(i - measure_state) * p;
+    if (want_osc) {
+      const int* levels = diag_levels.data() + k*noscillators;
+      for (size_t iosc = 0; iosc < noscillators; iosc++) {
+        if (quantities & ENERGY_OSC) buf[3 + iosc] += levels[iosc] * p;
+        if (quantities & POPULATION_OSC) buf[pop_offset[iosc] + levels[iosc]] += p;
+      }
+    }
+    if (quantities & POPULATION) pop_comp[i] = p;
+  }
+  VecRestoreArrayRead(x, &xptr);
+
+  /* One reduction for all quantities */
+  if (!serial) MPI_Allreduce(mybuf.data(), result.data(), nbuf, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+}
+
+void Observables::getPopulation(size_t iosc, std::vector<double>& pop) const {
+  pop.assign(result.begin() + pop_offset[iosc], result.begin() + pop_offset[iosc] + nlevels[iosc]);
+}
+
+void Observables::getPopulation(std::vector<double>& pop) const {
+  pop.assign(result.begin() + nscalar, result.begin() + nscalar + dim_rho);
+}
@@ -1,6 +1,6 @@
 #include "optimproblem.hpp"
 
-OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm comm_init_, MPI_Comm comm_optim_, int ninit_, Output* output_, bool quietmode_){
+OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm comm_init_, MPI_Comm comm_optim_, int ninit_, Output* output_, std::mt19937 rand_engine_, bool quietmode_){
 
   timestepper = timestepper_;
   ninit = ninit_;
@@ -21,6 +21,9 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   MPI_Comm_rank(comm_optim, &mpirank_optim);
   MPI_Comm_size(comm_optim, &mpisize_optim);
 
+  /* Communicator for all processors within one multi-start group. The rank in comm_optim identifies the group. */
+  MPI_Comm_split(MPI_COMM_WORLD, mpirank_optim, mpirank_world, &comm_group);
+
   /* Store number of initial conditions per init-processor group */
   ninit_local = ninit / mpisize_init; 
 
@@ -57,6 +60,7 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   VecDuplicate(rho_t0, &rho_t0_bar);
   VecZeroEntries(rho_t0_bar);
   VecAssemblyBegin(rho_t0_bar); VecAssemblyEnd(rho_t0_bar);
+  VecDuplicate(rho_t0, &rho_t0_bar_dot);
 
   /* Initialize the optimization target, including setting of initial state rho_t0 if read from file or pure state or ensemble */
   std::vector<std::string> target_str;
@@ -66,7 +70,9 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   config.GetVecDoubleParam("gate_rot_freq", read_gate_rot, 1e20, true, false); 
   std::vector<std::string> initcond_str;
   config.GetVecStrParam("initialcondition", initcond_str, "none", false);
-  optim_target = new OptimTarget(target_str, objective_str, initcond_str, timestepper->mastereq, timestepper->total_time, read_gate_rot, rho_t0, quietmode);
+  /* Cache of prepared initial and target states: number of initial conditions per processor (-1: all of them, 0: rebuild in every evaluation) */
+  int target_cache = config.GetIntParam("optim_target_cache", 0, false);
+  optim_target = new OptimTarget(target_str, objective_str, initcond_str, timestepper->mastereq, timestepper->total_time, read_gate_rot, rho_t0, target_cache, quietmode);
 
   /* Get weights for the objective function (weighting the different initial conditions */
   config.GetVecDoubleParam("optim_weights", obj_weights, 1.0);
@@ -91,6 +97,9 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   MPI_Scatter(sendbuf, nscatter, MPI_DOUBLE, recvbuf, nscatter,  MPI_DOUBLE, 0, comm_init);
   for (int i = 0; i < nscatter; i++) obj_weights[i] = recvbuf[i];
   for (size_t i=nscatter; i < obj_weights.size(); i++) obj_weights[i] = 0.0;
+  obj_weights_full = obj_weights;
+  // Fidelity is averaged uniformly over all initial conditions
+  fid_weights.assign(obj_weights.size(), 1./ninit);
 
 
   /* Store other optimization parameters */
@@ -106,6 +115,42 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   gamma_tik_interpolate = config.GetBoolParam("optim_regul_interpolate", false, false);
   gamma_penalty_dpdm = config.GetDoubleParam("optim_penalty_dpdm", 0.0);
   gamma_penalty_variation = config.GetDoubleParam("optim_penalty_variation", 0.01); 
+
+  /* Multi-start optimization: Each optim group runs its own optimization from a perturbed initial guess. 
+   * The perturbation amplitude is given in GHz, as the control initialization, hence multiply by 2pi here. */
+  rand_engine = rand_engine_;
+  multistart_perturb = config.GetDoubleParam("optim_multistart_perturbation", 0.005, false) * 2.0*M_PI;
+  multistart_droptol = config.GetDoubleParam("optim_multistart_droptol", 10.0, false);
+  multistart_warmup = config.GetIntParam("optim_multistart_warmup", 20, false);
+  multistart_status = MultistartStatus::RUNNING;
+  iter_offset = 0;
+  multistart_best = NULL;
+  if (mpisize_optim > 1) {
+    // Shared best objective lives on rank 0 of comm_optim. 
+    MPI_Win_allocate(sizeof(double), sizeof(double), MPI_INFO_NULL, comm_optim, &multistart_best, &multistart_win);
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, mpirank_optim, 0, multistart_win);
+    *multistart_best = 1e+300;
+    MPI_Win_unlock(mpirank_optim, multistart_win);
+    MPI_Barrier(comm_optim);
+  }
+
+  /* Mini-batch optimization: Optimize over a random subset of the initial conditions in epochs of a few iterations. 
+   * Each init processor samples its share of the batch, so that the work stays balanced. */
+  minibatch_size = config.GetIntParam("optim_minibatch", 0, false);
+  minibatch_epoch = config.GetIntParam("optim_minibatch_epoch", 10, false);
+  minibatch_switchtol = config.GetDoubleParam("optim_minibatch_switchtol", 1e-2, false);
+  if (minibatch_size >= (int) ninit) minibatch_size = 0; // No need to sample if the batch contains all initial conditions.
+  minibatch_epoch = std::max(1, minibatch_epoch);
+  minibatch_active = false;
+  std::seed_seq minibatch_seed{static_cast<unsigned int>(rand_engine()), static_cast<unsigned int>(mpirank_init), static_cast<unsigned int>(mpirank_optim)};
+  minibatch_engine.seed(minibatch_seed);
+
+  /* Multilevel optimization in time: Start on coarse time grids (ntime halved per level) until a loose 
+   * infidelity tolerance is met, then warm-start the next finer grid. */
+  multilevel_nlevels = std::max(1, config.GetIntParam("optim_multilevel", 1, false));
+  multilevel_tol = config.GetDoubleParam("optim_multilevel_tol", 1e-2, false);
+  multilevel_maxiter = config.GetIntParam("optim_multilevel_maxiter", maxiter, false);
+  multilevel_coarse = false;
   
 
   if (gamma_penalty_dpdm > 1e-13 && timestepper->mastereq->lindbladtype != LindbladType::NONE){
@@ -168,8 +213,23 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
  
   /* Create Petsc's optimization solver */
   TaoCreate(PETSC_COMM_WORLD, &tao);
-  /* Set optimization type and parameters */
-  TaoSetType(tao,TAOBQNLS);         // Optim type: taoblmvm vs BQNLS ??
+  /* Set optimization type and parameters. Newton-type solvers use matrix-free Hessian-vector products. */
+  solver_str = config.GetStrParam("optim_solver", "BQNLS", true, false);
+  Hess = NULL;
+  if (solver_str.compare("BQNLS") == 0) {
+    TaoSetType(tao,TAOBQNLS);         // Optim type: taoblmvm vs BQNLS ??
+  } else if (solver_str.compare("BNLS") == 0 || solver_str.compare("BNTR") == 0) {
+    if (solver_str.compare("BNLS") == 0) TaoSetType(tao, TAOBNLS);
+    else TaoSetType(tao, TAOBNTR);
+    MatCreateShell(PETSC_COMM_SELF, ndesign, ndesign, ndesign, ndesign, (void*) this, &Hess);
+    MatShellSetOperation(Hess, MATOP_MULT, (void(*)(void)) HessianMult);
+    MatSetUp(Hess);
+    TaoSetHessian(tao, Hess, Hess, TaoEvalHessian, (void*) this);
+    checkHessianSupport();
+  } else {
+    printf("\n\n ERROR: Unknown optimization solver: %s. Choose BQNLS, BNLS or BNTR.\n", solver_str.c_str());
+    exit(1);
+  }
   TaoSetMaximumIterations(tao, maxiter);
   TaoSetTolerances(tao, gatol, PETSC_DEFAULT, grtol);
   TaoMonitorSet(tao, TaoMonitor, (void*)this, NULL);
@@ -180,8 +240,12 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   TaoSetGradient(tao, NULL, TaoEvalGradient,(void *)this);
   TaoSetObjectiveAndGradient(tao, NULL, TaoEvalObjectiveAndGradient, (void*) this);
 
-  /* Allocate auxiliary vector */
-  mygrad = new double[ndesign];
+  /* Allocate buffers for the non-blocking gradient reduction */
+  mygrad = new double[2*ndesign];
+  mygrad_sum = new double[2*ndesign];
+  grad_request[0] = MPI_REQUEST_NULL;
+  grad_request[1] = MPI_REQUEST_NULL;
+  grad_slot = 0;
 
   /* Allocat xinit, xtmp */
   VecCreateSeq(PETSC_COMM_SELF, ndesign, &xinit);
@@ -190,11 +254,13 @@ OptimProblem::OptimProblem(Config config, TimeStepper* timestepper_, MPI_Comm co
   VecCreateSeq(PETSC_COMM_SELF, ndesign, &xtmp);
   VecSetFromOptions(xtmp);
   VecZeroEntries(xtmp);
+  VecDuplicate(xtmp, &xhess);
 }
 
 
 OptimProblem::~OptimProblem() {
   delete [] mygrad;
+  delete [] mygrad_sum;
   delete optim_target;
   VecDestroy(&rho_t0);
   VecDestroy(&rho_t0_bar);
@@ -203,12 +269,21 @@ OptimProblem::~OptimProblem() {
   VecDestroy(&xupper);
   VecDestroy(&xinit);
   VecDestroy(&xtmp);
+  VecDestroy(&xhess);
+  VecDestroy(&rho_t0_bar_dot);
+  if (Hess != NULL) MatDestroy(&Hess);
 
   for (size_t i = 0; i < store_finalstates.size(); i++) {
     VecDestroy(&(store_finalstates[i]));
   }
+  for (size_t i = 0; i < store_finaltangents.size(); i++) {
+    VecDestroy(&(store_finaltangents[i]));
+  }
 
   TaoDestroy(&tao);
+
+  if (mpisize_optim > 1) MPI_Win_free(&multistart_win);
+  MPI_Comm_free(&comm_group);
 }
 
 
@@ -235,10 +310,17 @@ double OptimProblem::evalF(const Vec x) {
   double fidelity_re = 0.0;
   double fidelity_im = 0.0;
   for (int iinit = 0; iinit < ninit_local; iinit++) {
+
+    /* Skip initial conditions that are not part of the current mini-batch */
+    if (minibatch_active && fid_weights[iinit] == 0.0) {
+      if (timestepper->writeTrajectoryDataFiles) output->skipTrajectory(timestepper->ntime);
+      continue;
+    }
       
     /* Prepare the initial condition in [rank * ninit_local, ... , (rank+1) * ninit_local - 1] */
     int iinit_global = mpirank_init * ninit_local + iinit;
     int initid = optim_target->prepareInitialState(iinit_global, ninit, timestepper->mastereq->nlevels, timestepper->mastereq->nessential, rho_t0);
+    output->setInitialCondition(iinit_global, ninit);
     if (mpirank_optim == 0 && !quietmode) printf("%d: Initial condition id=%d ...\n", mpirank_init, initid);
 
     /* If gate optimiztion, compute the target state rho^target = Vrho(0)V^dagger */
@@ -267,27 +349,23 @@ double OptimProblem::evalF(const Vec x) {
     double fidelity_iinit_re = 0.0;
     double fidelity_iinit_im = 0.0;
     optim_target->HilbertSchmidtOverlap(finalstate, false, &fidelity_iinit_re, &fidelity_iinit_im);
-    fidelity_re += 1./ ninit * fidelity_iinit_re;
-    fidelity_im += 1./ ninit * fidelity_iinit_im;
+    fidelity_re += fid_weights[iinit] * fidelity_iinit_re;
+    fidelity_im += fid_weights[iinit] * fidelity_iinit_im;
 
     // printf("%d, %d: iinit obj_iinit: %f * (%1.14e + i %1.14e, Overlap=%1.14e + i %1.14e\n", mpirank_world, mpirank_init, obj_weights[iinit], obj_iinit_re, obj_iinit_im, fidelity_iinit_re, fidelity_iinit_im);
   }
 
-  /* Sum up from initial conditions processors */
-  double mypen = obj_penal;
-  double mypen_dpdm = obj_penal_dpdm;
-  double mypenen = obj_penal_energy;
-  double mycost_re = obj_cost_re;
-  double mycost_im = obj_cost_im;
-  double myfidelity_re = fidelity_re;
-  double myfidelity_im = fidelity_im;
-  MPI_Allreduce(&mypen, &obj_penal, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mypen_dpdm, &obj_penal_dpdm, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mypenen, &obj_penal_energy, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mycost_re, &obj_cost_re, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mycost_im, &obj_cost_im, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&myfidelity_re, &fidelity_re, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&myfidelity_im, &fidelity_im, 1, MPI_DOUBLE, MPI_SUM, comm_init);
+  /* Sum up from initial conditions processors (all scalar terms packed into one message) */
+  double mysum[7] = {obj_penal, obj_penal_dpdm, obj_penal_energy, obj_cost_re, obj_cost_im, fidelity_re, fidelity_im};
+  double sum[7];
+  MPI_Allreduce(mysum, sum, 7, MPI_DOUBLE, MPI_SUM, comm_init);
+  obj_penal        = sum[0];
+  obj_penal_dpdm   = sum[1];
+  obj_penal_energy = sum[2];
+  obj_cost_re      = sum[3];
+  obj_cost_im      = sum[4];
+  fidelity_re      = sum[5];
+  fidelity_im      = sum[6];
 
   /* Set the fidelity: If Schroedinger, need to compute the absolute value: Fid= |\sum_i \phi^\dagger \phi_target|^2 */
   if (timestepper->mastereq->lindbladtype == LindbladType::NONE) {
@@ -343,26 +421,6 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
   /* Reset Gradient */
   VecZeroEntries(G);
 
-  /* Derivative of regulatization terms (ADD ON ONE PROC ONLY!) */
-  // if (mpirank_init == 0 && mpirank_optim == 0) { // TODO: Which one?? 
-  if (mpirank_init == 0 ) {
-
-    // Derivative of Tikhonov 0.5*gamma * ||x||^2 
-    VecAXPY(G, gamma_tik, x);   // + gamma_tik * x
-    if (gamma_tik_interpolate){
-      VecAXPY(G, -1.0*gamma_tik, xinit); // -gamma_tik * xinit
-    }
-
-    // Derivative of penalization of control variation 
-    double var_reg_bar = 0.5*gamma_penalty_variation;
-    int skip_to_oscillator = 0;
-    for (size_t iosc = 0; iosc < timestepper->mastereq->getNOscillators(); iosc++){
-      Oscillator* osc = timestepper->mastereq->getOscillator(iosc);
-      osc->evalControlVariationDiff(G, var_reg_bar, skip_to_oscillator);
-      skip_to_oscillator += osc->getNParams();
-    }
-  }
-
   /*  Iterate over initial condition */
   obj_cost = 0.0;
   obj_regul = 0.0;
@@ -377,9 +435,17 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
   double fidelity_im = 0.0;
   for (int iinit = 0; iinit < ninit_local; iinit++) {
 
+    /* Skip initial conditions that are not part of the current mini-batch. Lindblad solver still takes part in the gradient reduction. */
+    if (minibatch_active && fid_weights[iinit] == 0.0) {
+      if (timestepper->mastereq->lindbladtype != LindbladType::NONE) addGradientContribution(NULL, G);
+      if (timestepper->writeTrajectoryDataFiles) output->skipTrajectory(timestepper->ntime);
+      continue;
+    }
+
     /* Prepare the initial condition */
     int iinit_global = mpirank_init * ninit_local + iinit;
     int initid = optim_target->prepareInitialState(iinit_global, ninit, timestepper->mastereq->nlevels, timestepper->mastereq->nessential, rho_t0);
+    output->setInitialCondition(iinit_global, ninit);
 
     /* If gate optimiztion, compute the target state rho^target = Vrho(0)V^dagger */
     optim_target->prepareTargetState(rho_t0);
@@ -412,8 +478,8 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
     double fidelity_iinit_re = 0.0;
     double fidelity_iinit_im = 0.0;
     optim_target->HilbertSchmidtOverlap(finalstate, false, &fidelity_iinit_re, &fidelity_iinit_im);
-    fidelity_re += 1./ ninit * fidelity_iinit_re;
-    fidelity_im += 1./ ninit * fidelity_iinit_im;
+    fidelity_re += fid_weights[iinit] * fidelity_iinit_re;
+    fidelity_im += fid_weights[iinit] * fidelity_iinit_im;
 
     /* If Lindblas solver, compute adjoint for this initial condition. Otherwise (Schroedinger solver), compute adjoint only after all initial conditions have been propagated through (separate loop below) */
     if (timestepper->mastereq->lindbladtype != LindbladType::NONE) {
@@ -422,7 +488,7 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
       /* Reset adjoint */
       VecZeroEntries(rho_t0_bar);
 
-      /* Terminal condition for adjoint variable: Derivative of final time objective J */
+      /* Terminal condition for adjoint variable: Derivative of final time objective J. For Lindblad, this does not depend on the (not yet summed) cost. */
       double obj_cost_re_bar, obj_cost_im_bar;
       optim_target->finalizeJ_diff(obj_cost_re, obj_cost_im, &obj_cost_re_bar, &obj_cost_im_bar);
       optim_target->evalJ_diff(finalstate, rho_t0_bar, obj_weights[iinit]*obj_cost_re_bar, obj_weights[iinit]*obj_cost_im_bar);
@@ -430,39 +496,18 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
       /* Derivative of time-stepping */
       timestepper->solveAdjointODE(rho_t0_bar, finalstate, obj_weights[iinit] * gamma_penalty, obj_weights[iinit]*gamma_penalty_dpdm, obj_weights[iinit]*gamma_penalty_energy);
 
-      /* Add to optimizers's gradient */
-      VecAXPY(G, 1.0, timestepper->redgrad);
+      /* Add to optimizers's gradient. Its reduction overlaps with the next initial condition. */
+      addGradientContribution(timestepper->redgrad, G);
     }
   }
 
-  /* Sum up from initial conditions processors */
-  double mypen = obj_penal;
-  double mypen_dpdm = obj_penal_dpdm;
-  double mypenen = obj_penal_energy;
-  double mycost_re = obj_cost_re;
-  double mycost_im = obj_cost_im;
-  double myfidelity_re = fidelity_re;
-  double myfidelity_im = fidelity_im;
-  MPI_Allreduce(&mypen, &obj_penal, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mypen_dpdm, &obj_penal_dpdm, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mypenen, &obj_penal_energy, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mycost_re, &obj_cost_re, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&mycost_im, &obj_cost_im, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&myfidelity_re, &fidelity_re, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-  MPI_Allreduce(&myfidelity_im, &fidelity_im, 1, MPI_DOUBLE, MPI_SUM, comm_init);
-
-  /* Set the fidelity: If Schroedinger, need to compute the absolute value: Fid= |\sum_i \phi^\dagger \phi_target|^2 */
-  if (timestepper->mastereq->lindbladtype == LindbladType::NONE) {
-    fidelity = pow(fidelity_re, 2.0) + pow(fidelity_im, 2.0);
-  } else {
-    fidelity = fidelity_re; 
-  }
- 
-  /* Finalize the objective function Jtrace to get the infidelity. 
-     If Schroedingers solver, need to take the absolute value */
-  obj_cost = optim_target->finalizeJ(obj_cost_re, obj_cost_im);
+  /* Start summing up from initial conditions processors (all scalar terms packed into one message) */
+  double mysum[7] = {obj_penal, obj_penal_dpdm, obj_penal_energy, obj_cost_re, obj_cost_im, fidelity_re, fidelity_im};
+  double sum[7];
+  MPI_Request sum_request;
+  MPI_Iallreduce(mysum, sum, 7, MPI_DOUBLE, MPI_SUM, comm_init, &sum_request);
 
-  /* Evaluate Tikhonov regularization term += gamma/2 * ||x||^2*/
+  /* Evaluate Tikhonov regularization term += gamma/2 * ||x||^2 while the reduction is in flight */
   double xnorm;
   if (!gamma_tik_interpolate){  // ||x||^2
     VecNorm(x, NORM_2, &xnorm);
@@ -480,6 +525,27 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
   }
   obj_penal_variation = 0.5*gamma_penalty_variation*var_reg; 
 
+  /* Finish the scalar reduction */
+  MPI_Wait(&sum_request, MPI_STATUS_IGNORE);
+  obj_penal        = sum[0];
+  obj_penal_dpdm   = sum[1];
+  obj_penal_energy = sum[2];
+  obj_cost_re      = sum[3];
+  obj_cost_im      = sum[4];
+  fidelity_re      = sum[5];
+  fidelity_im      = sum[6];
+
+  /* Set the fidelity: If Schroedinger, need to compute the absolute value: Fid= |\sum_i \phi^\dagger \phi_target|^2 */
+  if (timestepper->mastereq->lindbladtype == LindbladType::NONE) {
+    fidelity = pow(fidelity_re, 2.0) + pow(fidelity_im, 2.0);
+  } else {
+    fidelity = fidelity_re; 
+  }
+ 
+  /* Finalize the objective function Jtrace to get the infidelity. 
+     If Schroedingers solver, need to take the absolute value */
+  obj_cost = optim_target->finalizeJ(obj_cost_re, obj_cost_im);
+
   /* Sum, store and return objective value */
   objective = obj_cost + obj_regul + obj_penal + obj_penal_dpdm + obj_penal_energy + obj_penal_variation;
 
@@ -488,6 +554,10 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
 
     // Iterate over all initial conditions 
     for (int iinit = 0; iinit < ninit_local; iinit++) {
+      if (minibatch_active && fid_weights[iinit] == 0.0) {
+        addGradientContribution(NULL, G);
+        continue;
+      }
       int iinit_global = mpirank_init * ninit_local + iinit;
 
       /* Recompute the initial state and target */
@@ -505,19 +575,29 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
       /* Derivative of time-stepping */
       timestepper->solveAdjointODE(rho_t0_bar, store_finalstates[iinit], obj_weights[iinit] * gamma_penalty, obj_weights[iinit]*gamma_penalty_dpdm, obj_weights[iinit]*gamma_penalty_energy);
 
-      /* Add to optimizers's gradient */
-      VecAXPY(G, 1.0, timestepper->redgrad);
+      /* Add to optimizers's gradient. Its reduction overlaps with the next initial condition. */
+      addGradientContribution(timestepper->redgrad, G);
     } // end of initial condition loop 
   } // end of adjoint for Schroedinger
 
-  /* Sum up the gradient from all initial condition processors */
-  PetscScalar* grad; 
-  VecGetArray(G, &grad);
-  for (int i=0; i<ndesign; i++) {
-    mygrad[i] = grad[i];
+  /* Finish summing up the gradient from all initial condition processors */
+  completeGradientReduction(0, G);
+  completeGradientReduction(1, G);
+
+  /* Derivative of regularization terms. Added after the reduction, hence on all initial condition processors. */
+  // Derivative of Tikhonov 0.5*gamma * ||x||^2 
+  VecAXPY(G, gamma_tik, x);   // + gamma_tik * x
+  if (gamma_tik_interpolate){
+    VecAXPY(G, -1.0*gamma_tik, xinit); // -gamma_tik * xinit
+  }
+  // Derivative of penalization of control variation 
+  double var_reg_bar = 0.5*gamma_penalty_variation;
+  int skip_to_oscillator = 0;
+  for (size_t iosc = 0; iosc < timestepper->mastereq->getNOscillators(); iosc++){
+    Oscillator* osc = timestepper->mastereq->getOscillator(iosc);
+    osc->evalControlVariationDiff(G, var_reg_bar, skip_to_oscillator);
+    skip_to_oscillator += osc->getNParams();
   }
-  MPI_Allreduce(mygrad, grad, ndesign, MPI_DOUBLE, MPI_SUM, comm_init);
-  VecRestoreArray(G, &grad);
 
   /* Compute and store gradient norm */
   VecNorm(G, NORM_2, &(gnorm));
@@ -529,9 +609,244 @@ void OptimProblem::evalGradF(const Vec x, Vec G){
   // }
 }
 
+void OptimProblem::addGradientContribution(Vec redgrad, Vec G) {
+
+  /* Nothing to communicate if all initial conditions are local */
+  if (mpisize_init == 1) {
+    if (redgrad != NULL) VecAXPY(G, 1.0, redgrad);
+    return;
+  }
+
+  /* Free the buffer slot: finish its previous reduction */
+  int slot = grad_slot;
+  completeGradientReduction(slot, G);
+
+  /* Copy the contribution into the send buffer and start summing it up */
+  double* sendbuf = mygrad + slot*ndesign;
+  if (redgrad != NULL) {
+    const PetscScalar* ptr;
+    VecGetArrayRead(redgrad, &ptr);
+    for (int i=0; i<ndesign; i++) sendbuf[i] = ptr[i];
+    VecRestoreArrayRead(redgrad, &ptr);
+  } else {
+    for (int i=0; i<ndesign; i++) sendbuf[i] = 0.0;
+  }
+  MPI_Iallreduce(sendbuf, mygrad_sum + slot*ndesign, ndesign, MPI_DOUBLE, MPI_SUM, comm_init, &grad_request[slot]);
+
+  grad_slot = 1 - slot;
+}
+
+void OptimProblem::completeGradientReduction(int slot, Vec G) {
+  if (grad_request[slot] == MPI_REQUEST_NULL) return;
+
+  MPI_Wait(&grad_request[slot], MPI_STATUS_IGNORE);
+
+  PetscScalar* grad; 
+  VecGetArray(G, &grad);
+  double* recvbuf = mygrad_sum + slot*ndesign;
+  for (int i=0; i<ndesign; i++) {
+    grad[i] += recvbuf[i];
+  }
+  VecRestoreArray(G, &grad);
+}
+
+void OptimProblem::setHessianPoint(const Vec x) {
+  VecCopy(x, xhess);
+}
+
+void OptimProblem::evalHessVec(const Vec v, Vec Hv) {
+
+  MasterEq* mastereq = timestepper->mastereq;
+
+  /* Pass the current iterate and the direction to the oscillators */
+  mastereq->setControlAmplitudes(xhess);
+  mastereq->setControlDirection(v);
+
+  /* Reset Hessian-vector product */
+  VecZeroEntries(Hv);
+
+  /* Lindblad solver: Tangent-linear forward and second-order adjoint solve for each initial condition. 
+   * Schroedinger solver: The terminal condition of the second-order adjoint depends on the tangent of the summed
+   * cost, hence first propagate all initial conditions (tangent forward), then run the adjoints in a second loop. */
+  double obj_cost_re = 0.0;
+  double obj_cost_im = 0.0;
+  double obj_cost_re_dot = 0.0;
+  double obj_cost_im_dot = 0.0;
+  int last_solved = -1;
+  for (int iinit = 0; iinit < ninit_local; iinit++) {
+
+    /* Skip initial conditions that are not part of the current mini-batch */
+    if (minibatch_active && fid_weights[iinit] == 0.0) {
+      if (mastereq->lindbladtype != LindbladType::NONE) addGradientContribution(NULL, Hv);
+      continue;
+    }
+
+    /* Prepare the initial condition and target */
+    int iinit_global = mpirank_init * ninit_local + iinit;
+    int initid = optim_target->prepareInitialState(iinit_global, ninit, mastereq->nlevels, mastereq->nessential, rho_t0);
+    optim_target->prepareTargetState(rho_t0);
+
+    /* Run forward with the tangent-linear equation */
+    Vec finalstate = timestepper->solveTangentODE(initid, rho_t0);
+    Vec finaltangent = timestepper->getFinalTangent();
+    last_solved = iinit;
+
+    if (mastereq->lindbladtype != LindbladType::NONE) {
+      /* Terminal conditions: The adjoint seeds of the Lindblad objective are constant */
+      double obj_cost_re_bar, obj_cost_im_bar;
+      optim_target->finalizeJ_diff(0.0, 0.0, &obj_cost_re_bar, &obj_cost_im_bar);
+      VecZeroEntries(rho_t0_bar);
+      VecZeroEntries(rho_t0_bar_dot);
+      optim_target->evalJ_diff(finalstate, rho_t0_bar, obj_weights[iinit]*obj_cost_re_bar, obj_weights[iinit]*obj_cost_im_bar);
+      optim_target->evalJ_diff_tangent(finalstate, finaltangent, rho_t0_bar_dot, obj_weights[iinit]*obj_cost_re_bar, obj_weights[iinit]*obj_cost_im_bar);
+
+      /* Second-order adjoint */
+      timestepper->solveSecondOrderAdjointODE(rho_t0_bar, rho_t0_bar_dot, obj_weights[iinit]*gamma_penalty, obj_weights[iinit]*gamma_penalty_energy);
+      addGradientContribution(timestepper->redhess, Hv);
+    } else {
+      /* Store the final state and tangent, and sum up the cost and its derivative */
+      VecCopy(finalstate, store_finalstates[iinit]);
+      VecCopy(finaltangent, store_finaltangents[iinit]);
+      double re, im, re_dot, im_dot;
+      optim_target->evalJ(finalstate, &re, &im);
+      optim_target->evalJ_tangent(finalstate, finaltangent, &re_dot, &im_dot);
+      obj_cost_re += obj_weights[iinit] * re;
+      obj_cost_im += obj_weights[iinit] * im;
+      obj_cost_re_dot += obj_weights[iinit] * re_dot;
+      obj_cost_im_dot += obj_weights[iinit] * im_dot;
+    }
+  }
+
+  if (mastereq->lindbladtype == LindbladType::NONE) {
+    double mysum[4] = {obj_cost_re, obj_cost_im, obj_cost_re_dot, obj_cost_im_dot};
+    double sum[4];
+    MPI_Allreduce(mysum, sum, 4, MPI_DOUBLE, MPI_SUM, comm_init);
+    double obj_cost_re_bar, obj_cost_im_bar, obj_cost_re_bar_dot, obj_cost_im_bar_dot;
+    optim_target->finalizeJ_diff(sum[0], sum[1], &obj_cost_re_bar, &obj_cost_im_bar);
+    optim_target->finalizeJ_diff_tangent(sum[0], sum[1], sum[2], sum[3], &obj_cost_re_bar_dot, &obj_cost_im_bar_dot);
+
+    for (int iinit = 0; iinit < ninit_local; iinit++) {
+      if (minibatch_active && fid_weights[iinit] == 0.0) {
+        addGradientContribution(NULL, Hv);
+        continue;
+      }
+      int iinit_global = mpirank_init * ninit_local + iinit;
+      int initid = optim_target->prepareInitialState(iinit_global, ninit, mastereq->nlevels, mastereq->nessential, rho_t0);
+      optim_target->prepareTargetState(rho_t0);
+
+      /* Recompute the stored trajectories, unless this initial condition was the last one solved */
+      if (iinit != last_solved) timestepper->solveTangentODE(initid, rho_t0);
+
+      /* Terminal conditions: Derivative of the adjoint seed, plus second derivative of J */
+      double w = obj_weights[iinit];
+      VecZeroEntries(rho_t0_bar);
+      VecZeroEntries(rho_t0_bar_dot);
+      optim_target->evalJ_diff(store_finalstates[iinit], rho_t0_bar, w*obj_cost_re_bar, w*obj_cost_im_bar);
+      optim_target->evalJ_diff_tangent(store_finalstates[iinit], store_finaltangents[iinit], rho_t0_bar_dot, w*obj_cost_re_bar, w*obj_cost_im_bar);
+      optim_target->evalJ_diff(store_finalstates[iinit], rho_t0_bar_dot, w*obj_cost_re_bar_dot, w*obj_cost_im_bar_dot);
+
+      /* Second-order adjoint */
+      timestepper->solveSecondOrderAdjointODE(rho_t0_bar, rho_t0_bar_dot, w*gamma_penalty, w*gamma_penalty_energy);
+      addGradientContribution(timestepper->redhess, Hv);
+    }
+  }
+
+  /* Finish summing up from all initial condition processors */
+  completeGradientReduction(0, Hv);
+  completeGradientReduction(1, Hv);
+
+  /* Second derivatives of the regularization terms */
+  VecAXPY(Hv, gamma_tik, v);
+  int skip_to_oscillator = 0;
+  for (size_t iosc = 0; iosc < mastereq->getNOscillators(); iosc++){
+    Oscillator* osc = mastereq->getOscillator(iosc);
+    osc->evalControlVariationHessVec(Hv, 0.5*gamma_penalty_variation, skip_to_oscillator);
+    skip_to_oscillator += osc->getNParams();
+  }
+}
+
+void OptimProblem::checkHessianSupport() {
+  MasterEq* mastereq = timestepper->mastereq;
+
+  for (size_t iosc = 0; iosc < mastereq->getNOscillators(); iosc++){
+    if (!mastereq->getOscillator(iosc)->hasLinearControls()) {
+      printf("ERROR: Hessian-vector products require controls that are linear in the parameters (spline or spline0).\n");
+      exit(1);
+    }
+  }
+  if (gamma_penalty_dpdm > 1e-13) {
+    printf("ERROR: Hessian-vector products are not implemented for the dpdm penalty. Set optim_penalty_dpdm = 0.0.\n");
+    exit(1);
+  }
+
+  /* Allocate storage for the final tangent states of the Schroedinger solver */
+  if (mastereq->lindbladtype == LindbladType::NONE && store_finaltangents.size() == 0) {
+    for (int i = 0; i < ninit_local; i++) {
+      Vec state;
+      VecDuplicate(store_finalstates[i], &state);
+      store_finaltangents.push_back(state);
+    }
+  }
+}
+
 void OptimProblem::solve(Vec xinit) {
   TaoSetSolution(tao, xinit);
-  TaoSolve(tao);
+  iter_offset = 0;
+
+  /* Multilevel mode: Optimize on coarse time grids first. The control parameterization does not depend 
+   * on the time grid, hence the coarse solution directly serves as initial guess on the next finer grid. */
+  if (multilevel_nlevels > 1) {
+    int ntime_fine = timestepper->ntime;
+    multilevel_coarse = true;
+    for (int level = multilevel_nlevels-1; level > 0; level--) {
+      int ntime_level = ntime_fine >> level;
+      if (ntime_level < 1 || iter_offset >= maxiter) continue;
+      if (multistart_status == MultistartStatus::DROPPED) break;
+      timestepper->setNTime(ntime_level);
+      if (mpirank_world == 0 && !quietmode) printf("Multilevel: Optimizing on coarse time grid, ntime=%d\n", ntime_level);
+
+      TaoSetMaximumIterations(tao, std::min(multilevel_maxiter, maxiter - iter_offset));
+      TaoSolve(tao);
+      PetscInt iter;
+      TaoGetIterationNumber(tao, &iter);
+      iter_offset += std::max((int) iter, 1);
+    }
+    multilevel_coarse = false;
+    timestepper->setNTime(ntime_fine);
+    iter_offset = std::min(iter_offset, maxiter);
+    TaoSetMaximumIterations(tao, maxiter - iter_offset);
+    if (mpirank_world == 0 && !quietmode) printf("Multilevel: Optimizing on fine time grid, ntime=%d\n", ntime_fine);
+  }
+
+  /* Mini-batch mode: Run short optimization epochs on sampled subsets of the initial conditions, 
+   * until the full objective is close enough to convergence. Each epoch warm-starts from the previous one. */
+  if (minibatch_size > 0) {
+    while (iter_offset < maxiter) {
+      /* Convergence check on the full set of initial conditions */
+      useFullBatch();
+      evalF(xinit);
+      if (mpirank_world == 0 && !quietmode) printf("Mini-batch: Iteration %d, full infidelity %1.8e\n", iter_offset, 1.0 - fidelity);
+      if (1.0 - fidelity <= minibatch_switchtol) break;
+
+      /* Optimize on a new random subset */
+      sampleMinibatch();
+      TaoSetMaximumIterations(tao, std::min(minibatch_epoch, maxiter - iter_offset));
+      TaoSolve(tao);
+      PetscInt iter;
+      TaoGetIterationNumber(tao, &iter);
+      iter_offset += std::max((int) iter, 1);
+    }
+    /* Remaining iterations on the full set of initial conditions */
+    useFullBatch();
+    iter_offset = std::min(iter_offset, maxiter);
+    TaoSetMaximumIterations(tao, maxiter - iter_offset);
+  }
+
+  /* Multi-start groups that were stopped on a coarse grid stay stopped */
+  if (multistart_status != MultistartStatus::DROPPED) TaoSolve(tao);
+
+  /* Multi-start: pick the best solution over all optim groups */
+  if (mpisize_optim > 1) finalizeMultistart();
 }
 
 void OptimProblem::getStartingPoint(Vec xinit){
@@ -554,6 +869,25 @@ void OptimProblem::getStartingPoint(Vec xinit){
     VecRestoreArray(xinit, &xptr);
   }
 
+  /* Multi-start: All but the first optim group start from a random perturbation of the initial guess */
+  if (mpisize_optim > 1 && mpirank_optim > 0) {
+    mastereq->setControlAmplitudes(xinit);
+    std::seed_seq seed{static_cast<unsigned int>(rand_engine()), static_cast<unsigned int>(mpirank_optim)};
+    std::mt19937 group_engine(seed);
+    PetscScalar* xptr;
+    VecGetArray(xinit, &xptr);
+    int shift = 0;
+    for (size_t ioscil = 0; ioscil<mastereq->getNOscillators(); ioscil++){
+      mastereq->getOscillator(ioscil)->perturbParams(multistart_perturb, group_engine);
+      mastereq->getOscillator(ioscil)->getParams(xptr + shift);
+      shift += mastereq->getOscillator(ioscil)->getNParams();
+    }
+    VecRestoreArray(xinit, &xptr);
+    /* Project onto the bounds */
+    VecPointwiseMin(xinit, xinit, xupper);
+    VecPointwiseMax(xinit, xinit, xlower);
+  }
+
   /* Assemble initial guess */
   VecAssemblyBegin(xinit);
   VecAssemblyEnd(xinit);
@@ -575,6 +909,104 @@ void OptimProblem::getSolution(Vec* param_ptr){
   *param_ptr = params;
 }
 
+void OptimProblem::sampleMinibatch(){
+
+  /* Number of samples drawn on this processor */
+  int nsample = (minibatch_size + mpisize_init - 1) / mpisize_init;
+
+  /* Sum of local weights */
+  double wsum = 0.0;
+  for (int i = 0; i < ninit_local; i++) wsum += obj_weights_full[i];
+
+  for (size_t i = 0; i < obj_weights.size(); i++) {
+    obj_weights[i] = 0.0;
+    fid_weights[i] = 0.0;
+  }
+
+  /* Draw initial conditions with probability w_i / wsum. Rescale the weights such that the sampled 
+   * objective and fidelity are unbiased estimates of the full ones. Repeated draws accumulate. */
+  if (wsum > 0.0) {
+    std::discrete_distribution<int> dist(obj_weights_full.begin(), obj_weights_full.begin() + ninit_local);
+    for (int k = 0; k < nsample; k++) {
+      int i = dist(minibatch_engine);
+      obj_weights[i] += wsum / nsample;
+      fid_weights[i] += wsum / (ninit * obj_weights_full[i] * nsample);
+    }
+  }
+  minibatch_active = true;
+}
+
+void OptimProblem::useFullBatch(){
+  obj_weights = obj_weights_full;
+  fid_weights.assign(obj_weights.size(), 1./ninit);
+  minibatch_active = false;
+}
+
+double OptimProblem::updateMultistartBest(double f){
+
+  /* The first processor of this group exchanges with rank 0 of comm_optim, which holds the best value so far */
+  double f_best = f;
+  if (mpirank_init == 0 && mpirank_petsc == 0) {
+    double f_prev;
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, multistart_win);
+    MPI_Fetch_and_op(&f, &f_prev, MPI_DOUBLE, 0, 0, MPI_MIN, multistart_win);
+    MPI_Win_unlock(0, multistart_win);
+    f_best = std::min(f, f_prev);
+  }
+  /* Make sure all processors of this group take the same decision */
+  MPI_Bcast(&f_best, 1, MPI_DOUBLE, 0, comm_group);
+
+  return f_best;
+}
+
+void OptimProblem::finalizeMultistart(){
+
+  /* Get the final status of this group's optimization */
+  PetscInt iter;
+  PetscReal f, gnorm_final, cnorm, xdiff;
+  TaoConvergedReason reason;
+  TaoGetSolutionStatus(tao, &iter, &f, &gnorm_final, &cnorm, &xdiff, &reason);
+  Vec params;
+  TaoGetSolution(tao, &params);
+
+  /* Find the group with the smallest objective */
+  struct { double val; int rank; } mine, best;
+  mine.val = f;
+  mine.rank = mpirank_optim;
+  MPI_Allreduce(&mine, &best, 1, MPI_DOUBLE_INT, MPI_MINLOC, comm_optim);
+
+  /* Gather the summary of all groups and write merged output file */
+  std::vector<int> iters(mpisize_optim, 0);
+  std::vector<double> objectives(mpisize_optim, 0.0);
+  std::vector<double> fidelities(mpisize_optim, 0.0);
+  std::vector<int> status_int(mpisize_optim, 0);
+  int myiter = iter;
+  int mystatus = static_cast<int>(multistart_status);
+  double myobj = f;
+  double myfidelity = fidelity;
+  MPI_Gather(&myiter, 1, MPI_INT, iters.data(), 1, MPI_INT, 0, comm_optim);
+  MPI_Gather(&mystatus, 1, MPI_INT, status_int.data(), 1, MPI_INT, 0, comm_optim);
+  MPI_Gather(&myobj, 1, MPI_DOUBLE, objectives.data(), 1, MPI_DOUBLE, 0, comm_optim);
+  MPI_Gather(&myfidelity, 1, MPI_DOUBLE, fidelities.data(), 1, MPI_DOUBLE, 0, comm_optim);
+  std::vector<MultistartStatus> status;
+  for (int k=0; k<mpisize_optim; k++) status.push_back(static_cast<MultistartStatus>(status_int[k]));
+  output->writeMultistartFile(iters, objectives, fidelities, status, best.rank);
+  if (mpirank_world == 0 && !quietmode) printf("\nMulti-start: Best objective %1.14e found by start %d (of %d).\n", best.val, best.rank, mpisize_optim);
+
+  /* Distribute the best solution to all groups */
+  PetscScalar* xptr;
+  VecGetArray(params, &xptr);
+  MPI_Bcast(xptr, ndesign, MPI_DOUBLE, best.rank, comm_optim);
+  VecRestoreArray(params, &xptr);
+
+  /* Print controls and trajectory data of the best solution. Only the first group writes. */
+  if (mpirank_optim == 0) {
+    output->writeControls(params, timestepper->mastereq, timestepper->ntime, timestepper->dt);
+    timestepper->writeTrajectoryDataFiles = true;
+    evalF(params);
+  }
+}
+
 PetscErrorCode TaoMonitor(Tao tao,void*ptr){
   OptimProblem* ctx = (OptimProblem*) ptr;
 
@@ -586,6 +1018,8 @@ PetscErrorCode TaoMonitor(Tao tao,void*ptr){
   PetscScalar f, gnorm;
   TaoGetSolutionStatus(tao, &iter, &f, &gnorm, NULL, &deltax, &reason);
   TaoGetSolution(tao, &params);
+  /* Mini-batch mode: Count iterations from previous epochs */
+  iter += ctx->getIterOffset();
 
   /* Grab some output stuff */
   double obj_cost = ctx->getCostT();
@@ -599,22 +1033,42 @@ PetscErrorCode TaoMonitor(Tao tao,void*ptr){
   /* Additional Stopping criteria */
   bool lastIter = false;
   std::string finalReason_str = "";
-  if (1.0 - F_avg <= ctx->getInfTol()) {
+  if (ctx->isMinibatchActive()) {
+    // Objective on a subset of initial conditions. Convergence is checked on the full set in between epochs, see solve(). 
+  } else if (ctx->isCoarseLevel()) {
+    // Coarse time grid: Stop at the loose tolerance, final output is done on the fine grid, see solve().
+    if (1.0 - F_avg <= ctx->getMultilevelTol()) TaoSetConvergedReason(tao, TAO_CONVERGED_USER);
+  } else if (1.0 - F_avg <= ctx->getInfTol()) {
     finalReason_str = "Optimization converged with small infidelity.";
     TaoSetConvergedReason(tao, TAO_CONVERGED_USER);
+    ctx->setMultistartStatus(MultistartStatus::CONVERGED);
     lastIter = true;
   } else if (obj_cost <= ctx->getFaTol()) {
     finalReason_str = "Optimization converged with small final time cost.";
     TaoSetConvergedReason(tao, TAO_CONVERGED_USER);
+    ctx->setMultistartStatus(MultistartStatus::CONVERGED);
     lastIter = true;
   } else if (iter == ctx->getMaxIter()) {
     finalReason_str = "Optimization stopped at maximum number of iterations.";
+    ctx->setMultistartStatus(MultistartStatus::MAXITER);
     lastIter = true;
   } else if (gnorm < ctx->getGaTol()) {
     finalReason_str = "OPtimization converged with small gradient norm.";
+    ctx->setMultistartStatus(MultistartStatus::CONVERGED);
     lastIter=true;
   }
 
+  /* Multi-start: Compare to the best objective over all optim groups, and stop this group if it falls far behind. */
+  if (ctx->isMultistart()) {
+    double f_best = ctx->updateMultistartBest(f);
+    if (!lastIter && iter >= ctx->getMultistartWarmup() && f > ctx->getMultistartDropTol() * f_best) {
+      finalReason_str = "Optimization stopped, objective falls behind the best multi-start group.";
+      TaoSetConvergedReason(tao, TAO_DIVERGED_USER);
+      ctx->setMultistartStatus(MultistartStatus::DROPPED);
+      lastIter = true;
+    }
+  }
+
   /* First iteration: Header for screen output of optimization history */
   if (iter == 0 && ctx->getMPIrank_world() == 0) {
     std::cout<<  "    Objective             Tikhonov                Penalty-Leakage        Penalty-StateVar       Penalty-TotalEnergy    Penalty-CtrlVar" << std::endl;
@@ -635,11 +1089,14 @@ PetscErrorCode TaoMonitor(Tao tao,void*ptr){
 
   /* Last iteration: Print solution, controls and trajectory data to files */
   if (lastIter) {
-    ctx->output->writeControls(params, ctx->timestepper->mastereq, ctx->timestepper->ntime, ctx->timestepper->dt);
+    // If multi-start, this is done for the best group only, see finalizeMultistart().
+    if (!ctx->isMultistart()) {
+      ctx->output->writeControls(params, ctx->timestepper->mastereq, ctx->timestepper->ntime, ctx->timestepper->dt);
 
-    // do one last forward evaluation while writing trajectory files
-    ctx->timestepper->writeTrajectoryDataFiles = true;
-    ctx->evalF(params); 
+      // do one last forward evaluation while writing trajectory files
+      ctx->timestepper->writeTrajectoryDataFiles = true;
+      ctx->evalF(params); 
+    }
 
     // Print stopping reason to screen
     if (ctx->getMPIrank_world() == 0){
@@ -677,3 +1134,20 @@ PetscErrorCode TaoEvalGradient(Tao /*tao*/, Vec x, Vec G, void*ptr){
   
   return 0;
 }
+
+PetscErrorCode TaoEvalHessian(Tao /*tao*/, Vec x, Mat /*H*/, Mat /*Hpre*/, void*ptr){
+
+  OptimProblem* ctx = (OptimProblem*) ptr;
+  ctx->setHessianPoint(x);
+
+  return 0;
+}
+
+PetscErrorCode HessianMult(Mat H, Vec v, Vec Hv){
+
+  OptimProblem* ctx;
+  MatShellGetContext(H, (void**) &ctx);
+  ctx->evalHessVec(v, Hv);
+
+  return 0;
+}
@@ -16,17 +16,22 @@ OptimTarget::OptimTarget(){
   targetstate = NULL;
   mpisize_petsc=0;
   mpirank_petsc=0;
+  observables = NULL;
+  cache_size = 0;
+  cache_current = -1;
 }
 
 
-OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string& objective_str, std::vector<std::string> initcond_str, MasterEq* mastereq, double total_time, std::vector<double> read_gate_rot, Vec rho_t0, bool quietmode_) : OptimTarget() {
+OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string& objective_str, std::vector<std::string> initcond_str, MasterEq* mastereq, double total_time, std::vector<double> read_gate_rot, Vec rho_t0, int cache_size_, bool quietmode_) : OptimTarget() {
 
   // initialize
+  cache_size = cache_size_;
   dim = mastereq->getDim();
   dim_rho = mastereq->getDimRho();
   dim_ess = mastereq->getDimEss();
   quietmode = quietmode_;
   lindbladtype = mastereq->lindbladtype;
+  observables = mastereq->getObservables();
   MPI_Comm_size(PETSC_COMM_WORLD, &mpisize_petsc);
   MPI_Comm_rank(PETSC_COMM_WORLD, &mpirank_petsc);
   int mpirank_world;
@@ -96,7 +101,7 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
     if (lindbladtype != LindbladType::NONE) vec_id = getVecID( diag_id, diag_id, dim_rho); 
     // Set 1.0 on the processor who owns this index
     if (ilow <= vec_id && vec_id < iupp) {
-      PetscInt id_global_x =  vec_id + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+      PetscInt id_global_x = getIndexReal(vec_id, localsize_u); // Global index of the real part of element vec_id in x
       VecSetValue(rho_t0, id_global_x, 1.0, INSERT_VALUES);
     }
   }
@@ -122,9 +127,9 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
         }
         PetscInt elemid = getVecID(k,j,dim_rho);
         if (ilow <= elemid && elemid < iupp) {
-          PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+          PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
           VecSetValue(rho_t0, id_global_x, vec[i], INSERT_VALUES);  // RealPart
-          VecSetValue(rho_t0, id_global_x + localsize_u, vec[i + dim_ess*dim_ess], INSERT_VALUES); // Imaginary Part
+          VecSetValue(rho_t0, getIndexImag(elemid, localsize_u), vec[i + dim_ess*dim_ess], INSERT_VALUES); // Imaginary Part
         }
       }
     } else { // Schroedinger solver, fill vector 
@@ -134,9 +139,9 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
           k = mapEssToFull(i, mastereq->nlevels, mastereq->nessential);
         PetscInt elemid = k;
         if (ilow <= elemid && elemid < iupp) {
-          PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+          PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
           VecSetValue(rho_t0, id_global_x, vec[i], INSERT_VALUES);  // RealPart
-          VecSetValue(rho_t0, id_global_x + localsize_u, vec[i + dim_ess], INSERT_VALUES); // Imaginary Part
+          VecSetValue(rho_t0, getIndexImag(elemid, localsize_u), vec[i + dim_ess], INSERT_VALUES); // Imaginary Part
         }
       }
     }
@@ -172,23 +177,23 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
           // diagonal element: 1/N_sub
           PetscInt elemid = getVecID(ifull, jfull, dimrho);
           if (ilow <= elemid && elemid < iupp) {
-            PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+            PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
             VecSetValue(rho_t0, id_global_x, 1./dimsub, INSERT_VALUES);
           }
         } else {
           // upper diagonal (0.5 + 0.5*i) / (N_sub^2)
           PetscInt elemid = getVecID(ifull, jfull, dimrho);
           if (ilow <= elemid && elemid < iupp) {
-            PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+            PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
             VecSetValue(rho_t0, id_global_x, 0.5/(dimsub*dimsub), INSERT_VALUES);
-            VecSetValue(rho_t0, id_global_x + localsize_u, 0.5/(dimsub*dimsub), INSERT_VALUES);
+            VecSetValue(rho_t0, getIndexImag(elemid, localsize_u), 0.5/(dimsub*dimsub), INSERT_VALUES);
           }
           // lower diagonal (0.5 - 0.5*i) / (N_sub^2)
           elemid = getVecID(jfull, ifull, dimrho);
           if (ilow <= elemid && elemid < iupp) {
-            PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+            PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
             VecSetValue(rho_t0, id_global_x,  0.5/(dimsub*dimsub), INSERT_VALUES);
-            VecSetValue(rho_t0, id_global_x + localsize_u, -0.5/(dimsub*dimsub), INSERT_VALUES);
+            VecSetValue(rho_t0, getIndexImag(elemid, localsize_u), -0.5/(dimsub*dimsub), INSERT_VALUES);
           }
         } 
       }
@@ -283,9 +288,9 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
         }
         PetscInt elemid = getVecID(k,j,dim_rho);
         if (ilow <= elemid && elemid < iupp) {
-          PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+          PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
           VecSetValue(targetstate, id_global_x, vec[i],       INSERT_VALUES); // RealPart
-          VecSetValue(targetstate, id_global_x + localsize_u, vec[i + dim_ess*dim_ess], INSERT_VALUES); // Imaginary Part
+          VecSetValue(targetstate, getIndexImag(elemid, localsize_u), vec[i + dim_ess*dim_ess], INSERT_VALUES); // Imaginary Part
         }
       }
     } else {  // Schroedinger solver, fill vector
@@ -295,9 +300,9 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
           k = mapEssToFull(i, mastereq->nlevels, mastereq->nessential);
         PetscInt elemid = k;
         if (ilow <= elemid && elemid < iupp) {
-          PetscInt id_global_x =  elemid + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+          PetscInt id_global_x = getIndexReal(elemid, localsize_u); // Global index of the real part of element elemid in x
           VecSetValue(targetstate, id_global_x, vec[i], INSERT_VALUES);        // RealPart
-          VecSetValue(targetstate, id_global_x + localsize_u, vec[i + dim_ess], INSERT_VALUES); // Imaginary Part
+          VecSetValue(targetstate, getIndexImag(elemid, localsize_u), vec[i + dim_ess], INSERT_VALUES); // Imaginary Part
         }
       }
     }
@@ -316,6 +321,10 @@ OptimTarget::OptimTarget(std::vector<std::string> target_str, const std::string&
 }
 
 OptimTarget::~OptimTarget(){
+  for (size_t k=0; k<cache_rho0.size(); k++) {
+    if (cache_rho0[k] != NULL) VecDestroy(&(cache_rho0[k]));
+    if (cache_target[k] != NULL) VecDestroy(&(cache_target[k]));
+  }
   if (objective_type == ObjectiveType::JFROBENIUS) VecDestroy(&aux);
   if (target_type == TargetType::GATE || target_type == TargetType::FROMFILE)  VecDestroy(&targetstate);
 
@@ -358,9 +367,9 @@ void OptimTarget::HilbertSchmidtOverlap(const Vec state, const bool scalebypurit
 
     // Get real and imag values from the processor who owns the subvector index.
     if (ilow <= idm && idm < iupp) {
-      PetscInt id_global_x = idm + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+      PetscInt id_global_x = getIndexReal(idm, localsize_u); // Global index of the real part of element idm in x
       VecGetValues(state, 1, &id_global_x, &HS_re);
-      id_global_x += localsize_u; // Imaginary part
+      id_global_x = getIndexImag(idm, localsize_u); // Imaginary part
       VecGetValues(state, 1, &id_global_x, &HS_im); // Should be 0.0 if Lindblad!
     }
     if (lindbladtype != LindbladType::NONE) assert(fabs(HS_im) <= 1e-14);
@@ -381,9 +390,11 @@ void OptimTarget::HilbertSchmidtOverlap(const Vec state, const bool scalebypurit
       const PetscScalar* state_ptr;
       VecGetArrayRead(targetstate, &target_ptr); 
       VecGetArrayRead(state, &state_ptr);
+      PetscInt stride_x, offset_im;
+      getStateStrides(localsize_u, &stride_x, &offset_im);
       for (PetscInt i=0; i<localsize_u; i++){
-        PetscInt idre = i;
-        PetscInt idim = i + localsize_u;
+        PetscInt idre = i*stride_x;
+        PetscInt idim = idre + offset_im;
         HS_re +=  target_ptr[idre]*state_ptr[idre] + target_ptr[idim]*state_ptr[idim];
         HS_im += -target_ptr[idim]*state_ptr[idre] + target_ptr[idre]*state_ptr[idim];
       } 
@@ -420,9 +431,9 @@ void OptimTarget::HilbertSchmidtOverlap_diff(Vec statebar, bool scalebypurity, c
     if (lindbladtype != LindbladType::NONE) idm = getVecID(purestateID, purestateID, (PetscInt)sqrt(dim));
 
     if (ilow <= idm && idm < iupp) {
-      PetscInt id_global_x = idm + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+      PetscInt id_global_x = getIndexReal(idm, localsize_u); // Global index of the real part of element idm in x
       VecSetValue(statebar, id_global_x, HS_re_bar*scale, ADD_VALUES);
-      VecSetValue(statebar, id_global_x + localsize_u, HS_im_bar, ADD_VALUES);
+      VecSetValue(statebar, getIndexImag(idm, localsize_u), HS_im_bar, ADD_VALUES);
     }
 
   } else { // Target is not of the form e_m or e_m*e_m^\dagger 
@@ -434,9 +445,11 @@ void OptimTarget::HilbertSchmidtOverlap_diff(Vec statebar, bool scalebypurity, c
       PetscScalar* statebar_ptr;
       VecGetArrayRead(targetstate, &target_ptr); 
       VecGetArray(statebar, &statebar_ptr);
+      PetscInt stride_x, offset_im;
+      getStateStrides(localsize_u, &stride_x, &offset_im);
       for (PetscInt i=0; i<localsize_u; i++){
-        PetscInt idre = i;
-        PetscInt idim = i + localsize_u;
+        PetscInt idre = i*stride_x;
+        PetscInt idim = idre + offset_im;
         statebar_ptr[idre] += target_ptr[idre] * HS_re_bar*scale  - target_ptr[idim] * HS_im_bar;
         statebar_ptr[idim] += target_ptr[idim] * HS_re_bar*scale  + target_ptr[idre] * HS_im_bar;
       }
@@ -449,6 +462,44 @@ void OptimTarget::HilbertSchmidtOverlap_diff(Vec statebar, bool scalebypurity, c
 
 int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std::vector<int>& nlevels, const std::vector<int>& nessential, Vec rho0){
 
+  cache_current = -1;
+  if (cache_size == 0) return buildInitialState(iinit, ninit, nlevels, nessential, rho0);
+  if ((int) cache_index.size() != ninit) cache_index.assign(ninit, -1);
+
+  /* Reuse the cached state. States without a stored vector are basis-type states, rebuilding those is cheap. */
+  int k = cache_index[iinit];
+  if (k >= 0) {
+    cache_current = k;
+    if (cache_rho0[k] != NULL) {
+      VecCopy(cache_rho0[k], rho0);
+      return cache_initID[k];
+    }
+    return buildInitialState(iinit, ninit, nlevels, nessential, rho0);
+  }
+
+  /* Build the state and store a new cache entry, if there is room */
+  int initID = buildInitialState(iinit, ninit, nlevels, nessential, rho0);
+  if (cache_size < 0 || (int) cache_initID.size() < cache_size) {
+    Vec rho0_copy = NULL;
+    if (initcond_type == InitialConditionType::THREESTATES || initcond_type == InitialConditionType::NPLUSONE) {
+      VecDuplicate(rho0, &rho0_copy);
+      VecCopy(rho0, rho0_copy);
+    }
+    cache_current = cache_initID.size();
+    cache_index[iinit] = cache_current;
+    cache_initID.push_back(initID);
+    cache_rho0.push_back(rho0_copy);
+    cache_target.push_back(NULL);
+    cache_purity.push_back(0.0);
+    cache_target_ready.push_back(false);
+  }
+
+  return initID;
+}
+
+
+int OptimTarget::buildInitialState(const int iinit, const int ninit, const std::vector<int>& nlevels, const std::vector<int>& nessential, Vec rho0){
+
   PetscInt elemID;
   double val;
   PetscInt dim_post;
@@ -465,15 +516,15 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
         if (lindbladtype == LindbladType::NONE) {
           double val = 1./ sqrt(2.*dim_rho);
           if (ilow <= i && i < iupp) {
-            PetscInt id_global_x =  i + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+            PetscInt id_global_x = getIndexReal(i, localsize_u); // Global index of the real part of element i in x
             VecSetValue(rho0, id_global_x, val, INSERT_VALUES);
-            VecSetValue(rho0, id_global_x + localsize_u, val, INSERT_VALUES);
+            VecSetValue(rho0, getIndexImag(i, localsize_u), val, INSERT_VALUES);
           }
         } else {
           PetscInt elem_re = getVecID(i, i, dim_rho);
           double val = 1./ dim_rho;
           if (ilow <= elem_re && elem_re < iupp) {
-            PetscInt id_global_x =  i + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+            PetscInt id_global_x = getIndexReal(i, localsize_u); // Global index of the real part of element i in x
             VecSetValue(rho0, id_global_x, val, INSERT_VALUES);
           }
         }
@@ -504,7 +555,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
           PetscInt diagID = getVecID(i_full,i_full,dim_rho);
           double val = 2.*(dim_rho - i_full) / (dim_rho * (dim_rho + 1));
           if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x =  diagID + mpirank_petsc*localsize_u; // Global index of u_i in x=[u,v]
+            PetscInt id_global_x = getIndexReal(diagID, localsize_u); // Global index of the real part of element diagID in x
             VecSetValue(rho0, id_global_x, val, INSERT_VALUES);
           }
         }
@@ -516,7 +567,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
             double val = 1./dim_rho;
             PetscInt index = getVecID(i_full,j_full,dim_rho);
             if (ilow <= index && index < iupp) {
-              PetscInt id_global_x =  index + mpirank_petsc*localsize_u;
+              PetscInt id_global_x = getIndexReal(index, localsize_u);
               VecSetValue(rho0, id_global_x, val, INSERT_VALUES); 
             }
           }
@@ -528,7 +579,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
           PetscInt diagID = getVecID(i_full,i_full,dim_rho);
           double val = 1./ dim_rho;
           if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x =  diagID + mpirank_petsc*localsize_u;
+            PetscInt id_global_x = getIndexReal(diagID, localsize_u);
             VecSetValue(rho0, id_global_x, val, INSERT_VALUES);
           }
         }
@@ -547,7 +598,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
         elemID = getVecID(iinit, iinit, dim_rho);
         val = 1.0;
         if (ilow <= elemID && elemID < iupp) {
-          PetscInt id_global_x = elemID+ mpirank_petsc*localsize_u;
+          PetscInt id_global_x = getIndexReal(elemID, localsize_u);
           VecSetValues(rho0, 1, &id_global_x, &val, INSERT_VALUES);
         }
       }
@@ -557,7 +608,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
             elemID = getVecID(i,j,dim_rho);
             val = 1.0 / dim_rho;
             if (ilow <= elemID && elemID < iupp) {
-              PetscInt id_global_x = elemID + mpirank_petsc*localsize_u;
+              PetscInt id_global_x = getIndexReal(elemID, localsize_u);
               VecSetValues(rho0, 1, &id_global_x, &val, INSERT_VALUES);
             }
           }
@@ -591,7 +642,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
       if (lindbladtype != LindbladType::NONE) elemID = getVecID(diagelem, diagelem, dim_rho); 
       val = 1.0;
       if (ilow <= elemID && elemID < iupp) {
-        PetscInt id_global_x =  elemID + mpirank_petsc*localsize_u; 
+        PetscInt id_global_x = getIndexReal(elemID, localsize_u);
         VecSetValues(rho0, 1, &id_global_x, &val, INSERT_VALUES);
       }
       VecAssemblyBegin(rho0); VecAssemblyEnd(rho0);
@@ -635,7 +686,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
         elemID = getVecID(k, k, dim_rho); 
         double val = 1.0;
         if (ilow <= elemID && elemID < iupp) {
-          PetscInt id_global_x =  elemID + mpirank_petsc*localsize_u; 
+          PetscInt id_global_x = getIndexReal(elemID, localsize_u);
           VecSetValues(rho0, 1, &id_global_x, &val, INSERT_VALUES);
         }
       } else {
@@ -656,7 +707,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
           vals[3] = 0.5;
           for (int i=0; i<4; i++) {
             if (ilow <= rows[i] && rows[i] < iupp) {
-              PetscInt id_global_x =  rows[i]+ mpirank_petsc*localsize_u; 
+              PetscInt id_global_x = getIndexReal(rows[i], localsize_u);
               VecSetValues(rho0, 1, &id_global_x, &(vals[i]), INSERT_VALUES);
             }
           }
@@ -665,7 +716,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
           vals[1] = 0.5;
           for (int i=0; i<2; i++) {
             if (ilow <= rows[i] && rows[i] < iupp) {
-              PetscInt id_global_x =  rows[i]+ mpirank_petsc*localsize_u; 
+              PetscInt id_global_x = getIndexReal(rows[i], localsize_u);
               VecSetValues(rho0, 1, &id_global_x, &(vals[i]), INSERT_VALUES);
             }
           }
@@ -675,7 +726,7 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
           rows[3] = getVecID(j, k, dim_rho); // (j,k)
           for (int i=2; i<4; i++) {
             if (ilow <= rows[i] && rows[i] < iupp) {
-              PetscInt id_global_x =  rows[i]+ mpirank_petsc*localsize_u + localsize_u; 
+              PetscInt id_global_x = getIndexImag(rows[i], localsize_u);
               VecSetValues(rho0, 1, &id_global_x, &(vals[i]), INSERT_VALUES);
             }
           }
@@ -699,12 +750,31 @@ int OptimTarget::prepareInitialState(const int iinit, const int ninit, const std
 
 
 void OptimTarget::prepareTargetState(const Vec rho_t0){
+
+  /* Reuse target state and purity if this initial condition has been prepared before */
+  int k = cache_current;
+  if (k >= 0 && cache_target_ready[k]) {
+    if (target_type == TargetType::GATE) VecCopy(cache_target[k], targetstate);
+    purity_rho0 = cache_purity[k];
+    return;
+  }
+
   // If gate optimization, apply the gate and store targetstate for later use. Else, do nothing.
   if (target_type == TargetType::GATE) targetgate->applyGate(rho_t0, targetstate);
 
   /* Compute and store the purity of rho(0), Tr(rho(0)^2), so that it can be used by JTrace (HS overlap) */
   VecNorm(rho_t0, NORM_2, &purity_rho0);
   purity_rho0 = purity_rho0 * purity_rho0;
+
+  /* Store in the cache */
+  if (k >= 0) {
+    if (target_type == TargetType::GATE) {
+      VecDuplicate(targetstate, &(cache_target[k]));
+      VecCopy(targetstate, cache_target[k]);
+    }
+    cache_purity[k] = purity_rho0;
+    cache_target_ready[k] = true;
+  }
 }
 
 
@@ -712,8 +782,7 @@ void OptimTarget::prepareTargetState(const Vec rho_t0){
 void OptimTarget::evalJ(const Vec state, double* J_re_ptr, double* J_im_ptr){
   double J_re = 0.0;
   double J_im = 0.0;
-  double sum, rhoii, rhoii_re, rhoii_im, lambdai, norm;
-  PetscInt dimsq;
+  double norm;
 
   switch(objective_type) {
 
@@ -731,7 +800,7 @@ void OptimTarget::evalJ(const Vec state, double* J_re_ptr, double* J_im_ptr){
         PetscInt diagID = purestateID;
         if (lindbladtype != LindbladType::NONE) diagID = getVecID(purestateID,purestateID,(PetscInt)sqrt(dim));
         if (ilow <= diagID && diagID < iupp) {
-          PetscInt id_global_x = diagID + mpirank_petsc*localsize_u; 
+          PetscInt id_global_x = getIndexReal(diagID, localsize_u);
           VecSetValue(state, id_global_x, -1.0, ADD_VALUES);
         }
         VecAssemblyBegin(state); VecAssemblyEnd(state);
@@ -739,7 +808,7 @@ void OptimTarget::evalJ(const Vec state, double* J_re_ptr, double* J_im_ptr){
         VecNorm(state, NORM_2, &norm);
         J_re = pow(norm, 2.0) / 2.0;
         if (ilow <= diagID && diagID < iupp) {
-          PetscInt id_global_x = diagID + mpirank_petsc*localsize_u; 
+          PetscInt id_global_x = getIndexReal(diagID, localsize_u);
           VecSetValue(state, id_global_x, +1.0, ADD_VALUES); // restore original state!
         }
         VecAssemblyBegin(state); VecAssemblyEnd(state);
@@ -760,36 +829,9 @@ void OptimTarget::evalJ(const Vec state, double* J_re_ptr, double* J_im_ptr){
         exit(1);
       }
 
-      dimsq = dim;   // Schroedinger solver: dim = N
-      if (lindbladtype != LindbladType::NONE) dimsq = (PetscInt)sqrt(dim); // Lindblad solver: dim = N^2
-
-      // iterate over diagonal elements 
-      sum = 0.0;
-      for (PetscInt i=0; i<dimsq; i++){
-        if (lindbladtype != LindbladType::NONE) {
-          PetscInt diagID = getVecID(i,i,dimsq);
-          rhoii = 0.0;
-          if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x =  diagID + mpirank_petsc*localsize_u;
-            VecGetValues(state, 1, &id_global_x, &rhoii);
-          }
-        } else  {
-          PetscInt diagID = i;
-          rhoii_re = 0.0;
-          rhoii_im = 0.0;
-          if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x =  diagID + mpirank_petsc*localsize_u;
-            VecGetValues(state, 1, &id_global_x, &rhoii_re);
-            id_global_x += localsize_u;
-            VecGetValues(state, 1, &id_global_x, &rhoii_im);
-          }
-          rhoii = pow(rhoii_re, 2.0) + pow(rhoii_im, 2.0);
-        }
-        lambdai = fabs(i - purestateID);
-        sum += lambdai * rhoii;
-      }
-      J_re = sum;
-      MPI_Allreduce(&sum, &J_re, 1, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+      /* Sum up |i-m| rho_ii over the diagonal */
+      observables->compute(state, Observables::MEASURE, purestateID);
+      J_re = observables->getMeasure();
       break; // case J_MEASURE
   }
 
@@ -816,7 +858,7 @@ void OptimTarget::evalJ_diff(const Vec state, Vec statebar, const double J_re_ba
         PetscInt diagID = purestateID;
         if (lindbladtype != LindbladType::NONE) diagID = getVecID(purestateID,purestateID,(PetscInt)sqrt(dim));
         if (ilow <= diagID && diagID < iupp) {
-          PetscInt id_global_x = diagID + mpirank_petsc*localsize_u;
+          PetscInt id_global_x = getIndexReal(diagID, localsize_u);
           VecSetValue(statebar, id_global_x, -1.0*J_re_bar, ADD_VALUES);
         }
       }
@@ -839,7 +881,7 @@ void OptimTarget::evalJ_diff(const Vec state, Vec statebar, const double J_re_ba
           PetscInt diagID = getVecID(i,i,dimsq);
           val = lambdai * J_re_bar;
           if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x =  diagID + mpirank_petsc*localsize_u;
+            PetscInt id_global_x = getIndexReal(diagID, localsize_u);
             VecSetValue(statebar, id_global_x, val, ADD_VALUES);
           }
         } else {
@@ -847,10 +889,10 @@ void OptimTarget::evalJ_diff(const Vec state, Vec statebar, const double J_re_ba
           rhoii_re = 0.0;
           rhoii_im = 0.0;
           if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x =  diagID + mpirank_petsc*localsize_u;
+            PetscInt id_global_x = getIndexReal(diagID, localsize_u);
             VecGetValues(state, 1, &id_global_x, &rhoii_re);
             VecSetValue(statebar, id_global_x, 2.*J_re_bar*lambdai*rhoii_re, ADD_VALUES);
-            id_global_x += localsize_u;
+            id_global_x = getIndexImag(diagID, localsize_u);
             VecGetValues(state, 1, &id_global_x, &rhoii_im);
             VecSetValue(statebar, id_global_x, 2.*J_re_bar*lambdai*rhoii_im, ADD_VALUES);
           }
@@ -895,3 +937,115 @@ void OptimTarget::finalizeJ_diff(const double obj_cost_re, const double obj_cost
     *obj_cost_im_bar = 0.0;
   }
 }
+
+void OptimTarget::evalJ_tangent(const Vec state, const Vec state_dot, double* J_re_dot, double* J_im_dot){
+  double Jdot_re = 0.0;
+  double Jdot_im = 0.0;
+  double dot, diag_re;
+
+  switch(objective_type) {
+
+    /* J_Frob = 1/2 * || rho_target - rho(T)||^2_F, derivative (rho(T) - rho_target)^T * rho_dot */
+    case ObjectiveType::JFROBENIUS:
+      VecDot(state, state_dot, &dot);
+      if (target_type == TargetType::GATE || target_type == TargetType::FROMFILE ) {
+        VecDot(targetstate, state_dot, &diag_re);
+        Jdot_re = dot - diag_re;
+      } else {
+        // The pure target e_m e_m^\dagger (or e_m) picks the real part of the m-th diagonal element of rho_dot
+        PetscInt diagID = purestateID;
+        if (lindbladtype != LindbladType::NONE) diagID = getVecID(purestateID,purestateID,(PetscInt)sqrt(dim));
+        double mydiag = 0.0;
+        if (ilow <= diagID && diagID < iupp) {
+          PetscInt id_global_x = getIndexReal(diagID, localsize_u);
+          VecGetValues(state_dot, 1, &id_global_x, &mydiag);
+        }
+        MPI_Allreduce(&mydiag, &diag_re, 1, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+        Jdot_re = dot - diag_re;
+      }
+      break;
+
+    /* J_Trace is linear in the state */
+    case ObjectiveType::JTRACE:
+      HilbertSchmidtOverlap(state_dot, true, &Jdot_re, &Jdot_im);
+      break;
+
+    case ObjectiveType::JMEASURE:
+      if (lindbladtype != LindbladType::NONE) {
+        /* Linear in the state */
+        observables->compute(state_dot, Observables::MEASURE, purestateID);
+        Jdot_re = observables->getMeasure();
+      } else {
+        /* \sum_i |i-m| 2 Re(phi_i^* phi_dot_i) */
+        const PetscScalar* xptr;
+        const PetscScalar* xdotptr;
+        VecGetArrayRead(state, &xptr);
+        VecGetArrayRead(state_dot, &xdotptr);
+        PetscInt stride_x, offset_im;
+        getStateStrides(localsize_u, &stride_x, &offset_im);
+        double mysum = 0.0;
+        for (PetscInt i=0; i<localsize_u; i++){
+          double lambdai = fabs(i + ilow - purestateID);
+          PetscInt idre = i*stride_x;
+          PetscInt idim = idre + offset_im;
+          mysum += 2.*lambdai * (xptr[idre]*xdotptr[idre] + xptr[idim]*xdotptr[idim]);
+        }
+        VecRestoreArrayRead(state, &xptr);
+        VecRestoreArrayRead(state_dot, &xdotptr);
+        MPI_Allreduce(&mysum, &Jdot_re, 1, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+      }
+      break;
+  }
+
+  *J_re_dot = Jdot_re;
+  *J_im_dot = Jdot_im;
+}
+
+void OptimTarget::evalJ_diff_tangent(const Vec /*state*/, const Vec state_dot, Vec statebar, const double J_re_bar, const double /*J_im_bar*/){
+
+  switch (objective_type) {
+
+    /* Hessian of 1/2||rho - rho_target||^2 is the identity */
+    case ObjectiveType::JFROBENIUS:
+      VecAXPY(statebar, J_re_bar, state_dot);
+      break;
+
+    /* Linear in the state, no second derivative */
+    case ObjectiveType::JTRACE:
+      break;
+
+    /* Linear in the state if Lindblad. Schroedinger: Hessian of \sum_i |i-m| |phi_i|^2 is diagonal with entries 2|i-m| */
+    case ObjectiveType::JMEASURE:
+      if (lindbladtype == LindbladType::NONE) {
+        const PetscScalar* xdotptr;
+        PetscScalar* xbarptr;
+        VecGetArrayRead(state_dot, &xdotptr);
+        VecGetArray(statebar, &xbarptr);
+        PetscInt stride_x, offset_im;
+        getStateStrides(localsize_u, &stride_x, &offset_im);
+        for (PetscInt i=0; i<localsize_u; i++){
+          double lambdai = fabs(i + ilow - purestateID);
+          PetscInt idre = i*stride_x;
+          PetscInt idim = idre + offset_im;
+          xbarptr[idre] += 2.*J_re_bar*lambdai*xdotptr[idre];
+          xbarptr[idim] += 2.*J_re_bar*lambdai*xdotptr[idim];
+        }
+        VecRestoreArrayRead(state_dot, &xdotptr);
+        VecRestoreArray(statebar, &xbarptr);
+      }
+      break;
+  }
+}
+
+void OptimTarget::finalizeJ_diff_tangent(const double /*obj_cost_re*/, const double /*obj_cost_im*/, const double obj_cost_re_dot, const double obj_cost_im_dot, double* obj_cost_re_bar_dot, double* obj_cost_im_bar_dot){
+
+  if (objective_type == ObjectiveType::JTRACE && lindbladtype == LindbladType::NONE) {
+    // obj_cost_re_bar = -2.*obj_cost_re, obj_cost_im_bar = -2.*obj_cost_im
+    *obj_cost_re_bar_dot = -2.*obj_cost_re_dot;
+    *obj_cost_im_bar_dot = -2.*obj_cost_im_dot;
+  } else {
+    // Constant adjoints
+    *obj_cost_re_bar_dot = 0.0;
+    *obj_cost_im_bar_dot = 0.0;
+  }
+}
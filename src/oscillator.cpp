@@ -5,11 +5,14 @@ Oscillator::Oscillator(){
   Tfinal = 0;
   ground_freq = 0.0;
   control_enforceBC = true;
+  control_table_valid = false;
+  observables = NULL;
 }
 
 Oscillator::Oscillator(Config config, size_t id, const std::vector<int>& nlevels_all_, std::vector<std::string>& controlsegments, std::vector<std::string>& controlinitializations, double ground_freq_, double selfkerr_, double rotational_freq_, double decay_time_, double dephase_time_, const std::vector<double>& carrier_freq_, double Tfinal_, LindbladType lindbladtype_, std::mt19937 rand_engine){
 
   myid = id;
+  observables = NULL;
   nlevels = nlevels_all_[id];
   Tfinal = Tfinal_;
   ground_freq = ground_freq_*2.0*M_PI;
@@ -22,6 +25,7 @@ Oscillator::Oscillator(Config config, size_t id, const std::vector<int>& nlevels
   decay_time = decay_time_;
   dephase_time = dephase_time_;
   lindbladtype = lindbladtype_;
+  control_table_valid = false;
 
   MPI_Comm_rank(PETSC_COMM_WORLD, &mpirank_petsc);
   MPI_Comm_size(PETSC_COMM_WORLD, &mpisize_petsc);
@@ -227,6 +231,7 @@ void Oscillator::setParams(const double* x){
   for (size_t i=0; i<params.size(); i++) {
     params[i] = x[i]; 
   }
+  control_table_valid = false;
 }
 
 void Oscillator::getParams(double* x){
@@ -235,6 +240,38 @@ void Oscillator::getParams(double* x){
   }
 }
 
+void Oscillator::perturbParams(double amplitude, std::mt19937& rand_engine){
+  if (params.size() == 0) return;
+
+  // Uniform distribution [-1,1)
+  std::uniform_real_distribution<double> unit_dist(-1.0, 1.0);
+
+  for (size_t bs = 0; bs < basisfunctions.size(); bs++){
+    int skip = basisfunctions[bs]->getSkip();
+    int nparams = getNSegParams(bs);
+    for (int i=0; i<nparams; i++){
+      double val = params[skip + i] + amplitude * unit_dist(rand_engine);
+      // If STEP: keep in [0,1]
+      if (basisfunctions[bs]->getType() == ControlType::STEP){
+        val = std::max(0.0, val);
+        val = std::min(1.0, val);
+      }
+      params[skip + i] = val;
+    }
+  }
+
+  control_table_valid = false;
+
+  /* Make sure the perturbed parameters satisfy the boundary conditions, if needed */
+  if (control_enforceBC){
+    for (size_t bs = 0; bs < basisfunctions.size(); bs++){
+      for (size_t f=0; f < carrier_freq.size(); f++) {
+        basisfunctions[bs]->enforceBoundary(params.data(), f);
+      }
+    }
+  }
+}
+
 int Oscillator::getNSegParams(int segmentID){
   int n = 0;
   if (params.size()>0) {
@@ -278,51 +315,170 @@ void Oscillator::evalControlVariationDiff(Vec G, double var_reg_bar, int skip_to
   } 
 }
 
-int Oscillator::evalControl(const double t, double* Re_ptr, double* Im_ptr){
+void Oscillator::evalControlVariationHessVec(Vec Hv, double var_reg_bar, int skip_to_oscillator){
 
-  // Sanity check 
-  if ( t > Tfinal ){
-    printf("ERROR: accessing spline outside of [0,T] at %f. Should never happen! Bug.\n", t);
-    exit(1);
+  if (params.size()>0) {
+    PetscScalar* hv; 
+    VecGetArray(Hv, &hv);
+
+    for (size_t iseg = 0; iseg< basisfunctions.size(); iseg++){
+      for (size_t f=0; f < carrier_freq.size(); f++) {
+        // The gradient is linear in the parameters: evaluate it at the direction
+        basisfunctions[iseg]->computeVariation_diff(hv+skip_to_oscillator, params_dir, var_reg_bar, f);
+     }
+    }
+    VecRestoreArray(Hv, &hv);
+  } 
+}
+
+void Oscillator::setControlTimes(const std::vector<double>& times){
+  control_times = times;
+  control_table_valid = false;
+
+  /* Tabulate the carrier waves and the lab-frame rotation. Those don't depend on the control parameters. */
+  size_t ncarrier = carrier_freq.size();
+  carrier_cos.resize(control_times.size() * ncarrier);
+  carrier_sin.resize(control_times.size() * ncarrier);
+  for (size_t f=0; f<ncarrier; f++){
+    carrierPhasors(carrier_freq[f], control_times, carrier_cos.data() + f, carrier_sin.data() + f, ncarrier);
   }
+  lab_cos.resize(control_times.size());
+  lab_sin.resize(control_times.size());
+  carrierPhasors(ground_freq, control_times, lab_cos.data(), lab_sin.data(), 1);
+}
 
-  // Default: Non controllable oscillator. Will typically be overwritten below. 
-  *Re_ptr = 0.0;
-  *Im_ptr = 0.0;
+void Oscillator::carrierPhasors(const double omega, const std::vector<double>& times, double* cos_out, double* sin_out, const size_t stride){
+  const size_t anchor = 64;    // Re-anchor with exact values every <anchor> time points
+  const size_t maxrot = 32;    // Maximum number of distinct time differences to keep
+  const double tol = 8.0 * std::numeric_limits<double>::epsilon() * std::max(1.0, Tfinal);
+
+  std::vector<double> rot_dt, rot_cos, rot_sin; // Rotations exp(i*omega*dt) for recurring time differences
+  double c = 1.0;
+  double s = 0.0;
+  for (size_t k=0; k<times.size(); k++){
+    bool exact = (k % anchor == 0);
+    if (!exact) {
+      /* Find the rotation for this time difference */
+      double delta = times[k] - times[k-1];
+      size_t r = 0;
+      while (r < rot_dt.size() && fabs(rot_dt[r] - delta) > tol) r++;
+      if (r == rot_dt.size() && rot_dt.size() < maxrot) {
+        rot_dt.push_back(delta);
+        rot_cos.push_back(cos(omega*delta));
+        rot_sin.push_back(sin(omega*delta));
+      }
+      /* Rotate the phasor, or evaluate exactly if the time differences don't recur */
+      if (r < rot_dt.size()) {
+        double cnew = c*rot_cos[r] - s*rot_sin[r];
+        s = s*rot_cos[r] + c*rot_sin[r];
+        c = cnew;
+      } else exact = true;
+    }
+    if (exact) {
+      c = cos(omega*times[k]);
+      s = sin(omega*times[k]);
+    }
+    cos_out[k*stride] = c;
+    sin_out[k*stride] = s;
+  }
+}
+
+void Oscillator::tabulateControl(){
+  size_t ntimes = control_times.size();
+  size_t ncarrier = carrier_freq.size();
+  control_p.assign(ntimes, 0.0);
+  control_q.assign(ntimes, 0.0);
 
-  /* Evaluate p(t) and q(t) using the parameters */
   if (params.size()>0) {
-    // Iterate over control segments. Only one will be used, see the break-statement. 
-    for (size_t bs = 0; bs < basisfunctions.size(); bs++){
-      if (basisfunctions[bs]->getTstart() <= t && 
-          basisfunctions[bs]->getTstop() >= t ) {
+    std::vector<double> Blt1(ntimes);
+    std::vector<double> Blt2(ntimes);
+    std::vector<bool> done(ntimes, false);  // The first segment containing a time point is used, as in computeControl()
 
-        /* Iterate over carrier frequencies */
-        double sum_p = 0.0;
-        double sum_q = 0.0;
-        for (size_t f=0; f < carrier_freq.size(); f++) {
-          /* Evaluate the Bspline for this carrier wave */
-          double Blt1 = 0.0; // Sums over alpha^1 * basisfunction(t) (real)
-          double Blt2 = 0.0; // Sums over alpha^2 * basisfunction(t) (imag)
-          basisfunctions[bs]->evaluate(t, params, f, &Blt1, &Blt2);
+    for (size_t bs = 0; bs < basisfunctions.size(); bs++){
+      /* Range of tabulated time points in this segment */
+      size_t lo = std::lower_bound(control_times.begin(), control_times.end(), basisfunctions[bs]->getTstart()) - control_times.begin();
+      size_t hi = std::upper_bound(control_times.begin(), control_times.end(), basisfunctions[bs]->getTstop()) - control_times.begin();
+      if (hi <= lo) continue;
+
+      /* Evaluate the basis for all time points at once, then multiply with the carrier waves */
+      for (size_t f=0; f < ncarrier; f++) {
+        basisfunctions[bs]->evaluateBatch(hi-lo, &control_times[lo], params, f, &Blt1[lo], &Blt2[lo]);
+        double phase = 0.0, cos_phase = 1.0, sin_phase = 0.0; // Phase of the amplitude parameterization, constant in time
+        for (size_t k=lo; k<hi; k++){
+          if (done[k]) continue;
+          double cos_omt = carrier_cos[k*ncarrier + f];
+          double sin_omt = carrier_sin[k*ncarrier + f];
           if (basisfunctions[bs]->getType() == ControlType::BSPLINEAMP) {
-            double cos_omt = cos(carrier_freq[f]*t + Blt2);
-            double sin_omt = sin(carrier_freq[f]*t + Blt2);
-            sum_p += cos_omt * Blt1; 
-            sum_q += sin_omt * Blt1;
+            // cos(omega*t + phase) and sin(omega*t + phase) 
+            if (Blt2[k] != phase) {
+              phase = Blt2[k];
+              cos_phase = cos(phase);
+              sin_phase = sin(phase);
+            }
+            double cos_shift = cos_omt * cos_phase - sin_omt * sin_phase;
+            double sin_shift = sin_omt * cos_phase + cos_omt * sin_phase;
+            control_p[k] += cos_shift * Blt1[k]; 
+            control_q[k] += sin_shift * Blt1[k];
           } else {
-            double cos_omt = cos(carrier_freq[f]*t);
-            double sin_omt = sin(carrier_freq[f]*t);
-            sum_p += cos_omt * Blt1 - sin_omt * Blt2; 
-            sum_q += sin_omt * Blt1 + cos_omt * Blt2;
+            control_p[k] += cos_omt * Blt1[k] - sin_omt * Blt2[k]; 
+            control_q[k] += sin_omt * Blt1[k] + cos_omt * Blt2[k];
           }
         }
-        *Re_ptr = sum_p;
-        *Im_ptr = sum_q;
-        break;
       }
+      for (size_t k=lo; k<hi; k++) done[k] = true;
     }
-  } 
+  }
+
+  /* If pipulse: Overwrite controls by constant amplitude */
+  for (size_t ipulse=0; ipulse< pipulse.tstart.size(); ipulse++){
+    for (size_t k=0; k<ntimes; k++){
+      if (pipulse.tstart[ipulse] <= control_times[k] && control_times[k] <= pipulse.tstop[ipulse]) {
+        double amp_pq =  pipulse.amp[ipulse] / sqrt(2.0);
+        control_p[k] = amp_pq;
+        control_q[k] = amp_pq;
+      }
+    }
+  }
+
+  control_table_valid = true;
+}
+
+int Oscillator::findControlTime(const double t){
+  if (control_times.empty()) return -1;
+
+  /* Binary search up to round-off. Stage times are at least a fraction of the time-step apart. */
+  double tol = 1e-12 * std::max(1.0, Tfinal);
+  std::vector<double>::iterator it = std::lower_bound(control_times.begin(), control_times.end(), t - tol);
+  if (it == control_times.end() || *it > t + tol) return -1;
+
+  if (!control_table_valid) tabulateControl();
+
+  return it - control_times.begin();
+}
+
+int Oscillator::evalControl(const double t, double* Re_ptr, double* Im_ptr){
+
+  /* Look up the control table */
+  int k = findControlTime(t);
+  if (k >= 0) {
+    *Re_ptr = control_p[k];
+    *Im_ptr = control_q[k];
+    return 0;
+  }
+
+  return computeControl(t, Re_ptr, Im_ptr);
+}
+
+int Oscillator::computeControl(const double t, double* Re_ptr, double* Im_ptr){
+
+  // Sanity check 
+  if ( t > Tfinal ){
+    printf("ERROR: accessing spline outside of [0,T] at %f. Should never happen! Bug.\n", t);
+    exit(1);
+  }
+
+  /* Evaluate p(t) and q(t) using the parameters. Zero for non controllable oscillators. */
+  evalBasisExpansion(t, params, Re_ptr, Im_ptr);
 
   /* If pipulse: Overwrite controls by constant amplitude */
   for (size_t ipulse=0; ipulse< pipulse.tstart.size(); ipulse++){
@@ -336,10 +492,88 @@ int Oscillator::evalControl(const double t, double* Re_ptr, double* Im_ptr){
   return 0;
 }
 
+void Oscillator::evalBasisExpansion(const double t, const std::vector<double>& coeffs, double* Re_ptr, double* Im_ptr){
+
+  *Re_ptr = 0.0;
+  *Im_ptr = 0.0;
+  if (coeffs.size() == 0) return;
+
+  // Carrier waves are looked up from the control table, if t is tabulated
+  int k = findControlTime(t);
+  size_t ncarrier = carrier_freq.size();
+
+  // Iterate over control segments. Only one will be used, see the break-statement. 
+  for (size_t bs = 0; bs < basisfunctions.size(); bs++){
+    if (basisfunctions[bs]->getTstart() <= t && 
+        basisfunctions[bs]->getTstop() >= t ) {
+
+      /* Iterate over carrier frequencies */
+      double sum_p = 0.0;
+      double sum_q = 0.0;
+      for (size_t f=0; f < ncarrier; f++) {
+        /* Evaluate the Bspline for this carrier wave */
+        double Blt1 = 0.0; // Sums over alpha^1 * basisfunction(t) (real)
+        double Blt2 = 0.0; // Sums over alpha^2 * basisfunction(t) (imag)
+        basisfunctions[bs]->evaluate(t, coeffs, f, &Blt1, &Blt2);
+        if (basisfunctions[bs]->getType() == ControlType::BSPLINEAMP) {
+          double cos_omt = cos(carrier_freq[f]*t + Blt2);
+          double sin_omt = sin(carrier_freq[f]*t + Blt2);
+          sum_p += cos_omt * Blt1; 
+          sum_q += sin_omt * Blt1;
+        } else {
+          double cos_omt, sin_omt;
+          if (k >= 0) {
+            cos_omt = carrier_cos[k*ncarrier + f];
+            sin_omt = carrier_sin[k*ncarrier + f];
+          } else {
+            cos_omt = cos(carrier_freq[f]*t);
+            sin_omt = sin(carrier_freq[f]*t);
+          }
+          sum_p += cos_omt * Blt1 - sin_omt * Blt2; 
+          sum_q += sin_omt * Blt1 + cos_omt * Blt2;
+        }
+      }
+      *Re_ptr = sum_p;
+      *Im_ptr = sum_q;
+      break;
+    }
+  }
+}
+
+void Oscillator::setParamsDirection(const double* x){
+  params_dir.assign(x, x + params.size());
+}
+
+void Oscillator::evalControlDirection(const double t, double* Re_ptr, double* Im_ptr){
+
+  /* Controls are linear in the parameters: Evaluate them with the direction as parameters */
+  evalBasisExpansion(t, params_dir, Re_ptr, Im_ptr);
+
+  /* Pi-pulses are constant */
+  for (size_t ipulse=0; ipulse< pipulse.tstart.size(); ipulse++){
+    if (pipulse.tstart[ipulse] <= t && t <= pipulse.tstop[ipulse]) {
+      *Re_ptr = 0.0;
+      *Im_ptr = 0.0;
+    }
+  }
+}
+
+bool Oscillator::hasLinearControls(){
+  for (size_t bs = 0; bs < basisfunctions.size(); bs++){
+    ControlType type = basisfunctions[bs]->getType();
+    if (type == ControlType::STEP || type == ControlType::BSPLINEAMP) return false;
+  }
+  return true;
+}
+
 int Oscillator::evalControl_diff(const double t, double* grad, const double pbar, const double qbar) {
 
   if (params.size()>0) {
 
+    // Carrier waves are looked up from the control table, if t is tabulated
+    int k = findControlTime(t);
+    size_t ncarrier = carrier_freq.size();
+
     // Iterate over control segments. Only one is active, see break statement.
     for (size_t bs = 0; bs < basisfunctions.size(); bs++){
       if (basisfunctions[bs]->getTstart() <= t && 
@@ -355,8 +589,14 @@ int Oscillator::evalControl_diff(const double t, double* grad, const double pbar
             exit(1);
           } else {
 
-            double cos_omt = cos(carrier_freq[f]*t);
-            double sin_omt = sin(carrier_freq[f]*t);
+            double cos_omt, sin_omt;
+            if (k >= 0) {
+              cos_omt = carrier_cos[k*ncarrier + f];
+              sin_omt = carrier_sin[k*ncarrier + f];
+            } else {
+              cos_omt = cos(carrier_freq[f]*t);
+              sin_omt = sin(carrier_freq[f]*t);
+            }
             double Blt1bar = sin_omt*qbar + cos_omt*pbar;
             double Blt2bar = cos_omt*qbar - sin_omt*pbar;
 
@@ -388,6 +628,14 @@ int Oscillator::evalControl_Labframe(const double t, double* f){
     exit(1);
   }
 
+  /* Look up the control table: f(t) = 2*(p(t)*cos(w*t) - q(t)*sin(w*t)). Amplitude parameterization is evaluated directly below. */
+  bool amplitude_param = params.size() > 0 && basisfunctions[0]->getType() == ControlType::BSPLINEAMP;
+  int k = amplitude_param ? -1 : findControlTime(t);
+  if (k >= 0) {
+    *f = 2. * (control_p[k] * lab_cos[k] - control_q[k] * lab_sin[k]);
+    return 0;
+  }
+
   /* Evaluate the spline at time t  */
   *f = 0.0;
   if (params.size()>0) {
@@ -428,48 +676,11 @@ int Oscillator::evalControl_Labframe(const double t, double* f){
 }
 
 double Oscillator::expectedEnergy(const Vec x) {
- 
-  PetscInt dim;
-  VecGetSize(x, &dim);
-  PetscInt dimmat;
-  if (lindbladtype != LindbladType::NONE)  dimmat = (PetscInt) sqrt(dim/2);
-  else dimmat = (PetscInt) dim/2;
 
-  /* Iterate over diagonal elements to add up expected energy level */
-  double expected = 0.0;
-  for (PetscInt i=0; i<dimmat; i++) {
-    /* Get diagonal element in number operator */
-    PetscInt num_diag = i % (nlevels*dim_postOsc);
-    num_diag = num_diag / dim_postOsc;
-    // Vectorize if Lindblad 
-    PetscInt idx_diag = i;
-    if (lindbladtype != LindbladType::NONE) idx_diag = getVecID(i,i,dimmat);
-    
-    double xdiag = 0.0;
-    if (lindbladtype != LindbladType::NONE){ // Lindblad solver: += i * rho_ii
-      if (ilow <= idx_diag && idx_diag < iupp) {
-        PetscInt id_global_x = idx_diag + mpirank_petsc*localsize_u; 
-        VecGetValues(x, 1, &id_global_x, &xdiag);
-      }
-      expected += num_diag * xdiag;
-    }
-    else { // Schoedinger solver: += i * | psi_i |^2
-      if (ilow <= idx_diag && idx_diag < iupp) {
-        PetscInt id_global_x = idx_diag + mpirank_petsc*localsize_u; 
-        VecGetValues(x, 1, &id_global_x, &xdiag);
-        expected += num_diag * xdiag * xdiag;
-        id_global_x += localsize_u; 
-        VecGetValues(x, 1, &id_global_x, &xdiag);
-        expected += num_diag * xdiag * xdiag;
-      }
-    }
-  }
-  
-  /* Sum up from all Petsc processors */
-  double myexp = expected;
-  MPI_Allreduce(&myexp, &expected, 1, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+  /* Sum up i * rho_ii (Lindblad) or i * |psi_i|^2 (Schroedinger) for this oscillator's level i */
+  observables->compute(x, Observables::ENERGY_OSC);
 
-  return expected;
+  return observables->getEnergy(myid);
 }
 
 
@@ -489,7 +700,7 @@ void Oscillator::expectedEnergy_diff(const Vec x, Vec x_bar, const double obj_ba
       val = num_diag * obj_bar;
       PetscInt idx_diag = getVecID(i, i, dimmat);
       if (ilow <= idx_diag && idx_diag < iupp) {
-        PetscInt id_global_x = idx_diag + mpirank_petsc*localsize_u; 
+        PetscInt id_global_x = getIndexReal(idx_diag, localsize_u);
         VecSetValues(x_bar, 1, &id_global_x, &val, ADD_VALUES);
       }
     }
@@ -498,12 +709,12 @@ void Oscillator::expectedEnergy_diff(const Vec x, Vec x_bar, const double obj_ba
       PetscInt idx_diag = i;
       xdiag = 0.0;
       if (ilow <= idx_diag && idx_diag < iupp) {
-        PetscInt id_global_x = idx_diag + mpirank_petsc*localsize_u; 
+        PetscInt id_global_x = getIndexReal(idx_diag, localsize_u);
         VecGetValues(x, 1, &id_global_x, &xdiag);
         val = num_diag * xdiag * obj_bar;
         VecSetValues(x_bar, 1, &id_global_x, &val, ADD_VALUES);
         // Imaginary part
-        id_global_x += localsize_u; 
+        id_global_x = getIndexImag(idx_diag, localsize_u);
         VecGetValues(x, 1, &id_global_x, &xdiag);
         val = - num_diag * xdiag * obj_bar; // TODO: Is this a minus or a plus?? 
         VecSetValues(x_bar, 1, &id_global_x, &val, ADD_VALUES);
@@ -517,50 +728,9 @@ void Oscillator::expectedEnergy_diff(const Vec x, Vec x_bar, const double obj_ba
 
 void Oscillator::population(const Vec x, std::vector<double> &pop) {
 
-  PetscInt dimN = dim_preOsc * nlevels * dim_postOsc;
-  double val;
-
   assert (pop.size() == static_cast<size_t>(nlevels));
 
-  std::vector<double> mypop(nlevels, 0.0);
-
-  /* Iterate over diagonal elements of the reduced density matrix for this oscillator */
-  for (int i=0; i < nlevels; i++) {
-    PetscInt identitystartID = i * dim_postOsc;
-    /* Sum up elements from all dim_preOsc blocks of size (n_k * dim_postOsc) */
-    double sum = 0.0;
-    for (PetscInt j=0; j < dim_preOsc; j++) {
-      PetscInt blockstartID = j * nlevels * dim_postOsc; // Go to the block
-      /* Iterate over identity */
-      for (PetscInt l=0; l < dim_postOsc; l++) {
-        /* Get diagonal element */
-        PetscInt rhoID = blockstartID + identitystartID + l; // Diagonal element of rho
-        if (lindbladtype != LindbladType::NONE) { // Lindblad solver
-          PetscInt diagID = getVecID(rhoID, rhoID, dimN);  // Position in vectorized rho
-          double val = 0.0;
-          if (ilow <= diagID && diagID < iupp)  {
-            PetscInt id_global_x = diagID+ mpirank_petsc*localsize_u; 
-            VecGetValues(x, 1, &id_global_x, &val);
-          }
-          sum += val;
-        } else {
-          PetscInt diagID = rhoID;
-          val = 0.0;
-          if (ilow <= diagID && diagID < iupp) {
-            PetscInt id_global_x = diagID+ mpirank_petsc*localsize_u; 
-            VecGetValues(x, 1, &id_global_x, &val);
-            sum += val * val;
-            id_global_x += localsize_u; 
-            VecGetValues(x, 1, &id_global_x, &val);
-            sum += val * val;
-          }
-        }
-      }
-    }
-    mypop[i] = sum;
-  } 
-
-  /* Gather poppulation from all Petsc processors */
-  for (size_t i=0; i<mypop.size(); i++) {pop[i] = mypop[i];}
-  MPI_Allreduce(mypop.data(), pop.data(), nlevels, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+  /* Diagonal of the reduced density matrix, gathered from all Petsc processors */
+  observables->compute(x, Observables::POPULATION_OSC);
+  observables->getPopulation(myid, pop);
 }
@@ -1,20 +1,140 @@
 #include "output.hpp"
 
+OutputWriter::OutputWriter(){
+  head = 0;
+  count = 0;
+  busy = false;
+  stop = false;
+  running = false;
+}
+
+OutputWriter::~OutputWriter(){
+  if (running) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stop = true;
+    }
+    cv_pop.notify_one();
+    worker.join();
+    running = false;
+  }
+}
+
+void OutputWriter::start(size_t capacity){
+  if (running) return;
+  ring.resize(capacity > 0 ? capacity : 1);
+  head = 0;
+  count = 0;
+  stop = false;
+  running = true;
+  worker = std::thread(&OutputWriter::run, this);
+}
+
+void OutputWriter::push(OutputRecord& rec){
+  if (!running) {
+    write(rec);
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mtx);
+  /* Backpressure: wait until the writer has freed a slot */
+  cv_push.wait(lock, [this]{ return count < ring.size(); });
+  size_t tail = (head + count) % ring.size();
+  std::swap(ring[tail], rec);
+  count++;
+  lock.unlock();
+  cv_pop.notify_one();
+}
+
+void OutputWriter::flush(){
+  if (!running) return;
+  std::unique_lock<std::mutex> lock(mtx);
+  cv_push.wait(lock, [this]{ return count == 0 && !busy; });
+}
+
+void OutputWriter::run(){
+  OutputRecord rec;
+  while (true) {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_pop.wait(lock, [this]{ return count > 0 || stop; });
+    if (count == 0) break; // stop requested and nothing left to write
+    /* Take the oldest record. Swapping hands the storage of rec back to the ring for reuse. */
+    std::swap(rec, ring[head]);
+    head = (head + 1) % ring.size();
+    count--;
+    busy = true;
+    lock.unlock();
+    cv_push.notify_all();
+
+    write(rec);
+
+    lock.lock();
+    busy = false;
+    lock.unlock();
+    cv_push.notify_all();
+  }
+}
+
+void OutputWriter::write(OutputRecord& rec){
+  if (rec.file == NULL) return;
+  size_t nrows = rec.ncols > 0 ? rec.values.size() / rec.ncols : 0;
+  for (size_t irow = 0; irow < nrows; irow++) {
+    const double* row = rec.values.data() + irow * rec.ncols;
+    fprintf(rec.file, rec.fmt_first, row[0]);
+    for (size_t j = 1; j < rec.ncols; j++) {
+      fprintf(rec.file, rec.fmt_value, row[j]);
+    }
+    fprintf(rec.file, "%s", rec.fmt_end);
+  }
+  if (rec.closefile) {
+    fclose(rec.file);
+    rec.file = NULL;
+  }
+}
+
 Output::Output(){
   mpirank_world = -1;
   mpirank_petsc = -1;
   mpirank_init  = -1;
+  mpirank_optim = -1;
+  mpisize_optim = 1;
+  optimfile = NULL;
   output_frequency = 0;
   quietmode = false;
+  comm_petsc = MPI_COMM_NULL;
+  fullstate_precision = 0;
+  statefile_open = false;
+  statefile_header = 0;
+  statefile_record = 0;
+  statefile_nsnapshots = 0;
+  trajectory_container = false;
+  containerfile_open = false;
+  container_slot = -1;
+  container_ninit = 0;
+  container_nsnap = 0;
+  container_ncols = 0;
+  container_block = 0;
+  container_col_expected_comp = -1;
+  container_col_population_comp = -1;
+  container_col_fullstate = -1;
+  comm_container = MPI_COMM_NULL;
+  container_flushrows = 256;
+  container_dim = 0;
+  container_rowfirst = 0;
+  container_nbuffered = 0;
+  container_nflushed = 0;
 }
 
-Output::Output(Config& config, MPI_Comm comm_petsc, MPI_Comm comm_init, int noscillators, bool quietmode_) : Output() {
+Output::Output(Config& config, MPI_Comm comm_petsc_, MPI_Comm comm_init, MPI_Comm comm_optim, int noscillators, bool quietmode_) : Output() {
 
   /* Get communicator ranks */
   MPI_Comm_rank(MPI_COMM_WORLD, &mpirank_world);
+  comm_petsc = comm_petsc_;
   MPI_Comm_rank(comm_petsc, &mpirank_petsc);
   MPI_Comm_size(comm_petsc, &mpisize_petsc);
+  comm_container = comm_init;
   MPI_Comm_rank(comm_init, &mpirank_init);
+  MPI_Comm_rank(comm_optim, &mpirank_optim);
+  MPI_Comm_size(comm_optim, &mpisize_optim);
 
   /* Reduced output */
   quietmode = quietmode_;
@@ -25,13 +145,16 @@ Output::Output(Config& config, MPI_Comm comm_petsc, MPI_Comm comm_init, int nosc
   if (mpirank_world == 0) {
     mkdir(datadir.c_str(), 0777);
   }
+  // Multi-start: Leaders of other optim groups open files in datadir right away, wait for it.
+  if (mpisize_optim > 1) MPI_Barrier(MPI_COMM_WORLD);
 
-  /* Prepare output for optimizer */
+  /* Prepare output for optimizer. If multi-start, the first processor of each optim group writes its own history file. */
   optim_monitor_freq = config.GetIntParam("optim_monitor_frequency", 10);
   output_frequency = config.GetIntParam("output_frequency", 1);
-  if (mpirank_world == 0) {
+  if (mpirank_petsc == 0 && mpirank_init == 0) {
     char filename[255];
-    snprintf(filename, 254, "%s/optim_history.dat", datadir.c_str());
+    if (mpisize_optim > 1) snprintf(filename, 254, "%s/optim_history_start%02d.dat", datadir.c_str(), mpirank_optim);
+    else snprintf(filename, 254, "%s/optim_history.dat", datadir.c_str());
     optimfile = fopen(filename, "w");
     fprintf(optimfile, "#\"iter\"    \"Objective\"           \"||Pr(grad)||\"           \"LS step\"           \"F_avg\"           \"Terminal cost\"         \"Tikhonov-regul\"        \"Penalty-term\"          \"State variation\"        \"Energy-term\"           \"Control variation\"\n");
   } 
@@ -66,12 +189,63 @@ Output::Output(Config& config, MPI_Comm comm_petsc, MPI_Comm comm_init, int nosc
       if (outputstr[i][j].compare("fullstate") == 0 ) writeFullState = true;
     }
   }
+
+  /* Format of the full state output: text (serial only), or binary (double or single precision), written with MPI-IO */
+  std::string fullstate_format = config.GetStrParam("output_fullstate_format", "text", true, false);
+  if (fullstate_format.compare("text") == 0) fullstate_precision = 0;
+  else if (fullstate_format.compare("binary") == 0) fullstate_precision = 8;
+  else if (fullstate_format.compare("binary32") == 0) fullstate_precision = 4;
+  else {
+    printf("\n\n ERROR: Unknown output_fullstate_format: %s. Choose text, binary or binary32.\n", fullstate_format.c_str());
+    exit(1);
+  }
+  if (writeFullState && fullstate_precision == 0 && mpisize_petsc > 1 && mpirank_world == 0) {
+    printf("Warning: Text output of the full state is not available with Petsc-parallel runs. Use output_fullstate_format = binary.\n");
+  }
+
+  /* Trajectory output: separate files per initial condition, or one binary container per run */
+  std::string trajectory_format = config.GetStrParam("output_trajectory_format", "files", true, false);
+  if (trajectory_format.compare("files") == 0) trajectory_container = false;
+  else if (trajectory_format.compare("container") == 0) trajectory_container = true;
+  else {
+    printf("\n\n ERROR: Unknown output_trajectory_format: %s. Choose files or container.\n", trajectory_format.c_str());
+    exit(1);
+  }
+  if (trajectory_container) {
+    containername = datadir + "/trajectories.bin";
+    // Remove the container of a previous run, so that no stale data blocks remain
+    if (mpirank_world == 0) MPI_File_delete(containername.c_str(), MPI_INFO_NULL);
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  /* Start the background writer for text output on those processors that write files. 
+   * output_buffer_size bounds the number of pending records, the time loop waits if the buffer is full. */
+  bool output_async = config.GetBoolParam("output_async", true, false);
+  int output_buffer_size = config.GetIntParam("output_buffer_size", 256, false);
+  if (output_buffer_size < 1) {
+    printf("\n\n ERROR: output_buffer_size must be positive.\n");
+    exit(1);
+  }
+  /* The writer thread runs next to MPI calls on the main thread, which requires at least MPI_THREAD_FUNNELED. 
+   * Fall back to synchronous writes if the MPI library does not provide it. */
+  int mpi_thread_level;
+  MPI_Query_thread(&mpi_thread_level);
+  if (output_async && mpi_thread_level < MPI_THREAD_FUNNELED) {
+    if (mpirank_world == 0 && !quietmode) printf("# Warning: MPI does not provide MPI_THREAD_FUNNELED, writing output synchronously.\n");
+    output_async = false;
+  }
+  if (output_async && mpirank_petsc == 0) {
+    writer.start(output_buffer_size);
+  }
+  container_flushrows = output_buffer_size;
 }
 
 
 Output::~Output(){
+  writer.flush();
+  if (containerfile_open) MPI_File_close(&containerfile);
   if (mpirank_world == 0 && !quietmode) printf("Output directory: %s\n", datadir.c_str());
-  if (mpirank_world == 0) fclose(optimfile);
+  if (optimfile != NULL) fclose(optimfile);
   writeExpectedEnergy.clear();
   writePopulation.clear();
 }
@@ -79,12 +253,35 @@ Output::~Output(){
 
 void Output::writeOptimFile(int optim_iter, double objective, double gnorm, double stepsize, double Favg, double costT, double tikh_regul, double penalty, double penalty_dpdm, double penalty_energy, double penalty_variation){
 
-  if (mpirank_world == 0){
+  if (optimfile != NULL){
     fprintf(optimfile, "%05d  %1.14e  %1.14e  %.8f  %1.14e  %1.14e  %1.14e  %1.14e  %1.14e  %1.14e  %1.14e\n", optim_iter, objective, gnorm, stepsize, Favg, costT, tikh_regul, penalty, penalty_dpdm, penalty_energy, penalty_variation);
     fflush(optimfile);
   } 
 }
 
+void Output::writeMultistartFile(const std::vector<int>& iters, const std::vector<double>& objectives, const std::vector<double>& fidelities, const std::vector<MultistartStatus>& status, int beststart){
+
+  if (mpirank_world == 0) {
+    char filename[255];
+    snprintf(filename, 254, "%s/optim_multistart.dat", datadir.c_str());
+    FILE* file = fopen(filename, "w");
+    fprintf(file, "#\"start\"  \"iter\"    \"Objective\"           \"F_avg\"                 \"status\"\n");
+    for (size_t k=0; k<objectives.size(); k++) {
+      std::string status_str;
+      switch (status[k]) {
+        case MultistartStatus::CONVERGED: status_str = "converged"; break;
+        case MultistartStatus::MAXITER:   status_str = "maxiter";   break;
+        case MultistartStatus::DROPPED:   status_str = "dropped";   break;
+        default:                          status_str = "stopped";   break;
+      }
+      fprintf(file, "%02zu      %05d   %1.14e  %1.14e  %s\n", k, iters[k], objectives[k], fidelities[k], status_str.c_str());
+    }
+    fprintf(file, "# Best start: %02d\n", beststart);
+    fclose(file);
+    if (!quietmode) printf("File written: %s\n", filename);
+  }
+}
+
 void Output::writeGradient(Vec grad){
   char filename[255];  
   PetscInt ngrad;
@@ -108,6 +305,31 @@ void Output::writeGradient(Vec grad){
   }
 }
 
+void Output::writeHessVec(Vec v, Vec Hv, Vec Hv_fd){
+  char filename[255];  
+  PetscInt n;
+  VecGetSize(v, &n);
+
+  if (mpirank_world == 0) {
+    FILE *file;
+    snprintf(filename, 254, "%s/hessvec.dat", datadir.c_str());
+    file = fopen(filename, "w");
+    fprintf(file, "#     direction             Hv              Hv_fd\n");
+
+    const PetscScalar *v_ptr, *hv_ptr, *fd_ptr;
+    VecGetArrayRead(v, &v_ptr);
+    VecGetArrayRead(Hv, &hv_ptr);
+    VecGetArrayRead(Hv_fd, &fd_ptr);
+    for (int i=0; i<n; i++){
+      fprintf(file, "%1.14e  %1.14e  %1.14e\n", v_ptr[i], hv_ptr[i], fd_ptr[i]);
+    }
+    VecRestoreArrayRead(v, &v_ptr);
+    VecRestoreArrayRead(Hv, &hv_ptr);
+    VecRestoreArrayRead(Hv_fd, &fd_ptr);
+    fclose(file);
+  }
+}
+
 void Output::writeControls(Vec params, MasterEq* mastereq, int ntime, double dt){
 
   /* Write controls every <outfreq> iterations */
@@ -117,18 +339,24 @@ void Output::writeControls(Vec params, MasterEq* mastereq, int ntime, double dt)
     PetscInt ndesign;
     VecGetSize(params, &ndesign);
 
+    /* Make sure that previous control files have been completed before overwriting them */
+    writer.flush();
+
     /* Print current parameters to file */
     FILE *file, *file_c;
     snprintf(filename, 254, "%s/params.dat", datadir.c_str());
     file = fopen(filename, "w");
 
+    OutputRecord rec;
+    rec.file = file;
+    rec.ncols = 1;
+    rec.fmt_first = "%1.14e";
+    rec.closefile = true;
     const PetscScalar* params_ptr;
     VecGetArrayRead(params, &params_ptr);
-    for (int i=0; i<ndesign; i++){
-      fprintf(file, "%1.14e\n", params_ptr[i]);
-    }
-    fclose(file);
+    rec.values.assign(params_ptr, params_ptr + ndesign);
     VecRestoreArrayRead(params, &params_ptr);
+    writer.push(rec);
     if (!quietmode) printf("File written: %s\n", filename);
 
     /* Print control to file for each oscillator */
@@ -138,7 +366,16 @@ void Output::writeControls(Vec params, MasterEq* mastereq, int ntime, double dt)
       file_c = fopen(filename, "w");
       fprintf(file_c, "#\"time\"         \"p(t) (rotating)\"          \"q(t) (rotating)\"         \"f(t) (labframe)\"\n");
 
-      /* Write every <num> timestep to file */
+      OutputRecord rec_c;
+      rec_c.file = file_c;
+      rec_c.ncols = 4;
+      rec_c.fmt_first = "% 1.8f";
+      rec_c.fmt_value = "   % 1.14e";
+      rec_c.fmt_end = " \n";
+      rec_c.closefile = true;
+      rec_c.values.reserve(4 * (ntime / output_frequency + 1));
+
+      /* Evaluate every <num> timestep, the writer formats them */
       for (int i=0; i<=ntime; i+=output_frequency) {
         double time = i*dt; 
 
@@ -146,19 +383,33 @@ void Output::writeControls(Vec params, MasterEq* mastereq, int ntime, double dt)
         mastereq->getOscillator(ioscil)->evalControl(time, &ReI, &ImI);
         mastereq->getOscillator(ioscil)->evalControl_Labframe(time, &LabI);
         // Write control drives
-        fprintf(file_c, "% 1.8f   % 1.14e   % 1.14e   % 1.14e \n", time, ReI/(2.0*M_PI), ImI/(2.0*M_PI), LabI/(2.0*M_PI));
-     } // end of time loop 
+        rec_c.values.push_back(time);
+        rec_c.values.push_back(ReI/(2.0*M_PI));
+        rec_c.values.push_back(ImI/(2.0*M_PI));
+        rec_c.values.push_back(LabI/(2.0*M_PI));
+      } // end of time loop 
 
-      fclose(file_c);
+      writer.push(rec_c);
       if (!quietmode) printf("File written: %s\n", filename);
     } // end of oscillator loop
   }
 }
 
 
-void Output::openTrajectoryDataFiles(std::string prefix, int initid){
+void Output::setInitialCondition(int iinit_global, int ninit){
+  container_slot = iinit_global;
+  container_ninit = ninit;
+}
+
+void Output::openTrajectoryDataFiles(std::string prefix, int initid, MasterEq* mastereq, int ntime){
   char filename[255];
 
+  // Container mode: all trajectory data goes into the data block of this initial condition
+  if (trajectory_container) {
+    openContainer(initid, mastereq, ntime);
+    return;
+  }
+
   // On the first petsc rank, open required files and print header information
   if (mpirank_petsc == 0) {
 
@@ -191,13 +442,224 @@ void Output::openTrajectoryDataFiles(std::string prefix, int initid){
       fprintf(populationfile_comp, "#\"time\"      \"population\"\n");
     }
     // Full vectorized state 
-    if (writeFullState ) {
+    if (writeFullState && fullstate_precision == 0) {
       snprintf(filename, 254, "%s/%s_Re.iinit%04d.dat", datadir.c_str(), prefix.c_str(), initid);
       ufile = fopen(filename, "w");
       snprintf(filename, 254, "%s/%s_Im.iinit%04d.dat", datadir.c_str(), prefix.c_str(), initid);
       vfile = fopen(filename, "w"); 
     }
   }
+
+  // Binary full state, opened collectively on all petsc ranks. 
+  // Header (all int64): magic "QUANDARY", version, bytes per value, lindblad flag, dim, noscillators, nlevels[noscillators], nsnapshots.
+  // Each snapshot then holds the time (double) followed by u and v (dim values each).
+  if (writeFullState && fullstate_precision > 0) {
+    snprintf(filename, 254, "%s/%s.iinit%04d.bin", datadir.c_str(), prefix.c_str(), initid);
+    MPI_File_open(comm_petsc, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &statefile);
+    MPI_File_set_size(statefile, 0);
+    statefile_open = true;
+    statefile_nsnapshots = 0;
+
+    PetscInt dim = mastereq->getDim();
+    std::vector<long long> header;
+    const char magic[9] = "QUANDARY";
+    long long magic_int;
+    memcpy(&magic_int, magic, 8);
+    header.push_back(magic_int);
+    header.push_back(1);
+    header.push_back(fullstate_precision);
+    header.push_back(mastereq->lindbladtype != LindbladType::NONE ? 1 : 0);
+    header.push_back(dim);
+    header.push_back(mastereq->getNOscillators());
+    for (size_t iosc = 0; iosc < mastereq->getNOscillators(); iosc++) header.push_back(mastereq->nlevels[iosc]);
+    header.push_back(0); // number of snapshots, updated when closing the file
+    statefile_header = header.size() * sizeof(long long);
+    statefile_record = sizeof(double) + 2 * (MPI_Offset) dim * fullstate_precision;
+    if (mpirank_petsc == 0) {
+      MPI_File_write_at(statefile, 0, header.data(), header.size(), MPI_LONG_LONG, MPI_STATUS_IGNORE);
+    }
+  }
+}
+
+void Output::openContainer(int initid, MasterEq* mastereq, int ntime){
+
+  size_t noscillators = mastereq->getNOscillators();
+  PetscInt dim = mastereq->getDim();
+  if (container_slot < 0 || container_slot >= container_ninit) {
+    container_slot = 0;
+    container_ninit = 1;
+  }
+
+  /* Column layout of each snapshot: time, expected energies, populations, full state (u, then v) */
+  std::vector<std::string> names;
+  std::vector<long long> cols, widths;
+  long long col = 1;
+  auto addDataset = [&](std::string name, long long width) {
+    names.push_back(name);
+    cols.push_back(col);
+    widths.push_back(width);
+    col += width;
+    return cols.back();
+  };
+  container_col_expected.assign(noscillators, -1);
+  container_col_population.assign(noscillators, -1);
+  container_col_expected_comp = -1;
+  container_col_population_comp = -1;
+  container_col_fullstate = -1;
+  for (size_t iosc = 0; iosc < noscillators; iosc++) {
+    if (writeExpectedEnergy[iosc]) container_col_expected[iosc] = addDataset("expected" + std::to_string(iosc), 1);
+  }
+  if (writeExpectedEnergy_comp) container_col_expected_comp = addDataset("expected_composite", 1);
+  for (size_t iosc = 0; iosc < noscillators; iosc++) {
+    if (writePopulation[iosc]) container_col_population[iosc] = addDataset("population" + std::to_string(iosc), mastereq->nlevels[iosc]);
+  }
+  if (writePopulation_comp) container_col_population_comp = addDataset("population_composite", mastereq->getDimRho());
+  if (writeFullState) {
+    container_col_fullstate = addDataset("fullstate_Re", dim);
+    addDataset("fullstate_Im", dim);
+  }
+  container_ncols = col;
+  container_nsnap = ntime / output_frequency + 1;
+
+  /* Header and index, aligned to chunks of 4096 bytes */
+  const long long chunk = 4096;
+  long long nheader = 8 + 6 * names.size() + container_ninit;
+  long long data_offset = (nheader * 8 + chunk - 1) / chunk * chunk;
+  long long block_stride = (container_nsnap * container_ncols * 8 + chunk - 1) / chunk * chunk;
+  container_block = data_offset + (MPI_Offset) container_slot * block_stride;
+
+  /* Local part of each row: time and observables on the first PETSc processor, followed by the local slices of the full state */
+  container_nbuffered = 0;
+  container_nflushed = 0;
+  container_rowfirst = 0;
+  container_dim = dim;
+  if (!hasContainerData()) return;
+  openContainerFile();
+  container_buf.resize(container_flushrows * getContainerLocalRowSize(dim));
+  if (mpirank_petsc == 0) {
+    /* The first initial condition writes the header, each initial condition writes its ID into the index */
+    if (container_slot == 0) {
+      std::vector<long long> header;
+      long long magic;
+      memcpy(&magic, "QUANDTRJ", 8);
+      header.push_back(magic);
+      header.push_back(1);
+      header.push_back(container_ninit);
+      header.push_back(container_nsnap);
+      header.push_back(container_ncols);
+      header.push_back(names.size());
+      header.push_back(data_offset);
+      header.push_back(block_stride);
+      for (size_t k = 0; k < names.size(); k++) {
+        long long name[4] = {0, 0, 0, 0};
+        memcpy(name, names[k].c_str(), std::min<size_t>(names[k].size(), 31));
+        header.insert(header.end(), name, name + 4);
+        header.push_back(cols[k]);
+        header.push_back(widths[k]);
+      }
+      MPI_File_write_at(containerfile, 0, header.data(), header.size(), MPI_LONG_LONG, MPI_STATUS_IGNORE);
+    }
+    long long id = initid;
+    MPI_Offset index_offset = (8 + 6 * names.size() + container_slot) * sizeof(long long);
+    MPI_File_write_at(containerfile, index_offset, &id, 1, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+  }
+}
+
+void Output::writeContainerRow(int timestep, double time, const Vec state, const std::vector<double>& obs, PetscInt dim){
+
+  long long isnap = timestep / output_frequency;
+  if (isnap >= container_nsnap) return;
+  if (isnap != container_rowfirst + container_nbuffered) return; // Rows are written in order, each once
+
+  /* Copy the local part of this snapshot into the row buffer */
+  double* row = container_buf.data() + container_nbuffered * getContainerLocalRowSize(dim);
+  if (mpirank_petsc == 0) {
+    row[0] = time;
+    for (size_t k = 0; k < obs.size(); k++) row[1 + k] = obs[k];
+    row += 1 + obs.size();
+  }
+  if (container_col_fullstate >= 0) {
+    PetscInt localsize_u = dim / mpisize_petsc;
+    const PetscScalar *xptr;
+    VecGetArrayRead(state, &xptr);
+    const double* x = getBlockedState(xptr, localsize_u);
+    for (PetscInt i = 0; i < 2*localsize_u; i++) row[i] = x[i];
+    VecRestoreArrayRead(state, &xptr);
+  }
+  container_nbuffered++;
+
+  /* Write the buffered rows once the buffer is full */
+  if (container_nbuffered == container_flushrows) flushContainer(dim);
+}
+
+PetscInt Output::getContainerLocalRowSize(PetscInt dim){
+  PetscInt nlocal = 0;
+  if (mpirank_petsc == 0) nlocal += (container_col_fullstate >= 0) ? container_col_fullstate : container_ncols;
+  if (container_col_fullstate >= 0) nlocal += 2 * (dim / mpisize_petsc);
+  return nlocal;
+}
+
+bool Output::hasContainerData(){
+  return mpirank_petsc == 0 || writeFullState;
+}
+
+void Output::openContainerFile(){
+  if (containerfile_open) return;
+  MPI_File_open(comm_container, containername.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &containerfile);
+  containerfile_open = true;
+}
+
+long long Output::getContainerNFlush(long long nsnap){
+  return (nsnap + container_flushrows - 1) / container_flushrows;
+}
+
+void Output::flushContainer(PetscInt dim){
+
+  /* File layout of the local parts of the buffered rows, in doubles relative to the first buffered row */
+  std::vector<int> blocklens, displs;
+  PetscInt localsize_u = dim / mpisize_petsc;
+  PetscInt ilow = mpirank_petsc * localsize_u;
+  for (long long r = 0; r < container_nbuffered; r++) {
+    long long rowstart = r * container_ncols;
+    if (mpirank_petsc == 0) {
+      blocklens.push_back((container_col_fullstate >= 0) ? container_col_fullstate : container_ncols);
+      displs.push_back(rowstart);
+    }
+    if (container_col_fullstate >= 0) {
+      blocklens.push_back(localsize_u);
+      displs.push_back(rowstart + container_col_fullstate + ilow);
+      blocklens.push_back(localsize_u);
+      displs.push_back(rowstart + container_col_fullstate + dim + ilow);
+    }
+  }
+  int count = 0;
+  for (size_t k = 0; k < blocklens.size(); k++) count += blocklens[k];
+
+  /* Collective write of all initial conditions on this PETSc rank, at disjoint offsets. Processors without rows write nothing. */
+  MPI_Datatype filetype = MPI_DOUBLE;
+  if (blocklens.size() > 0) {
+    MPI_Type_indexed(blocklens.size(), blocklens.data(), displs.data(), MPI_DOUBLE, &filetype);
+    MPI_Type_commit(&filetype);
+  }
+  MPI_Offset disp = container_block + (MPI_Offset) container_rowfirst * container_ncols * sizeof(double);
+  MPI_File_set_view(containerfile, disp, MPI_DOUBLE, filetype, "native", MPI_INFO_NULL);
+  MPI_File_write_at_all(containerfile, 0, container_buf.data(), count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_set_view(containerfile, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+  if (blocklens.size() > 0) MPI_Type_free(&filetype);
+
+  container_rowfirst += container_nbuffered;
+  container_nbuffered = 0;
+  container_nflushed++;
+}
+
+void Output::skipTrajectory(int ntime){
+
+  /* Container mode: Take part in the collective writes of the other initial conditions on this PETSc rank */
+  if (!trajectory_container || !hasContainerData()) return;
+  openContainerFile();
+  container_nbuffered = 0;
+  long long nflush = getContainerNFlush(ntime / output_frequency + 1);
+  for (long long k = 0; k < nflush; k++) flushContainer(0);
 }
 
 void Output::writeTrajectoryDataFiles(int timestep, double time, const Vec state, MasterEq* mastereq){
@@ -205,46 +667,72 @@ void Output::writeTrajectoryDataFiles(int timestep, double time, const Vec state
   /* Write output only every <num> time-steps */
   if (timestep % output_frequency == 0) {
 
+    /* Evaluate all requested energies and populations in one sweep over the diagonal */
+    int quantities = 0;
+    for (size_t iosc = 0; iosc < expectedfile.size(); iosc++) {
+      if (writeExpectedEnergy[iosc]) quantities |= Observables::ENERGY_OSC;
+      if (writePopulation[iosc]) quantities |= Observables::POPULATION_OSC;
+    }
+    if (writeExpectedEnergy_comp) quantities |= Observables::ENERGY;
+    if (writePopulation_comp) quantities |= Observables::POPULATION;
+    Observables* observables = mastereq->getObservables();
+    if (quantities) observables->compute(state, quantities);
+
+    /* Container mode: Write all observables of this snapshot in column order */
+    if (trajectory_container) {
+      std::vector<double> obs;
+      std::vector<double> pop;
+      for (size_t iosc = 0; iosc < expectedfile.size(); iosc++) {
+        if (writeExpectedEnergy[iosc]) obs.push_back(observables->getEnergy(iosc));
+      }
+      if (writeExpectedEnergy_comp) obs.push_back(observables->getEnergy());
+      for (size_t iosc = 0; iosc < populationfile.size(); iosc++) {
+        if (writePopulation[iosc]) {
+          observables->getPopulation(iosc, pop);
+          obs.insert(obs.end(), pop.begin(), pop.end());
+        }
+      }
+      if (writePopulation_comp) {
+        observables->getPopulation(pop);
+        obs.insert(obs.end(), pop.begin(), pop.end());
+      }
+      if (containerfile_open) writeContainerRow(timestep, time, state, obs, mastereq->getDim());
+      return;
+    }
+
     /* Write expected energy levels to file */
     for (size_t iosc = 0; iosc < expectedfile.size(); iosc++) {
       if (writeExpectedEnergy[iosc]) {
-        double expected = mastereq->getOscillator(iosc)->expectedEnergy(state);
-        if (mpirank_petsc==0) fprintf(expectedfile[iosc], "%.8f %1.14e\n", time, expected);
+        double expected = observables->getEnergy(iosc);
+        if (mpirank_petsc==0) pushTrajectoryRecord(expectedfile[iosc], time, &expected, 1, "%.8f", " %1.14e");
       }
     }
     if (writeExpectedEnergy_comp) {
-      double expected_comp = mastereq->expectedEnergy(state);
-      if (mpirank_petsc==0) fprintf(expectedfile_comp, "%.8f %1.14e\n", time, expected_comp);
+      double expected_comp = observables->getEnergy();
+      if (mpirank_petsc==0) pushTrajectoryRecord(expectedfile_comp, time, &expected_comp, 1, "%.8f", " %1.14e");
     }
 
     /* Write population to file */
     for (size_t iosc = 0; iosc < populationfile.size(); iosc++) {
       if (writePopulation[iosc]) {
-        std::vector<double> pop (mastereq->getOscillator(iosc)->getNLevels(), 0.0);
-        mastereq->getOscillator(iosc)->population(state, pop);
-        if (mpirank_petsc == 0) {
-          fprintf(populationfile[iosc], "%.8f ", time);
-          for (size_t i = 0; i<pop.size(); i++) {
-            fprintf(populationfile[iosc], " %1.14e", pop[i]);
-          }
-          fprintf(populationfile[iosc], "\n");
-        }
+        std::vector<double> pop;
+        observables->getPopulation(iosc, pop);
+        if (mpirank_petsc == 0) pushTrajectoryRecord(populationfile[iosc], time, pop.data(), pop.size(), "%.8f ", " %1.14e");
       }
     }
     if (writePopulation_comp) {
       std::vector<double> population_comp; 
-      mastereq->population(state, population_comp);
-      if (mpirank_petsc == 0) {
-        fprintf(populationfile_comp, "%.8f  ", time);
-        for (size_t i=0; i<population_comp.size(); i++){
-          fprintf(populationfile_comp, "%1.14e  ", population_comp[i]);
-        }
-        fprintf(populationfile_comp, "\n");
-      }
+      observables->getPopulation(population_comp);
+      if (mpirank_petsc == 0) pushTrajectoryRecord(populationfile_comp, time, population_comp.data(), population_comp.size(), "%.8f  ", "%1.14e  ");
     }
 
-    /* Write full state to file. Currently not available if Petsc-parallel */
-    if (writeFullState && mpisize_petsc == 1) {
+    /* Write full state to binary file, collectively on all petsc processors */
+    if (statefile_open) {
+      writeStateBinary(time, state, mastereq->getDim());
+    }
+
+    /* Write full state to text file. Currently not available if Petsc-parallel */
+    if (writeFullState && fullstate_precision == 0 && mpisize_petsc == 1) {
       /* TODO: Make this work in parallel! */
       /* Gather the vector from all petsc processors onto the first one */
       // VecScatterCreateToZero(x, &scat, &xseq);
@@ -253,17 +741,12 @@ void Output::writeTrajectoryDataFiles(int timestep, double time, const Vec state
 
       /* On first petsc rank, write full state vector to file */
       if (mpirank_petsc == 0) {
-        fprintf(ufile,  "%.8f  ", time);
-        fprintf(vfile,  "%.8f  ", time);
-        const PetscScalar *x;
-        VecGetArrayRead(state, &x);
-        for (int i=0; i<mastereq->getDim(); i++) {
-          fprintf(ufile, "%1.10e  ", x[i]);  
-          fprintf(vfile, "%1.10e  ", x[i + mastereq->getDim()]);  
-        }
-        fprintf(ufile, "\n");
-        fprintf(vfile, "\n");
-        VecRestoreArrayRead(state, &x);
+        const PetscScalar *xptr;
+        VecGetArrayRead(state, &xptr);
+        const double* x = getBlockedState(xptr, mastereq->getDim());
+        pushTrajectoryRecord(ufile, time, x, mastereq->getDim(), "%.8f  ", "%1.10e  ");
+        pushTrajectoryRecord(vfile, time, x + mastereq->getDim(), mastereq->getDim(), "%.8f  ", "%1.10e  ");
+        VecRestoreArrayRead(state, &xptr);
       }
       /* Destroy scatter context and vector */
       // VecScatterDestroy(&scat);
@@ -272,8 +755,86 @@ void Output::writeTrajectoryDataFiles(int timestep, double time, const Vec state
   }
 }
 
+void Output::pushTrajectoryRecord(FILE* file, double time, const double* values, size_t nvalues, const char* fmt_time, const char* fmt_value){
+  /* Refill the persistent record in place. Pushing swaps it with a ring slot that has already been 
+   * written, so the row buffers circulate between producer and writer and are not reallocated per row. */
+  OutputRecord& rec = trajectory_rec;
+  rec.file = file;
+  rec.ncols = nvalues + 1;
+  rec.fmt_first = fmt_time;
+  rec.fmt_value = fmt_value;
+  rec.fmt_end = "\n";
+  rec.closefile = false;
+  rec.values.resize(nvalues + 1);
+  rec.values[0] = time;
+  std::copy(values, values + nvalues, rec.values.begin() + 1);
+  writer.push(rec);
+}
+
+void Output::writeStateBinary(double time, const Vec state, PetscInt dim){
+
+  /* Local slices u_local, v_local are written at their global offsets, independent of the state layout */
+  PetscInt localsize_u = dim / mpisize_petsc;
+  PetscInt ilow = mpirank_petsc * localsize_u;
+  MPI_Offset record = statefile_header + statefile_nsnapshots * statefile_record;
+  MPI_Offset offset_u = record + sizeof(double) + (MPI_Offset) ilow * fullstate_precision;
+  MPI_Offset offset_v = record + sizeof(double) + ((MPI_Offset) dim + ilow) * fullstate_precision;
+
+  /* Time stamp */
+  if (mpirank_petsc == 0) {
+    MPI_File_write_at(statefile, record, &time, 1, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  }
+
+  /* State slices */
+  const PetscScalar *xptr;
+  VecGetArrayRead(state, &xptr);
+  const double* x = getBlockedState(xptr, localsize_u);
+  if (fullstate_precision == 4) {
+    std::vector<float> xfloat(2*localsize_u);
+    for (PetscInt i=0; i<2*localsize_u; i++) xfloat[i] = (float) x[i];
+    MPI_File_write_at_all(statefile, offset_u, xfloat.data(), localsize_u, MPI_FLOAT, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(statefile, offset_v, xfloat.data() + localsize_u, localsize_u, MPI_FLOAT, MPI_STATUS_IGNORE);
+  } else {
+    MPI_File_write_at_all(statefile, offset_u, x, localsize_u, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(statefile, offset_v, x + localsize_u, localsize_u, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  }
+  VecRestoreArrayRead(state, &xptr);
+
+  statefile_nsnapshots++;
+}
+
+const double* Output::getBlockedState(const double* x, PetscInt localsize_u){
+
+  if (getStateLayout() == StateLayout::BLOCKED) return x;
+
+  state_blocked.resize(2*localsize_u);
+  for (PetscInt i=0; i<localsize_u; i++) {
+    state_blocked[i] = x[2*i];
+    state_blocked[i + localsize_u] = x[2*i + 1];
+  }
+  return state_blocked.data();
+}
+
 void Output::closeTrajectoryDataFiles(){
 
+  /* Container: Write the remaining rows. All initial conditions on this PETSc rank take part in the same number of collective writes. */
+  if (trajectory_container && containerfile_open) {
+    long long nflush = getContainerNFlush(container_nsnap);
+    while (container_nflushed < nflush) flushContainer(container_dim);
+  }
+
+  /* Wait for the background writer before closing the text files */
+  writer.flush();
+
+  /* Finalize the binary state file: store the number of snapshots in the header */
+  if (statefile_open) {
+    if (mpirank_petsc == 0) {
+      MPI_File_write_at(statefile, statefile_header - sizeof(long long), &statefile_nsnapshots, 1, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&statefile);
+    statefile_open = false;
+  }
+
   /* Close output data files */
   if (ufile != NULL) {
     fclose(ufile);
@@ -11,6 +11,12 @@ TimeStepper::TimeStepper() {
   MPI_Comm_rank(PETSC_COMM_WORLD, &mpirank_petsc);
   MPI_Comm_size(PETSC_COMM_WORLD, &mpisize_petsc);
   writeTrajectoryDataFiles = false;
+  useControlTable = true;
+  ntime_tabulated = -1;
+  xdot = NULL;
+  xadj_dot = NULL;
+  xdot_full = NULL;
+  redhess = NULL;
 }
 
 TimeStepper::TimeStepper(MasterEq* mastereq_, int ntime_, double total_time_, Output* output_, bool storeFWD_) : TimeStepper() {
@@ -39,7 +45,7 @@ TimeStepper::TimeStepper(MasterEq* mastereq_, int ntime_, double total_time_, Ou
     for (int n = 0; n <=ntime; n++) {
       Vec state;
       VecCreate(PETSC_COMM_WORLD, &state);
-      PetscInt globalsize = 2 * mastereq->getDim();  // 2 for real and imaginary part
+      PetscInt globalsize = mastereq->getStateSize();  // 2*dim for real and imaginary part, or N^2 if Hermitian-packed
       PetscInt localsize = globalsize / mpisize_petsc;  // Local vector per processor
       VecSetSizes(state,localsize,globalsize);
       VecSetFromOptions(state);
@@ -50,7 +56,7 @@ TimeStepper::TimeStepper(MasterEq* mastereq_, int ntime_, double total_time_, Ou
   /* Allocate auxiliary state vector */
   VecCreate(PETSC_COMM_WORLD, &x);
 
-  PetscInt globalsize = 2 * mastereq->getDim(); 
+  PetscInt globalsize = mastereq->getStateSize(); 
   PetscInt localsize = globalsize / mpisize_petsc;  // Local vector per processor
   VecSetSizes(x,localsize,globalsize);
   VecSetFromOptions(x);
@@ -58,6 +64,15 @@ TimeStepper::TimeStepper(MasterEq* mastereq_, int ntime_, double total_time_, Ou
   VecDuplicate(x, &xadj);
   VecDuplicate(x, &xprimal);
 
+  /* Allocate the full vectorized state for output and objectives, if the Hermitian-packed state is evolved. The full adjoint is only allocated if the penalty integral needs it. */
+  x_full = NULL;
+  xbar_full = NULL;
+  if (mastereq->hermitianpacked) {
+    VecCreate(PETSC_COMM_WORLD, &x_full);
+    VecSetSizes(x_full, 2*localsize_u, 2*mastereq->getDim());
+    VecSetFromOptions(x_full);
+  }
+
   /* Allocate the reduced gradient */
   int ndesign = 0;
   for (size_t ioscil = 0; ioscil < mastereq->getNOscillators(); ioscil++) {
@@ -78,7 +93,17 @@ TimeStepper::~TimeStepper() {
   VecDestroy(&x);
   VecDestroy(&xadj);
   VecDestroy(&xprimal);
+  if (x_full != NULL) VecDestroy(&x_full);
+  if (xbar_full != NULL) VecDestroy(&xbar_full);
   VecDestroy(&redgrad);
+  for (size_t n = 0; n < hess_states.size(); n++) {
+    VecDestroy(&(hess_states[n]));
+    VecDestroy(&(hess_tangents[n]));
+  }
+  if (xdot != NULL) VecDestroy(&xdot);
+  if (xadj_dot != NULL) VecDestroy(&xadj_dot);
+  if (xdot_full != NULL) VecDestroy(&xdot_full);
+  if (redhess != NULL) VecDestroy(&redhess);
 }
 
 
@@ -93,15 +118,68 @@ Vec TimeStepper::getState(size_t tindex){
   return store_states[tindex];
 }
 
+Vec TimeStepper::getFullState(const Vec x){
+  if (!mastereq->hermitianpacked) return x;
+  unpackHermitianState(x, x_full);
+  return x_full;
+}
+
+void TimeStepper::setNTime(int ntime_){
+  ntime = ntime_;
+  dt = total_time / ntime;
+
+  /* Extend storage of primal states, if needed. Excess storage from a finer grid is kept. */
+  if (storeFWD) { 
+    for (int n = store_states.size(); n <=ntime; n++) {
+      Vec state;
+      VecDuplicate(x, &state);
+      store_states.push_back(state);
+    }
+  }
+}
+
+void TimeStepper::addStageTimes(const double /*tstart*/, const double /*tstop*/, std::vector<double>& /*times*/){}
+
+void TimeStepper::setControlTimes(){
+  std::vector<double> times;
+  if (useControlTable) {
+    for (int n = 0; n < ntime; n++){
+      times.push_back(n * dt);
+      addStageTimes(n * dt, (n+1) * dt, times);
+    }
+    times.push_back(ntime * dt);
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+  }
+  mastereq->setControlTimes(times);
+  ntime_tabulated = ntime;
+}
+
+void TimeStepper::setInitialState(int initid, Vec rho_t0){
+  if (mastereq->hermitianpacked) {
+    PetscBool isHermitian;
+    StateIsHermitian(rho_t0, 1e-12, &isHermitian);
+    if (!isHermitian) {
+      printf("ERROR: The Hermitian-packed state requires Hermitian initial states, but initial condition %d is not Hermitian. Set hermitian_packed = false.\n", initid);
+      exit(1);
+    }
+    packHermitianState(rho_t0, x);
+  }
+  else VecCopy(rho_t0, x);
+}
+
 Vec TimeStepper::solveODE(int initid, Vec rho_t0){
 
+  /* Set up the control table for the current time grid */
+  if (ntime_tabulated != ntime) setControlTimes();
+
   /* Open output files */
   if (writeTrajectoryDataFiles) {
-    output->openTrajectoryDataFiles("rho", initid);
+    output->openTrajectoryDataFiles("rho", initid, mastereq, ntime);
   }
 
   /* Set initial condition  */
-  VecCopy(rho_t0, x);
+  setInitialState(initid, rho_t0);
 
 
   /* Store initial state for dpdm penalty */
@@ -109,7 +187,7 @@ Vec TimeStepper::solveODE(int initid, Vec rho_t0){
     for (int i = 0; i < 2; i++) {
       Vec state;
       VecCreate(PETSC_COMM_WORLD, &state);
-      PetscInt globalsize = 2 * mastereq->getDim(); 
+      PetscInt globalsize = mastereq->getStateSize(); 
       PetscInt localsize = globalsize / mpisize_petsc;  // Local vector per processor
       VecSetSizes(state,localsize,globalsize);
       VecSetFromOptions(state);
@@ -131,14 +209,14 @@ Vec TimeStepper::solveODE(int initid, Vec rho_t0){
     /* store and write current state. */
     if (storeFWD) VecCopy(x, store_states[n]);
     if (writeTrajectoryDataFiles) {
-      output->writeTrajectoryDataFiles(n, tstart, x, mastereq);
+      output->writeTrajectoryDataFiles(n, tstart, getFullState(x), mastereq);
     }
 
     /* Take one time step */
     evolveFWD(tstart, tstop, x);
 
     /* Add to penalty objective term */
-    if (gamma_penalty > 1e-13) penalty_integral += penaltyIntegral(tstop, x);
+    if (gamma_penalty > 1e-13) penalty_integral += penaltyIntegral(tstop, getFullState(x));
 
     /* Add to penalty for second derivative */
     if (gamma_penalty_dpdm > 1e-13) {
@@ -154,7 +232,7 @@ Vec TimeStepper::solveODE(int initid, Vec rho_t0){
     if (gamma_penalty_energy > 1e-13) energy_penalty_integral += energyPenaltyIntegral(tstop);
 
 #ifdef SANITY_CHECK
-    SanityTests(x, tstart);
+    SanityTests(getFullState(x), tstart);
 #endif
   }
   penalty_dpdm = penalty_dpdm/ntime;
@@ -172,12 +250,12 @@ Vec TimeStepper::solveODE(int initid, Vec rho_t0){
 
   /* Write last time step and close files */
   if (writeTrajectoryDataFiles) {
-    output->writeTrajectoryDataFiles(ntime, ntime*dt, x, mastereq);
+    output->writeTrajectoryDataFiles(ntime, ntime*dt, getFullState(x), mastereq);
     output->closeTrajectoryDataFiles();
   }
   
 
-  return x;
+  return getFullState(x);
 }
 
 
@@ -186,18 +264,22 @@ void TimeStepper::solveAdjointODE(Vec rho_t0_bar, Vec finalstate, double Jbar_pe
   /* Reset gradient */
   VecZeroEntries(redgrad);
 
-  /* Set terminal adjoint condition */
-  VecCopy(rho_t0_bar, xadj);
-
-  /* Set terminal primal state */
-  VecCopy(finalstate, xprimal);
+  /* Set terminal adjoint condition and primal state. The packed adjoint is the transpose of the unpacking applied to rho_t0_bar. */
+  if (mastereq->hermitianpacked) {
+    VecZeroEntries(xadj);
+    unpackHermitianState_diff(rho_t0_bar, xadj);
+    packHermitianState(finalstate, xprimal);
+  } else {
+    VecCopy(rho_t0_bar, xadj);
+    VecCopy(finalstate, xprimal);
+  }
 
   /* Store states at N, N-1, N-2 for dpdm penalty */
   if (gamma_penalty_dpdm > 1e-13){
     for (int i = 0; i < 5; i++) {
       Vec state;
       VecCreate(PETSC_COMM_WORLD, &state);
-      PetscInt globalsize = 2 * mastereq->getDim(); 
+      PetscInt globalsize = mastereq->getStateSize(); 
       PetscInt localsize = globalsize / mpisize_petsc;  // Local vector per processor
       VecSetSizes(state,localsize,globalsize);
       VecSetFromOptions(state);
@@ -224,7 +306,14 @@ void TimeStepper::solveAdjointODE(Vec rho_t0_bar, Vec finalstate, double Jbar_pe
     if (gamma_penalty_dpdm > 1e-13) penaltyDpDm_diff(n, xadj, Jbar_penalty_dpdm/ntime);
 
     /* Derivative of penalty objective term */
-    if (gamma_penalty > 1e-13) penaltyIntegral_diff(tstop, xprimal, xadj, Jbar_penalty);
+    if (gamma_penalty > 1e-13) {
+      if (mastereq->hermitianpacked) {
+        if (xbar_full == NULL) VecDuplicate(x_full, &xbar_full);
+        VecZeroEntries(xbar_full);
+        penaltyIntegral_diff(tstop, getFullState(xprimal), xbar_full, Jbar_penalty);
+        unpackHermitianState_diff(xbar_full, xadj);
+      } else penaltyIntegral_diff(tstop, xprimal, xadj, Jbar_penalty);
+    }
 
     /* Get the state at n-1. If Schroedinger solver, recompute it by taking a step backwards with the forward solver, otherwise get it from storage. */
     if (storeFWD) VecCopy(getState(n-1), xprimal);
@@ -255,8 +344,6 @@ void TimeStepper::solveAdjointODE(Vec rho_t0_bar, Vec finalstate, double Jbar_pe
 
 double TimeStepper::penaltyIntegral(double time, const Vec x){
   double penalty = 0.0;
-  PetscInt dim_rho = mastereq->getDimRho(); // N
-  double x_re, x_im;
 
   /* weighted integral of the objective function */
   if (penalty_param > 1e-13) {
@@ -271,26 +358,10 @@ double TimeStepper::penaltyIntegral(double time, const Vec x){
 
   /* Add guard-level occupation to prevent leakage. A guard level is the LAST NON-ESSENTIAL energy level of an oscillator */
   if (addLeakagePrevent) {
-    double leakage = 0.0;
     /* Sum over all diagonal elements that correspond to a non-essential guard level. */
-    for (PetscInt i=0; i<dim_rho; i++) {
-      if ( isGuardLevel(i, mastereq->nlevels, mastereq->nessential) ) {
-        // vectorize if lindblad
-        PetscInt vecID = i;
-        if (mastereq->lindbladtype != LindbladType::NONE) vecID = getVecID(i,i,dim_rho);
-        x_re = 0.0; 
-        x_im = 0.0;
-        if (ilow <= vecID && vecID < iupp) {
-          PetscInt id_global_x = vecID + mpirank_petsc*localsize_u; 
-          VecGetValues(x, 1, &id_global_x, &x_re);
-          id_global_x += localsize_u; 
-          VecGetValues(x, 1, &id_global_x, &x_im); 
-        }
-        leakage += (x_re * x_re + x_im * x_im) / (dt*ntime);
-      }
-    }
-    double mine = leakage;
-    MPI_Allreduce(&mine, &leakage, 1, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+    Observables* observables = mastereq->getObservables();
+    observables->compute(x, Observables::LEAKAGE);
+    double leakage = observables->getLeakage() / (dt*ntime);
     penalty += dt * leakage;
   }
 
@@ -298,7 +369,6 @@ double TimeStepper::penaltyIntegral(double time, const Vec x){
 }
 
 void TimeStepper::penaltyIntegral_diff(double time, const Vec x, Vec xbar, double penaltybar){
-  PetscInt dim_rho = mastereq->getDimRho();  // N
 
   /* Derivative of weighted integral of the objective function */
   if (penalty_param > 1e-13){
@@ -315,27 +385,51 @@ void TimeStepper::penaltyIntegral_diff(double time, const Vec x, Vec xbar, doubl
   }
 
   /* If gate optimization: Derivative of adding guard-level occupation */
-  if (addLeakagePrevent) {
-    double x_re, x_im;
-    for (PetscInt i=0; i<dim_rho; i++) {
-      if ( isGuardLevel(i, mastereq->nlevels, mastereq->nessential) ) {
-        PetscInt  vecID = i;
-        if (mastereq->lindbladtype != LindbladType::NONE) vecID = getVecID(i,i,dim_rho);
-        x_re = 0.0; 
-        x_im = 0.0;
-        if (ilow <= vecID && vecID < iupp) {
-          PetscInt id_global_x = vecID + mpirank_petsc*localsize_u; 
-          VecGetValues(x, 1, &id_global_x, &x_re);
-          VecSetValue(xbar, id_global_x, 2.*x_re*penaltybar/ntime, ADD_VALUES);
-          id_global_x += localsize_u; 
-          VecGetValues(x, 1, &id_global_x, &x_im);
-          VecSetValue(xbar, id_global_x, 2.*x_im*penaltybar/ntime, ADD_VALUES);
-        }
-      }
-    }
-    VecAssemblyBegin(xbar);
-    VecAssemblyEnd(xbar);
+  if (addLeakagePrevent) leakagePenalty_diff(x, xbar, penaltybar);
+}
+
+void TimeStepper::leakagePenalty_diff(const Vec x, Vec xbar, double penaltybar){
+  const std::vector<PetscInt>& guard_local = mastereq->getObservables()->getGuardLocal();
+  PetscInt stride_x, offset_im;
+  getStateStrides(localsize_u, &stride_x, &offset_im);
+  const PetscScalar* xptr;
+  VecGetArrayRead(x, &xptr);
+  for (size_t k=0; k<guard_local.size(); k++) {
+    double x_re = xptr[guard_local[k]*stride_x];
+    double x_im = xptr[guard_local[k]*stride_x + offset_im];
+    VecSetValue(xbar, getIndexReal(guard_local[k] + ilow, localsize_u), 2.*x_re*penaltybar/ntime, ADD_VALUES);
+    VecSetValue(xbar, getIndexImag(guard_local[k] + ilow, localsize_u), 2.*x_im*penaltybar/ntime, ADD_VALUES);
   }
+  VecRestoreArrayRead(x, &xptr);
+  VecAssemblyBegin(xbar);
+  VecAssemblyEnd(xbar);
+}
+
+void TimeStepper::penaltyIntegral_diff_tangent(double time, const Vec x, const Vec xdot, Vec xbar_dot, double penaltybar){
+
+  /* Second derivative of the weighted integral of the objective function */
+  if (penalty_param > 1e-13){
+    double weight = 1./penalty_param * exp(- pow((time - total_time)/penalty_param, 2));
+    double scale = weight*penaltybar*dt;
+
+    double obj_cost_re = 0.0;
+    double obj_cost_im = 0.0;
+    optim_target->evalJ(x, &obj_cost_re, &obj_cost_im);
+    double obj_cost_re_dot = 0.0;
+    double obj_cost_im_dot = 0.0;
+    optim_target->evalJ_tangent(x, xdot, &obj_cost_re_dot, &obj_cost_im_dot);
+
+    double obj_cost_re_bar, obj_cost_im_bar;
+    optim_target->finalizeJ_diff(obj_cost_re, obj_cost_im, &obj_cost_re_bar, &obj_cost_im_bar);
+    double obj_cost_re_bar_dot, obj_cost_im_bar_dot;
+    optim_target->finalizeJ_diff_tangent(obj_cost_re, obj_cost_im, obj_cost_re_dot, obj_cost_im_dot, &obj_cost_re_bar_dot, &obj_cost_im_bar_dot);
+
+    optim_target->evalJ_diff_tangent(x, xdot, xbar_dot, scale*obj_cost_re_bar, scale*obj_cost_im_bar);
+    optim_target->evalJ_diff(x, xbar_dot, scale*obj_cost_re_bar_dot, scale*obj_cost_im_bar_dot);
+  }
+
+  /* The derivative of the guard-level occupation is linear in the state */
+  if (addLeakagePrevent) leakagePenalty_diff(xdot, xbar_dot, penaltybar);
 }
 
 
@@ -350,10 +444,13 @@ double TimeStepper::penaltyDpDm(Vec x, Vec xm1, Vec xm2){
     /* precompute 1/dt^4 */
     double dtinv = 1.0 / (dt*dt*dt*dt);
 
+    PetscInt stride_x, offset_im;
+    getStateStrides(localsize_u, &stride_x, &offset_im);
+
     double dpdm = 0.0;
     for (PetscInt i=0; i<localsize_u; i++) {
-        PetscInt vecID_re = i;
-        PetscInt vecID_im = i + localsize_u;
+        PetscInt vecID_re = i*stride_x;
+        PetscInt vecID_im = vecID_re + offset_im;
 
         double tmp1 = xptr[vecID_re]*xptr[vecID_re] - 2.0*xm1ptr[vecID_re]*xm1ptr[vecID_re] + xm2ptr[vecID_re]*xm2ptr[vecID_re];
         double tmp2 = xptr[vecID_im]*xptr[vecID_im] - 2.0*xm1ptr[vecID_im]*xm1ptr[vecID_im] + xm2ptr[vecID_im]*xm2ptr[vecID_im];
@@ -391,9 +488,12 @@ void TimeStepper::penaltyDpDm_diff(int n, Vec xbar, double Jbar){
     /* precompute 1/dt^4 */
     double dtinv = 1.0 / (dt*dt*dt*dt);
 
+    PetscInt stride_x, offset_im;
+    getStateStrides(localsize_u, &stride_x, &offset_im);
+
     for (PetscInt i=0; i<localsize_u; i++) {
-        PetscInt vecID_re = i;
-        PetscInt vecID_im = i + localsize_u;
+        PetscInt vecID_re = i*stride_x;
+        PetscInt vecID_im = vecID_re + offset_im;
 
         // first term
         if (n > 1) {
@@ -479,8 +579,133 @@ void TimeStepper::energyPenaltyIntegral_diff(double time, double penaltybar, Vec
   VecRestoreArray(redgrad, &grad_ptr);
 }
 
+void TimeStepper::energyPenaltyIntegral_hessvec(double time, double penaltybar, Vec redhess){
+
+  PetscInt col_shift = 0;
+  double* hess_ptr;
+  VecGetArray(redhess, &hess_ptr);
+
+  for (size_t iosc = 0; iosc < mastereq->getNOscillators(); iosc++){
+
+    /* The controls are linear in the parameters, hence only their directional derivative enters pbar, qbar */
+    double pdot, qdot;
+    mastereq->getOscillator(iosc)->evalControlDirection(time, &pdot, &qdot); 
+    double pbar_dot = penaltybar/ntime * 2.0 * pdot;
+    double qbar_dot = penaltybar/ntime * 2.0 * qdot;
+
+    mastereq->getOscillator(iosc)->evalControl_diff(time, hess_ptr + col_shift, pbar_dot, qbar_dot);
+
+    col_shift += mastereq->getOscillator(iosc)->getNParams();
+  } 
+  VecRestoreArray(redhess, &hess_ptr);
+}
+
+void TimeStepper::initHessianStorage(){
+
+  if (redhess == NULL) {
+    VecDuplicate(redgrad, &redhess);
+    VecDuplicate(x, &xdot);
+    VecDuplicate(x, &xadj_dot);
+    if (mastereq->hermitianpacked) VecDuplicate(x_full, &xdot_full);
+  }
+
+  /* Primal and tangent trajectories. Excess storage from a finer grid is kept. */
+  for (int n = hess_states.size(); n <= ntime; n++) {
+    Vec state;
+    VecDuplicate(x, &state);
+    hess_states.push_back(state);
+    VecDuplicate(x, &state);
+    hess_tangents.push_back(state);
+  }
+}
+
+Vec TimeStepper::solveTangentODE(int initid, Vec rho_t0){
+
+  /* Set up the control table for the current time grid */
+  if (ntime_tabulated != ntime) setControlTimes();
+  initHessianStorage();
+
+  /* Set initial condition. It doesn't depend on the controls, the tangent starts from zero. */
+  setInitialState(initid, rho_t0);
+  VecZeroEntries(xdot);
+
+  /* Loop over time interval, storing primal and tangent states */
+  for (int n = 0; n < ntime; n++){
+    VecCopy(x, hess_states[n]);
+    VecCopy(xdot, hess_tangents[n]);
+    evolveFWD_tangent(n * dt, (n+1) * dt, x, xdot);
+  }
+  VecCopy(x, hess_states[ntime]);
+  VecCopy(xdot, hess_tangents[ntime]);
+
+  return getFullState(x);
+}
+
+Vec TimeStepper::getFinalTangent(){
+  if (!mastereq->hermitianpacked) return xdot;
+  unpackHermitianState(xdot, xdot_full);
+  return xdot_full;
+}
+
+void TimeStepper::solveSecondOrderAdjointODE(Vec rho_t0_bar, Vec rho_t0_bar_dot, double Jbar_penalty, double Jbar_energy_penalty) {
+
+  /* Reset Hessian-vector product */
+  VecZeroEntries(redhess);
+
+  /* Set terminal conditions of the adjoint and second-order adjoint states */
+  if (mastereq->hermitianpacked) {
+    VecZeroEntries(xadj);
+    VecZeroEntries(xadj_dot);
+    unpackHermitianState_diff(rho_t0_bar, xadj);
+    unpackHermitianState_diff(rho_t0_bar_dot, xadj_dot);
+  } else {
+    VecCopy(rho_t0_bar, xadj);
+    VecCopy(rho_t0_bar_dot, xadj_dot);
+  }
+
+  /* Loop over time interval */
+  for (int n = ntime; n > 0; n--){
+    double tstop  = n * dt;
+    double tstart = (n-1) * dt;
+
+    /* Second derivative of energy penalty objective term */
+    if (gamma_penalty_energy > 1e-13) energyPenaltyIntegral_hessvec(tstop, Jbar_energy_penalty, redhess);
+
+    /* First and second derivative of penalty objective term */
+    if (gamma_penalty > 1e-13) {
+      if (mastereq->hermitianpacked) {
+        Vec xfull = getFullState(hess_states[n]);
+        unpackHermitianState(hess_tangents[n], xdot_full);
+        if (xbar_full == NULL) VecDuplicate(x_full, &xbar_full);
+        VecZeroEntries(xbar_full);
+        penaltyIntegral_diff(tstop, xfull, xbar_full, Jbar_penalty);
+        unpackHermitianState_diff(xbar_full, xadj);
+        VecZeroEntries(xbar_full);
+        penaltyIntegral_diff_tangent(tstop, xfull, xdot_full, xbar_full, Jbar_penalty);
+        unpackHermitianState_diff(xbar_full, xadj_dot);
+      } else {
+        penaltyIntegral_diff(tstop, hess_states[n], xadj, Jbar_penalty);
+        penaltyIntegral_diff_tangent(tstop, hess_states[n], hess_tangents[n], xadj_dot, Jbar_penalty);
+      }
+    }
+
+    /* Take one time step backwards for both adjoints */
+    evolveBWD_secondorder(tstop, tstart, hess_states[n-1], hess_tangents[n-1], xadj, xadj_dot, redhess);
+  }
+}
+
 void TimeStepper::evolveBWD(const double /*tstart*/, const double /*tstop*/, const Vec /*x_stop*/, Vec /*x_adj*/, Vec /*grad*/, bool /*compute_gradient*/){}
 
+void TimeStepper::evolveFWD_tangent(const double /*tstart*/, const double /*tstop*/, Vec /*x*/, Vec /*xdot*/){
+  printf("ERROR: Hessian-vector products are not implemented for this time-stepper. Use IMR, IMR4 or IMR8.\n");
+  exit(1);
+}
+
+void TimeStepper::evolveBWD_secondorder(const double /*tstart*/, const double /*tstop*/, const Vec /*x_stop*/, const Vec /*xdot_stop*/, Vec /*x_adj*/, Vec /*x_adj_dot*/, Vec /*hessvec*/){
+  printf("ERROR: Hessian-vector products are not implemented for this time-stepper. Use IMR, IMR4 or IMR8.\n");
+  exit(1);
+}
+
 ExplEuler::ExplEuler(MasterEq* mastereq_, int ntime_, double total_time_, Output* output_, bool storeFWD_) : TimeStepper(mastereq_, ntime_, total_time_, output_, storeFWD_) {
   MatCreateVecs(mastereq->getRHS(), &stage, NULL);
   VecZeroEntries(stage);
@@ -537,8 +762,24 @@ ImplMidpoint::ImplMidpoint(MasterEq* mastereq_, int ntime_, double total_time_,
   linsolve_iterstaken_avg = 0;
   linsolve_counter = 0;
   linsolve_error_avg = 0.0;
+  Mdense = NULL;
+  denselu_dt = 0.0;
+  stage_dot = NULL;
+  stage_adj_dot = NULL;
 
-  if (linsolve_type == LinearSolverType::GMRES) {
+  /* Small systems with a dense RHS are solved directly */
+  if (mastereq->usedense) linsolve_type = LinearSolverType::DENSELU;
+
+  if (linsolve_type == LinearSolverType::DENSELU) {
+    /* Dense LU factorization of I - dt/2 A, refactored whenever A or dt changes, see setupDenseLU */
+    KSPCreate(PETSC_COMM_WORLD, &ksp);
+    KSPSetType(ksp, KSPPREONLY);
+    KSPGetPC(ksp, &preconditioner);
+    PCSetType(preconditioner, PCLU);
+    MatDuplicate(mastereq->getRHS(), MAT_DO_NOT_COPY_VALUES, &Mdense);
+    KSPSetOperators(ksp, Mdense, Mdense);
+  }
+  else if (linsolve_type == LinearSolverType::GMRES) {
     /* Create Petsc's linear solver */
     KSPCreate(PETSC_COMM_WORLD, &ksp);
     KSPGetPC(ksp, &preconditioner);
@@ -566,12 +807,15 @@ ImplMidpoint::~ImplMidpoint(){
   // if (myrank == 0) printf("Linear solver type %d: Average iterations = %d, average error = %1.2e\n", linsolve_type, linsolve_iterstaken_avg, linsolve_error_avg);
 
   /* Free up Petsc's linear solver */
-  if (linsolve_type == LinearSolverType::GMRES) {
+  if (linsolve_type == LinearSolverType::GMRES || linsolve_type == LinearSolverType::DENSELU) {
     KSPDestroy(&ksp);
   } else {
     VecDestroy(&tmp);
     VecDestroy(&err);
   }
+  if (Mdense != NULL) MatDestroy(&Mdense);
+  if (stage_dot != NULL) VecDestroy(&stage_dot);
+  if (stage_adj_dot != NULL) VecDestroy(&stage_adj_dot);
 
   /* Free up intermediate vectors */
   VecDestroy(&stage_adj);
@@ -581,6 +825,10 @@ ImplMidpoint::~ImplMidpoint(){
 
 }
 
+void ImplMidpoint::addStageTimes(const double tstart, const double tstop, std::vector<double>& times){
+  times.push_back((tstart + tstop) / 2.0);
+}
+
 void ImplMidpoint::evolveFWD(const double tstart,const  double tstop, Vec x) {
 
   /* Compute time step size */
@@ -621,6 +869,12 @@ void ImplMidpoint::evolveFWD(const double tstart,const  double tstop, Vec x) {
     case LinearSolverType::NEUMANN:
       linsolve_iterstaken_avg += NeumannSolve(A, rhs, stage, dt/2.0, false);
       break;
+
+    case LinearSolverType::DENSELU:
+      /* Set up I-dt/2 A in a separate matrix, then factor and solve */
+      setupDenseLU(A, dt);
+      KSPSolve(ksp, rhs, stage);
+      break;
   }
   linsolve_counter++;
 
@@ -662,6 +916,11 @@ void ImplMidpoint::evolveBWD(const double tstop, const double tstart, const Vec
     case LinearSolverType::NEUMANN: 
       NeumannSolve(A, x_adj, stage_adj, dt/2.0, true);
       break;
+
+    case LinearSolverType::DENSELU:
+      setupDenseLU(A, dt);
+      KSPSolveTranspose(ksp, x_adj, stage_adj);
+      break;
   }
 
   // k_bar = h*k_bar 
@@ -671,6 +930,7 @@ void ImplMidpoint::evolveBWD(const double tstop, const double tstart, const Vec
   if (compute_gradient) {
     switch (linsolve_type) {
       case LinearSolverType::GMRES: 
+      case LinearSolverType::DENSELU:
         KSPSolve(ksp, rhs, stage);
         break;
       case LinearSolverType::NEUMANN:
@@ -694,6 +954,120 @@ void ImplMidpoint::evolveBWD(const double tstop, const double tstart, const Vec
 }
 
 
+void ImplMidpoint::solveStage(Mat A, double dt, Vec b, Vec y, bool transpose){
+
+  switch (linsolve_type) {
+    case LinearSolverType::GMRES:
+      /* Set up I-dt/2 A, solve, then revert the scaling and shifting */
+      MatScale(A, - dt/2.0);
+      MatShift(A, 1.0);
+      if (!transpose) KSPSolve(ksp, b, y);
+      else            KSPSolveTranspose(ksp, b, y);
+      double rnorm;
+      KSPGetResidualNorm(ksp, &rnorm);
+      if (rnorm > 1e-3)  {
+        printf("WARNING: Linear solver residual norm: %1.5e\n", rnorm);
+      }
+      MatAssemblyBegin(A, MAT_FINAL_ASSEMBLY);
+      MatAssemblyEnd(A, MAT_FINAL_ASSEMBLY);
+      break;
+
+    case LinearSolverType::NEUMANN:
+      NeumannSolve(A, b, y, dt/2.0, transpose);
+      break;
+
+    case LinearSolverType::DENSELU:
+      setupDenseLU(A, dt);
+      if (!transpose) KSPSolve(ksp, b, y);
+      else            KSPSolveTranspose(ksp, b, y);
+      break;
+  }
+}
+
+void ImplMidpoint::setupDenseLU(Mat A, double dt){
+
+  /* Keep the factorization if I - dt/2 A is unchanged. Leaving Mdense untouched keeps the LU factors of the preconditioner. */
+  if (dt == denselu_dt && mastereq->getDenseCoeffs() == denselu_coeffs) return;
+
+  MatCopy(A, Mdense, SAME_NONZERO_PATTERN);
+  MatScale(Mdense, - dt/2.0);
+  MatShift(Mdense, 1.0);
+  denselu_dt = dt;
+  denselu_coeffs = mastereq->getDenseCoeffs();
+}
+
+void ImplMidpoint::evolveFWD_tangent(const double tstart, const double tstop, Vec x, Vec xdot) {
+
+  double dt = tstop - tstart;
+  double thalf = (tstart + tstop) / 2.0;
+  if (stage_dot == NULL) {
+    VecDuplicate(stage, &stage_dot);
+    VecDuplicate(stage, &stage_adj_dot);
+  }
+
+  /* Compute A(t_n+h/2) */
+  mastereq->assemble_RHS(thalf);
+  Mat A = mastereq->getRHS(); 
+
+  /* Primal stage: (I-dt/2 A) k = Ax */
+  MatMult(A, x, rhs);
+  solveStage(A, dt, rhs, stage, false);
+
+  /* Tangent stage: (I-dt/2 A) k' = A xdot + B x_mid, with x_mid = x + dt/2 k */
+  VecWAXPY(stage_adj, dt/2.0, stage, x);
+  mastereq->applyControlDerivative(thalf, stage_adj, rhs, false);
+  MatMultAdd(A, xdot, rhs, rhs);
+  solveStage(A, dt, rhs, stage_dot, false);
+  linsolve_counter += 2;
+
+  /* Update x += dt * k, xdot += dt * k' */
+  VecAXPY(x, dt, stage);
+  VecAXPY(xdot, dt, stage_dot);
+}
+
+void ImplMidpoint::evolveBWD_secondorder(const double tstop, const double tstart, const Vec x, const Vec xdot, Vec x_adj, Vec x_adj_dot, Vec hessvec){
+
+  double dt = tstop - tstart;
+  double thalf = (tstart + tstop) / 2.0;
+  if (stage_dot == NULL) {
+    VecDuplicate(stage, &stage_dot);
+    VecDuplicate(stage, &stage_adj_dot);
+  }
+
+  /* Assemble RHS(t_1/2) */
+  mastereq->assemble_RHS(thalf);
+  Mat A = mastereq->getRHS();
+
+  /* Recompute the primal midpoint state x_mid = x + dt/2 k, stored in stage */
+  MatMult(A, x, rhs);
+  solveStage(A, dt, rhs, stage, false);
+  VecAYPX(stage, dt / 2.0, x);
+
+  /* Recompute the tangent midpoint state xdot_mid = xdot + dt/2 k', stored in stage_dot */
+  mastereq->applyControlDerivative(thalf, stage, rhs, false);
+  MatMultAdd(A, xdot, rhs, rhs);
+  solveStage(A, dt, rhs, stage_dot, false);
+  VecAYPX(stage_dot, dt / 2.0, xdot);
+
+  /* Adjoint stage s = dt (I-dt/2 A)^{-T} x_adj */
+  solveStage(A, dt, x_adj, stage_adj, true);
+  VecScale(stage_adj, dt);
+
+  /* Second-order adjoint stage: (I-dt/2 A)^T s' = dt x_adj_dot + dt/2 B^T s */
+  mastereq->applyControlDerivative(thalf, stage_adj, rhs_adj, true);
+  VecAXPBYPCZ(rhs, dt, dt/2.0, 0.0, x_adj_dot, rhs_adj);
+  solveStage(A, dt, rhs, stage_adj_dot, true);
+
+  /* Hessian-vector product: derivative of the gradient contribution x_mid^T (dA/dparams)^T s along the direction */
+  mastereq->compute_dRHS_dParams(thalf, stage_dot, stage_adj, 1.0, hessvec);
+  mastereq->compute_dRHS_dParams(thalf, stage, stage_adj_dot, 1.0, hessvec);
+
+  /* Update x_adj_dot += A^T s' + B^T s and x_adj += A^T s */
+  VecAXPY(x_adj_dot, 1.0, rhs_adj);
+  MatMultTransposeAdd(A, stage_adj_dot, x_adj_dot, x_adj_dot);
+  MatMultTransposeAdd(A, stage_adj, x_adj, x_adj);
+}
+
 int ImplMidpoint::NeumannSolve(Mat A, Vec b, Vec y, double alpha, bool transpose){
 
   double errnorm, errnorm0;
@@ -759,7 +1133,7 @@ CompositionalImplMidpoint::CompositionalImplMidpoint(int order_, MasterEq* maste
   if (mpirank_world == 0) printf("Timestepper: Compositional Impl. Midpoint, order %d, %lu stages\n", order, gamma.size());
 
   // Allocate storage of stages for backward process 
-  PetscInt globalsize = 2 * mastereq->getDim(); 
+  PetscInt globalsize = mastereq->getStateSize(); 
   PetscInt localsize = globalsize / mpisize_petsc;  // Local vector per processor
   for (size_t i = 0; i <gamma.size(); i++) {
     Vec state;
@@ -778,9 +1152,23 @@ CompositionalImplMidpoint::~CompositionalImplMidpoint(){
     VecDestroy(&(x_stage[i]));
   }
   VecDestroy(&aux);
+  for (size_t i = 0; i <xdot_stage.size(); i++) {
+    VecDestroy(&(xdot_stage[i]));
+  }
+  if (xdot_stage.size() > 0) VecDestroy(&auxdot);
 }
 
 
+void CompositionalImplMidpoint::addStageTimes(const double tstart, const double tstop, std::vector<double>& times){
+  double dt = tstop - tstart;
+  double tcurr = tstart;
+  for (size_t istage = 0; istage < gamma.size(); istage++) {
+    double dt_stage = gamma[istage] * dt;
+    ImplMidpoint::addStageTimes(tcurr, tcurr + dt_stage, times);
+    tcurr = tcurr + dt_stage;
+  }
+}
+
 void CompositionalImplMidpoint::evolveFWD(const double tstart,const  double tstop, Vec x) {
 
   double dt = tstop - tstart;
@@ -824,3 +1212,51 @@ void CompositionalImplMidpoint::evolveBWD(const double tstop, const double tstar
   }
   assert(fabs(tcurr - tstart) < 1e-12);
 }
+
+void CompositionalImplMidpoint::evolveFWD_tangent(const double tstart, const double tstop, Vec x, Vec xdot) {
+
+  double dt = tstop - tstart;
+  double tcurr = tstart;
+  for (size_t istage = 0; istage < gamma.size(); istage++) {
+    double dt_stage = gamma[istage] * dt;
+    ImplMidpoint::evolveFWD_tangent(tcurr, tcurr + dt_stage, x, xdot);
+    tcurr = tcurr + dt_stage;
+  }
+  assert(fabs(tcurr - tstop) < 1e-12);
+}
+
+void CompositionalImplMidpoint::evolveBWD_secondorder(const double tstop, const double tstart, const Vec x, const Vec xdot, Vec x_adj, Vec x_adj_dot, Vec hessvec){
+
+  double dt = tstop - tstart;
+
+  /* Allocate storage of the tangent stages */
+  if (xdot_stage.size() == 0) {
+    for (size_t i = 0; i <gamma.size(); i++) {
+      Vec state;
+      VecDuplicate(aux, &state);
+      xdot_stage.push_back(state);
+    }
+    VecDuplicate(aux, &auxdot);
+  }
+
+  // Run forward again to store the primal and tangent stages
+  double tcurr = tstart;
+  VecCopy(x, aux);
+  VecCopy(xdot, auxdot);
+  for (size_t istage = 0; istage < gamma.size(); istage++) {
+    VecCopy(aux, x_stage[istage]);
+    VecCopy(auxdot, xdot_stage[istage]);
+    double dt_stage = gamma[istage] * dt;
+    ImplMidpoint::evolveFWD_tangent(tcurr, tcurr + dt_stage, aux, auxdot);
+    tcurr = tcurr + dt_stage;
+  }
+  assert(fabs(tcurr - tstop) < 1e-12);
+
+  // Run backwards while updating both adjoints and the Hessian-vector product
+  for (int istage = gamma.size()-1; istage >=0; istage--){
+    double dt_stage = gamma[istage] * dt;
+    ImplMidpoint::evolveBWD_secondorder(tcurr, tcurr-dt_stage, x_stage[istage], xdot_stage[istage], x_adj, x_adj_dot, hessvec);
+    tcurr = tcurr - gamma[istage]*dt;
+  }
+  assert(fabs(tcurr - tstart) < 1e-12);
+}
@@ -1,4 +1,5 @@
 #include "util.hpp"
+#include <algorithm>
 
 // Suppress compiler warnings about unused parameters in code with #ifdef
 #define UNUSED(expr) (void)(expr)
@@ -73,6 +74,140 @@ PetscInt getVecID(const PetscInt row, const PetscInt col, const PetscInt dim){
   return row + col * dim;  
 } 
 
+/* Storage layout of the state vector, set once at startup */
+static StateLayout state_layout = StateLayout::BLOCKED;
+
+void setStateLayout(const StateLayout layout){
+  state_layout = layout;
+}
+
+StateLayout getStateLayout(){
+  return state_layout;
+}
+
+void getStateStrides(const PetscInt localsize_u, PetscInt* stride, PetscInt* offset_im){
+  if (state_layout == StateLayout::INTERLEAVED) {
+    *stride = 2;
+    *offset_im = 1;
+  } else {
+    *stride = 1;
+    *offset_im = localsize_u;
+  }
+}
+
+PetscInt getIndexReal(const PetscInt i, const PetscInt localsize_u){
+  if (state_layout == StateLayout::INTERLEAVED) return 2*i;
+  PetscInt owner = i / localsize_u;
+  return i + owner*localsize_u;
+}
+
+PetscInt getIndexImag(const PetscInt i, const PetscInt localsize_u){
+  if (state_layout == StateLayout::INTERLEAVED) return 2*i + 1;
+  PetscInt owner = i / localsize_u;
+  return i + owner*localsize_u + localsize_u;
+}
+
+PetscInt getPackedIndexReal(const PetscInt row, const PetscInt col){
+  return col*col + row;
+}
+
+PetscInt getPackedIndexImag(const PetscInt row, const PetscInt col){
+  return col*col + col + 1 + row;
+}
+
+void packHermitianState(const Vec x, Vec xp){
+  PetscInt dim;
+  VecGetSize(xp, &dim);
+  PetscInt N = round(sqrt(dim));
+
+  const PetscScalar* xptr;
+  PetscScalar* xpptr;
+  VecGetArrayRead(x, &xptr);
+  VecGetArray(xp, &xpptr);
+  for (PetscInt col = 0; col < N; col++) {
+    for (PetscInt row = 0; row <= col; row++) {
+      PetscInt vecID = getVecID(row, col, N);
+      xpptr[getPackedIndexReal(row, col)] = xptr[getIndexReal(vecID, dim)];
+      if (row < col) xpptr[getPackedIndexImag(row, col)] = xptr[getIndexImag(vecID, dim)];
+    }
+  }
+  VecRestoreArrayRead(x, &xptr);
+  VecRestoreArray(xp, &xpptr);
+}
+
+void unpackHermitianState(const Vec xp, Vec x){
+  PetscInt dim;
+  VecGetSize(xp, &dim);
+  PetscInt N = round(sqrt(dim));
+
+  const PetscScalar* xpptr;
+  PetscScalar* xptr;
+  VecGetArrayRead(xp, &xpptr);
+  VecGetArray(x, &xptr);
+  for (PetscInt col = 0; col < N; col++) {
+    for (PetscInt row = 0; row < col; row++) {
+      // rho_{col,row} = conj(rho_{row,col})
+      double re = xpptr[getPackedIndexReal(row, col)];
+      double im = xpptr[getPackedIndexImag(row, col)];
+      PetscInt upper = getVecID(row, col, N);
+      PetscInt lower = getVecID(col, row, N);
+      xptr[getIndexReal(upper, dim)] = re;
+      xptr[getIndexImag(upper, dim)] = im;
+      xptr[getIndexReal(lower, dim)] = re;
+      xptr[getIndexImag(lower, dim)] = -im;
+    }
+    PetscInt diag = getVecID(col, col, N);
+    xptr[getIndexReal(diag, dim)] = xpptr[getPackedIndexReal(col, col)];
+    xptr[getIndexImag(diag, dim)] = 0.0;
+  }
+  VecRestoreArrayRead(xp, &xpptr);
+  VecRestoreArray(x, &xptr);
+}
+
+void packHermitianState_diff(const Vec xp_bar, Vec x_bar){
+  PetscInt dim;
+  VecGetSize(xp_bar, &dim);
+  PetscInt N = round(sqrt(dim));
+
+  VecZeroEntries(x_bar);
+  const PetscScalar* xpptr;
+  PetscScalar* xptr;
+  VecGetArrayRead(xp_bar, &xpptr);
+  VecGetArray(x_bar, &xptr);
+  for (PetscInt col = 0; col < N; col++) {
+    for (PetscInt row = 0; row <= col; row++) {
+      PetscInt vecID = getVecID(row, col, N);
+      xptr[getIndexReal(vecID, dim)] = xpptr[getPackedIndexReal(row, col)];
+      if (row < col) xptr[getIndexImag(vecID, dim)] = xpptr[getPackedIndexImag(row, col)];
+    }
+  }
+  VecRestoreArrayRead(xp_bar, &xpptr);
+  VecRestoreArray(x_bar, &xptr);
+}
+
+void unpackHermitianState_diff(const Vec x_bar, Vec xp_bar){
+  PetscInt dim;
+  VecGetSize(xp_bar, &dim);
+  PetscInt N = round(sqrt(dim));
+
+  const PetscScalar* xptr;
+  PetscScalar* xpptr;
+  VecGetArrayRead(x_bar, &xptr);
+  VecGetArray(xp_bar, &xpptr);
+  for (PetscInt col = 0; col < N; col++) {
+    for (PetscInt row = 0; row < col; row++) {
+      PetscInt upper = getVecID(row, col, N);
+      PetscInt lower = getVecID(col, row, N);
+      xpptr[getPackedIndexReal(row, col)] += xptr[getIndexReal(upper, dim)] + xptr[getIndexReal(lower, dim)];
+      xpptr[getPackedIndexImag(row, col)] += xptr[getIndexImag(upper, dim)] - xptr[getIndexImag(lower, dim)];
+    }
+    PetscInt diag = getVecID(col, col, N);
+    xpptr[getPackedIndexReal(col, col)] += xptr[getIndexReal(diag, dim)];
+  }
+  VecRestoreArrayRead(x_bar, &xptr);
+  VecRestoreArray(xp_bar, &xpptr);
+}
+
 
 PetscInt mapEssToFull(const PetscInt i, const std::vector<int> &nlevels, const std::vector<int> &nessential){
 
@@ -208,33 +343,27 @@ PetscErrorCode Ikron(const Mat A,const  int dimI, const double alpha, Mat *Out,
     PetscInt* shiftcols;
     PetscScalar* vals;
     PetscInt dimA;
-    // PetscInt dimOut;
-    // PetscInt nonzeroOut;
-    PetscInt rowID;
+    PetscInt rstart, rend;
 
     MatGetSize(A, &dimA, NULL);
+    MatGetOwnershipRange(*Out, &rstart, &rend);
 
     ierr = PetscMalloc1(dimA, &shiftcols); CHKERRQ(ierr);
     ierr = PetscMalloc1(dimA, &vals); CHKERRQ(ierr);
 
-    /* Loop over dimension of I */
-    for (PetscInt i = 0; i < dimI; i++){
-
-        /* Set the diagonal block (i*dimA)::(i+1)*dimA */
-        for (PetscInt j=0; j<dimA; j++){
-            MatGetRow(A, j, &ncols, &cols, &Avals);
-            rowID = i*dimA + j;
-            for (int k=0; k<ncols; k++){
-                shiftcols[k] = cols[k] + i*dimA;
-                vals[k] = Avals[k] * alpha;
-            }
-            MatSetValues(*Out, 1, &rowID, ncols, shiftcols, vals, insert_mode);
-            MatRestoreRow(A, j, &ncols, &cols, &Avals);
+    /* Loop over the locally owned rows of Out. Row i*dimA + j is row j of A, shifted into the i-th diagonal block. */
+    for (PetscInt rowID = rstart; rowID < rend; rowID++){
+        PetscInt i = rowID / dimA;
+        PetscInt j = rowID % dimA;
+        if (i >= dimI) break;
+        MatGetRow(A, j, &ncols, &cols, &Avals);
+        for (int k=0; k<ncols; k++){
+            shiftcols[k] = cols[k] + i*dimA;
+            vals[k] = Avals[k] * alpha;
         }
-
+        MatSetValues(*Out, 1, &rowID, ncols, shiftcols, vals, insert_mode);
+        MatRestoreRow(A, j, &ncols, &cols, &Avals);
     }
-    // MatAssemblyBegin(*Out, MAT_FINAL_ASSEMBLY);
-    // MatAssemblyEnd(*Out, MAT_FINAL_ASSEMBLY);
 
     PetscFree(shiftcols);
     PetscFree(vals);
@@ -247,43 +376,33 @@ PetscErrorCode kronI(const Mat A, const int dimI, const double alpha, Mat *Out,
     PetscInt dimA;
     const PetscInt* cols; 
     const PetscScalar* Avals;
-    PetscInt rowid;
-    PetscInt colid;
-    PetscScalar insertval;
-    // PetscInt dimOut;
-    // PetscInt nonzeroOut;
+    PetscInt* colids;
+    PetscScalar* insertvals;
     PetscInt ncols;
-    // MatInfo Ainfo;
+    PetscInt rstart, rend;
+
     MatGetSize(A, &dimA, NULL);
+    MatGetOwnershipRange(*Out, &rstart, &rend);
 
-    ierr = PetscMalloc1(dimA, &cols); CHKERRQ(ierr);
-    ierr = PetscMalloc1(dimA, &Avals);
+    ierr = PetscMalloc1(dimA, &colids); CHKERRQ(ierr);
+    ierr = PetscMalloc1(dimA, &insertvals); CHKERRQ(ierr);
 
-    /* Loop over rows in A */
-    for (PetscInt i = 0; i < dimA; i++){
+    /* Loop over the locally owned rows of Out. Row i*dimI + k has the entries of row i of A at columns col*dimI + k. */
+    for (PetscInt rowid = rstart; rowid < rend; rowid++){
+        PetscInt i = rowid / dimI;
+        PetscInt k = rowid % dimI;
+        if (i >= dimA) break;
         MatGetRow(A, i, &ncols, &cols, &Avals);
-
-        /* Loop over non negative columns in row i */
         for (PetscInt j = 0; j < ncols; j++){
-            //printf("A: row = %d, col = %d, val = %f\n", i, cols[j], Avals[j]);
-            
-            // dimI rows. global row indices: i, i+dimI
-            for (PetscInt k=0; k<dimI; k++) {
-               rowid = i*dimI + k;
-               colid = cols[j]*dimI + k;
-               insertval = Avals[j] * alpha;
-               MatSetValues(*Out, 1, &rowid, 1, &colid, &insertval, insert_mode);
-              //  printf("Setting %d,%d %f\n", rowid, colid, insertval);
-            }
+            colids[j] = cols[j]*dimI + k;
+            insertvals[j] = Avals[j] * alpha;
         }
+        MatSetValues(*Out, 1, &rowid, ncols, colids, insertvals, insert_mode);
         MatRestoreRow(A, i, &ncols, &cols, &Avals);
     }
 
-    // MatAssemblyBegin(*Out, MAT_FINAL_ASSEMBLY);
-    // MatAssemblyEnd(*Out, MAT_FINAL_ASSEMBLY);
-
-    PetscFree(cols);
-    PetscFree(Avals);
+    PetscFree(colids);
+    PetscFree(insertvals);
 
     return 0;
 }
@@ -294,34 +413,32 @@ PetscErrorCode AkronB(const Mat A, const Mat B, const double alpha, Mat *Out, In
     PetscInt Adim1, Adim2, Bdim1, Bdim2;
     MatGetSize(A, &Adim1, &Adim2);
     MatGetSize(B, &Bdim1, &Bdim2);
+    PetscInt rstart, rend;
+    MatGetOwnershipRange(*Out, &rstart, &rend);
 
     PetscInt ncolsA, ncolsB;
     const PetscInt *colsA, *colsB;
     const double *valsA, *valsB;
-    // Iterate over rows of A 
-    for (PetscInt irowA = 0; irowA < Adim1; irowA++){
-        // Iterate over non-zero columns in this row of A
+    std::vector<PetscInt> colsOut;
+    std::vector<PetscScalar> valsOut;
+    // Iterate over the locally owned rows of Out. Row irowA*Bdim1 + irowB couples row irowA of A with row irowB of B.
+    for (PetscInt rowOut = rstart; rowOut < rend; rowOut++){
+        PetscInt irowA = rowOut / Bdim1;
+        PetscInt irowB = rowOut % Bdim1;
+        if (irowA >= Adim1) break;
         MatGetRow(A, irowA, &ncolsA, &colsA, &valsA);
+        MatGetRow(B, irowB, &ncolsB, &colsB, &valsB);
+        colsOut.resize(ncolsA*ncolsB);
+        valsOut.resize(ncolsA*ncolsB);
+        /* B-row at each nonzero column block icolA */
         for (PetscInt j=0; j<ncolsA; j++) {
-            PetscInt icolA = colsA[j];
-            PetscScalar valA = valsA[j];
-            /* put a B-block at position (irowA*Bdim1, icolA*Bdim2): */
-            // Iterate over rows of B 
-            for (PetscInt irowB = 0; irowB < Bdim1; irowB++){
-                // Iterate over non-zero columns in this B-row
-                MatGetRow(B, irowB, &ncolsB, &colsB, &valsB);
-                for (PetscInt k=0; k< ncolsB; k++) {
-                    PetscInt icolB = colsB[k];
-                    PetscScalar valB = valsB[k];
-                    /* Insert values in Out */
-                    PetscInt rowOut = irowA*Bdim1 + irowB;
-                    PetscInt colOut = icolA*Bdim2 + icolB;
-                    PetscScalar valOut = valA * valB * alpha; 
-                    MatSetValue(*Out, rowOut, colOut, valOut, insert_mode);
-                }
-                MatRestoreRow(B, irowB, &ncolsB, &colsB, &valsB);
+            for (PetscInt k=0; k< ncolsB; k++) {
+                colsOut[j*ncolsB + k] = colsA[j]*Bdim2 + colsB[k];
+                valsOut[j*ncolsB + k] = valsA[j] * valsB[k] * alpha; 
             }
-        }   
+        }
+        MatSetValues(*Out, 1, &rowOut, ncolsA*ncolsB, colsOut.data(), valsOut.data(), insert_mode);
+        MatRestoreRow(B, irowB, &ncolsB, &colsB, &valsB);
         MatRestoreRow(A, irowA, &ncolsA, &colsA, &valsA);
     }  
 
@@ -329,6 +446,62 @@ PetscErrorCode AkronB(const Mat A, const Mat B, const double alpha, Mat *Out, In
 }
 
 
+SparseEntries::SparseEntries(PetscInt ilow_, PetscInt iupp_) {
+  ilow = ilow_;
+  iupp = iupp_;
+}
+
+void SparseEntries::getCSR(std::vector<PetscInt>& csr_i, std::vector<PetscInt>& csr_j, std::vector<double>& csr_v) {
+
+  PetscInt localsize = iupp - ilow;
+
+  /* Sort the entries by local row (counting sort) */
+  std::vector<PetscInt> rowptr(localsize+1, 0);
+  for (size_t e = 0; e < rows.size(); e++) rowptr[rows[e] - ilow + 1]++;
+  for (PetscInt r = 0; r < localsize; r++) rowptr[r+1] += rowptr[r];
+  std::vector<std::pair<PetscInt, double>> entries(rows.size());
+  std::vector<PetscInt> next(rowptr.begin(), rowptr.end()-1);
+  for (size_t e = 0; e < rows.size(); e++) {
+    entries[next[rows[e] - ilow]++] = std::make_pair(cols[e], vals[e]);
+  }
+  std::vector<PetscInt>().swap(rows);
+  std::vector<PetscInt>().swap(cols);
+  std::vector<double>().swap(vals);
+
+  /* Sort each row by column and sum up duplicates into CSR arrays */
+  csr_i.assign(localsize+1, 0);
+  csr_j.clear();
+  csr_v.clear();
+  csr_j.reserve(entries.size());
+  csr_v.reserve(entries.size());
+  for (PetscInt r = 0; r < localsize; r++) {
+    std::sort(entries.begin() + rowptr[r], entries.begin() + rowptr[r+1]);
+    for (PetscInt e = rowptr[r]; e < rowptr[r+1]; e++) {
+      if (e > rowptr[r] && entries[e].first == csr_j.back()) csr_v.back() += entries[e].second;
+      else {
+        csr_j.push_back(entries[e].first);
+        csr_v.push_back(entries[e].second);
+      }
+    }
+    csr_i[r+1] = csr_j.size();
+  }
+}
+
+void SparseEntries::createMat(PetscInt globalsize, Mat* A) {
+
+  PetscInt localsize = iupp - ilow;
+  std::vector<PetscInt> csr_i, csr_j;
+  std::vector<double> csr_v;
+  getCSR(csr_i, csr_j, csr_v);
+
+  /* Create the matrix. Preallocation is exact, values are inserted and assembled in one call. */
+  MatCreate(PETSC_COMM_WORLD, A);
+  MatSetSizes(*A, localsize, localsize, globalsize, globalsize);
+  MatSetType(*A, MATMPIAIJ);
+  MatMPIAIJSetPreallocationCSR(*A, csr_i.data(), csr_j.data(), csr_v.data());
+}
+
+
 PetscErrorCode MatIsAntiSymmetric(Mat A, PetscReal tol, PetscBool *flag) {
   
   int ierr; 
@@ -363,8 +536,10 @@ PetscErrorCode StateIsHermitian(Vec x, PetscReal tol, PetscBool *flag) {
   IS isu, isv;
 
   PetscInt dimis = dim;
-  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, 0, 1, &isu); CHKERRQ(ierr);
-  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, dimis, 1, &isv); CHKERRQ(ierr);
+  PetscInt stride, offset_im;
+  getStateStrides(dimis, &stride, &offset_im);
+  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, 0, stride, &isu); CHKERRQ(ierr);
+  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, offset_im, stride, &isv); CHKERRQ(ierr);
   ierr = VecGetSubVector(x, isu, &u); CHKERRQ(ierr);
   ierr = VecGetSubVector(x, isv, &v); CHKERRQ(ierr);
 
@@ -412,8 +587,10 @@ PetscErrorCode StateHasTrace1(Vec x, PetscReal tol, PetscBool *flag) {
   PetscInt dimis = dim/2;
   Vec u, v;
   IS isu, isv;
-  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, 0, 1, &isu); CHKERRQ(ierr);
-  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, dimis, 1, &isv); CHKERRQ(ierr);
+  PetscInt stride, offset_im;
+  getStateStrides(dimis, &stride, &offset_im);
+  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, 0, stride, &isu); CHKERRQ(ierr);
+  ierr = ISCreateStride(PETSC_COMM_WORLD, dimis, offset_im, stride, &isv); CHKERRQ(ierr);
   ierr = VecGetSubVector(x, isu, &u); CHKERRQ(ierr);
   ierr = VecGetSubVector(x, isv, &v); CHKERRQ(ierr);
 
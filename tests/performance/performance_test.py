@@ -58,7 +58,10 @@ def run_quandary(command):
 
     memory_match = re.search(r"Global Memory:\s+([\d.]+) MB", result.stdout)
     memory = float(memory_match.group(1)) if memory_match else 0
-    return memory
+
+    setup_match = re.search(r"Setup Time:\s+([\d.]+) seconds", result.stdout)
+    setup_time = float(setup_match.group(1)) if setup_match else 0
+    return memory, setup_time
 
 
 @pytest.mark.parametrize(
@@ -85,13 +88,15 @@ def test_eval(benchmark, simulation_name, number_of_processes, request):
         config_file=config_file)
     print(f"Running command: \"{' '.join(command)}\"")
 
-    memory = benchmark.pedantic(
+    memory, setup_time = benchmark.pedantic(
         run_quandary,
         args=(command,),
         rounds=repetitions,
         iterations=1
     )
     print(f"{memory=} MB")
+    print(f"{setup_time=} s")
 
     benchmark.extra_info['number_of_processors'] = number_of_processes
     benchmark.extra_info['memory_mb'] = memory
+    benchmark.extra_info['setup_time_s'] = setup_time
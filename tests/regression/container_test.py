@@ -0,0 +1,78 @@
+import glob
+import os
+import re
+import subprocess
+import numpy as np
+import pytest
+
+from quandary import read_trajectory_container
+from tests.utils.common import build_mpi_command
+
+# Mark all tests in this file as regression tests
+pytestmark = pytest.mark.regression
+
+# Tolerances for comparing the container against the text files, which are written with 10 to 14 significant digits
+REL_TOL = 1.0e-7
+ABS_TOL = 1.0e-9
+
+TEST_PATH = os.path.dirname(os.path.realpath(__file__))
+CONTAINER_PATH = os.path.join(TEST_PATH, "container")
+QUANDARY_PATH = os.path.join(TEST_PATH, "..", "..", "quandary")
+
+# The reference run writes separate text files with the initial conditions distributed over two processors
+# and no PETSc parallelization. The container runs use the same distribution (np = 2) and two PETSc
+# processors per initial condition (np = 4), so that the full state is written in slices by each processor.
+FILES_CONFIG, FILES_DATADIR, FILES_NP = "container_files", "data_out_files", 2
+CONTAINER_CONFIG, CONTAINER_DATADIR = "container", "data_out_container"
+CONTAINER_NP = [2, 4]
+
+# Container datasets and the prefix of the corresponding text files (time in the first column, followed by the values)
+DATASETS = [
+    ("expected0", "expected0"),
+    ("population0", "population0"),
+    ("fullstate_Re", "rho_Re"),
+    ("fullstate_Im", "rho_Im"),
+]
+
+
+def run_quandary(config_name, number_of_processes, mpi_exec, mpi_opt):
+    os.chdir(CONTAINER_PATH)
+    command = build_mpi_command(
+        mpi_exec=mpi_exec,
+        num_processes=number_of_processes,
+        mpi_opt=mpi_opt,
+        quandary_path=QUANDARY_PATH,
+        config_file=os.path.join(CONTAINER_PATH, config_name + ".cfg"))
+    print(f"Running command: \"{' '.join(command)}\"")
+    result = subprocess.run(command, capture_output=True, text=True, check=True)
+    print(result.stdout)
+    assert result.returncode == 0
+
+
+@pytest.mark.parametrize("number_of_processes", CONTAINER_NP, ids=lambda x: f"np{x}")
+def test_container(number_of_processes, request):
+    mpi_exec = request.config.getoption("--mpi-exec")
+    mpi_opt = request.config.getoption("--mpi-opt")
+
+    run_quandary(FILES_CONFIG, FILES_NP, mpi_exec, mpi_opt)
+    run_quandary(CONTAINER_CONFIG, number_of_processes, mpi_exec, mpi_opt)
+
+    files_dir = os.path.join(CONTAINER_PATH, FILES_DATADIR)
+    data = read_trajectory_container(os.path.join(CONTAINER_PATH, CONTAINER_DATADIR, "trajectories.bin"))
+
+    # Index: one block per initial condition, holding the same initial conditions as the text output
+    initids = sorted(int(re.search(r"iinit(\d+)", f).group(1))
+                     for f in glob.glob(os.path.join(files_dir, "expected0.iinit*.dat")))
+    assert len(initids) > 1
+    assert sorted(int(i) for i in data["initid"]) == initids
+    for name, _ in DATASETS:
+        assert name in data, f"Dataset {name} missing in the container"
+
+    # Data blocks: every snapshot of every initial condition matches the text files
+    for slot, initid in enumerate(data["initid"]):
+        for name, prefix in DATASETS:
+            expected = np.loadtxt(os.path.join(files_dir, f"{prefix}.iinit{initid:04d}.dat"), ndmin=2)
+            assert data["time"].shape[1] == expected.shape[0], f"{name}, initial condition {initid}: number of snapshots"
+            np.testing.assert_allclose(data["time"][slot], expected[:, 0], rtol=REL_TOL, atol=ABS_TOL)
+            np.testing.assert_allclose(data[name][slot], expected[:, 1:], rtol=REL_TOL, atol=ABS_TOL,
+                                       err_msg=f"{name}, initial condition {initid}")
@@ -0,0 +1,49 @@
+import os
+import subprocess
+import numpy as np
+import pytest
+
+from tests.utils.common import build_mpi_command
+
+# Mark all tests in this file as regression tests
+pytestmark = pytest.mark.regression
+
+# Maximum relative difference between the second-order adjoint Hessian-vector product and finite differences
+HESSIAN_REL_TOL = 1.0e-5
+
+TEST_PATH = os.path.dirname(os.path.realpath(__file__))
+HESSIAN_PATH = os.path.join(TEST_PATH, "hessian")
+QUANDARY_PATH = os.path.join(TEST_PATH, "..", "..", "quandary")
+
+HESSIAN_CASES = [
+    ("hessian_lindblad", "data_out_lindblad", 1),
+    ("hessian_lindblad", "data_out_lindblad", 2),
+    ("hessian_schroedinger", "data_out_schroedinger", 1),
+    ("hessian_schroedinger", "data_out_schroedinger", 4),
+]
+
+
+@pytest.mark.parametrize("config_name,datadir,number_of_processes", HESSIAN_CASES,
+                         ids=lambda x: str(x))
+def test_hessvec(config_name, datadir, number_of_processes, request):
+    mpi_exec = request.config.getoption("--mpi-exec")
+    mpi_opt = request.config.getoption("--mpi-opt")
+
+    os.chdir(HESSIAN_PATH)
+    command = build_mpi_command(
+        mpi_exec=mpi_exec,
+        num_processes=number_of_processes,
+        mpi_opt=mpi_opt,
+        quandary_path=QUANDARY_PATH,
+        config_file=os.path.join(HESSIAN_PATH, config_name + ".cfg"))
+    print(f"Running command: \"{' '.join(command)}\"")
+    result = subprocess.run(command, capture_output=True, text=True, check=True)
+    print(result.stdout)
+    assert result.returncode == 0
+
+    data = np.loadtxt(os.path.join(HESSIAN_PATH, datadir, "hessvec.dat"))
+    hessvec = data[:, 1]
+    hessvec_fd = data[:, 2]
+    assert np.linalg.norm(hessvec) > 0.0
+    rel_diff = np.linalg.norm(hessvec - hessvec_fd) / np.linalg.norm(hessvec)
+    assert rel_diff < HESSIAN_REL_TOL, f"Hessian-vector product differs from finite differences: {rel_diff:e}"
@@ -4,7 +4,7 @@ import subprocess
 import pandas as pd
 import pytest
 from pydantic import BaseModel, TypeAdapter
-from typing import List
+from typing import List, Optional
 
 from tests.utils.common import build_mpi_command
 
@@ -26,6 +26,8 @@ class Case(BaseModel):
     simulation_name: str
     files_to_compare: List[str]
     number_of_processes: List[int]
+    reference: Optional[str] = None  # Compare against the base directory of this case instead of the own one
+    abs_tol: Optional[float] = None  # Absolute tolerance, overrides ABS_TOL
 
 
 def load_test_cases():
@@ -50,12 +52,14 @@ def test_eval(test_case: Case, request):
 
     simulation_dir = os.path.join(TEST_PATH, simulation_name)
     config_file = os.path.join(simulation_dir, simulation_name + ".cfg")
+    base_dir = os.path.join(TEST_PATH, test_case.reference or simulation_name, BASE_DIR)
+    abs_tol = test_case.abs_tol if test_case.abs_tol is not None else ABS_TOL
 
     for number_of_processes in number_of_processes_list:
-        run_test(simulation_dir, number_of_processes, config_file, files_to_compare, exact, mpi_exec, mpi_opt)
+        run_test(simulation_dir, base_dir, number_of_processes, config_file, files_to_compare, exact, mpi_exec, mpi_opt, abs_tol)
 
 
-def run_test(simulation_dir, number_of_processes, config_file, files_to_compare, exact, mpi_exec, mpi_opt):
+def run_test(simulation_dir, base_dir, number_of_processes, config_file, files_to_compare, exact, mpi_exec, mpi_opt, abs_tol=ABS_TOL):
     os.chdir(simulation_dir)
 
     command = build_mpi_command(
@@ -70,17 +74,18 @@ def run_test(simulation_dir, number_of_processes, config_file, files_to_compare,
     assert result.returncode == 0
 
     matching_files = [file for pattern in files_to_compare
-                      for file in glob.glob(os.path.join(simulation_dir, BASE_DIR, pattern))]
+                      for file in glob.glob(os.path.join(base_dir, pattern))]
+    assert len(matching_files) > 0, f"No files to compare in {base_dir}"
     for expected in matching_files:
         file_name = os.path.basename(expected)
         output = os.path.join(simulation_dir, DATA_OUT_DIR, file_name)
-        compare_files(file_name, output, expected, exact)
+        compare_files(file_name, output, expected, exact, abs_tol)
 
 
-def compare_files(file_name, output, expected, exact):
+def compare_files(file_name, output, expected, exact, abs_tol=ABS_TOL):
     df_output = pd.read_csv(output, sep="\\s+", header=get_header(output))
     df_expected = pd.read_csv(expected, sep="\\s+", header=get_header(expected))
-    pd.testing.assert_frame_equal(df_output, df_expected, rtol=REL_TOL, atol=ABS_TOL, obj=file_name, check_exact=exact)
+    pd.testing.assert_frame_equal(df_output, df_expected, rtol=REL_TOL, atol=abs_tol, obj=file_name, check_exact=exact)
 
 
 def get_header(path):